@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "affinity.h"
+#include "config.h"
+#include "trace.h"
+
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define MAX_NODES  64
+
+typedef struct {
+    int cpu;
+    int node;
+    int package;
+    int core;
+} cpu_info_t;
+
+// CPU set of the current worker (used to spread its pool threads)
+static cpu_set_t worker_set;
+static int worker_set_valid = 0;
+static int worker_pinned = 0;
+
+
+/**
+ * @brief Parses a Linux CPU list ("0-3,8,10-11") into a cpu_set_t.
+ * @param list CPU list string.
+ * @param set Destination set (cleared first).
+ * @return Number of CPUs in the set.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long a = strtol(p, &end, 10);
+        if (end == p) break;
+
+        long b = a;
+        if (*end == '-') {
+            p = end + 1;
+            b = strtol(p, &end, 10);
+            if (end == p) break;
+        }
+
+        for (long c = a; c <= b && c < CPU_SETSIZE; c++)
+            if (c >= 0) CPU_SET(c, set);
+
+        p = end;
+        while (*p == ',' || *p == ' ' || *p == '\n') p++;
+    }
+    return CPU_COUNT(set);
+}
+
+/**
+ * @brief Reads a small integer from a sysfs file.
+ * @return The value, or -1 if the file cannot be read.
+ */
+static int read_sysfs_int(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int v = -1;
+    if (fscanf(f, "%d", &v) != 1) v = -1;
+    fclose(f);
+    return v;
+}
+
+/**
+ * @brief Reads a sysfs CPU list file into a set.
+ * @return Number of CPUs read (0 on error).
+ */
+static int read_sysfs_list(const char *path, cpu_set_t *set) {
+    char buf[1024];
+    FILE *f = fopen(path, "r");
+    CPU_ZERO(set);
+    if (!f) return 0;
+    int n = 0;
+    if (fgets(buf, sizeof(buf), f))
+        n = parse_cpu_list(buf, set);
+    fclose(f);
+    return n;
+}
+
+/**
+ * @brief Finds the NUMA node of a CPU (the cpuN/nodeM entry in sysfs).
+ * @return Node number, 0 if the system exposes no NUMA information.
+ */
+static int cpu_node(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+
+    DIR *d = opendir(path);
+    if (!d) return 0;
+
+    int node = 0;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (!strncmp(de->d_name, "node", 4) && de->d_name[4] >= '0' && de->d_name[4] <= '9') {
+            node = atoi(de->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+static int cmp_cpu_info(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+/**
+ * @brief Builds the list of physical cores (one entry per core, lowest CPU id),
+ *        ordered by NUMA node, package and core id.
+ * @param cores Output array (CPU_SETSIZE entries).
+ * @return Number of physical cores.
+ */
+static int physical_cores(cpu_info_t *cores) {
+    cpu_set_t online;
+    if (read_sysfs_list(SYSFS_CPU "/online", &online) == 0)
+        return 0;
+
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &online)) continue;
+
+        char path[160];
+        cpu_set_t siblings;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+
+        // Keep only the first hardware thread of each core
+        if (read_sysfs_list(path, &siblings) > 0) {
+            int first = -1;
+            for (int c = 0; c < CPU_SETSIZE && first < 0; c++)
+                if (CPU_ISSET(c, &siblings)) first = c;
+            if (first != cpu) continue;
+        }
+
+        cores[n].cpu = cpu;
+        cores[n].node = cpu_node(cpu);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+        cores[n].package = read_sysfs_int(path);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+        cores[n].core = read_sysfs_int(path);
+        n++;
+    }
+
+    qsort(cores, n, sizeof(cpu_info_t), cmp_cpu_info);
+    return n;
+}
+
+/**
+ * @brief Adds a CPU and its SMT siblings to a set.
+ */
+static void add_core(int cpu, cpu_set_t *set) {
+    char path[160];
+    cpu_set_t siblings;
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+
+    if (read_sysfs_list(path, &siblings) > 0)
+        CPU_OR(set, set, &siblings);
+    else
+        CPU_SET(cpu, set);
+}
+
+/**
+ * @brief Computes the [first, last) share of 'total' items for a worker slot.
+ *        With more workers than items, worker i gets item i % total.
+ */
+static void slot_range(int slot, int nworkers, int total, int *first, int *last) {
+    if (nworkers >= total) {
+        *first = slot % total;
+        *last = *first + 1;
+    } else {
+        *first = (int)((long)slot * total / nworkers);
+        *last  = (int)((long)(slot + 1) * total / nworkers);
+    }
+}
+
+/**
+ * @brief Computes the CPU set of a worker from CPU_AFFINITY.
+ * @return Number of CPUs in the set, 0 if placement is disabled.
+ */
+static int worker_cpus(const char *mode, int slot, int nworkers, cpu_set_t *set) {
+    CPU_ZERO(set);
+    if (nworkers < 1) nworkers = 1;
+
+    if (!mode[0] || !strcasecmp(mode, "none"))
+        return 0;
+
+    int first, last;
+
+    if (!strcasecmp(mode, "auto")) {
+        static cpu_info_t cores[CPU_SETSIZE];
+        int ncores = physical_cores(cores);
+        if (ncores == 0) return 0;
+
+        slot_range(slot, nworkers, ncores, &first, &last);
+        for (int i = first; i < last; i++)
+            add_core(cores[i].cpu, set);
+        return CPU_COUNT(set);
+    }
+
+    cpu_set_t listed;
+    int total = parse_cpu_list(mode, &listed);
+    if (total == 0) {
+        fprintf(stderr, "[AFFINITY] CPU_AFFINITY inválido: '%s'\n", mode);
+        return 0;
+    }
+
+    int ids[CPU_SETSIZE], n = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &listed)) ids[n++] = c;
+
+    slot_range(slot, nworkers, n, &first, &last);
+    for (int i = first; i < last; i++)
+        CPU_SET(ids[i], set);
+    return CPU_COUNT(set);
+}
+
+/**
+ * @brief Sets the memory policy of the process to the NUMA node(s) of a CPU set.
+ * @param set CPUs of the worker.
+ * @param mode "preferred" or "bind".
+ * @return Node used (first node for bind), -1 on error.
+ */
+static int apply_numa_policy(const cpu_set_t *set, const char *mode) {
+    unsigned long nodemask = 0;
+    int first_node = -1;
+
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, set)) continue;
+        int node = cpu_node(c);
+        if (node < 0 || node >= MAX_NODES) continue;
+        if (first_node < 0) first_node = node;
+        nodemask |= 1UL << node;
+    }
+    if (first_node < 0) return -1;
+
+    long rc;
+    if (!strcasecmp(mode, "bind")) {
+        rc = syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, MAX_NODES + 1);
+    } else {
+        // Preferred policy takes a single node
+        unsigned long one = 1UL << first_node;
+        rc = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &one, MAX_NODES + 1);
+    }
+
+    if (rc != 0) {
+        perror("[AFFINITY] set_mempolicy");
+        return -1;
+    }
+    return first_node;
+}
+
+/**
+ * @brief Formats a CPU set as a compact list for log messages.
+ */
+static void format_cpu_set(const cpu_set_t *set, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+
+    for (int c = 0; c < CPU_SETSIZE && len < size; c++) {
+        if (!CPU_ISSET(c, set)) continue;
+        int end = c;
+        while (end + 1 < CPU_SETSIZE && CPU_ISSET(end + 1, set)) end++;
+
+        if (end == c)
+            len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", c);
+        else
+            len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", c, end);
+        c = end;
+    }
+}
+
+/**
+ * @brief Applies CPU_AFFINITY and NUMA_MEMORY to the calling worker process.
+ * @param slot Worker slot index.
+ * @param nworkers Number of configured workers.
+ * @return 0 on success (or nothing to do), -1 on error.
+ */
+int affinity_apply_worker(int slot, int nworkers) {
+    cpu_set_t set;
+    int n = worker_cpus(get_cpu_affinity(), slot, nworkers, &set);
+
+    worker_set_valid = 0;
+
+    if (n == 0) {
+        // Placement disabled: undo the pinning inherited from a previous generation
+        if (worker_pinned) {
+            cpu_set_t online;
+            if (read_sysfs_list(SYSFS_CPU "/online", &online) > 0)
+                sched_setaffinity(0, sizeof(online), &online);
+            syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+            worker_pinned = 0;
+        }
+        return 0;
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("[AFFINITY] sched_setaffinity");
+        return -1;
+    }
+    worker_set = set;
+    worker_set_valid = 1;
+    worker_pinned = 1;
+
+    int node = -1;
+    const char *numa = get_numa_memory();
+    if (numa[0] && strcasecmp(numa, "off"))
+        node = apply_numa_policy(&set, numa);
+    else
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+
+    char cpus[256];
+    format_cpu_set(&set, cpus, sizeof(cpus));
+    if (node >= 0)
+        TRACE_INFO(TRACE_WORKER, "Worker %d: CPUs %s, memory %s node %d",
+                   getpid(), cpus, numa, node);
+    else
+        TRACE_INFO(TRACE_WORKER, "Worker %d: CPUs %s", getpid(), cpus);
+
+    return 0;
+}
+
+/**
+ * @brief Pins a pool thread to one CPU of its worker's set (THREAD_AFFINITY=spread).
+ *        In inherit mode threads keep the worker's whole set.
+ * @param thread Thread to pin.
+ * @param index Index of the thread in the pool.
+ */
+void affinity_apply_thread(pthread_t thread, int index) {
+    if (!worker_set_valid || strcasecmp(get_thread_affinity(), "spread"))
+        return;
+
+    int count = CPU_COUNT(&worker_set);
+    int target = index % count;
+
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &worker_set)) continue;
+        if (target-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(c, &one);
+            pthread_setaffinity_np(thread, sizeof(one), &one);
+            return;
+        }
+    }
+}
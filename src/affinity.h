@@ -0,0 +1,27 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+// ------------------------------------------------------------
+// CPU / NUMA placement of workers and pool threads
+// ------------------------------------------------------------
+//
+// CPU_AFFINITY    = none | auto | <cpu list>  (e.g. "0-7,16-23")
+//   auto: physical cores from sysfs topology, ordered by NUMA node and
+//         split evenly between the workers (SMT siblings go with their core)
+//   list: the listed CPUs split evenly between the workers
+// THREAD_AFFINITY = inherit | spread
+//   spread: pool thread k is pinned to the k-th CPU of its worker's set
+// NUMA_MEMORY     = off | preferred | bind
+//   memory policy of the worker towards the node(s) of its CPU set
+
+// Pins the calling worker process (slot of nworkers) and sets its memory
+// policy according to the configuration. Returns 0 on success or when
+// placement is disabled, -1 on error.
+int affinity_apply_worker(int slot, int nworkers);
+
+// Pins pool thread number 'index' of the current worker (spread mode only)
+void affinity_apply_thread(pthread_t thread, int index);
+
+#endif
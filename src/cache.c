@@ -3,10 +3,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <pthread.h>
 #include "cache.h"
+#include "cache_arena.h"
+#include "sketch.h"
+#include "config.h"
 #include "shared_mem.h"
 #include "semaphores.h"
+#include "trace.h"
+#include "metrics.h"
 
 extern shared_data_t* shm_data;
 extern ipc_semaphores_t sems;
@@ -15,6 +21,27 @@ static cache_entry_t *cache_table = NULL;
 static size_t cache_capacity = 0;
 static size_t cache_count = 0;
 
+static size_t cache_bytes = 0;          // Sum of the cached file sizes
+static size_t cache_budget = 0;         // CACHE_SIZE_MB in bytes
+static size_t cache_max_object = 0;     // CACHE_MAX_OBJECT_KB in bytes
+static cm_sketch_t cache_sketch;        // Lookup frequencies (admission)
+static uint64_t evict_rng = 88172645463325252ULL;
+static int usage_published = 0;         // Bytes/entries reported in the metrics
+
+// Per virtual host: bytes, entries, quota (0 = none) and ring of entries
+static size_t host_bytes[CONFIG_MAX_VHOSTS + 1];
+static long host_count[CONFIG_MAX_VHOSTS + 1];
+static size_t host_quota[CONFIG_MAX_VHOSTS + 1];
+static int32_t host_ring[CONFIG_MAX_VHOSTS + 1];    // Slot of the next entry to sample, -1 if none
+
+// File contents are shared with the responses that are sending them
+typedef struct {
+    int refs;           // The table holds one reference while cached
+    char data[];
+} cache_blob_t;
+
+#define BLOB_OF(p) ((cache_blob_t *)((char *)(p) - offsetof(cache_blob_t, data)))
+
 // Reader-Writer lock instead of simple mutex
 static pthread_rwlock_t cache_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 
@@ -22,37 +49,267 @@ static pthread_rwlock_t cache_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 /**
  * @brief Computes a simple hash for a file path.
  * @param path File path.
- * @return Hash index for the cache table.
+ * @return 64-bit hash (slot = hash % capacity, also the sketch key).
  */
-static size_t hash_path(const char *path) {
-    unsigned long h = 5381;
+static uint64_t hash_path(const char *path) {
+    uint64_t h = 5381;
     int c;
     while ((c = *path++))
         h = ((h << 5) + h) + c;
-    return h % cache_capacity;
+
+    // djb2 has weak high bits; mix them for the sketch rows
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
 }
 
+/**
+ * @brief Frees a blob, from the arena or from malloc (fallback).
+ */
+static void blob_free(cache_blob_t *blob) {
+    if (cache_arena_free(blob) != 0)
+        free(blob);
+}
+
+static void blob_unref(char *data) {
+    if (data && __atomic_sub_fetch(&BLOB_OF(data)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        blob_free(BLOB_OF(data));
+}
 
 /**
- * @brief Initializes the in-memory cache with the given capacity (in MB).
+ * @brief Empties the rings and the per-host totals (table rebuilt).
+ */
+static void host_reset(void) {
+    for (int i = 0; i <= CONFIG_MAX_VHOSTS; i++) {
+        host_bytes[i] = 0;
+        host_count[i] = 0;
+        host_ring[i] = -1;
+    }
+}
+
+/**
+ * @brief Adds an entry to the ring and the totals of its virtual host.
+ *        Called with the write lock held.
+ */
+static void host_link(cache_entry_t *e) {
+    int32_t slot = (int32_t)(e - cache_table);
+    int32_t *head = &host_ring[e->vhost];
+
+    host_bytes[e->vhost] += e->size;
+    host_count[e->vhost]++;
+
+    if (*head < 0) {
+        e->prev = e->next = slot;
+        *head = slot;
+        return;
+    }
+
+    // Behind the head: sampled last
+    cache_entry_t *first = &cache_table[*head];
+    e->next = *head;
+    e->prev = first->prev;
+    cache_table[first->prev].next = slot;
+    first->prev = slot;
+}
+
+/**
+ * @brief Removes an entry from the ring and the totals of its virtual host.
+ *        Called with the write lock held.
+ */
+static void host_unlink(cache_entry_t *e) {
+    int32_t slot = (int32_t)(e - cache_table);
+    int32_t *head = &host_ring[e->vhost];
+
+    host_bytes[e->vhost] -= e->size;
+    host_count[e->vhost]--;
+
+    if (e->next == slot) {
+        *head = -1;
+        return;
+    }
+    cache_table[e->prev].next = e->next;
+    cache_table[e->next].prev = e->prev;
+    if (*head == slot)
+        *head = e->next;
+}
+
+/**
+ * @brief Removes an entry. Called with the write lock held.
+ */
+static void evict(cache_entry_t *e) {
+    cache_bytes -= e->size;
+    cache_count--;
+    host_unlink(e);
+    if (usage_published)
+        metrics_cache_usage(e->vhost, -(long)e->size, -1);
+    blob_unref(e->data);
+    e->data = NULL;
+    e->valid = 0;
+}
+
+/**
+ * @brief Samples a few entries and returns the least frequently used one.
+ *        Called with the write lock held.
+ * @param skip Entry that must not be chosen (the slot being filled).
+ * @return Victim, NULL if the table has no other entry.
+ */
+static cache_entry_t *sample_victim(const cache_entry_t *skip) {
+    cache_entry_t *victim = NULL;
+    unsigned victim_freq = 0;
+    int found = 0;
+
+    for (int probes = 0; probes < 64 * CACHE_EVICT_SAMPLES && found < CACHE_EVICT_SAMPLES; probes++) {
+        evict_rng ^= evict_rng << 13;
+        evict_rng ^= evict_rng >> 7;
+        evict_rng ^= evict_rng << 17;
+
+        cache_entry_t *e = &cache_table[evict_rng % cache_capacity];
+        if (!e->valid || e == skip) continue;
+
+        unsigned f = cm_sketch_estimate(&cache_sketch, e->hash);
+        if (!victim || f < victim_freq) {
+            victim = e;
+            victim_freq = f;
+        }
+        found++;
+    }
+    return victim;
+}
+
+/**
+ * @brief Returns the least frequently used of the next few entries of a
+ *        virtual host's ring, and moves the ring past them so the following
+ *        call samples others. Called with the write lock held.
+ * @param vhost Virtual host over its quota.
+ * @param skip Entry that must not be chosen (the slot being filled).
+ * @return Victim, NULL if the host has no other entry.
+ */
+static cache_entry_t *host_victim(int vhost, const cache_entry_t *skip) {
+    cache_entry_t *victim = NULL;
+    unsigned victim_freq = 0;
+    int32_t start = host_ring[vhost], slot = start;
+
+    for (int n = 0; slot >= 0 && n < CACHE_EVICT_SAMPLES; n++) {
+        cache_entry_t *e = &cache_table[slot];
+        slot = e->next;
+
+        if (e != skip) {
+            unsigned f = cm_sketch_estimate(&cache_sketch, e->hash);
+            if (!victim || f < victim_freq) {
+                victim = e;
+                victim_freq = f;
+            }
+        }
+        if (slot == start)
+            break;
+    }
+    host_ring[vhost] = slot;
+    return victim;
+}
+
+/**
+ * @brief Evicts entries until the budget, and the quota of the newcomer's
+ *        virtual host, hold 'extra' more bytes. Called with the write lock held.
+ * @param extra Bytes about to be inserted.
+ * @param cand_freq Frequency of the newcomer: only less popular entries are
+ *                  evicted for it (SKETCH_MAX + 1 to shrink unconditionally).
+ * @param skip Slot of the newcomer.
+ * @param vhost Virtual host of the newcomer, -1 to check the budget only.
+ * @return 0 if there is room, -1 if the newcomer lost.
+ */
+static int make_room(size_t extra, unsigned cand_freq, const cache_entry_t *skip, int vhost) {
+    while (vhost >= 0 && host_quota[vhost] && host_bytes[vhost] + extra > host_quota[vhost]) {
+        cache_entry_t *victim = host_victim(vhost, skip);
+        if (!victim || cm_sketch_estimate(&cache_sketch, victim->hash) >= cand_freq)
+            return -1;
+        evict(victim);
+        metrics_cache_evicted();
+    }
+
+    while (cache_bytes + extra > cache_budget) {
+        cache_entry_t *victim = sample_victim(skip);
+        if (!victim || cm_sketch_estimate(&cache_sketch, victim->hash) >= cand_freq)
+            return -1;
+        evict(victim);
+        metrics_cache_evicted();
+    }
+    return 0;
+}
+
+
+/**
+ * @brief fork() handlers: the cache lock is held across fork so the table is
+ *        consistent in the child. The child re-initializes the lock instead of
+ *        unlocking it, because the writer TID recorded by glibc is the parent's.
+ */
+static void cache_atfork_prepare(void) { pthread_rwlock_wrlock(&cache_rwlock); }
+static void cache_atfork_parent(void)  { pthread_rwlock_unlock(&cache_rwlock); }
+static void cache_atfork_child(void) {
+    pthread_rwlock_init(&cache_rwlock, NULL);
+    usage_published = 0;    // The parent still reports what it inherited
+}
+
+
+/**
+ * @brief Number of table entries for a cache of the given size.
  * @param mb Cache size in megabytes.
+ * @return Number of entries (at least 64).
  */
-void cache_init(int mb) {
+static size_t capacity_for_mb(int mb) {
     size_t bytes = (size_t)mb * 1024 * 1024;
-    
+
     // each entry will have aproximately 1 KB 
-    cache_capacity = bytes / sizeof(cache_entry_t);
-    if (cache_capacity < 64)
-        cache_capacity = 64;
+    size_t capacity = bytes / sizeof(cache_entry_t);
+    if (capacity < 64)
+        capacity = 64;
+    return capacity;
+}
+
+
+/**
+ * @brief Sizes the arena for a cache budget: headers, fragmentation and one
+ *        object of slack, so a full cache rarely falls back to malloc.
+ * @param mb Cache size in megabytes.
+ */
+static void configure_arena(int mb) {
+    size_t budget = (size_t)mb * 1024 * 1024;
+    size_t bytes = budget + budget / 8 + (size_t)get_cache_max_object_kb() * 1024;
+
+    if (cache_arena_configure(bytes, get_cache_huge_pages()) != 0)
+        TRACE_WARN(TRACE_CACHE, "Unknown CACHE_HUGE_PAGES '%s', using thp",
+                   get_cache_huge_pages());
+}
+
+
+/**
+ * @brief Initializes the in-memory cache with the given capacity (in MB).
+ * @param mb Cache size in megabytes.
+ */
+void cache_init(int mb) {
+    static int atfork_registered = 0;
+
+    cache_capacity = capacity_for_mb(mb);
 
     cache_table = calloc(cache_capacity, sizeof(cache_entry_t));
     cache_count = 0;
+    cache_bytes = 0;
+    host_reset();
+    cache_budget = (size_t)mb * 1024 * 1024;
+    cache_max_object = (size_t)get_cache_max_object_kb() * 1024;
+    cm_sketch_init(&cache_sketch, cache_capacity);
+    configure_arena(mb);
 
     // Initialize the reader-writer lock
     pthread_rwlock_init(&cache_rwlock, NULL);
 
-        printf("Cache initialized with %zu entries (~%d MB) [RW-Lock]\n",
-            cache_capacity, mb);
+    if (!atfork_registered) {
+        pthread_atfork(cache_atfork_prepare, cache_atfork_parent, cache_atfork_child);
+        atfork_registered = 1;
+    }
+
+        printf("Cache initialized with %zu entries (~%d MB, objects up to %zu KB) [RW-Lock, TinyLFU, huge pages: %s]\n",
+            cache_capacity, mb, cache_max_object / 1024, get_cache_huge_pages());
 }
 
 
@@ -64,10 +321,14 @@ void cache_init(int mb) {
  * @return 1 if found, 0 otherwise.
  */
 int cache_get(const char *path, char **data, size_t *size) {
+    uint64_t h = hash_path(path);
+
     pthread_rwlock_rdlock(&cache_rwlock);
 
-    size_t idx = hash_path(path);
-    cache_entry_t *e = &cache_table[idx];
+    // Hits and misses both count as accesses for the admission filter
+    cm_sketch_add(&cache_sketch, h);
+
+    cache_entry_t *e = &cache_table[h % cache_capacity];
 
     if (!e->valid || strcmp(e->path, path) != 0) {
         pthread_rwlock_unlock(&cache_rwlock);
@@ -78,19 +339,22 @@ int cache_get(const char *path, char **data, size_t *size) {
             shm_data->stats.cache_misses++;
             sem_post(sems.sem_stats);
         }
+        metrics_cache(0);
         
         return 0;
     }
 
     *data = e->data;
     *size = e->size;
-    
+    __atomic_add_fetch(&BLOB_OF(e->data)->refs, 1, __ATOMIC_RELAXED);
+
     // CACHE HIT
     if (shm_data && sems.sem_stats) {
         sem_wait(sems.sem_stats);
         shm_data->stats.cache_hits++;
         sem_post(sems.sem_stats);
     }
+    metrics_cache(1);
 
     pthread_rwlock_unlock(&cache_rwlock);
     return 1;
@@ -98,38 +362,222 @@ int cache_get(const char *path, char **data, size_t *size) {
 
 
 /**
- * @brief Inserts or updates a file in the cache.
+ * @brief Releases the data returned by cache_get.
+ * @param data Data pointer (NULL is ignored).
+ */
+void cache_release(const char *data) {
+    blob_unref((char *)data);
+}
+
+
+/**
+ * @brief Inserts or updates a file in the cache, through the admission filter.
  * @param path File path.
- * @param data Pointer to the data to store.
+ * @param data Pointer to the data to store (copied).
  * @param size Size of the data.
+ * @param vhost Virtual host charged for the entry (its quota).
+ * @return 1 if the file was cached, 0 if it was rejected.
  */
-void cache_put(const char *path, char *data, size_t size) {
+int cache_put(const char *path, const char *data, size_t size, int vhost) {
+    if (vhost < 0 || vhost > CONFIG_MAX_VHOSTS)
+        vhost = 0;
+
+    if (size > cache_max_object || size > cache_budget ||
+        (host_quota[vhost] && size > host_quota[vhost])) {
+        TRACE_DEBUG(TRACE_CACHE, "Rejected '%s': %zu bytes is too large", path, size);
+        metrics_cache_rejected(1);
+        return 0;
+    }
+
+    uint64_t h = hash_path(path);
+
+    cache_blob_t *blob = cache_arena_alloc(sizeof(cache_blob_t) + size);
+    if (!blob)
+        blob = malloc(sizeof(cache_blob_t) + size);
+    if (!blob) return 0;
+    blob->refs = 1;
+    memcpy(blob->data, data, size);
+
     pthread_rwlock_wrlock(&cache_rwlock);
 
-    size_t idx = hash_path(path);
-    cache_entry_t *e = &cache_table[idx];
+    cache_entry_t *e = &cache_table[h % cache_capacity];
+    unsigned freq = cm_sketch_estimate(&cache_sketch, h);
 
-    // NOVO: Se já existe entrada válida com path diferente, não sobrescreve
+    // Another file owns the slot: the more popular of the two keeps it
     if (e->valid && strcmp(e->path, path) != 0) {
-        printf("[Cache] Collision at index %zu: '%s' vs '%s' - skipping\n",
-               idx, e->path, path);
-        pthread_rwlock_unlock(&cache_rwlock);
-        return;
+        if (freq <= cm_sketch_estimate(&cache_sketch, e->hash)) {
+            TRACE_DEBUG(TRACE_CACHE, "Rejected '%s': slot owner '%s' is more popular",
+                        path, e->path);
+            goto reject;
+        }
+        evict(e);
+        metrics_cache_evicted();
     }
 
-    // Limpa entrada antiga
-    if (e->valid && e->data)
-        free(e->data);
+    // Same file again (it changed or two threads missed together)
+    if (e->valid)
+        evict(e);
+
+    if (make_room(size, freq, e, vhost) != 0) {
+        TRACE_DEBUG(TRACE_CACHE, "Rejected '%s': cache full of more popular files", path);
+        goto reject;
+    }
 
     // Armazena nova entrada
-    e->data = malloc(size);
-    memcpy(e->data, data, size);
+    e->data = blob->data;
     e->size = size;
+    e->hash = h;
+    e->vhost = vhost;
     strncpy(e->path, path, sizeof(e->path)-1);
     e->path[sizeof(e->path)-1] = '\0';
     e->valid = 1;
+    cache_count++;
+    cache_bytes += size;
+    host_link(e);
+    if (usage_published)
+        metrics_cache_usage(vhost, (long)size, 1);
 
     pthread_rwlock_unlock(&cache_rwlock);
+
+    metrics_cache_admitted();
+    return 1;
+
+reject:
+    pthread_rwlock_unlock(&cache_rwlock);
+    blob_free(blob);
+    metrics_cache_rejected(0);
+    return 0;
+}
+
+
+/**
+ * @brief Publishes or withdraws this process's cache usage in the metrics.
+ * @param sign +1 when a worker starts serving, -1 when it exits.
+ */
+void cache_publish_usage(int sign) {
+    pthread_rwlock_wrlock(&cache_rwlock);
+    if (usage_published != (sign > 0)) {
+        for (int i = 0; i <= CONFIG_MAX_VHOSTS; i++)
+            if (host_count[i])
+                metrics_cache_usage(i, sign * (long)host_bytes[i], sign * host_count[i]);
+        usage_published = (sign > 0);
+    }
+    pthread_rwlock_unlock(&cache_rwlock);
+
+    if (sign > 0) {
+        metrics_cache_budget(cache_get_budget());
+        cache_arena_publish();
+    }
+}
+
+
+/**
+ * @brief Changes the byte budget of the cache, keeping the table (memory
+ *        governor). A smaller budget evicts the least popular entries now.
+ * @param bytes New budget.
+ */
+void cache_set_budget(size_t bytes) {
+    pthread_rwlock_wrlock(&cache_rwlock);
+    cache_budget = bytes;
+    make_room(0, SKETCH_MAX + 1, NULL, -1);
+    pthread_rwlock_unlock(&cache_rwlock);
+    metrics_cache_budget(bytes);
+}
+
+/**
+ * @brief Sets the bytes a virtual host may hold (vhost_load). A lower quota
+ *        evicts the least popular entries of the host now.
+ * @param vhost Virtual host index (vhost.h).
+ * @param bytes Quota, 0 for none (only the shared budget applies).
+ */
+void cache_set_quota(int vhost, size_t bytes) {
+    if (vhost < 0 || vhost > CONFIG_MAX_VHOSTS)
+        return;
+
+    pthread_rwlock_wrlock(&cache_rwlock);
+    host_quota[vhost] = bytes;
+    if (cache_table)
+        make_room(0, SKETCH_MAX + 1, NULL, vhost);
+    pthread_rwlock_unlock(&cache_rwlock);
+}
+
+/**
+ * @brief Gets the byte budget of the cache.
+ * @return Bytes.
+ */
+size_t cache_get_budget(void) {
+    pthread_rwlock_rdlock(&cache_rwlock);
+    size_t bytes = cache_budget;
+    pthread_rwlock_unlock(&cache_rwlock);
+    return bytes;
+}
+
+/**
+ * @brief Resizes the cache table keeping the current entries (used on reload,
+ *        so a new worker generation starts with the warm cache it inherited).
+ *        Entries that collide in the new table are dropped.
+ * @param mb New cache size in megabytes.
+ */
+void cache_resize(int mb) {
+    size_t new_capacity = capacity_for_mb(mb);
+
+    pthread_rwlock_wrlock(&cache_rwlock);
+
+    cache_budget = (size_t)mb * 1024 * 1024;
+    cache_max_object = (size_t)get_cache_max_object_kb() * 1024;
+
+    // An arena already mapped keeps its size: a larger budget spills to malloc
+    configure_arena(mb);
+
+    if (!cache_table || new_capacity == cache_capacity) {
+        make_room(0, SKETCH_MAX + 1, NULL, -1);
+        pthread_rwlock_unlock(&cache_rwlock);
+        return;
+    }
+
+    cache_entry_t *old_table = cache_table;
+    size_t old_capacity = cache_capacity;
+
+    cache_table = calloc(new_capacity, sizeof(cache_entry_t));
+    if (!cache_table) {
+        cache_table = old_table;
+        pthread_rwlock_unlock(&cache_rwlock);
+        return;
+    }
+    cache_capacity = new_capacity;
+    cache_count = 0;
+
+    size_t kept = 0;
+    cache_bytes = 0;
+    host_reset();
+    for (size_t i = 0; i < old_capacity; i++) {
+        cache_entry_t *old = &old_table[i];
+        if (!old->valid) continue;
+
+        cache_entry_t *e = &cache_table[old->hash % cache_capacity];
+        if (e->valid) {
+            blob_unref(old->data);
+            continue;
+        }
+        *e = *old;
+        cache_bytes += e->size;
+        host_link(e);
+        kept++;
+    }
+    cache_count = kept;
+    free(old_table);
+
+    // The sketch is sized for the table: start counting afresh
+    cm_sketch_free(&cache_sketch);
+    cm_sketch_init(&cache_sketch, cache_capacity);
+
+    // A smaller budget drops entries (sampled, least popular first)
+    make_room(0, SKETCH_MAX + 1, NULL, -1);
+
+    pthread_rwlock_unlock(&cache_rwlock);
+
+    TRACE_INFO(TRACE_CACHE, "Cache resized to %zu entries (~%d MB), %zu entries kept",
+               new_capacity, mb, kept);
 }
 
 
@@ -142,13 +590,19 @@ void cache_cleanup(void) {
     if (cache_table) {
         for (size_t i = 0; i < cache_capacity; i++) {
             if (cache_table[i].valid && cache_table[i].data) {
-                free(cache_table[i].data);
+                blob_unref(cache_table[i].data);
             }
         }
         free(cache_table);
         cache_table = NULL;
+        cache_count = cache_bytes = 0;
+        host_reset();
     }
+    cm_sketch_free(&cache_sketch);
 
     pthread_rwlock_unlock(&cache_rwlock);
     pthread_rwlock_destroy(&cache_rwlock);
+
+    // Unmapped unless a response still holds an entry
+    cache_arena_release();
 }
\ No newline at end of file
@@ -2,17 +2,38 @@
 #define CACHE_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 // ------------------------------------------------------------
 // Internal structure of each cache entry
 // ------------------------------------------------------------
 typedef struct {
     char path[1024];   // file path
-    char *data;        // content in RAM
+    char *data;        // content in RAM (reference counted, see cache_release)
     size_t size;       // file size
+    uint64_t hash;     // hash of the path (table slot and frequency sketch)
     int valid;         // 1 if valid, 0 if empty
+    int vhost;         // virtual host charged for the entry (quota)
+    int32_t prev, next;    // slots of the entries of the same virtual host (ring)
 } cache_entry_t;
 
+// ------------------------------------------------------------
+// Admission (TinyLFU)
+// ------------------------------------------------------------
+// Every lookup is counted in a count-min sketch with aging. A file is only
+// cached if it is at most CACHE_MAX_OBJECT_KB and, when its slot is taken or
+// the CACHE_SIZE_MB budget is full, if it is estimated to be more popular
+// than every entry it would displace (the slot owner and the least popular
+// of a few sampled entries). A crawl or a large download therefore cannot
+// push the hot set out.
+
+// Entries sampled for each eviction when the byte budget is full
+#define CACHE_EVICT_SAMPLES 8
+
+// Per virtual host quotas (VHOST ... cache=MB): on top of the shared budget,
+// each host may hold at most its quota; a newcomer over it only displaces
+// less popular entries of the same host, sampled from the host's ring.
+
 
 // ------------------------------------------------------------
 // Cache API
@@ -21,11 +42,31 @@ typedef struct {
 // Initialize cache with X MB
 void cache_init(int mb);
 
-// Get file from cache (returns 1 if exists)
+// Get file from cache (returns 1 if exists). The data stays valid, even if
+// the entry is evicted meanwhile, until cache_release(data)
 int cache_get(const char *path, char **data, size_t *size);
+void cache_release(const char *data);
+
+// Put a copy of a file in the cache if the admission filter lets it in,
+// charged to a virtual host (vhost.h, 0 = default). Returns 1 if cached,
+// 0 if rejected
+int cache_put(const char *path, const char *data, size_t size, int vhost);
+
+// Bytes a virtual host may hold (0 = no quota). A lower quota evicts the
+// least popular entries of the host now
+void cache_set_quota(int vhost, size_t bytes);
+
+// Publishes (+1) or withdraws (-1) the bytes and entries of this process's
+// cache in the worker metrics (a reloaded worker inherits a warm cache)
+void cache_publish_usage(int sign);
+
+// Resize the cache keeping current entries (reload)
+void cache_resize(int mb);
 
-// Put file in cache
-void cache_put(const char *path, char *data, size_t size);
+// Byte budget, changed at run time by the memory governor (the table keeps
+// its size; a smaller budget evicts the least popular entries)
+void cache_set_budget(size_t bytes);
+size_t cache_get_budget(void);
 
 // Clean up cache
 void cache_cleanup(void);
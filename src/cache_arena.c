@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+
+#include "cache_arena.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_BINS  64
+
+// A block: header, then the caller's data (or the free-list links)
+typedef struct arena_block {
+    size_t prev_size;               // Size of the block before (0 = first block)
+    size_t size;                    // Bytes with the header; bit 0 = in use
+    struct arena_block *next_free;  // Free blocks only
+    struct arena_block *prev_free;
+} arena_block_t;
+
+#define BLOCK_HEADER    offsetof(arena_block_t, next_free)
+#define BLOCK_MIN       sizeof(arena_block_t)
+#define BLOCK_USED      ((size_t)1)
+#define BLOCK_SIZE(b)   ((b)->size & ~BLOCK_USED)
+
+static struct {
+    pthread_mutex_t mutex;
+    char *base;                     // Mapping (NULL until the first allocation)
+    char *end;
+    size_t bytes;                   // Size the next mapping gets
+    int want;                       // CACHE_ARENA_* asked for (NONE = off)
+    int pages;                      // CACHE_ARENA_* of the mapping
+    int failed;                     // Mapping failed: no further attempt
+    unsigned long live;             // Allocated blocks
+    arena_block_t *bins[ARENA_BINS];
+} arena = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief fork() handlers: the arena is consistent in the child (a successor
+ *        inherits the cache and its blocks).
+ */
+static void arena_atfork_prepare(void) { pthread_mutex_lock(&arena.mutex); }
+static void arena_atfork_parent(void)  { pthread_mutex_unlock(&arena.mutex); }
+static void arena_atfork_child(void)   { pthread_mutex_init(&arena.mutex, NULL); }
+
+/**
+ * @brief Free list of a block size (power of two just below it).
+ */
+static int bin_of(size_t size) {
+    return 63 - __builtin_clzl(size);
+}
+
+static void bin_insert(arena_block_t *b) {
+    int i = bin_of(b->size);
+    b->prev_free = NULL;
+    b->next_free = arena.bins[i];
+    if (b->next_free)
+        b->next_free->prev_free = b;
+    arena.bins[i] = b;
+}
+
+static void bin_remove(arena_block_t *b) {
+    if (b->prev_free)
+        b->prev_free->next_free = b->next_free;
+    else
+        arena.bins[bin_of(b->size)] = b->next_free;
+    if (b->next_free)
+        b->next_free->prev_free = b->prev_free;
+}
+
+/**
+ * @brief Block after 'b', NULL at the end of the arena.
+ */
+static arena_block_t *block_next(arena_block_t *b) {
+    char *next = (char *)b + BLOCK_SIZE(b);
+    return next < arena.end ? (arena_block_t *)next : NULL;
+}
+
+/**
+ * @brief Stores the mapping in the worker metrics (arena.mutex held).
+ */
+static void publish_mapping(void) {
+    metrics_cache_arena((unsigned long)arena.base,
+                        arena.base ? (size_t)(arena.end - arena.base) : 0, arena.pages);
+}
+
+/**
+ * @brief Maps the arena (arena.mutex held): huge pages from the reserved
+ *        pool if asked, otherwise a 2 MB aligned anonymous mapping with THP.
+ * @return 0 on success, -1 if nothing could be mapped.
+ */
+static int arena_map(void) {
+    size_t len = (arena.bytes + CACHE_ARENA_HUGE_PAGE - 1) & ~(CACHE_ARENA_HUGE_PAGE - 1);
+    char *p = MAP_FAILED;
+
+    if (arena.want == CACHE_ARENA_HUGETLB) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            arena.pages = CACHE_ARENA_HUGETLB;
+        else
+            TRACE_WARN(TRACE_CACHE, "MAP_HUGETLB of %zu MB failed, using THP", len >> 20);
+    }
+
+    if (p == MAP_FAILED) {
+        // Over-map by one huge page and trim, so the arena starts on a 2 MB
+        // boundary and every 2 MB of it can be one huge page
+        char *raw = mmap(NULL, len + CACHE_ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (raw == MAP_FAILED)
+            return -1;
+
+        p = (char *)(((uintptr_t)raw + CACHE_ARENA_HUGE_PAGE - 1) & ~(CACHE_ARENA_HUGE_PAGE - 1));
+        if (p > raw)
+            munmap(raw, p - raw);
+        if (raw + CACHE_ARENA_HUGE_PAGE > p)
+            munmap(p + len, raw + CACHE_ARENA_HUGE_PAGE - p);
+
+        arena.pages = madvise(p, len, MADV_HUGEPAGE) == 0 ? CACHE_ARENA_THP : CACHE_ARENA_PAGES;
+    }
+
+    arena.base = p;
+    arena.end = p + len;
+    arena.live = 0;
+    memset(arena.bins, 0, sizeof(arena.bins));
+
+    arena_block_t *b = (arena_block_t *)p;
+    b->prev_size = 0;
+    b->size = len;
+    bin_insert(b);
+
+    TRACE_INFO(TRACE_CACHE, "Cache arena: %zu MB on %s pages", len >> 20,
+               cache_arena_pages_name(arena.pages));
+    publish_mapping();
+    return 0;
+}
+
+/**
+ * @brief Sets the size and pages of the arena the next allocation maps.
+ * @param bytes Arena size (rounded up to 2 MB).
+ * @param mode "thp", "hugetlb" or "off".
+ * @return 0 on success, -1 for an unknown mode (thp is used).
+ */
+int cache_arena_configure(size_t bytes, const char *mode) {
+    static int atfork_registered = 0;
+    int rc = 0;
+
+    pthread_mutex_lock(&arena.mutex);
+
+    if (!atfork_registered) {
+        pthread_atfork(arena_atfork_prepare, arena_atfork_parent, arena_atfork_child);
+        atfork_registered = 1;
+    }
+
+    if (!strcasecmp(mode, "off"))
+        arena.want = CACHE_ARENA_NONE;
+    else if (!strcasecmp(mode, "hugetlb"))
+        arena.want = CACHE_ARENA_HUGETLB;
+    else {
+        arena.want = CACHE_ARENA_THP;
+        rc = strcasecmp(mode, "thp") ? -1 : 0;
+    }
+    arena.bytes = bytes;
+    arena.failed = 0;
+
+    pthread_mutex_unlock(&arena.mutex);
+    return rc;
+}
+
+/**
+ * @brief Allocates a block from the arena (mapping it on first use).
+ * @param size Bytes needed.
+ * @return 16-byte aligned pointer, NULL if the arena is off or has no free
+ *         block large enough (counted as a fallback).
+ */
+void *cache_arena_alloc(size_t size) {
+    size_t need = (size + BLOCK_HEADER + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (need < BLOCK_MIN)
+        need = BLOCK_MIN;
+
+    pthread_mutex_lock(&arena.mutex);
+
+    if (arena.want == CACHE_ARENA_NONE) {
+        pthread_mutex_unlock(&arena.mutex);
+        return NULL;
+    }
+    if (!arena.base && !arena.failed && arena_map() != 0) {
+        TRACE_WARN(TRACE_CACHE, "Could not map the cache arena, using malloc");
+        arena.failed = 1;
+    }
+
+    // First fit: the list of the size's power of two is searched, any block
+    // of a larger list is big enough
+    arena_block_t *b = NULL;
+    for (int i = bin_of(need); i < ARENA_BINS && arena.base && !b; i++)
+        for (arena_block_t *f = arena.bins[i]; f; f = f->next_free)
+            if (f->size >= need) {
+                b = f;
+                break;
+            }
+
+    if (!b) {
+        pthread_mutex_unlock(&arena.mutex);
+        metrics_cache_arena_fallback();
+        return NULL;
+    }
+    bin_remove(b);
+
+    // Split: the tail stays free
+    if (b->size - need >= BLOCK_MIN) {
+        arena_block_t *rest = (arena_block_t *)((char *)b + need);
+        rest->prev_size = need;
+        rest->size = b->size - need;
+        arena_block_t *after = block_next(rest);
+        if (after)
+            after->prev_size = rest->size;
+        bin_insert(rest);
+        b->size = need;
+    }
+
+    b->size |= BLOCK_USED;
+    arena.live++;
+
+    pthread_mutex_unlock(&arena.mutex);
+    return (char *)b + BLOCK_HEADER;
+}
+
+/**
+ * @brief Returns a block to the arena, merged with free neighbours.
+ * @param p Pointer from cache_arena_alloc.
+ * @return 0 on success, -1 if 'p' is not in the arena.
+ */
+int cache_arena_free(void *p) {
+    pthread_mutex_lock(&arena.mutex);
+
+    if (!arena.base || (char *)p < arena.base || (char *)p >= arena.end) {
+        pthread_mutex_unlock(&arena.mutex);
+        return -1;
+    }
+
+    arena_block_t *b = (arena_block_t *)((char *)p - BLOCK_HEADER);
+    b->size &= ~BLOCK_USED;
+    arena.live--;
+
+    arena_block_t *next = block_next(b);
+    if (next && !(next->size & BLOCK_USED)) {
+        bin_remove(next);
+        b->size += next->size;
+    }
+
+    if (b->prev_size) {
+        arena_block_t *prev = (arena_block_t *)((char *)b - b->prev_size);
+        if (!(prev->size & BLOCK_USED)) {
+            bin_remove(prev);
+            prev->size += b->size;
+            b = prev;
+        }
+    }
+
+    next = block_next(b);
+    if (next)
+        next->prev_size = b->size;
+    bin_insert(b);
+
+    pthread_mutex_unlock(&arena.mutex);
+    return 0;
+}
+
+/**
+ * @brief Returns the memory of free blocks to the kernel (memory pressure):
+ *        whole 2 MB pages inside free blocks are discarded with
+ *        MADV_DONTNEED, so huge pages still in use are not split. The
+ *        blocks stay free; touching them again faults in zeroed pages.
+ * @return Bytes discarded.
+ */
+size_t cache_arena_trim(void) {
+    size_t released = 0;
+
+    pthread_mutex_lock(&arena.mutex);
+    for (int i = 0; i < ARENA_BINS && arena.base; i++) {
+        for (arena_block_t *b = arena.bins[i]; b; b = b->next_free) {
+            // The header and the free-list links must survive
+            uintptr_t start = ((uintptr_t)b + BLOCK_MIN + CACHE_ARENA_HUGE_PAGE - 1) &
+                              ~(CACHE_ARENA_HUGE_PAGE - 1);
+            uintptr_t end = ((uintptr_t)b + b->size) & ~(CACHE_ARENA_HUGE_PAGE - 1);
+            if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0)
+                released += end - start;
+        }
+    }
+    pthread_mutex_unlock(&arena.mutex);
+    return released;
+}
+
+/**
+ * @brief Unmaps the arena when no block is in use, so the next allocation
+ *        maps one of the configured size.
+ */
+void cache_arena_release(void) {
+    pthread_mutex_lock(&arena.mutex);
+    if (arena.base && arena.live == 0) {
+        munmap(arena.base, arena.end - arena.base);
+        arena.base = arena.end = NULL;
+        arena.pages = CACHE_ARENA_NONE;
+    }
+    pthread_mutex_unlock(&arena.mutex);
+}
+
+/**
+ * @brief Publishes the arena of this process (address, size and pages) in
+ *        its worker metrics; /metrics reads its coverage from smaps.
+ */
+void cache_arena_publish(void) {
+    pthread_mutex_lock(&arena.mutex);
+    publish_mapping();
+    pthread_mutex_unlock(&arena.mutex);
+}
+
+/**
+ * @brief Name of the pages backing an arena.
+ * @param pages CACHE_ARENA_* value.
+ */
+const char *cache_arena_pages_name(int pages) {
+    switch (pages) {
+    case CACHE_ARENA_PAGES:   return "normal";
+    case CACHE_ARENA_THP:     return "thp";
+    case CACHE_ARENA_HUGETLB: return "hugetlb";
+    default:                  return "none";
+    }
+}
+
+/**
+ * @brief Reads how much of an arena mapping is resident, and how much of it
+ *        in huge pages (AnonHugePages for THP, *_Hugetlb for MAP_HUGETLB).
+ * @param pid Process owning the arena.
+ * @param addr Start of the arena.
+ * @param resident Receives the resident bytes.
+ * @param huge Receives the bytes mapped by huge pages.
+ * @return 0 on success, -1 if smaps or the mapping could not be read.
+ */
+int cache_arena_coverage(pid_t pid, unsigned long addr, size_t *resident, size_t *huge) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/smaps", (int)pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    int found = 0, inside = 0;
+    *resident = *huge = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, end, kb;
+
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if (found) break;
+            inside = found = (addr >= start && addr < end);
+            continue;
+        }
+        if (!inside)
+            continue;
+
+        if (sscanf(line, "Rss: %lu kB", &kb) == 1) {
+            *resident += kb * 1024;
+        } else if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            *huge += kb * 1024;
+        } else if (sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+                   sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1) {
+            *resident += kb * 1024;
+            *huge += kb * 1024;
+        }
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+#ifndef CACHE_ARENA_H
+#define CACHE_ARENA_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// ------------------------------------------------------------
+// Huge-page arena for cache entries
+// ------------------------------------------------------------
+// Cached file contents come from one large mapping instead of individual
+// malloc blocks spread over the heap, so a hot set of many MB is covered by
+// a few 2 MB pages and cache hits miss the TLB far less. CACHE_HUGE_PAGES
+// selects the pages:
+//   thp      anonymous mapping, 2 MB aligned, madvise(MADV_HUGEPAGE); if THP
+//            is disabled the arena stays, on normal pages
+//   hugetlb  MAP_HUGETLB from the reserved pool (vm.nr_hugepages), falling
+//            back to thp when the pool is too small. A successor forked on
+//            reload copies touched pages on write: the pool must cover both
+//   off      no arena, every entry is malloc'd
+// Blocks are carved with boundary tags (first fit over power-of-two free
+// lists, neighbours merged on free). The arena is sized for CACHE_SIZE_MB
+// when a process first caches a file (workers, not the master); entries
+// that do not fit (fragmentation, a larger budget after reload) fall back
+// to malloc and are counted in webserver_cache_arena_fallbacks_total.
+
+// Pages backing the arena (webserver_cache_arena_bytes{pages=...})
+#define CACHE_ARENA_NONE    0
+#define CACHE_ARENA_PAGES   1       // Normal pages (THP unavailable)
+#define CACHE_ARENA_THP     2
+#define CACHE_ARENA_HUGETLB 3
+
+#define CACHE_ARENA_HUGE_PAGE (2UL * 1024 * 1024)
+
+// Sets the size and pages of the arena mapped by the next allocation (an
+// arena already mapped is kept). Returns 0, -1 for an unknown mode
+int cache_arena_configure(size_t bytes, const char *mode);
+
+// Allocates from the arena. NULL if it is full or disabled (use malloc)
+void *cache_arena_alloc(size_t size);
+
+// Frees a block of cache_arena_alloc. Returns 0, -1 if 'p' is not in the
+// arena (a malloc'd fallback, to be freed by the caller)
+int cache_arena_free(void *p);
+
+// Discards the whole 2 MB pages of free blocks (memory governor). Returns
+// the bytes given back
+size_t cache_arena_trim(void);
+
+// Unmaps the arena if no block is in use (cache_cleanup)
+void cache_arena_release(void);
+
+// Publishes the mapping of this process in its worker metrics
+void cache_arena_publish(void);
+
+// Name of a CACHE_ARENA_* value
+const char *cache_arena_pages_name(int pages);
+
+// Resident and huge-page bytes of an arena mapping of a process, from
+// /proc/<pid>/smaps. Returns 0, -1 if the mapping was not found
+int cache_arena_coverage(pid_t pid, unsigned long addr, size_t *resident, size_t *huge);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 
 #include "config.h"
@@ -9,15 +10,62 @@
 static server_config_t config = {
     .port = 8080,
     .https_port = 8443,
+    .num_listen = 0,
+    .listen_backlog = 1024,
+    .tcp_defer_accept_seconds = 5,
+    .tcp_fastopen = 0,
+    .accept_batch = 16,
+    .tcp_nodelay = "on",
+    .tcp_cork = "on",
     .document_root = "www",
+    .num_vhosts = 0,
     .num_workers = 4,
     .threads_per_worker = 30,
+    .threads_min_per_worker = 4,
+    .pool_grow_busy_percent = 80,
+    .pool_grow_queue_wait_ms = 10,
+    .pool_idle_seconds = 30,
+    .disk_io_threads = 4,
     .max_queue_size = 200,
     .log_file = "access.log",
     .cache_size_mb = 50,
+    .cache_max_object_kb = 1024,
+    .stream_threshold_kb = 1024,
+    .cache_huge_pages = "thp",
+    .memory_governor = "on",
+    .memory_limit_mb = 0,
+    .memory_high_percent = 85,
+    .memory_low_percent = 70,
+    .memory_psi_percent = 10,
     .timeout_seconds = 5,
+    .handshake_timeout_seconds = 10,
+    .keepalive_timeout_seconds = 5,
+    .pipeline_depth = 16,
+    .http2 = "on",
+    .h2c = "off",
+    .stats_stream_interval_ms = 1000,
+    .http_parser_simd = "auto",
+    .mime_types = "mime.types",
+    .num_proxy_routes = 0,
+    .proxy_keepalive = 16,
+    .proxy_timeout_seconds = 30,
+    .proxy_max_fails = 3,
+    .proxy_fail_timeout_seconds = 10,
+    .rate_limit_rps = 0,
+    .rate_limit_burst = 50,
+    .rate_limit_subnet_rps = 0,
+    .rate_limit_subnet_burst = 200,
+    .rate_limit_subnet_prefix = 24,
+    .rate_limit_connections = 0,
+    .rate_limit_subnet_connections = 0,
+    .slow_request_ms = 500,
     .ssl_cert = "cert.pem",
-    .ssl_key = "key.pem"
+    .ssl_key = "key.pem",
+    .trace_level = "info",
+    .trace_categories = "all",
+    .cpu_affinity = "none",
+    .thread_affinity = "inherit",
+    .numa_memory = "off"
 };
 
 
@@ -61,6 +109,11 @@ int load_config(const char *filename) {
     char line[256];
     int line_num = 0;
 
+    // PROXY_PASS, LISTEN and VHOST lines accumulate: a reload starts over
+    config.num_proxy_routes = 0;
+    config.num_listen = 0;
+    config.num_vhosts = 0;
+
     while (fgets(line, sizeof(line), file)) {
         line_num++;
 
@@ -87,15 +140,64 @@ int load_config(const char *filename) {
         else if (strcmp(key, "HTTPS_PORT") == 0)
             config.https_port = atoi(value);
 
+        else if (strcmp(key, "LISTEN") == 0) {
+            if (config.num_listen < CONFIG_MAX_LISTENERS)
+                strncpy(config.listen[config.num_listen++], value,
+                        sizeof(config.listen[0])-1);
+            else
+                printf("Too many LISTEN lines, line %d ignored\n", line_num);
+        }
+
+        else if (strcmp(key, "LISTEN_BACKLOG") == 0)
+            config.listen_backlog = atoi(value);
+
+        else if (strcmp(key, "TCP_DEFER_ACCEPT_SECONDS") == 0)
+            config.tcp_defer_accept_seconds = atoi(value);
+
+        else if (strcmp(key, "TCP_FASTOPEN") == 0)
+            config.tcp_fastopen = atoi(value);
+
+        else if (strcmp(key, "ACCEPT_BATCH") == 0)
+            config.accept_batch = atoi(value);
+
+        else if (strcmp(key, "TCP_NODELAY") == 0)
+            strncpy(config.tcp_nodelay, value, sizeof(config.tcp_nodelay)-1);
+
+        else if (strcmp(key, "TCP_CORK") == 0)
+            strncpy(config.tcp_cork, value, sizeof(config.tcp_cork)-1);
+
         else if (strcmp(key, "DOCUMENT_ROOT") == 0)
             strncpy(config.document_root, value, sizeof(config.document_root)-1);
 
+        else if (strcmp(key, "VHOST") == 0) {
+            if (config.num_vhosts < CONFIG_MAX_VHOSTS)
+                strncpy(config.vhost[config.num_vhosts++], value,
+                        sizeof(config.vhost[0])-1);
+            else
+                printf("Too many VHOST lines, line %d ignored\n", line_num);
+        }
+
         else if (strcmp(key, "NUM_WORKERS") == 0)
             config.num_workers = atoi(value);
 
         else if (strcmp(key, "THREADS_PER_WORKER") == 0)
             config.threads_per_worker = atoi(value);
 
+        else if (strcmp(key, "THREADS_MIN_PER_WORKER") == 0)
+            config.threads_min_per_worker = atoi(value);
+
+        else if (strcmp(key, "POOL_GROW_BUSY_PERCENT") == 0)
+            config.pool_grow_busy_percent = atoi(value);
+
+        else if (strcmp(key, "POOL_GROW_QUEUE_WAIT_MS") == 0)
+            config.pool_grow_queue_wait_ms = atoi(value);
+
+        else if (strcmp(key, "POOL_IDLE_SECONDS") == 0)
+            config.pool_idle_seconds = atoi(value);
+
+        else if (strcmp(key, "DISK_IO_THREADS") == 0)
+            config.disk_io_threads = atoi(value);
+
         else if (strcmp(key, "MAX_QUEUE_SIZE") == 0)
             config.max_queue_size = atoi(value);
 
@@ -105,15 +207,122 @@ int load_config(const char *filename) {
         else if (strcmp(key, "CACHE_SIZE_MB") == 0)
             config.cache_size_mb = atoi(value);
 
+        else if (strcmp(key, "CACHE_MAX_OBJECT_KB") == 0)
+            config.cache_max_object_kb = atoi(value);
+
+        else if (strcmp(key, "STREAM_THRESHOLD_KB") == 0)
+            config.stream_threshold_kb = atoi(value);
+
+        else if (strcmp(key, "CACHE_HUGE_PAGES") == 0)
+            strncpy(config.cache_huge_pages, value, sizeof(config.cache_huge_pages)-1);
+
+        else if (strcmp(key, "MEMORY_GOVERNOR") == 0)
+            strncpy(config.memory_governor, value, sizeof(config.memory_governor)-1);
+
+        else if (strcmp(key, "MEMORY_LIMIT_MB") == 0)
+            config.memory_limit_mb = atoi(value);
+
+        else if (strcmp(key, "MEMORY_HIGH_PERCENT") == 0)
+            config.memory_high_percent = atoi(value);
+
+        else if (strcmp(key, "MEMORY_LOW_PERCENT") == 0)
+            config.memory_low_percent = atoi(value);
+
+        else if (strcmp(key, "MEMORY_PSI_PERCENT") == 0)
+            config.memory_psi_percent = atoi(value);
+
         else if (strcmp(key, "TIMEOUT_SECONDS") == 0)
             config.timeout_seconds = atoi(value);
 
+        else if (strcmp(key, "HANDSHAKE_TIMEOUT_SECONDS") == 0)
+            config.handshake_timeout_seconds = atoi(value);
+
+        else if (strcmp(key, "KEEPALIVE_TIMEOUT_SECONDS") == 0)
+            config.keepalive_timeout_seconds = atoi(value);
+
+        else if (strcmp(key, "PIPELINE_DEPTH") == 0)
+            config.pipeline_depth = atoi(value);
+
+        else if (strcmp(key, "HTTP2") == 0)
+            strncpy(config.http2, value, sizeof(config.http2)-1);
+
+        else if (strcmp(key, "H2C") == 0)
+            strncpy(config.h2c, value, sizeof(config.h2c)-1);
+
+        else if (strcmp(key, "STATS_STREAM_INTERVAL_MS") == 0)
+            config.stats_stream_interval_ms = atoi(value);
+
+        else if (strcmp(key, "HTTP_PARSER_SIMD") == 0)
+            strncpy(config.http_parser_simd, value, sizeof(config.http_parser_simd)-1);
+
+        else if (strcmp(key, "MIME_TYPES") == 0)
+            strncpy(config.mime_types, value, sizeof(config.mime_types)-1);
+
+        else if (strcmp(key, "PROXY_PASS") == 0) {
+            if (config.num_proxy_routes < CONFIG_MAX_PROXY_ROUTES)
+                strncpy(config.proxy_pass[config.num_proxy_routes++], value,
+                        sizeof(config.proxy_pass[0])-1);
+            else
+                printf("Too many PROXY_PASS routes, line %d ignored\n", line_num);
+        }
+
+        else if (strcmp(key, "PROXY_KEEPALIVE") == 0)
+            config.proxy_keepalive = atoi(value);
+
+        else if (strcmp(key, "PROXY_TIMEOUT_SECONDS") == 0)
+            config.proxy_timeout_seconds = atoi(value);
+
+        else if (strcmp(key, "PROXY_MAX_FAILS") == 0)
+            config.proxy_max_fails = atoi(value);
+
+        else if (strcmp(key, "PROXY_FAIL_TIMEOUT_SECONDS") == 0)
+            config.proxy_fail_timeout_seconds = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_RPS") == 0)
+            config.rate_limit_rps = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_BURST") == 0)
+            config.rate_limit_burst = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_SUBNET_RPS") == 0)
+            config.rate_limit_subnet_rps = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_SUBNET_BURST") == 0)
+            config.rate_limit_subnet_burst = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_SUBNET_PREFIX") == 0)
+            config.rate_limit_subnet_prefix = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_CONNECTIONS") == 0)
+            config.rate_limit_connections = atoi(value);
+
+        else if (strcmp(key, "RATE_LIMIT_SUBNET_CONNECTIONS") == 0)
+            config.rate_limit_subnet_connections = atoi(value);
+
+        else if (strcmp(key, "SLOW_REQUEST_MS") == 0)
+            config.slow_request_ms = atoi(value);
+
         else if (strcmp(key, "SSL_CERT") == 0)
             strncpy(config.ssl_cert, value, sizeof(config.ssl_cert)-1);
 
         else if (strcmp(key, "SSL_KEY") == 0)
             strncpy(config.ssl_key, value, sizeof(config.ssl_key)-1);
 
+        else if (strcmp(key, "TRACE_LEVEL") == 0)
+            strncpy(config.trace_level, value, sizeof(config.trace_level)-1);
+
+        else if (strcmp(key, "TRACE_CATEGORIES") == 0)
+            strncpy(config.trace_categories, value, sizeof(config.trace_categories)-1);
+
+        else if (strcmp(key, "CPU_AFFINITY") == 0)
+            strncpy(config.cpu_affinity, value, sizeof(config.cpu_affinity)-1);
+
+        else if (strcmp(key, "THREAD_AFFINITY") == 0)
+            strncpy(config.thread_affinity, value, sizeof(config.thread_affinity)-1);
+
+        else if (strcmp(key, "NUMA_MEMORY") == 0)
+            strncpy(config.numa_memory, value, sizeof(config.numa_memory)-1);
+
         else
             printf("Unknown option on line %d: %s\n", line_num, key);
     }
@@ -148,6 +357,76 @@ int get_https_port(void) {
     return config.https_port;
 }
 
+/**
+ * @brief Gets the number of LISTEN lines.
+ * @return Number of listeners configured (0 = PORT and HTTPS_PORT only).
+ */
+int get_listen_count(void) {
+    return config.num_listen;
+}
+
+/**
+ * @brief Gets one LISTEN line as written in server.conf.
+ * @param i Listener index (0 .. get_listen_count() - 1).
+ * @return The address and options, NULL if out of range.
+ */
+const char *get_listen(int i) {
+    if (i < 0 || i >= config.num_listen)
+        return NULL;
+    return config.listen[i];
+}
+
+/**
+ * @brief Gets the accept queue length requested from listen() (the kernel
+ *        caps it at net.core.somaxconn).
+ * @return Backlog (at least 1).
+ */
+int get_listen_backlog(void) {
+    return config.listen_backlog > 0 ? config.listen_backlog : 1;
+}
+
+/**
+ * @brief Gets how long the kernel holds a new connection until the client
+ *        sends data (TCP_DEFER_ACCEPT).
+ * @return Time in seconds (0 = accept at once).
+ */
+int get_tcp_defer_accept_seconds(void) {
+    return config.tcp_defer_accept_seconds > 0 ? config.tcp_defer_accept_seconds : 0;
+}
+
+/**
+ * @brief Gets the TCP Fast Open queue length of the listeners.
+ * @return Pending Fast Open requests allowed (0 = disabled).
+ */
+int get_tcp_fastopen(void) {
+    return config.tcp_fastopen > 0 ? config.tcp_fastopen : 0;
+}
+
+/**
+ * @brief Gets how many connections a worker accepts per listener wakeup.
+ * @return Number of accepts (at least 1).
+ */
+int get_accept_batch(void) {
+    return config.accept_batch > 0 ? config.accept_batch : 1;
+}
+
+/**
+ * @brief Checks whether client sockets disable Nagle's algorithm.
+ * @return 1 if TCP_NODELAY=on, 0 otherwise.
+ */
+int get_tcp_nodelay(void) {
+    return strcasecmp(config.tcp_nodelay, "on") == 0;
+}
+
+/**
+ * @brief Checks whether responses written in several parts are corked, so
+ *        the header and the body leave in full segments.
+ * @return 1 if TCP_CORK=on, 0 otherwise.
+ */
+int get_tcp_cork(void) {
+    return strcasecmp(config.tcp_cork, "on") == 0;
+}
+
 /**
  * @brief Gets the document root directory to serve.
  * @return String with the document root path.
@@ -156,6 +435,26 @@ const char *get_document_root(void) {
     return config.document_root;
 }
 
+/**
+ * @brief Gets the number of virtual hosts (VHOST lines).
+ * @return Number of virtual hosts (0 = DOCUMENT_ROOT serves every Host).
+ */
+int get_vhost_count(void) {
+    return config.num_vhosts;
+}
+
+/**
+ * @brief Gets one virtual host as written in server.conf.
+ * @param i Virtual host index (0 .. get_vhost_count() - 1).
+ * @return String "<name>[,<alias>...] <root> [cert=F key=F] [cache=MB]",
+ *         NULL if out of range.
+ */
+const char *get_vhost(int i) {
+    if (i < 0 || i >= config.num_vhosts)
+        return NULL;
+    return config.vhost[i];
+}
+
 /**
  * @brief Gets the number of configured worker processes.
  * @return Number of workers.
@@ -165,13 +464,56 @@ int get_num_workers(void) {
 }
 
 /**
- * @brief Gets the number of threads per worker.
+ * @brief Gets the most threads the pool of a worker may grow to.
  * @return Number of threads per worker.
  */
 int get_threads_per_worker(void) {
     return config.threads_per_worker;
 }
 
+/**
+ * @brief Gets the threads a worker pool starts with and keeps when idle.
+ * @return Number of threads (at least 1, at most THREADS_PER_WORKER).
+ */
+int get_threads_min_per_worker(void) {
+    int n = config.threads_min_per_worker;
+    if (n > config.threads_per_worker) n = config.threads_per_worker;
+    return n > 0 ? n : 1;
+}
+
+/**
+ * @brief Gets the share of busy threads at which the pool adds a thread.
+ * @return Percentage (1..100).
+ */
+int get_pool_grow_busy_percent(void) {
+    int p = config.pool_grow_busy_percent;
+    return p < 1 ? 1 : p > 100 ? 100 : p;
+}
+
+/**
+ * @brief Gets the queue wait after which the pool adds a thread.
+ * @return Time in milliseconds (0 = grow on busy share only).
+ */
+int get_pool_grow_queue_wait_ms(void) {
+    return config.pool_grow_queue_wait_ms > 0 ? config.pool_grow_queue_wait_ms : 0;
+}
+
+/**
+ * @brief Gets how long a thread above the minimum may stay idle before it exits.
+ * @return Time in seconds (0 = threads never exit).
+ */
+int get_pool_idle_seconds(void) {
+    return config.pool_idle_seconds > 0 ? config.pool_idle_seconds : 0;
+}
+
+/**
+ * @brief Gets the threads per worker that read files on cache misses.
+ * @return Number of threads (0 = request threads read files themselves).
+ */
+int get_disk_io_threads(void) {
+    return config.disk_io_threads > 0 ? config.disk_io_threads : 0;
+}
+
 /**
  * @brief Gets the maximum request queue size.
  * @return Queue size.
@@ -197,13 +539,266 @@ int get_cache_size_mb(void) {
 }
 
 /**
- * @brief Gets the configured timeout for server operations.
+ * @brief Gets the largest file the cache admits.
+ * @return Size in KB (at least 1).
+ */
+int get_cache_max_object_kb(void) {
+    return config.cache_max_object_kb > 0 ? config.cache_max_object_kb : 1;
+}
+
+/**
+ * @brief Gets the file size above which a file is streamed from disk in
+ *        fixed-size chunks instead of being read into memory and cached.
+ * @return Size in KB (0 = every file is read into memory).
+ */
+int get_stream_threshold_kb(void) {
+    return config.stream_threshold_kb > 0 ? config.stream_threshold_kb : 0;
+}
+
+/**
+ * @brief Gets the pages backing the cache arena (thp, hugetlb, off).
+ * @return String with the mode.
+ */
+const char *get_cache_huge_pages(void) {
+    return config.cache_huge_pages;
+}
+
+/**
+ * @brief Checks if the memory governor shrinks caches and pools under pressure.
+ * @return 1 if enabled, 0 otherwise.
+ */
+int get_memory_governor(void) {
+    return strcasecmp(config.memory_governor, "on") == 0;
+}
+
+/**
+ * @brief Gets the memory limit the governor applies to the workers' RSS.
+ * @return Limit in MB (0 = the cgroup v2 memory.max).
+ */
+int get_memory_limit_mb(void) {
+    return config.memory_limit_mb > 0 ? config.memory_limit_mb : 0;
+}
+
+/**
+ * @brief Gets the memory usage (percent of the limit) above which the
+ *        governor shrinks the cache and pools.
+ * @return Percent (1 to 100).
+ */
+int get_memory_high_percent(void) {
+    if (config.memory_high_percent < 1) return 1;
+    return config.memory_high_percent > 100 ? 100 : config.memory_high_percent;
+}
+
+/**
+ * @brief Gets the memory usage (percent of the limit) below which the
+ *        cache grows back.
+ * @return Percent (at most MEMORY_HIGH_PERCENT).
+ */
+int get_memory_low_percent(void) {
+    int high = get_memory_high_percent();
+    if (config.memory_low_percent < 0) return 0;
+    return config.memory_low_percent > high ? high : config.memory_low_percent;
+}
+
+/**
+ * @brief Gets the PSI memory pressure (some avg10) above which the governor
+ *        shrinks the cache and pools.
+ * @return Percent of time stalled (0 = PSI ignored).
+ */
+int get_memory_psi_percent(void) {
+    return config.memory_psi_percent > 0 ? config.memory_psi_percent : 0;
+}
+
+/**
+ * @brief Gets the configured timeout for server operations
+ *        (whole request header read, and each chunk of a response write).
  * @return Timeout in seconds.
  */
 int get_timeout_seconds(void) {
     return config.timeout_seconds;
 }
 
+/**
+ * @brief Gets the maximum duration of a TLS handshake.
+ * @return Timeout in seconds.
+ */
+int get_handshake_timeout_seconds(void) {
+    return config.handshake_timeout_seconds;
+}
+
+/**
+ * @brief Gets how long an idle keep-alive connection waits for its next request.
+ * @return Timeout in seconds (0 disables keep-alive).
+ */
+int get_keepalive_timeout_seconds(void) {
+    return config.keepalive_timeout_seconds;
+}
+
+/**
+ * @brief Gets the maximum number of pipelined responses batched before a flush.
+ * @return Number of requests (at least 1).
+ */
+int get_pipeline_depth(void) {
+    return config.pipeline_depth > 0 ? config.pipeline_depth : 1;
+}
+
+/**
+ * @brief Checks whether HTTP/2 is offered through ALPN on the HTTPS port.
+ * @return 1 if HTTP2=on, 0 otherwise.
+ */
+int get_http2_enabled(void) {
+    return strcasecmp(config.http2, "on") == 0;
+}
+
+/**
+ * @brief Checks whether the plain port accepts HTTP/2 with prior knowledge (h2c).
+ * @return 1 if H2C=on, 0 otherwise.
+ */
+int get_h2c_enabled(void) {
+    return strcasecmp(config.h2c, "on") == 0;
+}
+
+/**
+ * @brief Gets the cadence of the live stats stream (/api/stats/stream).
+ * @return Interval in milliseconds (at least 100).
+ */
+int get_stats_stream_interval_ms(void) {
+    return config.stats_stream_interval_ms >= 100 ? config.stats_stream_interval_ms : 100;
+}
+
+/**
+ * @brief Gets the delimiter scanner of the HTTP/1 parser (auto, avx2, sse4.2, off).
+ * @return String with the scanner name.
+ */
+const char *get_http_parser_simd(void) {
+    return config.http_parser_simd;
+}
+
+/**
+ * @brief Gets the path of the mime.types file (content types and cache policies).
+ * @return String with the file path.
+ */
+const char *get_mime_types_file(void) {
+    return config.mime_types;
+}
+
+/**
+ * @brief Gets the number of reverse proxy routes (PROXY_PASS lines).
+ * @return Number of routes.
+ */
+int get_proxy_route_count(void) {
+    return config.num_proxy_routes;
+}
+
+/**
+ * @brief Gets one reverse proxy route as written in server.conf.
+ * @param i Route index (0 .. get_proxy_route_count() - 1).
+ * @return String "<prefix> <host:port>[,...] [cache=N]", NULL if out of range.
+ */
+const char *get_proxy_route(int i) {
+    if (i < 0 || i >= config.num_proxy_routes)
+        return NULL;
+    return config.proxy_pass[i];
+}
+
+/**
+ * @brief Gets the idle keep-alive connections kept per upstream and worker.
+ * @return Number of connections (0 = a new connection per request).
+ */
+int get_proxy_keepalive(void) {
+    return config.proxy_keepalive > 0 ? config.proxy_keepalive : 0;
+}
+
+/**
+ * @brief Gets the connect, send and receive timeout towards upstreams.
+ * @return Timeout in seconds (at least 1).
+ */
+int get_proxy_timeout_seconds(void) {
+    return config.proxy_timeout_seconds > 0 ? config.proxy_timeout_seconds : 1;
+}
+
+/**
+ * @brief Gets the consecutive failures that take an upstream out of rotation.
+ * @return Number of failures (at least 1).
+ */
+int get_proxy_max_fails(void) {
+    return config.proxy_max_fails > 0 ? config.proxy_max_fails : 1;
+}
+
+/**
+ * @brief Gets how long a failed upstream is skipped before it is retried.
+ * @return Time in seconds.
+ */
+int get_proxy_fail_timeout_seconds(void) {
+    return config.proxy_fail_timeout_seconds > 0 ? config.proxy_fail_timeout_seconds : 0;
+}
+
+/**
+ * @brief Gets the sustained request rate allowed per client IP.
+ * @return Requests per second (0 = no limit).
+ */
+int get_rate_limit_rps(void) {
+    return config.rate_limit_rps > 0 ? config.rate_limit_rps : 0;
+}
+
+/**
+ * @brief Gets the requests a client IP may send at once above its rate.
+ * @return Bucket size in requests (at least 1).
+ */
+int get_rate_limit_burst(void) {
+    return config.rate_limit_burst > 0 ? config.rate_limit_burst : 1;
+}
+
+/**
+ * @brief Gets the sustained request rate allowed per client subnet.
+ * @return Requests per second (0 = no limit).
+ */
+int get_rate_limit_subnet_rps(void) {
+    return config.rate_limit_subnet_rps > 0 ? config.rate_limit_subnet_rps : 0;
+}
+
+/**
+ * @brief Gets the requests a client subnet may send at once above its rate.
+ * @return Bucket size in requests (at least 1).
+ */
+int get_rate_limit_subnet_burst(void) {
+    return config.rate_limit_subnet_burst > 0 ? config.rate_limit_subnet_burst : 1;
+}
+
+/**
+ * @brief Gets the prefix length that groups IPv4 clients into a subnet
+ *        (IPv6 clients are grouped by /64).
+ * @return Prefix length (1..32).
+ */
+int get_rate_limit_subnet_prefix(void) {
+    int p = config.rate_limit_subnet_prefix;
+    return p < 1 ? 1 : p > 32 ? 32 : p;
+}
+
+/**
+ * @brief Gets the connections a client IP may hold open at once.
+ * @return Number of connections (0 = no limit).
+ */
+int get_rate_limit_connections(void) {
+    return config.rate_limit_connections > 0 ? config.rate_limit_connections : 0;
+}
+
+/**
+ * @brief Gets the connections a client subnet may hold open at once.
+ * @return Number of connections (0 = no limit).
+ */
+int get_rate_limit_subnet_connections(void) {
+    return config.rate_limit_subnet_connections > 0 ? config.rate_limit_subnet_connections : 0;
+}
+
+/**
+ * @brief Gets the duration from which a request is kept in the slow-request ring.
+ * @return Threshold in milliseconds (0 = none kept).
+ */
+int get_slow_request_ms(void) {
+    return config.slow_request_ms > 0 ? config.slow_request_ms : 0;
+}
+
 /**
  * @brief Gets the SSL certificate path.
  * @return String with the certificate path.
@@ -218,4 +813,44 @@ const char *get_ssl_cert(void) {
  */
 const char *get_ssl_key(void) {
     return config.ssl_key;
+}
+
+/**
+ * @brief Gets the runtime trace level name (error, warn, info, debug, off).
+ * @return String with the trace level.
+ */
+const char *get_trace_level(void) {
+    return config.trace_level;
+}
+
+/**
+ * @brief Gets the comma separated list of enabled trace categories.
+ * @return String with the categories ("all" by default).
+ */
+const char *get_trace_categories(void) {
+    return config.trace_categories;
+}
+
+/**
+ * @brief Gets the CPU placement of workers (none, auto or a CPU list).
+ * @return String with the CPU affinity mode.
+ */
+const char *get_cpu_affinity(void) {
+    return config.cpu_affinity;
+}
+
+/**
+ * @brief Gets the placement of pool threads inside a worker (inherit or spread).
+ * @return String with the thread affinity mode.
+ */
+const char *get_thread_affinity(void) {
+    return config.thread_affinity;
+}
+
+/**
+ * @brief Gets the NUMA memory policy of workers (off, preferred or bind).
+ * @return String with the NUMA memory mode.
+ */
+const char *get_numa_memory(void) {
+    return config.numa_memory;
 }
\ No newline at end of file
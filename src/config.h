@@ -1,21 +1,80 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+// Most PROXY_PASS lines (routes) in server.conf
+#define CONFIG_MAX_PROXY_ROUTES 16
+
+// Most LISTEN lines in server.conf
+#define CONFIG_MAX_LISTENERS 16
+
+// Most VHOST lines (virtual hosts) in server.conf
+#define CONFIG_MAX_VHOSTS 16
+
 // ------------------------------------------------------------
 // Server configuration structure
 // ------------------------------------------------------------
 typedef struct {
     int port;
     int https_port;
+    char listen[CONFIG_MAX_LISTENERS][256];
+    int num_listen;
+    int listen_backlog;
+    int tcp_defer_accept_seconds;
+    int tcp_fastopen;
+    int accept_batch;
+    char tcp_nodelay[8];
+    char tcp_cork[8];
     char document_root[256];
+    char vhost[CONFIG_MAX_VHOSTS][256];
+    int num_vhosts;
     int num_workers;
     int threads_per_worker;
+    int threads_min_per_worker;
+    int pool_grow_busy_percent;
+    int pool_grow_queue_wait_ms;
+    int pool_idle_seconds;
+    int disk_io_threads;
     int max_queue_size;
     char log_file[256];
     int cache_size_mb;
+    int cache_max_object_kb;
+    int stream_threshold_kb;
+    char cache_huge_pages[16];
+    char memory_governor[8];
+    int memory_limit_mb;
+    int memory_high_percent;
+    int memory_low_percent;
+    int memory_psi_percent;
     int timeout_seconds;
+    int handshake_timeout_seconds;
+    int keepalive_timeout_seconds;
+    int pipeline_depth;
+    char http2[8];
+    char h2c[8];
+    int stats_stream_interval_ms;
+    char http_parser_simd[16];
+    char mime_types[256];
+    char proxy_pass[CONFIG_MAX_PROXY_ROUTES][256];
+    int num_proxy_routes;
+    int proxy_keepalive;
+    int proxy_timeout_seconds;
+    int proxy_max_fails;
+    int proxy_fail_timeout_seconds;
+    int rate_limit_rps;
+    int rate_limit_burst;
+    int rate_limit_subnet_rps;
+    int rate_limit_subnet_burst;
+    int rate_limit_subnet_prefix;
+    int rate_limit_connections;
+    int rate_limit_subnet_connections;
+    int slow_request_ms;
     char ssl_cert[256];
     char ssl_key[256];
+    char trace_level[16];
+    char trace_categories[128];
+    char cpu_affinity[128];
+    char thread_affinity[16];
+    char numa_memory[16];
 } server_config_t;
 
 
@@ -32,14 +91,64 @@ const server_config_t *get_config(void);
 // Individual getters
 int get_server_port(void);
 int get_https_port(void);
+int get_listen_count(void);
+const char *get_listen(int i);
+int get_listen_backlog(void);
+int get_tcp_defer_accept_seconds(void);
+int get_tcp_fastopen(void);
+int get_accept_batch(void);
+int get_tcp_nodelay(void);
+int get_tcp_cork(void);
 const char *get_document_root(void);
+int get_vhost_count(void);
+const char *get_vhost(int i);
 int get_num_workers(void);
 int get_threads_per_worker(void);
+int get_threads_min_per_worker(void);
+int get_pool_grow_busy_percent(void);
+int get_pool_grow_queue_wait_ms(void);
+int get_pool_idle_seconds(void);
+int get_disk_io_threads(void);
 int get_max_queue_size(void);
 const char *get_log_file(void);
 int get_cache_size_mb(void);
+int get_cache_max_object_kb(void);
+int get_stream_threshold_kb(void);
+const char *get_cache_huge_pages(void);
+int get_memory_governor(void);
+int get_memory_limit_mb(void);
+int get_memory_high_percent(void);
+int get_memory_low_percent(void);
+int get_memory_psi_percent(void);
 int get_timeout_seconds(void);
+int get_handshake_timeout_seconds(void);
+int get_keepalive_timeout_seconds(void);
+int get_pipeline_depth(void);
+int get_http2_enabled(void);
+int get_h2c_enabled(void);
+int get_stats_stream_interval_ms(void);
+const char *get_http_parser_simd(void);
+const char *get_mime_types_file(void);
+int get_proxy_route_count(void);
+const char *get_proxy_route(int i);
+int get_proxy_keepalive(void);
+int get_proxy_timeout_seconds(void);
+int get_proxy_max_fails(void);
+int get_proxy_fail_timeout_seconds(void);
+int get_rate_limit_rps(void);
+int get_rate_limit_burst(void);
+int get_rate_limit_subnet_rps(void);
+int get_rate_limit_subnet_burst(void);
+int get_rate_limit_subnet_prefix(void);
+int get_rate_limit_connections(void);
+int get_rate_limit_subnet_connections(void);
+int get_slow_request_ms(void);
 const char *get_ssl_cert(void);
 const char *get_ssl_key(void);
+const char *get_trace_level(void);
+const char *get_trace_categories(void);
+const char *get_cpu_affinity(void);
+const char *get_thread_affinity(void);
+const char *get_numa_memory(void);
 
 #endif
\ No newline at end of file
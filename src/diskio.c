@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "diskio.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define DISKIO_MAX_THREADS 64
+
+typedef struct diskio_job {
+    struct diskio_job *next;    // Queue link (pending jobs)
+    char *path;
+    int refs;                   // Waiters (the submitter and joined requests)
+    int done;
+    int err;                    // errno of a failed load
+    char *data;
+    size_t size;
+    pthread_cond_t cond_done;
+} diskio_job_t;
+
+// Jobs not finished yet, in submission order: 'head' .. 'tail' are pending,
+// 'running' lists the ones an I/O thread took (both are searched on submit)
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_work;
+    diskio_job_t *head;
+    diskio_job_t *tail;
+    diskio_job_t *running[DISKIO_MAX_THREADS];
+    pthread_t threads[DISKIO_MAX_THREADS];
+    int nthreads;
+    int stopping;
+} io;
+
+/**
+ * @brief Reads a whole file with sequential access hints.
+ * @param path File to read.
+ * @param data Receives a malloc'd buffer with the contents.
+ * @param size Receives the length.
+ * @return 0 on success, an errno value on error.
+ */
+static int read_file(const char *path, char **data, size_t *size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        return err;
+    }
+
+    // One large sequential read: let the kernel fetch ahead of us
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    readahead(fd, 0, st.st_size);
+
+    char *buf = malloc(st.st_size ? st.st_size : 1);
+    if (!buf) {
+        close(fd);
+        return ENOMEM;
+    }
+
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + total, st.st_size - total);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    close(fd);
+
+    if (total != (size_t)st.st_size) {
+        TRACE_ERROR(TRACE_SERVE, "Lido %zu bytes de %s, esperado %ld bytes",
+                    total, path, (long)st.st_size);
+        free(buf);
+        return EIO;
+    }
+
+    *data = buf;
+    *size = total;
+    return 0;
+}
+
+/**
+ * @brief Disk I/O thread: runs queued jobs until diskio_stop and the
+ *        queue is empty.
+ * @param arg Slot of the thread in io.running (intptr_t).
+ */
+static void *io_thread(void *arg) {
+    int slot = (int)(intptr_t)arg;
+
+    pthread_mutex_lock(&io.mutex);
+    while (1) {
+        while (!io.head && !io.stopping)
+            pthread_cond_wait(&io.cond_work, &io.mutex);
+        if (!io.head)
+            break;
+
+        diskio_job_t *job = io.head;
+        io.head = job->next;
+        if (!io.head)
+            io.tail = NULL;
+        io.running[slot] = job;
+        metrics_disk_queue(-1);
+        pthread_mutex_unlock(&io.mutex);
+
+        unsigned long start = metrics_now_us();
+        job->err = read_file(job->path, &job->data, &job->size);
+        metrics_disk_read(job->err ? 0 : job->size, metrics_now_us() - start);
+        if (job->err)
+            metrics_disk_error();
+
+        pthread_mutex_lock(&io.mutex);
+        io.running[slot] = NULL;
+        job->done = 1;
+        pthread_cond_broadcast(&job->cond_done);
+    }
+    pthread_mutex_unlock(&io.mutex);
+    return NULL;
+}
+
+/**
+ * @brief Starts the disk I/O threads of this process. A successor forked
+ *        on reload starts its own (threads are not inherited by fork).
+ * @param threads Number of threads (0 = reads stay on request threads).
+ */
+void diskio_start(int threads) {
+    if (threads > DISKIO_MAX_THREADS)
+        threads = DISKIO_MAX_THREADS;
+
+    memset(&io, 0, sizeof(io));
+    pthread_mutex_init(&io.mutex, NULL);
+    pthread_cond_init(&io.cond_work, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&io.threads[i], NULL, io_thread, (void *)(intptr_t)i) != 0) {
+            TRACE_WARN(TRACE_SERVE, "Could not start disk I/O thread %d", i);
+            break;
+        }
+        io.nthreads++;
+    }
+}
+
+/**
+ * @brief Stops the disk I/O threads after the queued jobs are done.
+ */
+void diskio_stop(void) {
+    pthread_mutex_lock(&io.mutex);
+    io.stopping = 1;
+    pthread_cond_broadcast(&io.cond_work);
+    pthread_mutex_unlock(&io.mutex);
+
+    for (int i = 0; i < io.nthreads; i++)
+        pthread_join(io.threads[i], NULL);
+    io.nthreads = 0;
+}
+
+/**
+ * @brief Finds an unfinished job for a path (io.mutex held).
+ */
+static diskio_job_t *find_job(const char *path) {
+    for (diskio_job_t *j = io.head; j; j = j->next)
+        if (!strcmp(j->path, path))
+            return j;
+    for (int i = 0; i < io.nthreads; i++)
+        if (io.running[i] && !strcmp(io.running[i]->path, path))
+            return io.running[i];
+    return NULL;
+}
+
+static void job_free(diskio_job_t *job) {
+    pthread_cond_destroy(&job->cond_done);
+    free(job->data);
+    free(job->path);
+    free(job);
+}
+
+/**
+ * @brief Reads a whole file through the disk I/O threads (or directly
+ *        when there are none), joining a load of the same file in flight.
+ * @param path File to read.
+ * @param data Receives a malloc'd copy of the contents (caller frees).
+ * @param size Receives the length.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int diskio_load(const char *path, char **data, size_t *size) {
+    if (io.nthreads == 0) {
+        int err = read_file(path, data, size);
+        if (err) {
+            errno = err;
+            return -1;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&io.mutex);
+
+    diskio_job_t *job = find_job(path);
+    if (job) {
+        job->refs++;
+        metrics_disk_coalesced();
+    } else {
+        job = calloc(1, sizeof(*job));
+        if (!job || !(job->path = strdup(path))) {
+            pthread_mutex_unlock(&io.mutex);
+            free(job);
+            errno = ENOMEM;
+            return -1;
+        }
+        job->refs = 1;
+        pthread_cond_init(&job->cond_done, NULL);
+
+        if (io.tail)
+            io.tail->next = job;
+        else
+            io.head = job;
+        io.tail = job;
+        metrics_disk_queue(1);
+        pthread_cond_signal(&io.cond_work);
+    }
+
+    while (!job->done)
+        pthread_cond_wait(&job->cond_done, &io.mutex);
+
+    int err = job->err;
+
+    // The last waiter takes the buffer, the others copy it
+    if (job->refs == 1) {
+        pthread_mutex_unlock(&io.mutex);
+        *data = job->data;
+        *size = job->size;
+        job->data = NULL;
+        job_free(job);
+    } else {
+        pthread_mutex_unlock(&io.mutex);
+
+        char *copy = NULL;
+        if (!err) {
+            copy = malloc(job->size ? job->size : 1);
+            if (copy)
+                memcpy(copy, job->data, job->size);
+            else
+                err = ENOMEM;
+        }
+        *data = copy;
+        *size = job->size;
+
+        pthread_mutex_lock(&io.mutex);
+        int last = --job->refs == 0;
+        pthread_mutex_unlock(&io.mutex);
+        if (last)
+            job_free(job);
+    }
+
+    if (err) {
+        free(*data);
+        *data = NULL;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef DISKIO_H
+#define DISKIO_H
+
+#include <stddef.h>
+
+// ------------------------------------------------------------
+// Disk I/O threads for cache misses
+// ------------------------------------------------------------
+// Request threads do not read files themselves: they submit a load job and
+// wait for it. DISK_IO_THREADS threads per worker run the jobs, so only that
+// many cold reads hit the disk at once, whatever the number of pool threads.
+// Each file is opened with POSIX_FADV_SEQUENTIAL and readahead() of its
+// whole length before the read loop. Concurrent misses of the same file
+// share one job: one read, and every waiter gets the contents. While
+// request threads wait for the disk, the elastic pool counts them as busy
+// and starts threads for the connections behind them, so cache hits keep
+// being served. DISK_IO_THREADS=0 reads on the request thread.
+
+// Starts the disk I/O threads of this process (worker_serve)
+void diskio_start(int threads);
+
+// Lets the threads finish the queued jobs, then stops them
+void diskio_stop(void);
+
+// Reads a whole file. Returns 0 with a malloc'd copy in *data (caller
+// frees) and its length in *size, -1 with errno set on error
+int diskio_load(const char *path, char **data, size_t *size);
+
+#endif
@@ -0,0 +1,295 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "history.h"
+#include "shared_mem.h"
+
+// Shared memory of this process (worker.c)
+extern shared_data_t* shm_data;
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
+// Counters of a sample, after 'time': all unsigned long
+#define SAMPLE_WORDS ((sizeof(history_sample_t) - offsetof(history_sample_t, requests)) \
+                      / sizeof(unsigned long))
+
+// Totals of every worker slot at the previous tick (master only)
+static history_sample_t last_totals;
+static int have_totals = 0;
+
+/**
+ * @brief Counter words of a sample, in declaration order.
+ */
+static unsigned long *sample_words(history_sample_t *s) {
+    return &s->requests;
+}
+
+/**
+ * @brief Adds up the request counters of every worker slot (slots keep
+ *        their counters across reloads, so the totals only grow).
+ * @param t Receives the totals.
+ */
+static void read_totals(history_sample_t *t) {
+    memset(t, 0, sizeof(*t));
+
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        const worker_metrics_t *m = &shm_data->workers[i].metrics;
+
+        t->requests += LOAD(&m->requests_total);
+        t->bytes += LOAD(&m->response_bytes_total);
+        t->cache_hits += LOAD(&m->cache_hits_total);
+        t->cache_misses += LOAD(&m->cache_misses_total);
+        for (int c = 0; c < METRICS_STATUS_CLASSES; c++)
+            t->responses[c] += LOAD(&m->responses_total[c]);
+        for (int b = 0; b <= METRICS_DURATION_BUCKETS; b++)
+            t->duration_buckets[b] += LOAD(&m->duration_buckets[b]);
+        t->duration_sum_us += LOAD(&m->duration_sum_us);
+    }
+}
+
+/**
+ * @brief Adds one second of activity to the interval of a ring that holds it
+ *        (an entry left from an older interval is cleared first).
+ * @param ring Ring of intervals.
+ * @param size Entries in the ring.
+ * @param step Interval length in seconds.
+ * @param t Second the activity belongs to (Unix time).
+ * @param delta Activity of that second.
+ */
+static void accumulate(history_sample_t *ring, int size, long step, long t,
+                       history_sample_t *delta) {
+    long start = t - t % step;
+    history_sample_t *s = &ring[(start / step) % size];
+
+    if (s->time != start) {
+        memset(s, 0, sizeof(*s));
+        s->time = start;
+    }
+
+    unsigned long *dst = sample_words(s);
+    const unsigned long *src = sample_words(delta);
+    for (size_t i = 0; i < SAMPLE_WORDS; i++)
+        dst[i] += src[i];
+}
+
+/**
+ * @brief SIGALRM handler of the master: stores the activity of the second
+ *        that just ended. Only clock reads, relaxed loads and plain stores.
+ */
+static void sample_tick(int sig) {
+    (void)sig;
+    if (!shm_data) return;
+
+    int saved_errno = errno;
+    history_sample_t now, delta;
+    read_totals(&now);
+
+    if (have_totals) {
+        unsigned long *d = sample_words(&delta);
+        unsigned long *cur = sample_words(&now);
+        unsigned long *prev = sample_words(&last_totals);
+        for (size_t i = 0; i < SAMPLE_WORDS; i++)
+            d[i] = cur[i] >= prev[i] ? cur[i] - prev[i] : 0;
+
+        // Ticks come just after the second boundary
+        long t = (long)time(NULL) - 1;
+        history_t *h = &shm_data->history;
+
+        __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        accumulate(h->seconds, HISTORY_SECONDS, 1, t, &delta);
+        accumulate(h->minutes, HISTORY_MINUTES, 60, t, &delta);
+        accumulate(h->hours, HISTORY_HOURS, 3600, t, &delta);
+
+        __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+    }
+
+    last_totals = now;
+    have_totals = 1;
+    errno = saved_errno;
+}
+
+/**
+ * @brief Starts the one-second sampler of the master: SIGALRM (SA_RESTART,
+ *        so wait() and file I/O are not disturbed) from an interval timer
+ *        aligned 10 ms after each second boundary. Forked workers inherit
+ *        the handler but not the timer.
+ */
+void history_start(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sample_tick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    struct itimerval it;
+    it.it_interval.tv_sec = 1;
+    it.it_interval.tv_usec = 0;
+    it.it_value.tv_sec = 0;
+    it.it_value.tv_usec = 1000000 - tv.tv_usec + 10000;
+    if (it.it_value.tv_usec >= 1000000) {
+        it.it_value.tv_sec = 1;
+        it.it_value.tv_usec -= 1000000;
+    }
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/**
+ * @brief Request duration at a quantile, interpolated inside its bucket.
+ * @param s Interval.
+ * @param q Quantile (0..1).
+ * @return Milliseconds (the largest bound for the +Inf bucket, 0 if idle).
+ */
+static double quantile_ms(const history_sample_t *s, double q) {
+    unsigned long total = 0;
+    for (int b = 0; b <= METRICS_DURATION_BUCKETS; b++)
+        total += s->duration_buckets[b];
+    if (total == 0)
+        return 0;
+
+    double rank = q * total;
+    unsigned long cumulative = 0;
+    for (int b = 0; b < METRICS_DURATION_BUCKETS; b++) {
+        unsigned long n = s->duration_buckets[b];
+        if (n && cumulative + n >= rank) {
+            double lower = b ? metrics_duration_bound(b - 1) : 0;
+            double upper = metrics_duration_bound(b);
+            return (lower + (upper - lower) * (rank - cumulative) / n) * 1000;
+        }
+        cumulative += n;
+    }
+    return metrics_duration_bound(METRICS_DURATION_BUCKETS - 1) * 1000;
+}
+
+/**
+ * @brief Copies a ring, retrying while the master is updating it.
+ */
+static void copy_ring(history_sample_t *dst, const history_sample_t *src, int size) {
+    const history_t *h = &shm_data->history;
+
+    for (int attempt = 0; attempt < 4; attempt++) {
+        unsigned long seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        memcpy(dst, src, size * sizeof(*dst));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(seq & 1) && __atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+// Columns of a series: name and value of an interval
+typedef struct {
+    const char *name;
+    int percentile;             // 1: the value is a duration in ms
+    double q;
+    size_t offset;              // Counter, when not a percentile
+} column_t;
+
+static const column_t columns[] = {
+    { "requests",     0, 0,    offsetof(history_sample_t, requests) },
+    { "bytes",        0, 0,    offsetof(history_sample_t, bytes) },
+    { "cache_hits",   0, 0,    offsetof(history_sample_t, cache_hits) },
+    { "cache_misses", 0, 0,    offsetof(history_sample_t, cache_misses) },
+    { "status_2xx",   0, 0,    offsetof(history_sample_t, responses[2]) },
+    { "status_3xx",   0, 0,    offsetof(history_sample_t, responses[3]) },
+    { "status_4xx",   0, 0,    offsetof(history_sample_t, responses[4]) },
+    { "status_5xx",   0, 0,    offsetof(history_sample_t, responses[5]) },
+    { "p50_ms",       1, 0.50, 0 },
+    { "p90_ms",       1, 0.90, 0 },
+    { "p99_ms",       1, 0.99, 0 },
+};
+
+/**
+ * @brief Writes one series: the last 'points' intervals, oldest first, as
+ *        one array per column (intervals without activity are zeros).
+ */
+static void render_series(FILE *f, const char *name, const history_sample_t *ring,
+                          int size, long step, long last, int points) {
+    static history_sample_t empty;
+
+    if (points <= 0 || points > size)
+        points = size;
+    long first = last - (points - 1) * step;
+
+    fprintf(f, "\"%s\":{\"step\":%ld,\"start\":%ld", name, step, first);
+
+    for (size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); c++) {
+        fprintf(f, ",\"%s\":[", columns[c].name);
+        for (int i = 0; i < points; i++) {
+            long t = first + i * step;
+            const history_sample_t *s = &ring[(t / step) % size];
+            if (s->time != t)
+                s = &empty;
+
+            if (i) fputc(',', f);
+            if (columns[c].percentile)
+                fprintf(f, "%.2f", quantile_ms(s, columns[c].q));
+            else
+                fprintf(f, "%lu", *(const unsigned long *)((const char *)s + columns[c].offset));
+        }
+        fputc(']', f);
+    }
+    fputc('}', f);
+}
+
+/**
+ * @brief Renders the history for GET /api/stats/history. The per-second
+ *        series ends at the last complete second, the minute and hour
+ *        series at the current (partial) interval.
+ * @param resolutions HISTORY_RES_* bits.
+ * @param points Intervals per series (0 = the whole ring).
+ * @param len Receives the length of the document.
+ * @return malloc'd JSON document (caller frees), NULL on error.
+ */
+char *history_render_json(int resolutions, int points, size_t *len) {
+    if (!shm_data) return NULL;
+
+    // Large rings: copied to the heap, not to a pool thread's stack
+    history_t *h = malloc(sizeof(*h));
+    if (!h) return NULL;
+
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&buf, &size);
+    if (!f) {
+        free(h);
+        return NULL;
+    }
+
+    long now = (long)time(NULL);
+    fprintf(f, "{\"now\":%ld", now);
+
+    if (resolutions & HISTORY_RES_SECOND) {
+        copy_ring(h->seconds, shm_data->history.seconds, HISTORY_SECONDS);
+        fputc(',', f);
+        render_series(f, "1s", h->seconds, HISTORY_SECONDS, 1, now - 1, points);
+    }
+    if (resolutions & HISTORY_RES_MINUTE) {
+        copy_ring(h->minutes, shm_data->history.minutes, HISTORY_MINUTES);
+        fputc(',', f);
+        render_series(f, "1m", h->minutes, HISTORY_MINUTES, 60, now - now % 60, points);
+    }
+    if (resolutions & HISTORY_RES_HOUR) {
+        copy_ring(h->hours, shm_data->history.hours, HISTORY_HOURS);
+        fputc(',', f);
+        render_series(f, "1h", h->hours, HISTORY_HOURS, 3600, now - now % 3600, points);
+    }
+    fputc('}', f);
+    free(h);
+
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+    *len = size;
+    return buf;
+}
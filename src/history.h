@@ -0,0 +1,57 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+#include "metrics.h"
+
+// ------------------------------------------------------------
+// Per-second stats history in shared memory
+// ------------------------------------------------------------
+// Once a second the master adds up the request counters of every worker
+// slot and stores the increase since the previous second in three rings:
+// per second, per minute and per hour (the minute and hour entries are
+// sums of seconds, histograms included, so their percentiles are exact to
+// the bucket). The sampler runs in the master's SIGALRM handler: it only
+// reads the clock and shared memory, which is async-signal-safe. Workers
+// serve the rings at /api/stats/history; a sequence number (odd while the
+// master writes) lets them retry a copy taken mid-update.
+
+#define HISTORY_SECONDS 300     // 5 minutes
+#define HISTORY_MINUTES 120     // 2 hours
+#define HISTORY_HOURS   168     // 7 days
+
+// Resolutions (HISTORY_RES_* bits for history_render_json)
+#define HISTORY_RES_SECOND 1
+#define HISTORY_RES_MINUTE 2
+#define HISTORY_RES_HOUR   4
+#define HISTORY_RES_ALL    7
+
+// Activity of one interval
+typedef struct {
+    long time;                  // Start of the interval (Unix time, 0 = empty)
+    unsigned long requests;
+    unsigned long bytes;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    unsigned long responses[METRICS_STATUS_CLASSES];   // By status class
+    unsigned long duration_buckets[METRICS_DURATION_BUCKETS + 1];
+    unsigned long duration_sum_us;
+} history_sample_t;
+
+typedef struct {
+    unsigned long seq;          // Odd while the master updates the rings
+    history_sample_t seconds[HISTORY_SECONDS];
+    history_sample_t minutes[HISTORY_MINUTES];
+    history_sample_t hours[HISTORY_HOURS];
+} history_t;
+
+// Master: starts the one-second sampler (SIGALRM aligned to the second)
+void history_start(void);
+
+// Renders the last 'points' intervals of the selected resolutions (0 =
+// the whole ring) as column arrays. Returns a malloc'd JSON document
+// (caller frees) and its length, NULL on error
+char *history_render_json(int resolutions, int points, size_t *len);
+
+#endif
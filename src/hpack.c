@@ -0,0 +1,433 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "hpack.h"
+
+#define HPACK_STATIC_COUNT 61
+
+// RFC 7541, Appendix A
+static const struct { const char *name; const char *value; } static_table[HPACK_STATIC_COUNT] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"},
+    {":status", "200"}, {":status", "204"}, {":status", "206"}, {":status", "304"},
+    {":status", "400"}, {":status", "404"}, {":status", "500"},
+    {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"}, {"accept-language", ""},
+    {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""},
+    {"content-length", ""}, {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""}, {"date", ""}, {"etag", ""}, {"expect", ""},
+    {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""},
+    {"if-unmodified-since", ""}, {"last-modified", ""}, {"link", ""}, {"location", ""},
+    {"max-forwards", ""}, {"proxy-authenticate", ""}, {"proxy-authorization", ""},
+    {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""}, {"server", ""},
+    {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""}
+};
+
+// RFC 7541, Appendix B: {code, length in bits} of symbols 0..255 and EOS (256)
+static const struct { uint32_t code; uint8_t len; } huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+// Decoding tree built from huffman_codes: children of each internal node,
+// a negative value -(sym + 1) marks a leaf, 0 an unused branch
+static int16_t huffman_tree[256][2];
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * @brief Builds the Huffman decoding tree (once per process).
+ */
+static void huffman_build(void) {
+    int nodes = 1;
+
+    for (int sym = 0; sym < 257; sym++) {
+        uint32_t code = huffman_codes[sym].code;
+        int node = 0;
+
+        for (int i = huffman_codes[sym].len - 1; i >= 0; i--) {
+            int bit = (code >> i) & 1;
+            if (i == 0) {
+                huffman_tree[node][bit] = -(sym + 1);
+            } else {
+                if (!huffman_tree[node][bit])
+                    huffman_tree[node][bit] = nodes++;
+                node = huffman_tree[node][bit];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Decodes a Huffman coded string.
+ * @return Length of the decoded string, -1 if it is invalid or too long.
+ */
+static int huffman_decode(const uint8_t *in, size_t len, char *dst, size_t cap) {
+    pthread_once(&huffman_once, huffman_build);
+
+    size_t n = 0;
+    int node = 0;
+    int bits = 0;       // Bits since the last complete symbol
+    int ones = 1;       // Those bits are all 1 (valid padding)
+
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            int bit = (in[i] >> b) & 1;
+            int next = huffman_tree[node][bit];
+
+            bits++;
+            ones &= bit;
+
+            if (next < 0) {
+                int sym = -next - 1;
+                if (sym == 256 || n + 1 >= cap)
+                    return -1;
+                dst[n++] = (char)sym;
+                node = 0;
+                bits = 0;
+                ones = 1;
+            } else if (next == 0) {
+                return -1;
+            } else {
+                node = next;
+            }
+        }
+    }
+
+    // Padding: at most 7 bits, all set (prefix of EOS)
+    if (bits > 7 || !ones)
+        return -1;
+    return (int)n;
+}
+
+/**
+ * @brief Decodes an integer with an N-bit prefix (RFC 7541, 5.1).
+ * @return 0 on success, -1 if truncated or too large.
+ */
+static int decode_int(const uint8_t **p, const uint8_t *end, int prefix, uint32_t *out) {
+    if (*p >= end) return -1;
+
+    uint32_t max = (1u << prefix) - 1;
+    uint64_t v = **p & max;
+    (*p)++;
+
+    if (v < max) {
+        *out = (uint32_t)v;
+        return 0;
+    }
+
+    for (int shift = 0; *p < end && shift <= 28; shift += 7) {
+        uint8_t b = **p;
+        (*p)++;
+        v += (uint64_t)(b & 0x7f) << shift;
+        if (v > 0xffffff) return -1;
+        if (!(b & 0x80)) {
+            *out = (uint32_t)v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Decodes a string literal (plain or Huffman) into dst (NUL terminated).
+ * @return Length of the string, -1 on error.
+ */
+static int decode_string(const uint8_t **p, const uint8_t *end, char *dst, size_t cap) {
+    if (*p >= end) return -1;
+
+    int huffman = **p & 0x80;
+    uint32_t len;
+    if (decode_int(p, end, 7, &len) < 0 || len > (size_t)(end - *p))
+        return -1;
+
+    int n;
+    if (huffman) {
+        n = huffman_decode(*p, len, dst, cap);
+    } else {
+        if (len >= cap) return -1;
+        memcpy(dst, *p, len);
+        n = (int)len;
+    }
+    if (n < 0) return -1;
+
+    dst[n] = '\0';
+    *p += len;
+    return n;
+}
+
+/**
+ * @brief Initializes a decoder dynamic table.
+ * @param t Table.
+ */
+void hpack_table_init(hpack_table_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->max_size = HPACK_TABLE_SIZE;
+}
+
+/**
+ * @brief Drops the oldest entry of the dynamic table.
+ */
+static void table_evict(hpack_table_t *t) {
+    int idx = (t->head + t->count - 1) % HPACK_MAX_ENTRIES;
+    hpack_entry_t *e = &t->entries[idx];
+
+    t->size -= e->size;
+    free(e->name);
+    free(e->value);
+    e->name = e->value = NULL;
+    t->count--;
+}
+
+/**
+ * @brief Releases every entry of a decoder dynamic table.
+ * @param t Table.
+ */
+void hpack_table_free(hpack_table_t *t) {
+    while (t->count > 0)
+        table_evict(t);
+}
+
+/**
+ * @brief Inserts a header at the front of the dynamic table (RFC 7541, 4.4).
+ */
+static void table_add(hpack_table_t *t, const char *name, const char *value) {
+    size_t size = strlen(name) + strlen(value) + 32;
+
+    while (t->count > 0 && (t->size + size > t->max_size || t->count == HPACK_MAX_ENTRIES))
+        table_evict(t);
+
+    // Larger than the whole table: the table is just emptied
+    if (size > t->max_size)
+        return;
+
+    t->head = (t->head + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    hpack_entry_t *e = &t->entries[t->head];
+    e->name = strdup(name);
+    e->value = strdup(value);
+    e->size = size;
+    t->size += size;
+    t->count++;
+}
+
+/**
+ * @brief Looks up an index of the static + dynamic table.
+ * @return 0 on success, -1 if the index does not exist.
+ */
+static int table_get(hpack_table_t *t, uint32_t index, const char **name, const char **value) {
+    if (index == 0)
+        return -1;
+
+    if (index <= HPACK_STATIC_COUNT) {
+        *name = static_table[index - 1].name;
+        *value = static_table[index - 1].value;
+        return 0;
+    }
+
+    uint32_t i = index - HPACK_STATIC_COUNT - 1;
+    if (i >= (uint32_t)t->count)
+        return -1;
+
+    hpack_entry_t *e = &t->entries[(t->head + i) % HPACK_MAX_ENTRIES];
+    if (!e->name || !e->value)
+        return -1;
+    *name = e->name;
+    *value = e->value;
+    return 0;
+}
+
+/**
+ * @brief Decodes a complete header block, calling cb for every header.
+ * @param t Dynamic table of the connection.
+ * @param buf Header block (HEADERS + CONTINUATION fragments).
+ * @param len Block length.
+ * @param cb Header callback.
+ * @param ctx Callback argument.
+ * @return 0 on success, -1 on a compression error.
+ */
+int hpack_decode(hpack_table_t *t, const uint8_t *buf, size_t len,
+                 hpack_header_fn cb, void *ctx) {
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    char name[HPACK_MAX_STRING];
+    char value[HPACK_MAX_STRING];
+
+    while (p < end) {
+        uint8_t b = *p;
+        uint32_t index;
+        const char *n, *v;
+
+        if (b & 0x80) {
+            // Indexed header field
+            if (decode_int(&p, end, 7, &index) < 0 || table_get(t, index, &n, &v) < 0)
+                return -1;
+            cb(ctx, n, v);
+            continue;
+        }
+
+        if ((b & 0xe0) == 0x20) {
+            // Dynamic table size update
+            if (decode_int(&p, end, 5, &index) < 0 || index > HPACK_TABLE_SIZE)
+                return -1;
+            t->max_size = index;
+            while (t->count > 0 && t->size > t->max_size)
+                table_evict(t);
+            continue;
+        }
+
+        // Literal: with incremental indexing (01), without indexing (0000)
+        // or never indexed (0001)
+        int indexing = (b & 0xc0) == 0x40;
+        if (decode_int(&p, end, indexing ? 6 : 4, &index) < 0)
+            return -1;
+
+        if (index) {
+            if (table_get(t, index, &n, &v) < 0)
+                return -1;
+            // Copied: inserting the new entry may evict the one we point to
+            snprintf(name, sizeof(name), "%s", n);
+        } else if (decode_string(&p, end, name, sizeof(name)) < 0) {
+            return -1;
+        }
+
+        if (decode_string(&p, end, value, sizeof(value)) < 0)
+            return -1;
+
+        cb(ctx, name, value);
+
+        if (indexing)
+            table_add(t, name, value);
+    }
+    return 0;
+}
+
+/**
+ * @brief Encodes an integer with an N-bit prefix and the given flag bits.
+ * @return Number of bytes written.
+ */
+static size_t encode_int(uint8_t *out, uint32_t v, int prefix, uint8_t flags) {
+    uint32_t max = (1u << prefix) - 1;
+    size_t n = 0;
+
+    if (v < max) {
+        out[n++] = flags | v;
+        return n;
+    }
+
+    out[n++] = flags | max;
+    v -= max;
+    while (v >= 128) {
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+/**
+ * @brief Encodes the ":status" pseudo-header.
+ * @param out Destination (at least 5 bytes).
+ * @param status HTTP status code.
+ * @return Number of bytes written.
+ */
+size_t hpack_encode_status(uint8_t *out, int status) {
+    // Static table entries 8..14
+    static const int indexed[] = { 200, 204, 206, 304, 400, 404, 500 };
+    for (size_t i = 0; i < sizeof(indexed) / sizeof(indexed[0]); i++) {
+        if (indexed[i] == status) {
+            out[0] = 0x80 | (uint8_t)(8 + i);
+            return 1;
+        }
+    }
+
+    // Literal without indexing, name ":status" (index 8)
+    size_t n = encode_int(out, 8, 4, 0x00);
+    out[n++] = 3;
+    out[n++] = '0' + (status / 100) % 10;
+    out[n++] = '0' + (status / 10) % 10;
+    out[n++] = '0' + status % 10;
+    return n;
+}
+
+/**
+ * @brief Encodes a header as a literal without indexing, using the static
+ *        table for the name when possible.
+ * @param out Destination buffer.
+ * @param cap Space available in out.
+ * @param name Lowercase header name.
+ * @param value Header value.
+ * @return Number of bytes written, 0 if it does not fit.
+ */
+size_t hpack_encode_header(uint8_t *out, size_t cap, const char *name, const char *value) {
+    size_t nlen = strlen(name);
+    size_t vlen = strlen(value);
+    uint32_t index = 0;
+
+    for (int i = 0; i < HPACK_STATIC_COUNT; i++) {
+        if (!strcmp(static_table[i].name, name)) {
+            index = i + 1;
+            break;
+        }
+    }
+
+    // Worst case: 5 bytes per integer
+    if (cap < 5 + (index ? 0 : 5 + nlen) + 5 + vlen)
+        return 0;
+
+    size_t n = encode_int(out, index, 4, 0x00);
+    if (!index) {
+        n += encode_int(out + n, nlen, 7, 0x00);
+        memcpy(out + n, name, nlen);
+        n += nlen;
+    }
+    n += encode_int(out + n, vlen, 7, 0x00);
+    memcpy(out + n, value, vlen);
+    n += vlen;
+    return n;
+}
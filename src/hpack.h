@@ -0,0 +1,51 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------
+// HPACK header compression for HTTP/2 (RFC 7541)
+// ------------------------------------------------------------
+// The decoder keeps the dynamic table of one connection (up to the
+// 4096 bytes we advertise). The encoder never indexes: responses use
+// static table names and plain (non-Huffman) literals, so it has no state.
+
+#define HPACK_TABLE_SIZE   4096
+#define HPACK_MAX_ENTRIES  (HPACK_TABLE_SIZE / 32)   // Each entry costs 32 + name + value
+#define HPACK_MAX_STRING   8192                      // Longest decoded name or value
+
+typedef struct {
+    char *name;
+    char *value;
+    size_t size;        // name + value + 32
+} hpack_entry_t;
+
+typedef struct {
+    hpack_entry_t entries[HPACK_MAX_ENTRIES];   // Ring, entries[head] is the newest
+    int head;
+    int count;
+    size_t size;
+    size_t max_size;
+} hpack_table_t;
+
+// Called for every decoded header (strings are NUL terminated)
+typedef void (*hpack_header_fn)(void *ctx, const char *name, const char *value);
+
+// Initializes / releases a decoder table
+void hpack_table_init(hpack_table_t *t);
+void hpack_table_free(hpack_table_t *t);
+
+// Decodes a complete header block. Returns 0 on success, -1 on a
+// compression error (the connection must then be closed)
+int hpack_decode(hpack_table_t *t, const uint8_t *buf, size_t len,
+                 hpack_header_fn cb, void *ctx);
+
+// Encodes ":status". Returns the number of bytes written (at most 5)
+size_t hpack_encode_status(uint8_t *out, int status);
+
+// Encodes a header as a literal without indexing (name must be lowercase).
+// Returns the number of bytes written, 0 if it does not fit in cap
+size_t hpack_encode_header(uint8_t *out, size_t cap, const char *name, const char *value);
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +10,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <limits.h>
+#include <ctype.h>
 #include <sys/time.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -21,45 +25,38 @@
 #include "stats.h"
 #include "shared_mem.h"
 #include "semaphores.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "http2.h"
+#include "metrics.h"
+#include "stats_stream.h"
+#include "mime.h"
+#include "proxy.h"
+#include "ratelimit.h"
+#include "listener.h"
+#include "slowlog.h"
+#include "history.h"
+#include "diskio.h"
+#include "memgov.h"
+#include "vhost.h"
 
 #define MAX_REQ 2048
-#define MAX_REQ_LINE 2048
+
+// Largest piece handed to send/SSL_write under a single write deadline
+#define WRITE_CHUNK (64 * 1024)
+
+// Pipelined responses are batched up to this size before being written
+#define OUT_BUF_MAX (64 * 1024)
 
 // External references to shared memory and semaphores from worker.c
 extern shared_data_t* shm_data;
 extern ipc_semaphores_t sems;
-
-/**
- * @brief Returns the appropriate MIME type for a file based on its extension.
- * @param path File path.
- * @return String with the corresponding MIME type.
- */
-static const char* mime_from_path(const char* path) {
-
-    const char* ext = strrchr(path, '.');
-    if (!ext) return "application/octet-stream";
-    ext++;
-
-    if (!strcasecmp(ext, "html")) return "text/html; charset=utf-8";
-    if (!strcasecmp(ext, "htm"))  return "text/html; charset=utf-8";
-    if (!strcasecmp(ext, "css"))  return "text/css";
-    if (!strcasecmp(ext, "js"))   return "application/javascript";
-    if (!strcasecmp(ext, "json")) return "application/json; charset=utf-8";
-    if (!strcasecmp(ext, "png"))  return "image/png";
-    if (!strcasecmp(ext, "jpg"))  return "image/jpeg";
-    if (!strcasecmp(ext, "jpeg")) return "image/jpeg";
-    if (!strcasecmp(ext, "gif"))  return "image/gif";
-    if (!strcasecmp(ext, "svg"))  return "image/svg+xml";
-    if (!strcasecmp(ext, "txt"))  return "text/plain; charset=utf-8";
-    if (!strcasecmp(ext, "pdf"))  return "application/pdf";
-
-    return "application/octet-stream";
-}
+extern timer_wheel_t worker_wheel;
 
 /**
  * @brief Lê dados de uma conexão (HTTP ou HTTPS)
  */
-static ssize_t conn_read(connection_t* conn, void* buf, size_t len) {
+ssize_t conn_read(connection_t* conn, void* buf, size_t len) {
     if (conn->is_https && conn->ssl) {
         return SSL_read(conn->ssl, buf, len);
     } else {
@@ -69,167 +66,491 @@ static ssize_t conn_read(connection_t* conn, void* buf, size_t len) {
 
 /**
  * @brief Escreve dados numa conexão (HTTP ou HTTPS)
+ *        Each WRITE_CHUNK must be accepted by the peer within TIMEOUT_SECONDS,
+ *        otherwise the write deadline shuts the socket down (slow readers).
+ * @return Bytes written, or -1 if nothing could be written.
  */
-static ssize_t conn_write(connection_t* conn, const void* buf, size_t len) {
-    if (conn->is_https && conn->ssl) {
-        return SSL_write(conn->ssl, buf, len);
-    } else {
-        return send(conn->fd, buf, len, 0);
+ssize_t conn_write(connection_t* conn, const void* buf, size_t len) {
+    const char *p = buf;
+    size_t sent = 0;
+    int timeout_ms = get_timeout_seconds() * 1000;
+
+    while (sent < len) {
+        size_t chunk = len - sent;
+        if (chunk > WRITE_CHUNK) chunk = WRITE_CHUNK;
+
+        timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_WRITE, timeout_ms);
+
+        ssize_t n;
+        if (conn->is_https && conn->ssl) {
+            n = SSL_write(conn->ssl, p + sent, chunk);
+        } else {
+            n = send(conn->fd, p + sent, chunk, MSG_NOSIGNAL);
+        }
+
+        timer_wheel_cancel(&worker_wheel, &conn->timer);
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR && !conn->ssl) continue;
+            if (conn->timer.fired == TIMEOUT_WRITE)
+                TRACE_WARN(TRACE_HTTP, "Write deadline expired on fd %d", conn->fd);
+            return sent > 0 ? (ssize_t)sent : -1;
+        }
+        sent += n;
     }
+    return sent;
 }
 
 /**
  * @brief Fecha uma conexão e liberta recursos
  */
-static void conn_close(connection_t* conn) {
-    if (conn->is_https && conn->ssl) {
-        SSL_shutdown(conn->ssl);
-        SSL_free(conn->ssl);
+void conn_close(connection_t* conn) {
+    // Cancel before close(): the fd number could be reused by a new connection
+    timer_wheel_cancel(&worker_wheel, &conn->timer);
+
+    // Cleared first: a successor forked meanwhile must not close or free them
+    SSL *ssl = conn->ssl;
+    int fd = conn->fd;
+    conn->ssl = NULL;
+    conn->fd = -1;
+
+    if (conn->is_https && ssl) {
+        // No close_notify on a socket already cut by a deadline
+        if (!conn->timer.fired)
+            SSL_shutdown(ssl);
+        SSL_free(ssl);
     }
-    close(conn->fd);
-    free(conn);
+    close(fd);
+    ratelimit_disconnect(&conn->limits);
+    conn_pool_put(conn);
+    metrics_connection_close();
 }
 
 /**
- * @brief Reads a line from the socket non-blocking, until '\n' or reaching the maximum.
+ * @brief Performs the TLS handshake of an HTTPS connection under the
+ *        HANDSHAKE_TIMEOUT_SECONDS deadline.
+ * @param conn Connection structure (ssl already bound to the socket).
+ * @return 0 on success, -1 on error or timeout.
+ */
+static int conn_handshake(connection_t* conn) {
+    unsigned long start = metrics_now_us();
+    timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_HANDSHAKE,
+                    get_handshake_timeout_seconds() * 1000);
+
+    int ret = SSL_accept(conn->ssl);
+
+    timer_wheel_cancel(&worker_wheel, &conn->timer);
+    metrics_handshake(ret > 0, metrics_now_us() - start);
+
+    if (ret <= 0) {
+        int ssl_err = SSL_get_error(conn->ssl, ret);
+
+        if (conn->timer.fired == TIMEOUT_HANDSHAKE) {
+            TRACE_WARN(TRACE_SSL, "SSL_accept timeout on fd %d", conn->fd);
+        } else if (ssl_err == SSL_ERROR_SYSCALL) {
+            TRACE_WARN(TRACE_SSL, "SSL_accept syscall error (errno=%d)", errno);
+        } else if (ssl_err == SSL_ERROR_ZERO_RETURN) {
+            TRACE_WARN(TRACE_SSL, "SSL_accept connection closed");
+        } else {
+            TRACE_WARN(TRACE_SSL, "SSL_accept error %d", ssl_err);
+            ERR_print_errors_fp(stderr);
+        }
+        return -1;
+    }
+
+    TRACE_DEBUG(TRACE_SSL, "HTTPS connection established (cipher: %s)",
+                SSL_get_cipher(conn->ssl));
+    return 0;
+}
+
+/**
+ * @brief Reads more bytes from the socket into the connection's input buffer.
+ *        The first bytes of a request end its idle deadline: from then on the
+ *        whole header has TIMEOUT_SECONDS to arrive.
  * @param conn Connection structure.
- * @param buf Destination buffer for the read line.
- * @param max Maximum buffer size.
- * @return Number of bytes read, or -1 on error.
+ * @return Bytes read, 0 if the peer closed (or the buffer is full), -1 on error.
  */
-static int read_line_conn(connection_t* conn, char* buf, int max) {
-    int i = 0;
-    char c;
+static ssize_t conn_fill(connection_t* conn) {
+    // Move the unparsed bytes to the start of the buffer
+    if (conn->in_off > 0) {
+        memmove(conn->in_buf, conn->in_buf + conn->in_off, conn->in_len - conn->in_off);
+        conn->in_len -= conn->in_off;
+        conn->in_off = 0;
+    }
 
-    while (i < max - 1) {
-        int n = conn_read(conn, &c, 1);
+    if (conn->in_len == sizeof(conn->in_buf))
+        return 0;
 
-        if (n == 0) {
-            // cliente fechou a ligação
-            break;
-        }
+    ssize_t n;
+    do {
+        n = conn_read(conn, conn->in_buf + conn->in_len, sizeof(conn->in_buf) - conn->in_len);
+    } while (n < 0 && errno == EINTR && !conn->ssl);
+
+    if (n > 0) {
+        conn->in_len += n;
+        if (conn->timer.kind == TIMEOUT_IDLE)
+            timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_HEADER,
+                            get_timeout_seconds() * 1000);
+    }
+    return n;
+}
 
-        if (n < 0) {
-            // interrupções do sistema → tentar de novo
-            if (errno == EINTR) continue;
+/**
+ * @brief Checks whether a complete request header is already buffered.
+ * @param conn Connection structure.
+ * @return 1 if the input buffer holds a full header, 0 otherwise.
+ */
+static int request_buffered(connection_t* conn) {
+    return memmem(conn->in_buf + conn->in_off, conn->in_len - conn->in_off,
+                  "\r\n\r\n", 4) != NULL;
+}
 
-            // socket não tem dados ainda → tentar de novo
-            if (errno == EAGAIN || errno == EWOULDBLOCK) continue;
+/**
+ * @brief Reads until the connection's input buffer holds a whole request
+ *        header, recording where each line ends. Only new bytes are scanned.
+ *        The socket is blocking: a silent client is cut by the header deadline.
+ * @param conn Connection structure.
+ * @param ends Offsets (from in_off) of the '\n' of each line, blank line last.
+ * @param max Capacity of 'ends'.
+ * @return Number of lines including the blank one, or -1 on error, end of
+ *         stream, a header larger than the buffer or too many lines.
+ */
+static int read_header_lines(connection_t* conn, size_t* ends, int max) {
+    size_t pos = 0;         // Next byte to scan (from in_off)
+    size_t line = 0;        // Start of the current line (from in_off)
+    int nlines = 0;
 
-            return -1;
-        }
+    while (1) {
+        const char *base = conn->in_buf + conn->in_off;
+        size_t avail = conn->in_len - conn->in_off;
+
+        while (pos < avail) {
+            size_t nl = pos + http_scan(base + pos, avail - pos, &HTTP_CS_EOL);
+            if (nl == avail)
+                break;
+
+            size_t len = nl - line;
+            if (len > 0 && base[nl - 1] == '\r')
+                len--;
+            pos = nl + 1;
+
+            if (len == 0 && nlines == 0) {
+                // CRLF before the request line (after a body): skipped
+                conn->in_off += pos;
+                base += pos;
+                avail -= pos;
+                pos = line = 0;
+                continue;
+            }
 
-        buf[i++] = c;
+            if (nlines == max)
+                return -1;
+            ends[nlines++] = nl;
+            line = pos;
 
-        if (c == '\n')
-            break;
+            if (len == 0)
+                return nlines;
+        }
+        pos = avail;
+
+        // cliente fechou a ligação (ou header demasiado grande)
+        if (conn_fill(conn) <= 0)
+            return -1;
     }
+}
 
-    buf[i] = '\0';
-    return i;
+/**
+ * @brief Parses a Content-Length value: decimal digits only (no sign, no
+ *        spaces, no list), without overflow.
+ * @param value Header value.
+ * @param len Receives the length.
+ * @return 0 on success, -1 if the value is malformed.
+ */
+int http_parse_content_length(const char *value, long *len) {
+    long n = 0;
+
+    if (!*value)
+        return -1;
+    for (const char *p = value; *p; p++) {
+        if (*p < '0' || *p > '9')
+            return -1;
+        if (n > (LONG_MAX - (*p - '0')) / 10)
+            return -1;
+        n = n * 10 + (*p - '0');
+    }
+    *len = n;
+    return 0;
 }
 
 /**
- * @brief Parses the HTTP request, separating method, path, and headers.
+ * @brief Parses the HTTP request in place: the request line and the headers
+ *        become views into the input buffer, NUL-terminated where they end.
+ *        Delimiters are found with http_scan (SIMD when available) and
+ *        header names are resolved through the known-header table.
  * @param conn Connection structure.
  * @param req Structure where the request data will be stored.
+ * @param arena Arena for the header table (reset by the caller).
  * @return 0 on success, -1 on error.
  */
-static int parse_request_conn(connection_t* conn, http_request_t* req) {
-    char line[MAX_REQ_LINE];
+int parse_request_conn(connection_t* conn, http_request_t* req, arena_t* arena) {
+    size_t ends[HTTP_MAX_HEADERS + 2];
+    int has_length = 0, has_chunked = 0;
+
+    TRACE_DEBUG(TRACE_PARSE, "A ler request...");
+
+    req->path = req->host = req->user_agent = req->accept = req->connection = "";
+    req->nheaders = 0;
+
+    int nlines = read_header_lines(conn, ends, HTTP_MAX_HEADERS + 2);
+    if (nlines < 0) return -1;
+
+    char *base = conn->in_buf + conn->in_off;
+    conn->in_off += ends[nlines - 1] + 1;
+
+    // Primeira linha: METHOD SP PATH SP VERSION
+    char *line = base;
+    size_t len = ends[0];
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    TRACE_DEBUG(TRACE_PARSE, "First line raw: '%s'", line);
+
+    char *tok = line;
+    char *end = line + len;
+    for (int t = 0; t < 3 && tok < end; t++) {
+        size_t n = http_scan(tok, end - tok, &HTTP_CS_SPACE);
+        tok[n] = '\0';
+
+        if (t == 0)
+            snprintf(req->method, sizeof(req->method), "%s", tok);
+        else if (t == 1)
+            req->path = tok;
+        else
+            snprintf(req->version, sizeof(req->version), "%s", tok);
+
+        tok += n + 1;
+        while (tok < end && *tok == ' ') tok++;
+    }
+    TRACE_DEBUG(TRACE_PARSE, "Método='%s' Path='%s' Versão='%s'",
+                req->method, req->path, req->version);
 
-    printf("[PARSE] A ler request...\n");
+    // Headers (the last line is the blank one)
+    if (nlines > 2) {
+        req->headers = arena_alloc(arena, sizeof(http_header_t) * (nlines - 2));
+        if (!req->headers) return -1;
+    }
 
-    // Primeira linha
-    int n = read_line_conn(conn, line, sizeof(line));
-    printf("[PARSE] First line raw: '%s' (n=%d)\n", line, n);
+    for (int i = 1; i < nlines - 1; i++) {
+        line = base + ends[i - 1] + 1;
+        len = ends[i] - ends[i - 1] - 1;
+        if (len > 0 && line[len - 1] == '\r') len--;
+        TRACE_DEBUG(TRACE_PARSE, "Header line: '%.*s'", (int)len, line);
+
+        size_t colon = http_scan(line, len, &HTTP_CS_COLON);
+        if (colon == len || colon == 0)
+            continue;   // Not a header: ignored
+
+        char *value = line + colon + 1;
+        end = line + len;
+        while (value < end && (*value == ' ' || *value == '\t')) value++;
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = '\0';
+
+        http_header_t *h = &req->headers[req->nheaders++];
+        h->name = line;
+        h->name_len = colon;
+        h->value = value;
+        h->value_len = end - value;
+        h->id = http_header_lookup(line, colon);
+
+        switch (h->id) {
+            case HTTP_HDR_HOST:              req->host = value; break;
+            case HTTP_HDR_USER_AGENT:        req->user_agent = value; break;
+            case HTTP_HDR_ACCEPT:            req->accept = value; break;
+            case HTTP_HDR_CONNECTION:        req->connection = value; break;
+            case HTTP_HDR_CONTENT_LENGTH: {
+                // Framing must be unambiguous: a proxy behind us could read it otherwise
+                long n;
+                if (http_parse_content_length(value, &n) < 0 ||
+                    (has_length && n != req->content_length)) {
+                    TRACE_DEBUG(TRACE_PARSE, "Invalid Content-Length '%s'", value);
+                    return -1;
+                }
+                req->content_length = n;
+                has_length = 1;
+                break;
+            }
+            case HTTP_HDR_TRANSFER_ENCODING:
+                if (has_chunked || strcasecmp(value, "chunked") != 0) {
+                    TRACE_DEBUG(TRACE_PARSE, "Unsupported Transfer-Encoding '%s'", value);
+                    return -1;
+                }
+                req->content_length = -1;
+                has_chunked = 1;
+                break;
+            default: break;
+        }
+    }
+    TRACE_DEBUG(TRACE_PARSE, "Fim dos headers (%d)", req->nheaders);
 
-    if (n <= 0) return -1;
+    if (has_length && has_chunked) {
+        TRACE_DEBUG(TRACE_PARSE, "Both Content-Length and Transfer-Encoding");
+        return -1;
+    }
 
-    sscanf(line, "%7s %1023s %15s", req->method, req->path, req->version);
-    printf("[PARSE] Método='%s' Path='%s' Versão='%s'\n",
-           req->method, req->path, req->version);
+    return 0;
+}
 
-    // Headers
-    while (1) {
-        n = read_line_conn(conn, line, sizeof(line));
-        printf("[PARSE] Header line: '%s' (n=%d)\n", line, n);
+/**
+ * @brief Finds a header of the request by its known name.
+ * @param req Parsed request.
+ * @param id Header id.
+ * @return The first header with that name, NULL if absent.
+ */
+const http_header_t* http_request_header(const http_request_t* req, http_header_id_t id) {
+    for (int i = 0; i < req->nheaders; i++)
+        if (req->headers[i].id == id)
+            return &req->headers[i];
+    return NULL;
+}
 
-        if (n <= 0) return -1;
+/**
+ * @brief Sends every buffered response with a single write.
+ * @param conn Connection structure.
+ * @return 0 on success, -1 on error.
+ */
+static int conn_flush(connection_t* conn) {
+    if (conn->out_len == 0) return 0;
 
-        if (!strcmp(line, "\r\n")) {
-            printf("[PARSE] Fim dos headers\n");
-            break;
-        }
+    ssize_t n = conn_write(conn, conn->out_buf, conn->out_len);
+    int ok = (n == (ssize_t)conn->out_len);
+    conn->out_len = 0;
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Appends response bytes to the connection's output buffer, so that
+ *        pipelined responses leave together. Bodies larger than OUT_BUF_MAX
+ *        are written directly after flushing what is pending.
+ * @param conn Connection structure.
+ * @param buf Data to send.
+ * @param len Data size.
+ * @return 0 on success, -1 on error.
+ */
+static int out_write(connection_t* conn, const void* buf, size_t len) {
+    if (conn->out_len + len > OUT_BUF_MAX) {
+        if (conn_flush(conn) < 0) return -1;
+        if (len > OUT_BUF_MAX)
+            return conn_write(conn, buf, len) == (ssize_t)len ? 0 : -1;
+    }
+
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : 4096;
+        while (cap < conn->out_len + len) cap *= 2;
 
-        sscanf(line, "Host: %511[^\r\n]", req->host);
-        sscanf(line, "User-Agent: %511[^\r\n]", req->user_agent);
-        sscanf(line, "Accept: %511[^\r\n]", req->accept);
+        char *p = realloc(conn->out_buf, cap);
+        if (!p) {
+            // Sem memória: enviar diretamente
+            if (conn_flush(conn) < 0) return -1;
+            return conn_write(conn, buf, len) == (ssize_t)len ? 0 : -1;
+        }
+        conn->out_buf = p;
+        conn->out_cap = cap;
     }
 
+    memcpy(conn->out_buf + conn->out_len, buf, len);
+    conn->out_len += len;
     return 0;
 }
 
 /**
- * @brief Sends a custom or generic HTTP error page to the client.
- * @param conn Connection structure.
+ * @brief Value of the Connection header of the current response.
+ */
+static const char* conn_state(connection_t* conn) {
+    return conn->keep_alive ? "keep-alive" : "close";
+}
+
+/**
+ * @brief Checks that a request path stays under the document root: it must
+ *        be absolute and no segment may be "..", also once percent-decoded
+ *        ("%2e%2e", ".%2E"). A decoded NUL or '/' is refused as well.
+ * @param path Path of the request line.
+ * @return 1 if the path can be appended to a document root, 0 otherwise.
+ */
+static int path_is_safe(const char *path) {
+    if (path[0] != '/')
+        return 0;
+
+    for (const char *seg = path + 1; ; ) {
+        int dots = 0, other = 0;
+        const char *p = seg;
+        for (; *p && *p != '/'; p++) {
+            int c = (unsigned char)*p;
+            if (c == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+                char hex[3] = { p[1], p[2], '\0' };
+                c = (int)strtol(hex, NULL, 16);
+                p += 2;
+                if (c == '\0' || c == '/')
+                    return 0;
+            }
+            if (c == '.')
+                dots++;
+            else
+                other = 1;
+        }
+        if (dots == 2 && !other)
+            return 0;
+        if (*p != '/')
+            return 1;
+        seg = p + 1;
+    }
+}
+
+/**
+ * @brief Builds the error page of a site: <root>/errors/<code>.html, or a
+ *        generic page.
+ * @param root Document root of the site.
  * @param code HTTP error code (e.g., 404, 500).
  * @param msg Message associated with the error.
+ * @param resp Response to fill.
  */
-static void send_error_page_conn(connection_t* conn, int code, const char* msg) {
-    char errpath[256];
-    snprintf(errpath, sizeof(errpath), "%s/errors/%d.html",
-             get_document_root(), code);
+static void build_error_page(const char *root, int code, const char* msg, http_response_t* resp) {
+    char errpath[512];
+    snprintf(errpath, sizeof(errpath), "%s/errors/%d.html", root, code);
+
+    resp->status = code;
+    resp->reason = msg;
+    resp->content_type = "text/html; charset=utf-8";
 
     int f = open(errpath, O_RDONLY);
 
     if (f >= 0) {
         struct stat st;
-        fstat(f, &st);
-
-        char header[256];
-        int h = snprintf(header, sizeof(header),
-            "HTTP/1.1 %d %s\r\n"
-            "Content-Type: text/html; charset=utf-8\r\n"
-            "Content-Length: %ld\r\n"
-            "Connection: close\r\n"
-            "\r\n",
-            code, msg, st.st_size
-        );
+        char *page = NULL;
+        ssize_t n = -1;
 
-        conn_write(conn, header, h);
+        if (fstat(f, &st) == 0 && (page = malloc(st.st_size + 1)) != NULL)
+            n = read(f, page, st.st_size);
+        close(f);
 
-        char buf[4096];
-        ssize_t n;
-        while ((n = read(f, buf, sizeof(buf))) > 0)
-            conn_write(conn, buf, n);
+        if (n >= 0) {
+            resp->body = resp->owned = page;
+            resp->body_len = n;
 
-        close(f);
-        
-        if (shm_data) {
-            stats_update(&shm_data->stats, sems.sem_stats, code, st.st_size);
+            if (shm_data) {
+                stats_update(&shm_data->stats, sems.sem_stats, code, n);
+            }
+            return;
         }
-        
-        return;
+        free(page);
     }
 
     // fallback
-    char body[256];
-    int blen = snprintf(body, sizeof(body),
-        "<html><body><h1>%d %s</h1></body></html>", code, msg);
+    char *body = malloc(256);
+    int blen = body ? snprintf(body, 256,
+        "<html><body><h1>%d %s</h1></body></html>", code, msg) : 0;
 
-    char header[256];
-    int h = snprintf(header, sizeof(header),
-        "HTTP/1.1 %d %s\r\n"
-        "Content-Type: text/html; charset=utf-8\r\n"
-        "Content-Length: %d\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        code, msg, blen
-    );
-
-    conn_write(conn, header, h);
-    conn_write(conn, body, blen);
+    resp->body = resp->owned = body;
+    resp->body_len = blen;
     
     if (shm_data) {
         stats_update(&shm_data->stats, sems.sem_stats, code, blen);
@@ -237,12 +558,27 @@ static void send_error_page_conn(connection_t* conn, int code, const char* msg)
 }
 
 /**
- * @brief Serve statistics in JSON format
- * @param conn Connection structure
+ * @brief Builds a custom or generic HTTP error page (DOCUMENT_ROOT/errors).
+ * @param code HTTP error code (e.g., 404, 500).
+ * @param msg Message associated with the error.
+ * @param resp Response to fill.
+ */
+void http_build_error(int code, const char* msg, http_response_t* resp) {
+    build_error_page(get_document_root(), code, msg, resp);
+}
+
+/**
+ * @brief Builds the statistics response in JSON format
+ * @param resp Response to fill
  */
-static void serve_stats_json(connection_t* conn) {
-    char json[2048];
+static void build_stats_json(http_response_t* resp) {
+    char *json = malloc(4096);
     int len;
+
+    if (!json) {
+        http_build_error(500, "Internal Server Error", resp);
+        return;
+    }
     
     if (shm_data) {
         // Read stats atomically
@@ -256,8 +592,14 @@ static void serve_stats_json(connection_t* conn) {
         unsigned long cache_total = stats_copy.cache_hits + stats_copy.cache_misses;
         float cache_hit_rate = cache_total > 0 ? 
             (float)stats_copy.cache_hits / cache_total * 100.0f : 0.0f;
+
+        long pool_threads, pool_busy, pool_max;
+        metrics_pool_totals(&pool_threads, &pool_busy, &pool_max);
+
+        char memory[1024];
+        memgov_render_json(memory, sizeof(memory));
         
-        len = snprintf(json, sizeof(json),
+        len = snprintf(json, 4096,
             "{\n"
             "  \"total_requests\": %lu,\n"
             "  \"status_200\": %lu,\n"
@@ -267,6 +609,15 @@ static void serve_stats_json(connection_t* conn) {
             "  \"cache_hits\": %lu,\n"
             "  \"cache_misses\": %lu,\n"
             "  \"cache_hit_rate\": %.2f,\n"
+            "  \"timeouts_handshake\": %lu,\n"
+            "  \"timeouts_header\": %lu,\n"
+            "  \"timeouts_idle\": %lu,\n"
+            "  \"timeouts_write\": %lu,\n"
+            "  \"pool_threads\": %ld,\n"
+            "  \"pool_busy_threads\": %ld,\n"
+            "  \"pool_max_threads\": %ld,\n"
+            "  \"response_memory_peak_bytes\": %lu,\n"
+            "  \"memory\": %s,\n"
             "  \"timestamp\": %ld\n"
             "}\n",
             stats_copy.total_requests,
@@ -277,69 +628,220 @@ static void serve_stats_json(connection_t* conn) {
             stats_copy.cache_hits,
             stats_copy.cache_misses,
             cache_hit_rate,
+            stats_copy.timeouts_handshake,
+            stats_copy.timeouts_header,
+            stats_copy.timeouts_idle,
+            stats_copy.timeouts_write,
+            pool_threads,
+            pool_busy,
+            pool_max,
+            metrics_response_memory_peak(),
+            memory,
             time(NULL)
         );
     } else {
         // Fallback if shared memory is not available
-        len = snprintf(json, sizeof(json),
+        len = snprintf(json, 4096,
             "{\n"
             "  \"error\": \"Statistics not available\",\n"
             "  \"message\": \"Shared memory not initialized\"\n"
             "}\n"
         );
     }
-    
-    char header[256];
-    int h = snprintf(header, sizeof(header),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: application/json\r\n"
-        "Content-Length: %d\r\n"
+
+    resp->status = 200;
+    resp->reason = "OK";
+    resp->content_type = "application/json";
+    snprintf(resp->headers, sizeof(resp->headers),
         "Access-Control-Allow-Origin: *\r\n"
-        "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        len
-    );
+        "Cache-Control: no-cache, no-store, must-revalidate\r\n");
+    resp->body = resp->owned = json;
+    resp->body_len = len;
     
-    conn_write(conn, header, h);
-    conn_write(conn, json, len);
-    
-    printf("[API] Served /api/stats - %d bytes\n", len);
+    TRACE_DEBUG(TRACE_API, "Served /api/stats - %d bytes", len);
+}
+
+/**
+ * @brief Builds a single-event stream of the stats (HTTP/2 or HEAD): the
+ *        retry hint makes EventSource poll over the same connection.
+ * @param resp Response to fill
+ */
+static void build_stats_oneshot(http_response_t* resp) {
+    size_t len = 0;
+    char *body = stats_stream_oneshot(&len);
+
+    if (!body) {
+        http_build_error(500, "Internal Server Error", resp);
+        return;
+    }
+
+    resp->status = 200;
+    resp->reason = "OK";
+    resp->content_type = "text/event-stream";
+    snprintf(resp->headers, sizeof(resp->headers),
+        "Access-Control-Allow-Origin: *\r\n"
+        "Cache-Control: no-cache\r\n");
+    resp->body = resp->owned = body;
+    resp->body_len = len;
+}
+
+/**
+ * @brief Builds the Prometheus exposition of /metrics (no stats semaphore).
+ * @param resp Response to fill
+ */
+static void build_metrics(http_response_t* resp) {
+    size_t len = 0;
+    char *text = metrics_render(&len);
+
+    if (!text) {
+        http_build_error(500, "Internal Server Error", resp);
+        return;
+    }
+
+    resp->status = 200;
+    resp->reason = "OK";
+    resp->content_type = "text/plain; version=0.0.4; charset=utf-8";
+    snprintf(resp->headers, sizeof(resp->headers), "Cache-Control: no-cache\r\n");
+    resp->body = resp->owned = text;
+    resp->body_len = len;
+
+    TRACE_DEBUG(TRACE_API, "Served /metrics - %zu bytes", len);
+}
+
+/**
+ * @brief Builds the JSON of /api/stats/history. Query: res=1s|1m|1h
+ *        (repeatable, all three by default) and points=N per series.
+ * @param query Rest of the path after "/api/stats/history".
+ * @param resp Response to fill
+ */
+static void build_history_json(const char *query, http_response_t* resp) {
+    int resolutions = 0;
+    int points = 0;
+
+    if (*query == '?')
+        query++;
+    else if (*query) {
+        http_build_error(404, "Not Found", resp);
+        return;
+    }
+
+    while (*query) {
+        size_t n = strcspn(query, "&");
+        if (n == 6 && !strncmp(query, "res=1s", 6)) resolutions |= HISTORY_RES_SECOND;
+        else if (n == 6 && !strncmp(query, "res=1m", 6)) resolutions |= HISTORY_RES_MINUTE;
+        else if (n == 6 && !strncmp(query, "res=1h", 6)) resolutions |= HISTORY_RES_HOUR;
+        else if (!strncmp(query, "points=", 7)) points = atoi(query + 7);
+        query += n;
+        if (*query == '&')
+            query++;
+    }
+
+    size_t len = 0;
+    char *json = history_render_json(resolutions ? resolutions : HISTORY_RES_ALL, points, &len);
+
+    if (!json) {
+        http_build_error(500, "Internal Server Error", resp);
+        return;
+    }
+
+    resp->status = 200;
+    resp->reason = "OK";
+    resp->content_type = "application/json";
+    snprintf(resp->headers, sizeof(resp->headers), "Cache-Control: no-cache\r\n");
+    resp->body = resp->owned = json;
+    resp->body_len = len;
+
+    TRACE_DEBUG(TRACE_API, "Served /api/stats/history - %zu bytes", len);
+}
+
+/**
+ * @brief Builds the JSON of /api/slow from the slow-request ring.
+ * @param resp Response to fill
+ */
+static void build_slow_json(http_response_t* resp) {
+    size_t len = 0;
+    char *json = slowlog_render_json(&len);
+
+    if (!json) {
+        http_build_error(500, "Internal Server Error", resp);
+        return;
+    }
+
+    resp->status = 200;
+    resp->reason = "OK";
+    resp->content_type = "application/json";
+    snprintf(resp->headers, sizeof(resp->headers), "Cache-Control: no-cache\r\n");
+    resp->body = resp->owned = json;
+    resp->body_len = len;
+
+    TRACE_DEBUG(TRACE_API, "Served /api/slow - %zu bytes", len);
+}
+
+/**
+ * @brief Prepares a file to be streamed from disk: the body is sent in
+ *        fixed-size chunks by the send path, never read whole into memory
+ *        and never cached.
+ * @param resp Response to fill (body_fd and body_len).
+ * @param fullpath Absolute path of the file.
+ * @return 0 on success, -1 if the file could not be opened.
+ */
+static int stream_file(http_response_t* resp, const char *fullpath) {
+    int fd = open(fullpath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    // Read front to back once: let the kernel fetch ahead of the sends
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    slowlog_phase(PHASE_DISK);
+
+    resp->body_fd = fd;
+    resp->body_len = st.st_size;
+    metrics_stream(st.st_size);
+
+    TRACE_DEBUG(TRACE_SERVE, "A enviar %s do disco (%ld bytes)", fullpath, (long)st.st_size);
+
+    if (shm_data) {
+        stats_update(&shm_data->stats, sems.sem_stats, 200, st.st_size);
+    }
+    return 0;
 }
 
 /**
- * @brief Serves a file to the client, using the cache if possible.
- * @param conn Connection structure (HTTP or HTTPS)
+ * @brief Builds the response for a file, using the cache if possible.
+ * @param resp Response to fill.
+ * @param vh Virtual host of the request (cache quota, error pages).
  * @param fullpath Absolute path of the file to serve.
  * @param is_head If 1, sends only headers (HEAD method), if 0 sends body as well (GET).
  */
-static void serve_file_conn(connection_t* conn, const char *fullpath, int is_head) {
+static void build_file_response(http_response_t* resp, const vhost_t *vh,
+                                const char *fullpath, int is_head) {
 
-    printf("[SERVE] fullpath='%s', is_head=%d\n", fullpath, is_head);
+    TRACE_DEBUG(TRACE_SERVE, "fullpath='%s', is_head=%d", fullpath, is_head);
 
     char* cached_data = NULL;
     size_t cached_size = 0;
 
+    resp->status = 200;
+    resp->reason = "OK";
+    const mime_type_t *type = mime_lookup(fullpath);
+    resp->content_type = type->content_type;
+    resp->head_only = is_head;
+    mime_cache_headers(type, resp->headers, sizeof(resp->headers));
+
     // Tentar obter do cache
-    if (cache_get(fullpath, &cached_data, &cached_size)) {
-        printf("[SERVE] Cache HIT: %zu bytes\n", cached_size);
-
-        const char* mime = mime_from_path(fullpath);
-
-        char header[256];
-        int h = snprintf(header, sizeof(header),
-            "HTTP/1.1 200 OK\r\n"
-            "Content-Type: %s\r\n"
-            "Content-Length: %zu\r\n"
-            "Connection: close\r\n\r\n",
-            mime, cached_size
-        );
+    int hit = cache_get(fullpath, &cached_data, &cached_size);
+    slowlog_phase(PHASE_CACHE);
 
-        conn_write(conn, header, h);
+    if (hit) {
+        TRACE_DEBUG(TRACE_SERVE, "Cache HIT: %zu bytes", cached_size);
 
-        if (!is_head) {
-            conn_write(conn, cached_data, cached_size);
-        }
+        resp->body = resp->cached = cached_data;
+        resp->body_len = cached_size;
 
         if (shm_data) {
             stats_update(&shm_data->stats, sems.sem_stats, 200, cached_size);
@@ -349,183 +851,609 @@ static void serve_file_conn(connection_t* conn, const char *fullpath, int is_hea
     }
 
     // Cache miss - ler do disco
-    printf("[SERVE] Cache MISS - a ler do disco\n");
-
-    int file_fd = open(fullpath, O_RDONLY);
-    printf("[SERVE] open() file_fd=%d\n", file_fd);
+    TRACE_DEBUG(TRACE_SERVE, "Cache MISS - a ler do disco");
 
-    if (file_fd < 0) {
-        send_error_page_conn(conn, 500, "Internal Server Error");
+    if (is_head) {
+        // HEAD request - só header
+        struct stat st;
+        if (stat(fullpath, &st) < 0) {
+            build_error_page(vh->root, 500, "Internal Server Error", resp);
+            return;
+        }
+        resp->body_len = st.st_size;
+        if (shm_data) {
+            stats_update(&shm_data->stats, sems.sem_stats, 200, 0);
+        }
         return;
     }
 
+    // Ficheiros grandes: enviados do disco por blocos, nunca em memória nem no cache
+    long threshold = get_stream_threshold_kb() * 1024L;
     struct stat st;
-    if (fstat(file_fd, &st) < 0) {
-        close(file_fd);
-        send_error_page_conn(conn, 500, "Internal Server Error");
+    if (threshold > 0 && stat(fullpath, &st) == 0 && st.st_size > threshold) {
+        if (stream_file(resp, fullpath) < 0)
+            build_error_page(vh->root, 500, "Internal Server Error", resp);
         return;
     }
 
-    printf("[SERVE] Tamanho do ficheiro: %ld bytes\n", st.st_size);
+    // Ler ficheiro para memória (threads de I/O de disco) para colocar no cache
+    char* file_data = NULL;
+    size_t file_size = 0;
 
-    const char* mime = mime_from_path(fullpath);
+    if (diskio_load(fullpath, &file_data, &file_size) != 0) {
+        // Fallback: enviar diretamente do ficheiro, sem cache
+        if (errno != ENOMEM || stream_file(resp, fullpath) < 0) {
+            build_error_page(vh->root, 500, "Internal Server Error", resp);
+            return;
+        }
+        TRACE_WARN(TRACE_SERVE, "Sem memória para cache, a enviar diretamente");
+        return;
+    }
+    slowlog_phase(PHASE_DISK);
 
-    char header[256];
-    int h = snprintf(header, sizeof(header),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %ld\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        mime, st.st_size
-    );
+    TRACE_DEBUG(TRACE_SERVE, "Lido do disco: %zu bytes", file_size);
 
-    printf("[SERVE] A enviar header (%d bytes)\n", h);
-    conn_write(conn, header, h);
+    // Colocar no cache
+    cache_put(fullpath, file_data, file_size, vh->index);
+    TRACE_DEBUG(TRACE_SERVE, "Adicionado ao cache");
 
-    if (is_head) {
-        // HEAD request - só header
-        close(file_fd);
-        if (shm_data) {
-            stats_update(&shm_data->stats, sems.sem_stats, 200, 0);
-        }
-        return;
+    resp->body = resp->owned = file_data;
+    resp->body_len = file_size;
+
+    // Atualizar estatísticas
+    if (shm_data) {
+        stats_update(&shm_data->stats, sems.sem_stats, 200, file_size);
     }
+}
 
-    // Ler ficheiro para memória para colocar no cache
-    char* file_data = malloc(st.st_size);
-    if (!file_data) {
-        printf("[SERVE] AVISO: Sem memória para cache, a enviar diretamente\n");
-        
-        // Fallback: enviar diretamente sem cache
-        char buf[4096];
-        ssize_t n;
-        size_t total_sent = 0;
-        
-        while ((n = read(file_fd, buf, sizeof(buf))) > 0) {
-            ssize_t written = conn_write(conn, buf, n);
-            if (written > 0) {
-                total_sent += written;
+/**
+ * @brief Releases what a response owns (buffers and file descriptors).
+ * @param resp Response to release.
+ */
+void http_response_free(http_response_t* resp) {
+    free(resp->owned);
+    resp->owned = NULL;
+    cache_release(resp->cached);
+    resp->cached = NULL;
+    resp->body = NULL;
+    if (resp->body_fd >= 0) {
+        close(resp->body_fd);
+        resp->body_fd = -1;
+    }
+}
+
+/**
+ * @brief Sends a file body after the batched output, one WRITE_CHUNK at a
+ *        time under the write deadline: sendfile() over plain HTTP (no copy
+ *        through user space), reads into the connection's output buffer
+ *        over TLS. Memory stays at one buffer whatever the file size.
+ * @param conn Connection structure (HTTP or HTTPS).
+ * @param fd File, positioned at the start of the body.
+ * @param len Bytes to send (Content-Length).
+ * @return 0 on success, -1 on error (write error, deadline or short file).
+ */
+static int send_file_body(connection_t* conn, int fd, size_t len) {
+    if (conn_flush(conn) < 0) return -1;
+
+    size_t sent = 0;
+
+    if (!conn->is_https || !conn->ssl) {
+        int timeout_ms = get_timeout_seconds() * 1000;
+
+        while (sent < len) {
+            size_t chunk = len - sent;
+            if (chunk > WRITE_CHUNK) chunk = WRITE_CHUNK;
+
+            timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_WRITE, timeout_ms);
+            ssize_t n = sendfile(conn->fd, fd, NULL, chunk);
+            timer_wheel_cancel(&worker_wheel, &conn->timer);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (conn->timer.fired == TIMEOUT_WRITE)
+                    TRACE_WARN(TRACE_HTTP, "Write deadline expired on fd %d", conn->fd);
+                return -1;
             }
+            sent += n;
         }
-        
-        close(file_fd);
-        
-        printf("[SERVE] Enviado diretamente: %zu bytes\n", total_sent);
-        
-        if (shm_data) {
-            stats_update(&shm_data->stats, sems.sem_stats, 200, total_sent);
-        }
-        
-        return;
+        return 0;
     }
 
-    // Ler ficheiro completo
-    ssize_t total_read = 0;
-    ssize_t n;
-    
-    while (total_read < st.st_size) {
-        n = read(file_fd, file_data + total_read, st.st_size - total_read);
-        if (n <= 0) break;
-        total_read += n;
+    // TLS encrypts in user space: reuse the (flushed) output buffer
+    if (conn->out_cap < WRITE_CHUNK) {
+        char *p = realloc(conn->out_buf, WRITE_CHUNK);
+        if (!p) return -1;
+        conn->out_buf = p;
+        conn->out_cap = WRITE_CHUNK;
     }
-    
-    close(file_fd);
 
-    if (total_read != st.st_size) {
-        printf("[SERVE] ERRO: Lido %zd bytes, esperado %ld bytes\n", total_read, st.st_size);
-        free(file_data);
-        send_error_page_conn(conn, 500, "Internal Server Error");
-        return;
+    while (sent < len) {
+        size_t chunk = len - sent;
+        if (chunk > WRITE_CHUNK) chunk = WRITE_CHUNK;
+
+        ssize_t n = read(fd, conn->out_buf, chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (conn_write(conn, conn->out_buf, n) != n) return -1;
+        sent += n;
     }
+    return 0;
+}
 
-    printf("[SERVE] Lido do disco: %zd bytes\n", total_read);
+/**
+ * @brief Formats the head of an HTTP/1.1 response.
+ * @param buf Destination buffer.
+ * @param len Size of buf.
+ * @return Length of the whole head (may be >= len, as snprintf), -1 on error.
+ */
+static int format_head(connection_t* conn, const http_response_t* resp, char *buf, size_t len) {
+    return snprintf(buf, len,
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %zu\r\n"
+        "%s"
+        "Connection: %s\r\n"
+        "\r\n",
+        resp->status, resp->reason, resp->content_type, resp->body_len,
+        resp->headers, conn_state(conn)
+    );
+}
 
-    // Enviar dados
-    ssize_t written = conn_write(conn, file_data, st.st_size);
-    printf("[SERVE] Enviado ao cliente: %zd bytes\n", written);
+/**
+ * @brief Appends a response to the connection's output buffer in HTTP/1.1 form.
+ * @param conn Connection structure (HTTP or HTTPS).
+ * @param resp Response to send.
+ * @return 0 on success, -1 if the head or the body could not be written
+ *         (keep_alive is then cleared).
+ */
+static int send_response_http1(connection_t* conn, const http_response_t* resp) {
+    char stack_header[1024];
+    char *header = stack_header;
+    int h = format_head(conn, resp, header, sizeof(stack_header));
+
+    // Long content types or extra headers (proxied responses): heap copy
+    if (h >= (int)sizeof(stack_header)) {
+        header = malloc((size_t)h + 1);
+        if (header)
+            h = format_head(conn, resp, header, (size_t)h + 1);
+    }
+    if (h < 0 || !header) {
+        TRACE_ERROR(TRACE_SERVE, "Header da resposta %d não formatado", resp->status);
+        conn->keep_alive = 0;
+        return -1;
+    }
 
-    // Colocar no cache
-    cache_put(fullpath, file_data, st.st_size);
-    printf("[SERVE] Adicionado ao cache\n");
+    TRACE_DEBUG(TRACE_SERVE, "A enviar header (%d bytes)", h);
+
+    // Written in several parts: corked, so the header and the tail of the
+    // body do not leave in short segments of their own
+    int corked = !resp->head_only && conn->peer.ss_family != AF_UNIX &&
+                 (resp->body_fd >= 0 || conn->out_len + h + resp->body_len > OUT_BUF_MAX);
+    if (corked)
+        listener_cork(conn->fd, 1);
+
+    int rc = out_write(conn, header, h);
+    if (header != stack_header)
+        free(header);
+
+    // The client is gone: no body after a head that did not leave
+    if (rc < 0) {
+        conn->keep_alive = 0;
+        if (corked)
+            listener_cork(conn->fd, 0);
+        return -1;
+    }
 
-    // Atualizar estatísticas
-    if (shm_data) {
-        stats_update(&shm_data->stats, sems.sem_stats, 200, st.st_size);
+    if (resp->head_only)
+        return 0;
+
+    // Body memory of this request: its own buffer, or the chunk buffer of
+    // a file streamed over TLS (cache entries are shared, sendfile copies none)
+    metrics_response_memory(resp->owned ? resp->body_len :
+                            resp->body_fd >= 0 && conn->ssl ? WRITE_CHUNK : 0);
+
+    if (resp->body)
+        rc = out_write(conn, resp->body, resp->body_len);
+    else if (resp->body_fd >= 0)
+        rc = send_file_body(conn, resp->body_fd, resp->body_len);
+
+    if (corked) {
+        if (rc == 0)
+            rc = conn_flush(conn);
+        listener_cork(conn->fd, 0);
     }
 
-    free(file_data);
+    if (rc < 0)
+        conn->keep_alive = 0;
+    return rc < 0 ? -1 : 0;
 }
 
 /**
- * @brief Main function to handle an HTTP request from a client.
- *        Parses, validates, serves files, and logs statistics.
+ * @brief Sends a response immediately, flushing batched responses first.
  * @param conn Connection structure (HTTP or HTTPS).
+ * @param resp Response to send.
  */
-void http_handle_request(connection_t* conn) {
-    printf("[HTTP] Entrou no http_handle_request com fd %d (HTTPS=%d)\n", 
-           conn->fd, conn->is_https);
+void http_send_response(connection_t* conn, const http_response_t* resp) {
+    send_response_http1(conn, resp);
+    if (conn_flush(conn) < 0)
+        conn->keep_alive = 0;
+}
+
+/**
+ * @brief Applies the per-client request rate (RATE_LIMIT_RPS and
+ *        RATE_LIMIT_SUBNET_RPS) before a request is routed. The 429 is a
+ *        fixed in-memory response: no file read, no stats semaphore.
+ * @param req Parsed request.
+ * @param resp Filled with the 429 when the client is over its rate.
+ * @return 1 if the request was refused, 0 if it may be served.
+ */
+int http_rate_limited(const http_request_t* req, http_response_t* resp) {
+    static const char body[] = "Too Many Requests\n";
+
+    if (ratelimit_request(req->client_ip) == RATELIMIT_OK)
+        return 0;
+
+    memset(resp, 0, sizeof(*resp));
+    resp->body_fd = -1;
+    resp->status = 429;
+    resp->reason = "Too Many Requests";
+    resp->content_type = "text/plain; charset=utf-8";
+    snprintf(resp->headers, sizeof(resp->headers), "Retry-After: 1\r\n");
+    resp->body = body;
+    resp->body_len = sizeof(body) - 1;
+    resp->head_only = !strcmp(req->method, "HEAD");
+
+    logger_log(req->client_ip, req->method, req->path, 429, 0);
+    return 1;
+}
+
+/**
+ * @brief Decides whether the connection stays open after this request.
+ * @param req Parsed request.
+ * @param body_read 1 if the handler consumes the request body (proxy).
+ * @return 1 for keep-alive, 0 to close after the response.
+ */
+static int wants_keep_alive(const http_request_t* req, int body_read) {
+    if (get_keepalive_timeout_seconds() <= 0 || worker_draining()) return 0;
 
-    http_request_t req = {0};
+    // Request bodies are not read by the file paths, so they cannot be skipped
+    if (req->content_length != 0 && !body_read) return 0;
 
-    struct sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
-    getpeername(conn->fd, (struct sockaddr *)&addr, &addrlen);
-    snprintf(req.client_ip, sizeof(req.client_ip),
-             "%s", inet_ntoa(addr.sin_addr));
+    if (!strncasecmp(req->connection, "close", 5)) return 0;
+    if (!strcmp(req->version, "HTTP/1.1")) return 1;
+    return !strncasecmp(req->connection, "keep-alive", 10);
+}
 
-    if (parse_request_conn(conn, &req) < 0) {
-        send_error_page_conn(conn, 400, "Bad Request");
-        logger_log(req.client_ip, "-", "-", 400, 0);
-        conn_close(conn);
+/**
+ * @brief Validates a request and builds its response (API endpoints, static
+ *        files through the cache, error pages). Shared by HTTP/1.x and HTTP/2.
+ *        Statistics and the access log are updated here.
+ * @param req Parsed request.
+ * @param resp Response to fill (release with http_response_free).
+ */
+void http_build_response(http_request_t* req, http_response_t* resp) {
+    memset(resp, 0, sizeof(*resp));
+    resp->body_fd = -1;
+
+    // Handle API endpoints (HTTP/1.x GETs of the stream are handed to the
+    // stats hub before getting here)
+    if (strcmp(req->path, "/api/stats/stream") == 0) {
+        build_stats_oneshot(resp);
+        logger_log(req->client_ip, req->method, req->path, resp->status, 0);
         return;
     }
 
-    // Handle API endpoints
-    if (strncmp(req.path, "/api/stats", 10) == 0) {
-        serve_stats_json(conn);
-        logger_log(req.client_ip, req.method, req.path, 200, 0);
-        conn_close(conn);
+    if (strncmp(req->path, "/api/stats/history", 18) == 0) {
+        build_history_json(req->path + 18, resp);
+        logger_log(req->client_ip, req->method, req->path, resp->status, 0);
+        return;
+    }
+
+    if (strncmp(req->path, "/api/stats", 10) == 0) {
+        build_stats_json(resp);
+        logger_log(req->client_ip, req->method, req->path, resp->status, 0);
         return;
     }
 
+    if (strcmp(req->path, "/api/slow") == 0) {
+        build_slow_json(resp);
+        logger_log(req->client_ip, req->method, req->path, resp->status, 0);
+        return;
+    }
+
+    if (strcmp(req->path, "/metrics") == 0) {
+        build_metrics(resp);
+        logger_log(req->client_ip, req->method, req->path, resp->status, 0);
+        return;
+    }
+
+    // Reverse proxy routes (HTTP/1.x requests are streamed before getting here)
+    proxy_route_t *route = proxy_match(req->path);
+    if (route) {
+        proxy_build_response(req, route, resp);
+        return;
+    }
+
+    // Site of the request: document root, cache quota and error pages
+    const vhost_t *vh = vhost_match(req->host);
+
     // Validar método
     int is_head = 0;
-    if (strcmp(req.method, "GET") == 0) {
+    if (strcmp(req->method, "GET") == 0) {
         is_head = 0;
-    } else if (strcmp(req.method, "HEAD") == 0) {
+    } else if (strcmp(req->method, "HEAD") == 0) {
         is_head = 1;
     } else {
-        send_error_page_conn(conn, 501, "Not Implemented");
-        logger_log(req.client_ip, req.method, req.path, 501, 0);
-        conn_close(conn);
+        build_error_page(vh->root, 501, "Not Implemented", resp);
+        logger_log(req->client_ip, req->method, req->path, 501, 0);
+        metrics_vhost(vh->index, 0);
         return;
     }
 
-    if (!strcmp(req.path, "/"))
-        strcpy(req.path, "/dashboard.html");
+    // "/../server.conf" and its encoded forms would leave the document root
+    if (!path_is_safe(req->path)) {
+        build_error_page(vh->root, 400, "Bad Request", resp);
+        logger_log(req->client_ip, req->method, req->path, 400, 0);
+        metrics_vhost(vh->index, 0);
+        return;
+    }
+
+    // The default host opens on the dashboard, virtual hosts on index.html
+    if (!strcmp(req->path, "/"))
+        req->path = vh->index == VHOST_DEFAULT ? "/dashboard.html" : "/index.html";
 
     char fullpath[1024];
-    snprintf(fullpath, sizeof(fullpath), "%s%s",
-             get_document_root(), req.path);
+    snprintf(fullpath, sizeof(fullpath), "%s%s", vh->root, req->path);
 
     struct stat st;
     if (stat(fullpath, &st) < 0) {
-        send_error_page_conn(conn, 404, "Not Found");
-        logger_log(req.client_ip, req.method, req.path, 404, 0);
-        conn_close(conn);
+        build_error_page(vh->root, 404, "Not Found", resp);
+        logger_log(req->client_ip, req->method, req->path, 404, 0);
+        metrics_vhost(vh->index, 0);
         return;
     }
 
     if (S_ISDIR(st.st_mode)) {
-        send_error_page_conn(conn, 403, "Forbidden");
-        logger_log(req.client_ip, req.method, req.path, 403, 0);
+        build_error_page(vh->root, 403, "Forbidden", resp);
+        logger_log(req->client_ip, req->method, req->path, 403, 0);
+        metrics_vhost(vh->index, 0);
+        return;
+    }
+
+    build_file_response(resp, vh, fullpath, is_head);
+    logger_log(req->client_ip, req->method, req->path, resp->status, st.st_size);
+    metrics_vhost(vh->index, resp->cached != NULL);
+}
+
+/**
+ * @brief Checks whether ALPN selected HTTP/2 during the TLS handshake.
+ */
+static int alpn_selected_h2(connection_t* conn) {
+    const unsigned char *proto = NULL;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(conn->ssl, &proto, &len);
+    return len == 2 && memcmp(proto, "h2", 2) == 0;
+}
+
+/**
+ * @brief h2c with prior knowledge: reads while the buffered bytes can still
+ *        be the HTTP/2 connection preface.
+ * @return 1 for HTTP/2, 0 for HTTP/1 (bytes stay buffered), -1 if the client
+ *         closed or the header deadline expired.
+ */
+static int h2c_preface(connection_t* conn) {
+    int result = 0;
+
+    timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_HEADER,
+                    get_timeout_seconds() * 1000);
+
+    while (1) {
+        size_t len = conn->in_len - conn->in_off;
+        size_t cmp = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+
+        if (len > 0 && memcmp(conn->in_buf + conn->in_off, H2_PREFACE, cmp) != 0)
+            break;
+        if (len >= H2_PREFACE_LEN) {
+            result = 1;
+            break;
+        }
+        if (conn_fill(conn) <= 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    timer_wheel_cancel(&worker_wheel, &conn->timer);
+    return result;
+}
+
+/**
+ * @brief Main function to handle the HTTP requests of a client connection.
+ *        Requests are served in order while the client keeps the connection
+ *        alive; responses to pipelined requests that are already buffered are
+ *        batched (up to PIPELINE_DEPTH) and flushed with a single write.
+ * @param conn Connection structure (HTTP or HTTPS).
+ */
+void http_handle_request(connection_t* conn) {
+    TRACE_DEBUG(TRACE_HTTP, "Entrou no http_handle_request com fd %d (HTTPS=%d)",
+                conn->fd, conn->is_https);
+
+    char client_ip[64];
+    listener_peer_name((struct sockaddr *)&conn->peer, client_ip, sizeof(client_ip));
+
+    // The first request is timed from accept: queue wait and handshake
+    req_timer_t timer;
+    slowlog_begin(&timer, conn->accepted_us);
+    slowlog_phase(PHASE_QUEUE);
+
+    if (conn->is_https && conn->ssl && conn_handshake(conn) != 0) {
+        slowlog_cancel(&timer);
         conn_close(conn);
         return;
     }
+    slowlog_phase(PHASE_HANDSHAKE);
 
-    serve_file_conn(conn, fullpath, is_head);
-    logger_log(req.client_ip, req.method, req.path, 200, st.st_size);
+    // HTTP/2 streams are timed one by one
+    if (conn->ssl && alpn_selected_h2(conn)) {
+        slowlog_cancel(&timer);
+        http2_serve(conn, client_ip);
+        conn_close(conn);
+        return;
+    }
+
+    if (!conn->is_https && get_h2c_enabled()) {
+        int h2c = h2c_preface(conn);
+        if (h2c != 0) {
+            slowlog_cancel(&timer);
+            if (h2c > 0)
+                http2_serve(conn, client_ip);
+            conn_close(conn);
+            return;
+        }
+    }
+
+    int served = 0;
+    int batched = 0;
+    int depth = get_pipeline_depth();
 
+    while (1) {
+        // Flush before we may block on the socket, or when the batch is full
+        if (conn->out_len > 0 && (batched >= depth || !request_buffered(conn))) {
+            if (conn_flush(conn) < 0)
+                break;
+            batched = 0;
+        }
+
+        // Request strings live in this thread's arena until the next request
+        arena_t *arena = request_arena();
+        if (!arena)
+            break;
+        arena_reset(arena);
+
+        http_request_t req = {0};
+        memcpy(req.client_ip, client_ip, sizeof(req.client_ip));
+        req.client_family = conn->peer.ss_family;
+        req.is_https = conn->is_https;
+
+        if (served > 0 && conn->in_off == conn->in_len) {
+            // Keep-alive: wait for the next request under the idle deadline
+            timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_IDLE,
+                            get_keepalive_timeout_seconds() * 1000);
+            // Checked after arming: the drain expires the idle timers once
+            if (worker_draining() || conn_fill(conn) <= 0) {
+                timer_wheel_cancel(&worker_wheel, &conn->timer);
+                break;
+            }
+        } else {
+            // The whole header must arrive within TIMEOUT_SECONDS (slowloris)
+            timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_HEADER,
+                            get_timeout_seconds() * 1000);
+        }
+
+        // Later requests start once their first bytes are here
+        if (served > 0)
+            slowlog_begin(&timer, metrics_now_us());
+
+        int parsed = parse_request_conn(conn, &req, arena);
+        timer_wheel_cancel(&worker_wheel, &conn->timer);
+        slowlog_phase(PHASE_READ);
+
+        if (parsed < 0) {
+            conn->keep_alive = 0;
+            http_response_t resp = { .body_fd = -1 };
+            if (conn->timer.fired == TIMEOUT_HEADER) {
+                http_build_error(408, "Request Timeout", &resp);
+                logger_log(req.client_ip, "-", "-", 408, 0);
+            } else {
+                http_build_error(400, "Bad Request", &resp);
+                logger_log(req.client_ip, "-", "-", 400, 0);
+            }
+            send_response_http1(conn, &resp);
+            metrics_request(resp.status, resp.body_len, 0, 0);
+            http_response_free(&resp);
+            break;
+        }
+
+        http_response_t limited;
+        if (http_rate_limited(&req, &limited)) {
+            conn->keep_alive = wants_keep_alive(&req, 0);
+            int sent = send_response_http1(conn, &limited) == 0;
+            slowlog_phase(PHASE_SEND);
+            metrics_request(limited.status, sent && !limited.head_only ? limited.body_len : 0,
+                            0, 0);
+            slowlog_end(&timer, req.method, req.path, req.client_ip, limited.status, 0);
+
+            served++;
+            batched++;
+            if (!conn->keep_alive)
+                break;
+            continue;
+        }
+
+        // Live stats: the connection leaves this thread for the stats hub
+        if (!strcmp(req.path, "/api/stats/stream") && !strcmp(req.method, "GET")) {
+            if (conn_flush(conn) < 0)
+                break;
+            if (stats_stream_subscribe(conn) == 0) {
+                logger_log(req.client_ip, req.method, req.path, 200, 0);
+                metrics_request(200, 0, 0, 0);
+                slowlog_cancel(&timer);
+                return;
+            }
+
+            conn->keep_alive = 0;
+            http_response_t resp = { .body_fd = -1 };
+            http_build_error(503, "Service Unavailable", &resp);
+            logger_log(req.client_ip, req.method, req.path, 503, 0);
+            send_response_http1(conn, &resp);
+            metrics_request(resp.status, resp.body_len, 0, 0);
+            http_response_free(&resp);
+            break;
+        }
+
+        unsigned long start = metrics_now_us();
+
+        // Reverse proxy: bodies are streamed both ways on this thread
+        proxy_route_t *route = proxy_match(req.path);
+        if (route) {
+            if (conn_flush(conn) < 0)
+                break;
+            batched = 0;
+
+            size_t bytes = 0;
+            conn->keep_alive = wants_keep_alive(&req, 1);
+            int status = proxy_serve(conn, &req, route, &bytes);
+            slowlog_phase(PHASE_UPSTREAM);
+            metrics_request(status, bytes, metrics_now_us() - start, 0);
+            slowlog_end(&timer, req.method, req.path, req.client_ip, status, 0);
+
+            served++;
+            if (!conn->keep_alive)
+                break;
+            continue;
+        }
+
+        http_response_t resp;
+        http_build_response(&req, &resp);
+        slowlog_phase(PHASE_OTHER);
+
+        // Unknown methods may carry a body we do not read
+        conn->keep_alive = wants_keep_alive(&req, 0) && resp.status != 501;
+        int sent = send_response_http1(conn, &resp) == 0;
+        slowlog_phase(PHASE_SEND);
+        metrics_request(resp.status, sent && !resp.head_only ? resp.body_len : 0,
+                        metrics_now_us() - start, 0);
+        slowlog_end(&timer, req.method, req.path, req.client_ip, resp.status, 0);
+        http_response_free(&resp);
+
+        served++;
+        batched++;
+
+        if (!conn->keep_alive)
+            break;
+    }
+
+    slowlog_cancel(&timer);
+    conn_flush(conn);
     conn_close(conn);
-}
\ No newline at end of file
+}
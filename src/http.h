@@ -2,24 +2,99 @@
 #define HTTP_H
 
 #include <stddef.h>
+#include <sys/types.h>
 #include "worker.h"  // For connection_t
+#include "mempool.h" // For arena_t
+#include "http_parser.h"
 
-// Structure with relevant fields of the HTTP request
+// Most header lines a request may have
+#define HTTP_MAX_HEADERS 100
+
+// A header as a view into the connection's input buffer
+typedef struct {
+    const char *name;
+    size_t name_len;
+    const char *value;      // NUL-terminated in place
+    size_t value_len;
+    http_header_id_t id;
+} http_header_t;
+
+// Structure with relevant fields of the HTTP request. The strings point
+// into the input buffer of the connection (HTTP/1, valid until the next
+// request is read) or into the stream's arena (HTTP/2). Never NULL: ""
+// when the header is absent
 typedef struct {
     char method[8];
-    char path[1024];
+    const char *path;
     char version[16];
 
-    char host[512];
-    char user_agent[512];
-    char accept[512];
+    const char *host;
+    const char *user_agent;
+    const char *accept;
+    const char *connection;
+    long content_length;   // -1 for a chunked body
+
+    http_header_t *headers; // Every header line (HTTP/1 only), in the arena
+    int nheaders;
 
-    char client_ip[64];
+    char client_ip[64];     // "unix:" for a Unix socket peer
+    int client_family;      // AF_INET, AF_INET6 or AF_UNIX
+    int is_https;           // Received over TLS (X-Forwarded-Proto)
 } http_request_t;
 
 
+// Response built by http_build_response, independent of the protocol
+// (sent as HTTP/1.1 text or as HTTP/2 frames)
+typedef struct {
+    int status;
+    const char *reason;
+    const char *content_type;
+    char headers[512];      // Extra header lines ("Name: value\r\n")
+    const char *body;       // Body in memory (cache entry or 'owned')
+    size_t body_len;        // Content-Length
+    char *owned;            // Buffer released by http_response_free
+    const char *cached;     // Cache entry pinned until http_response_free
+    int body_fd;            // Body read from this file instead (-1 if none)
+    int head_only;          // HEAD: headers only
+} http_response_t;
+
+
 // Main function called by each worker thread
 // Now receives connection_t instead of int
 void http_handle_request(connection_t* conn);
 
+// Parses the request line and headers of a connection in place; the
+// header table is allocated from 'arena' (exposed for the microbenchmarks)
+int parse_request_conn(connection_t* conn, http_request_t* req, arena_t* arena);
+
+// Content-Length value: digits only. Returns 0 with *len, -1 if malformed
+int http_parse_content_length(const char *value, long *len);
+
+// First header with a known name, NULL if absent
+const http_header_t* http_request_header(const http_request_t* req, http_header_id_t id);
+
+// Routes a request (API, static files through the cache, error pages);
+// updates stats and the access log
+void http_build_response(http_request_t* req, http_response_t* resp);
+
+// Per-client request rate: fills resp with a 429 and returns 1 if the
+// client is over its limit, 0 otherwise
+int http_rate_limited(const http_request_t* req, http_response_t* resp);
+
+// Builds an error page response (errors/<code>.html or a generic page)
+void http_build_error(int code, const char* msg, http_response_t* resp);
+
+// Releases the buffers/file owned by a response
+void http_response_free(http_response_t* resp);
+
+// Sends a response in HTTP/1.1 form right away (after anything batched)
+void http_send_response(connection_t* conn, const http_response_t* resp);
+
+// Raw connection I/O (TLS or plain), shared with the HTTP/2 code and the
+// stats stream. conn_write writes everything under the write deadline;
+// conn_close returns conn to the connection pool.
+ssize_t conn_read(connection_t* conn, void* buf, size_t len);
+ssize_t conn_write(connection_t* conn, const void* buf, size_t len);
+void conn_close(connection_t* conn);
+
 #endif
\ No newline at end of file
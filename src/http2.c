@@ -0,0 +1,1075 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+#include "http2.h"
+#include "http.h"
+#include "hpack.h"
+#include "config.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "stats.h"
+#include "shared_mem.h"
+#include "semaphores.h"
+#include "metrics.h"
+#include "slowlog.h"
+
+// External references to shared memory, semaphores and the timer wheel from worker.c
+extern shared_data_t* shm_data;
+extern ipc_semaphores_t sems;
+extern timer_wheel_t worker_wheel;
+
+// Frame types
+#define H2_DATA          0x0
+#define H2_HEADERS       0x1
+#define H2_PRIORITY      0x2
+#define H2_RST_STREAM    0x3
+#define H2_SETTINGS      0x4
+#define H2_PUSH_PROMISE  0x5
+#define H2_PING          0x6
+#define H2_GOAWAY        0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION  0x9
+
+// Frame flags
+#define H2_FLAG_END_STREAM  0x01
+#define H2_FLAG_ACK         0x01
+#define H2_FLAG_END_HEADERS 0x04
+#define H2_FLAG_PADDED      0x08
+#define H2_FLAG_PRIORITY    0x20
+
+// SETTINGS identifiers
+#define H2_SETTINGS_ENABLE_PUSH            0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE         0x5
+
+// Error codes
+#define H2_NO_ERROR           0x0
+#define H2_PROTOCOL_ERROR     0x1
+#define H2_INTERNAL_ERROR     0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED      0x5
+#define H2_FRAME_SIZE_ERROR   0x6
+#define H2_REFUSED_STREAM     0x7
+#define H2_COMPRESSION_ERROR  0x9
+#define H2_ENHANCE_YOUR_CALM  0xb
+
+#define H2_FRAME_HEADER_LEN  9
+#define H2_MAX_FRAME         16384              // Largest frame we accept and send
+#define H2_MAX_STREAMS       100                // SETTINGS_MAX_CONCURRENT_STREAMS
+#define H2_DEFAULT_WINDOW    65535
+#define H2_MAX_WINDOW        0x7fffffffL
+#define H2_DEFAULT_WEIGHT    16
+#define H2_HEADER_BLOCK_MAX  (64 * 1024)        // HEADERS + CONTINUATION
+#define H2_WRITE_BUDGET      (64 * 1024)        // DATA per round before checking input
+#define H2_STREAM_ARENA      1024               // Request strings of a stream
+#define H2_DRAIN_CHECK_MS    500                // Idle poll slice (worker draining?)
+
+typedef struct {
+    uint32_t id;
+    int remote_closed;          // END_STREAM received: the request is complete
+    int64_t send_window;
+
+    // Priority (RFC 7540, 5.3): dependency, weight and virtual finish time
+    uint32_t depends_on;
+    int weight;
+    uint64_t vtime;
+
+    http_request_t req;
+    int bad_request;
+    int has_length;             // content-length seen (duplicates must agree)
+    arena_t arena;              // Strings of 'req' (released with the stream)
+    char arena_buf[H2_STREAM_ARENA];
+
+    http_response_t resp;
+    unsigned long started_us;   // Request complete (for the duration histogram)
+    req_timer_t timer;          // Phases: handling, then sending
+    int has_response;
+    int headers_sent;
+    size_t body_off;
+} h2_stream_t;
+
+typedef struct {
+    connection_t *conn;
+    const char *client_ip;
+
+    uint8_t in[H2_FRAME_HEADER_LEN + H2_MAX_FRAME + 8192];
+    size_t in_len;
+    uint8_t out[H2_WRITE_BUDGET + H2_FRAME_HEADER_LEN + H2_MAX_FRAME];
+    size_t out_len;
+
+    hpack_table_t decoder;
+
+    int64_t send_window;            // Connection-level flow control
+    int64_t peer_initial_window;
+    uint32_t peer_max_frame;
+    uint32_t last_stream_id;
+
+    h2_stream_t *streams[H2_MAX_STREAMS];
+    int nstreams;
+    uint64_t vclock;                // Virtual time of the last scheduled stream
+
+    // Header block being assembled (HEADERS + CONTINUATION)
+    uint8_t *hblock;
+    size_t hblock_len;
+    uint32_t hblock_stream;
+    int hblock_end_stream;
+    int hblock_has_priority;
+    uint32_t hblock_dep;
+    int hblock_weight;
+    int hblock_exclusive;
+    int continuation;
+
+    int goaway_received;
+    int goaway_sent;                // Worker draining: no new streams
+    int error;                      // Connection error code, -1 if none
+} h2_conn_t;
+
+
+static uint32_t get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/**
+ * @brief Writes the pending frames with a single write.
+ * @return 0 on success, -1 on error.
+ */
+static int h2_flush(h2_conn_t *h) {
+    if (h->out_len == 0) return 0;
+
+    ssize_t n = conn_write(h->conn, h->out, h->out_len);
+    int ok = (n == (ssize_t)h->out_len);
+    h->out_len = 0;
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Reserves a frame in the output buffer and writes its header.
+ * @param len Payload length (at most H2_MAX_FRAME).
+ * @return Pointer to the payload, NULL on write error.
+ */
+static uint8_t *h2_frame(h2_conn_t *h, int type, int flags, uint32_t stream, size_t len) {
+    if (h->out_len + H2_FRAME_HEADER_LEN + len > sizeof(h->out) && h2_flush(h) < 0)
+        return NULL;
+
+    uint8_t *p = h->out + h->out_len;
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    put32(p + 5, stream & 0x7fffffff);
+
+    h->out_len += H2_FRAME_HEADER_LEN + len;
+    return p + H2_FRAME_HEADER_LEN;
+}
+
+static void send_rst(h2_conn_t *h, uint32_t stream, uint32_t code) {
+    uint8_t *p = h2_frame(h, H2_RST_STREAM, 0, stream, 4);
+    if (p) put32(p, code);
+}
+
+static void send_window_update(h2_conn_t *h, uint32_t stream, uint32_t increment) {
+    uint8_t *p = h2_frame(h, H2_WINDOW_UPDATE, 0, stream, 4);
+    if (p) put32(p, increment);
+}
+
+static void send_goaway(h2_conn_t *h, uint32_t code) {
+    uint8_t *p = h2_frame(h, H2_GOAWAY, 0, 0, 8);
+    if (p) {
+        put32(p, h->last_stream_id);
+        put32(p + 4, code);
+    }
+}
+
+static h2_stream_t *stream_find(h2_conn_t *h, uint32_t id) {
+    for (int i = 0; i < h->nstreams; i++)
+        if (h->streams[i]->id == id)
+            return h->streams[i];
+    return NULL;
+}
+
+/**
+ * @brief Opens a stream.
+ * @return The stream, NULL if SETTINGS_MAX_CONCURRENT_STREAMS is reached.
+ */
+static h2_stream_t *stream_new(h2_conn_t *h, uint32_t id) {
+    if (h->nstreams == H2_MAX_STREAMS)
+        return NULL;
+
+    h2_stream_t *s = calloc(1, sizeof(h2_stream_t));
+    if (!s) return NULL;
+
+    s->id = id;
+    s->send_window = h->peer_initial_window;
+    s->weight = H2_DEFAULT_WEIGHT;
+    s->vtime = h->vclock;
+    s->resp.body_fd = -1;
+
+    arena_init(&s->arena, s->arena_buf, sizeof(s->arena_buf));
+    s->req.path = s->req.host = s->req.user_agent = s->req.accept = s->req.connection = "";
+
+    h->streams[h->nstreams++] = s;
+    return s;
+}
+
+static void stream_free(h2_conn_t *h, h2_stream_t *s) {
+    for (int i = 0; i < h->nstreams; i++) {
+        if (h->streams[i] == s) {
+            h->streams[i] = h->streams[--h->nstreams];
+            break;
+        }
+    }
+
+    // Children of a closed stream move to its parent
+    for (int i = 0; i < h->nstreams; i++)
+        if (h->streams[i]->depends_on == s->id)
+            h->streams[i]->depends_on = s->depends_on;
+
+    if (s->has_response)
+        http_response_free(&s->resp);
+    slowlog_cancel(&s->timer);
+    arena_reset(&s->arena);
+    arena_destroy(&s->arena);
+    free(s);
+}
+
+/**
+ * @brief Closes a stream whose response was fully sent.
+ */
+static void stream_done(h2_conn_t *h, h2_stream_t *s) {
+    unsigned long now = metrics_now_us();
+    metrics_request(s->resp.status, s->resp.head_only ? 0 : s->resp.body_len,
+                    now - s->started_us, 1);
+    slowlog_phase_at(&s->timer, PHASE_SEND, now);
+    slowlog_end(&s->timer, s->req.method, s->req.path, s->req.client_ip, s->resp.status, 1);
+    stream_free(h, s);
+}
+
+static void stream_reset(h2_conn_t *h, h2_stream_t *s, uint32_t code) {
+    send_rst(h, s->id, code);
+    stream_free(h, s);
+}
+
+/**
+ * @brief Applies a priority (RFC 7540, 5.3.3): dependency, weight and the
+ *        exclusive flag, moving the new parent up if it depended on the stream.
+ */
+static void set_priority(h2_conn_t *h, h2_stream_t *s, uint32_t dep, int weight, int exclusive) {
+    // The new parent cannot be a descendant of the stream
+    h2_stream_t *p = stream_find(h, dep);
+    for (int guard = 0; p && guard < H2_MAX_STREAMS; guard++) {
+        if (p->depends_on == s->id) {
+            p->depends_on = s->depends_on;
+            break;
+        }
+        p = stream_find(h, p->depends_on);
+    }
+
+    if (exclusive) {
+        for (int i = 0; i < h->nstreams; i++) {
+            h2_stream_t *t = h->streams[i];
+            if (t != s && t->depends_on == dep)
+                t->depends_on = s->id;
+        }
+    }
+
+    s->depends_on = dep;
+    s->weight = weight;
+}
+
+/**
+ * @brief HPACK callback: fills the http_request_t of the stream.
+ */
+static void on_header(void *ctx, const char *name, const char *value) {
+    h2_stream_t *s = ctx;
+    if (!s) return;     // Refused stream or trailers: decoded only for the table
+
+    http_request_t *r = &s->req;
+
+    if (!strcmp(name, ":method"))
+        snprintf(r->method, sizeof(r->method), "%s", value);
+    else if (!strcmp(name, ":path"))
+        r->path = arena_strndup(&s->arena, value, strlen(value));
+    else if (!strcmp(name, ":authority") || !strcmp(name, "host"))
+        r->host = arena_strndup(&s->arena, value, strlen(value));
+    else if (!strcmp(name, "user-agent"))
+        r->user_agent = arena_strndup(&s->arena, value, strlen(value));
+    else if (!strcmp(name, "accept"))
+        r->accept = arena_strndup(&s->arena, value, strlen(value));
+    else if (!strcmp(name, "content-length")) {
+        long n = 0;
+        if (http_parse_content_length(value, &n) < 0 ||
+            (s->has_length && n != r->content_length))
+            s->bad_request = 1;     // Malformed or conflicting length
+        r->content_length = n;
+        s->has_length = 1;
+    }
+    else if (!strcmp(name, "connection") || !strcmp(name, "transfer-encoding") ||
+             (name[0] == ':' && strcmp(name, ":scheme")))
+        s->bad_request = 1;     // Connection-specific or unknown pseudo-header
+}
+
+/**
+ * @brief Builds the response of a complete request through the shared
+ *        HTTP/1 paths (router, cache, file serving, error pages).
+ */
+static void start_response(h2_conn_t *h, h2_stream_t *s) {
+    if (s->has_response) return;
+
+    s->started_us = metrics_now_us();
+    slowlog_begin(&s->timer, s->started_us);
+    http_request_t *r = &s->req;
+    snprintf(r->version, sizeof(r->version), "HTTP/2");
+    snprintf(r->client_ip, sizeof(r->client_ip), "%s", h->client_ip);
+    r->client_family = h->conn->peer.ss_family;
+    r->is_https = h->conn->is_https;
+
+    if (s->bad_request || !r->method[0] || !r->path[0]) {
+        memset(&s->resp, 0, sizeof(s->resp));
+        s->resp.body_fd = -1;
+        http_build_error(400, "Bad Request", &s->resp);
+    } else if (!http_rate_limited(r, &s->resp)) {
+        http_build_response(r, &s->resp);
+    }
+    s->has_response = 1;
+    slowlog_phase_at(&s->timer, PHASE_OTHER, metrics_now_us());
+
+    // File bodies are read into the DATA frames: only owned buffers count
+    if (!s->resp.head_only)
+        metrics_response_memory(s->resp.owned ? s->resp.body_len : 0);
+
+    TRACE_DEBUG(TRACE_HTTP, "HTTP/2 stream %u: %s %s -> %d", s->id,
+                r->method, r->path, s->resp.status);
+}
+
+/**
+ * @brief Decodes a complete header block and opens the stream.
+ * @return 0 on success, -1 on a connection error.
+ */
+static int complete_headers(h2_conn_t *h) {
+    uint32_t id = h->hblock_stream;
+    h2_stream_t *s = stream_find(h, id);
+    int trailers = (s != NULL);
+
+    if (!s) {
+        if (!(id & 1) || id <= h->last_stream_id) {
+            h->error = id <= h->last_stream_id ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        h->last_stream_id = id;
+        s = h->goaway_sent ? NULL : stream_new(h, id);
+        if (s && h->hblock_has_priority && h->hblock_dep != id)
+            set_priority(h, s, h->hblock_dep, h->hblock_weight, h->hblock_exclusive);
+    }
+
+    // Always decoded, even for refused streams, to keep the table in sync
+    int rc = hpack_decode(&h->decoder, h->hblock, h->hblock_len, on_header,
+                          trailers ? NULL : s);
+    h->hblock_len = 0;
+
+    if (rc < 0) {
+        h->error = H2_COMPRESSION_ERROR;
+        return -1;
+    }
+
+    if (!s) {
+        send_rst(h, id, H2_REFUSED_STREAM);
+        return 0;
+    }
+
+    if (h->hblock_has_priority && h->hblock_dep == id) {
+        stream_reset(h, s, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+
+    if (trailers && !h->hblock_end_stream) {
+        stream_reset(h, s, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+
+    if (h->hblock_end_stream) {
+        s->remote_closed = 1;
+        start_response(h, s);
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a header block fragment.
+ * @return 0 on success, -1 if the block is too large.
+ */
+static int append_fragment(h2_conn_t *h, const uint8_t *p, size_t n) {
+    if (h->hblock_len + n > H2_HEADER_BLOCK_MAX) {
+        h->error = H2_ENHANCE_YOUR_CALM;
+        return -1;
+    }
+    if (!h->hblock) {
+        h->hblock = malloc(H2_HEADER_BLOCK_MAX);
+        if (!h->hblock) {
+            h->error = H2_INTERNAL_ERROR;
+            return -1;
+        }
+    }
+    memcpy(h->hblock + h->hblock_len, p, n);
+    h->hblock_len += n;
+    return 0;
+}
+
+static int handle_headers(h2_conn_t *h, int flags, uint32_t stream, const uint8_t *p, size_t n) {
+    size_t pad = 0;
+
+    if (stream == 0) {
+        h->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    if (flags & H2_FLAG_PADDED) {
+        if (n < 1) goto protocol_error;
+        pad = p[0];
+        p++;
+        n--;
+    }
+
+    h->hblock_has_priority = 0;
+    if (flags & H2_FLAG_PRIORITY) {
+        if (n < 5) goto protocol_error;
+        uint32_t v = get32(p);
+        h->hblock_has_priority = 1;
+        h->hblock_exclusive = (v >> 31) & 1;
+        h->hblock_dep = v & 0x7fffffff;
+        h->hblock_weight = p[4] + 1;
+        p += 5;
+        n -= 5;
+    }
+
+    if (pad > n) goto protocol_error;
+    n -= pad;
+
+    h->hblock_stream = stream;
+    h->hblock_end_stream = flags & H2_FLAG_END_STREAM;
+    h->hblock_len = 0;
+
+    if (append_fragment(h, p, n) < 0)
+        return -1;
+
+    if (flags & H2_FLAG_END_HEADERS)
+        return complete_headers(h);
+
+    h->continuation = 1;
+    return 0;
+
+protocol_error:
+    h->error = H2_PROTOCOL_ERROR;
+    return -1;
+}
+
+static int handle_data(h2_conn_t *h, int flags, uint32_t stream, const uint8_t *p, size_t n) {
+    if (stream == 0) {
+        h->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    if ((flags & H2_FLAG_PADDED) && (n < 1 || p[0] >= n)) {
+        h->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    // The whole frame counts for flow control; give it back right away
+    if (n > 0)
+        send_window_update(h, 0, n);
+
+    h2_stream_t *s = stream_find(h, stream);
+    if (!s) {
+        if (stream > h->last_stream_id) {
+            h->error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        send_rst(h, stream, H2_STREAM_CLOSED);
+        return 0;
+    }
+
+    if (s->remote_closed) {
+        stream_reset(h, s, H2_STREAM_CLOSED);
+        return 0;
+    }
+
+    // Request bodies are not used (the router answers them with 501)
+    if (n > 0 && !(flags & H2_FLAG_END_STREAM))
+        send_window_update(h, stream, n);
+
+    if (flags & H2_FLAG_END_STREAM) {
+        s->remote_closed = 1;
+        start_response(h, s);
+    }
+    return 0;
+}
+
+static int handle_settings(h2_conn_t *h, int flags, uint32_t stream, const uint8_t *p, size_t n) {
+    if (stream != 0) {
+        h->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    if (flags & H2_FLAG_ACK) {
+        if (n != 0) {
+            h->error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (n % 6) {
+        h->error = H2_FRAME_SIZE_ERROR;
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i += 6) {
+        int id = (p[i] << 8) | p[i + 1];
+        uint32_t value = get32(p + i + 2);
+
+        switch (id) {
+            case H2_SETTINGS_ENABLE_PUSH:
+                if (value > 1) goto protocol_error;
+                break;
+
+            case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+                if (value > H2_MAX_WINDOW) {
+                    h->error = H2_FLOW_CONTROL_ERROR;
+                    return -1;
+                }
+                int64_t delta = (int64_t)value - h->peer_initial_window;
+                for (int k = 0; k < h->nstreams; k++) {
+                    h->streams[k]->send_window += delta;
+                    if (h->streams[k]->send_window > H2_MAX_WINDOW) {
+                        h->error = H2_FLOW_CONTROL_ERROR;
+                        return -1;
+                    }
+                }
+                h->peer_initial_window = value;
+                break;
+            }
+
+            case H2_SETTINGS_MAX_FRAME_SIZE:
+                if (value < 16384 || value > 16777215) goto protocol_error;
+                h->peer_max_frame = value;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    h2_frame(h, H2_SETTINGS, H2_FLAG_ACK, 0, 0);
+    return 0;
+
+protocol_error:
+    h->error = H2_PROTOCOL_ERROR;
+    return -1;
+}
+
+static int handle_window_update(h2_conn_t *h, uint32_t stream, const uint8_t *p, size_t n) {
+    if (n != 4) {
+        h->error = H2_FRAME_SIZE_ERROR;
+        return -1;
+    }
+
+    uint32_t inc = get32(p) & 0x7fffffff;
+
+    if (stream == 0) {
+        h->send_window += inc;
+        if (inc == 0 || h->send_window > H2_MAX_WINDOW) {
+            h->error = inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR;
+            return -1;
+        }
+        return 0;
+    }
+
+    h2_stream_t *s = stream_find(h, stream);
+    if (!s) return 0;
+
+    s->send_window += inc;
+    if (inc == 0)
+        stream_reset(h, s, H2_PROTOCOL_ERROR);
+    else if (s->send_window > H2_MAX_WINDOW)
+        stream_reset(h, s, H2_FLOW_CONTROL_ERROR);
+    return 0;
+}
+
+static int handle_priority(h2_conn_t *h, uint32_t stream, const uint8_t *p, size_t n) {
+    if (stream == 0) {
+        h->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+    if (n != 5) {
+        send_rst(h, stream, H2_FRAME_SIZE_ERROR);
+        return 0;
+    }
+
+    uint32_t v = get32(p);
+    uint32_t dep = v & 0x7fffffff;
+    h2_stream_t *s = stream_find(h, stream);
+
+    if (dep == stream) {
+        if (s) stream_reset(h, s, H2_PROTOCOL_ERROR);
+        else send_rst(h, stream, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+
+    // Priorities of idle/closed streams are not kept
+    if (s)
+        set_priority(h, s, dep, p[4] + 1, (v >> 31) & 1);
+    return 0;
+}
+
+/**
+ * @brief Handles one complete frame.
+ * @return 0 on success, -1 on a connection error (h->error set).
+ */
+static int handle_frame(h2_conn_t *h, int type, int flags, uint32_t stream,
+                        const uint8_t *p, size_t n) {
+    // A header block must be continued without interleaving (RFC 7540, 6.10)
+    if (h->continuation && (type != H2_CONTINUATION || stream != h->hblock_stream)) {
+        h->error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    switch (type) {
+        case H2_DATA:
+            return handle_data(h, flags, stream, p, n);
+
+        case H2_HEADERS:
+            return handle_headers(h, flags, stream, p, n);
+
+        case H2_CONTINUATION:
+            if (!h->continuation) {
+                h->error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            if (append_fragment(h, p, n) < 0)
+                return -1;
+            if (flags & H2_FLAG_END_HEADERS) {
+                h->continuation = 0;
+                return complete_headers(h);
+            }
+            return 0;
+
+        case H2_PRIORITY:
+            return handle_priority(h, stream, p, n);
+
+        case H2_RST_STREAM: {
+            if (stream == 0 || n != 4) {
+                h->error = stream == 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR;
+                return -1;
+            }
+            h2_stream_t *s = stream_find(h, stream);
+            if (s) stream_free(h, s);
+            return 0;
+        }
+
+        case H2_SETTINGS:
+            return handle_settings(h, flags, stream, p, n);
+
+        case H2_PING:
+            if (n != 8 || stream != 0) {
+                h->error = n != 8 ? H2_FRAME_SIZE_ERROR : H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            if (!(flags & H2_FLAG_ACK)) {
+                uint8_t *ack = h2_frame(h, H2_PING, H2_FLAG_ACK, 0, 8);
+                if (ack) memcpy(ack, p, 8);
+            }
+            return 0;
+
+        case H2_GOAWAY:
+            h->goaway_received = 1;
+            return 0;
+
+        case H2_WINDOW_UPDATE:
+            return handle_window_update(h, stream, p, n);
+
+        case H2_PUSH_PROMISE:
+            h->error = H2_PROTOCOL_ERROR;
+            return -1;
+
+        default:
+            return 0;   // Unknown frame types are ignored
+    }
+}
+
+/**
+ * @brief Handles every complete frame in the input buffer.
+ * @return 0 on success, -1 on a connection error.
+ */
+static int process_frames(h2_conn_t *h) {
+    size_t off = 0;
+
+    while (h->in_len - off >= H2_FRAME_HEADER_LEN) {
+        const uint8_t *f = h->in + off;
+        size_t len = ((size_t)f[0] << 16) | (f[1] << 8) | f[2];
+
+        if (len > H2_MAX_FRAME) {
+            h->error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        if (h->in_len - off < H2_FRAME_HEADER_LEN + len)
+            break;
+
+        if (handle_frame(h, f[3], f[4], get32(f + 5) & 0x7fffffff,
+                         f + H2_FRAME_HEADER_LEN, len) < 0)
+            return -1;
+
+        off += H2_FRAME_HEADER_LEN + len;
+    }
+
+    memmove(h->in, h->in + off, h->in_len - off);
+    h->in_len -= off;
+    return 0;
+}
+
+/**
+ * @brief Encodes and queues the HEADERS frame of a response.
+ * @return 1 if the stream is finished (no body), 0 otherwise, -1 on error.
+ */
+static int send_headers(h2_conn_t *h, h2_stream_t *s) {
+    http_response_t *r = &s->resp;
+    uint8_t block[2048];
+    char value[64];
+    size_t n = hpack_encode_status(block, r->status);
+
+    n += hpack_encode_header(block + n, sizeof(block) - n, "content-type", r->content_type);
+    snprintf(value, sizeof(value), "%zu", r->body_len);
+    n += hpack_encode_header(block + n, sizeof(block) - n, "content-length", value);
+
+    // Extra header lines "Name: value\r\n" (names lowercased, hop-by-hop dropped)
+    const char *line = r->headers;
+    while (*line) {
+        const char *colon = strchr(line, ':');
+        const char *eol = strstr(line, "\r\n");
+        if (!colon || !eol || colon > eol) break;
+
+        char name[64], val[256];
+        size_t nl = colon - line;
+        const char *v = colon + 1;
+        while (*v == ' ') v++;
+
+        if (nl < sizeof(name) && (size_t)(eol - v) < sizeof(val)) {
+            for (size_t i = 0; i < nl; i++)
+                name[i] = tolower((unsigned char)line[i]);
+            name[nl] = '\0';
+            memcpy(val, v, eol - v);
+            val[eol - v] = '\0';
+
+            if (strcmp(name, "connection") && strcmp(name, "keep-alive") &&
+                strcmp(name, "transfer-encoding"))
+                n += hpack_encode_header(block + n, sizeof(block) - n, name, val);
+        }
+        line = eol + 2;
+    }
+
+    int end = r->head_only || r->body_len == 0;
+    uint8_t *p = h2_frame(h, H2_HEADERS,
+                          H2_FLAG_END_HEADERS | (end ? H2_FLAG_END_STREAM : 0), s->id, n);
+    if (!p) return -1;
+    memcpy(p, block, n);
+
+    s->headers_sent = 1;
+    return end;
+}
+
+static int stream_sendable(const h2_conn_t *h, const h2_stream_t *s) {
+    (void)h;
+    return s->headers_sent && s->body_off < s->resp.body_len && s->send_window > 0;
+}
+
+/**
+ * @brief A stream only gets bandwidth when none of its ancestors can send
+ *        (RFC 7540, 5.3.1).
+ */
+static int ancestor_sendable(h2_conn_t *h, const h2_stream_t *s) {
+    uint32_t dep = s->depends_on;
+    for (int guard = 0; dep && guard < H2_MAX_STREAMS; guard++) {
+        h2_stream_t *p = stream_find(h, dep);
+        if (!p) break;
+        if (stream_sendable(h, p)) return 1;
+        dep = p->depends_on;
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues one DATA frame of a stream (memory or file body).
+ * @return 1 if the stream is finished, 0 otherwise, -1 on error.
+ */
+static int send_data(h2_conn_t *h, h2_stream_t *s, size_t chunk) {
+    http_response_t *r = &s->resp;
+    int last = (s->body_off + chunk == r->body_len);
+
+    uint8_t *p = h2_frame(h, H2_DATA, last ? H2_FLAG_END_STREAM : 0, s->id, chunk);
+    if (!p) return -1;
+
+    if (r->body) {
+        memcpy(p, r->body + s->body_off, chunk);
+    } else {
+        size_t got = 0;
+        while (got < chunk) {
+            ssize_t n = read(r->body_fd, p + got, chunk - got);
+            if (n <= 0) break;
+            got += n;
+        }
+        if (got < chunk) {
+            // File shrank under us: drop the frame and reset the stream
+            h->out_len -= H2_FRAME_HEADER_LEN + chunk;
+            stream_reset(h, s, H2_INTERNAL_ERROR);
+            return 1;
+        }
+    }
+
+    s->body_off += chunk;
+    s->send_window -= chunk;
+    h->send_window -= chunk;
+
+    // Weighted fair share among siblings: virtual time grows as 1/weight
+    h->vclock = s->vtime;
+    s->vtime += (uint64_t)chunk * 256 / s->weight;
+
+    if (last)
+        stream_done(h, s);
+    return last;
+}
+
+/**
+ * @brief Sends new response headers, then DATA by priority and weight within
+ *        the flow-control windows, up to H2_WRITE_BUDGET bytes, in one write.
+ * @return 0 on success, -1 on write error.
+ */
+static int write_round(h2_conn_t *h) {
+    for (int i = 0; i < h->nstreams; i++) {
+        h2_stream_t *s = h->streams[i];
+        if (!s->has_response || s->headers_sent)
+            continue;
+
+        int rc = send_headers(h, s);
+        if (rc < 0) return -1;
+        if (rc == 1 && s->remote_closed) {
+            stream_done(h, s);
+            i--;
+        }
+    }
+
+    size_t budget = H2_WRITE_BUDGET;
+
+    while (budget > 0 && h->send_window > 0) {
+        h2_stream_t *best = NULL;
+
+        for (int i = 0; i < h->nstreams; i++) {
+            h2_stream_t *s = h->streams[i];
+            if (!stream_sendable(h, s) || ancestor_sendable(h, s))
+                continue;
+            if (!best || s->vtime < best->vtime)
+                best = s;
+        }
+        if (!best) break;
+
+        size_t chunk = best->resp.body_len - best->body_off;
+        if (chunk > (size_t)best->send_window) chunk = best->send_window;
+        if (chunk > (size_t)h->send_window) chunk = h->send_window;
+        if (chunk > h->peer_max_frame) chunk = h->peer_max_frame;
+        if (chunk > H2_MAX_FRAME) chunk = H2_MAX_FRAME;
+        if (chunk > budget) chunk = budget;
+
+        if (send_data(h, best, chunk) < 0)
+            return -1;
+        budget -= chunk;
+    }
+
+    return h2_flush(h);
+}
+
+/**
+ * @brief Checks whether some response can still make progress right now.
+ */
+static int output_pending(h2_conn_t *h) {
+    for (int i = 0; i < h->nstreams; i++) {
+        h2_stream_t *s = h->streams[i];
+        if (s->has_response && !s->headers_sent)
+            return 1;
+        if (h->send_window > 0 && stream_sendable(h, s))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether responses are waiting for a WINDOW_UPDATE.
+ */
+static int output_blocked(h2_conn_t *h) {
+    for (int i = 0; i < h->nstreams; i++)
+        if (h->streams[i]->headers_sent && h->streams[i]->body_off < h->streams[i]->resp.body_len)
+            return 1;
+    return 0;
+}
+
+static int input_ready(h2_conn_t *h) {
+    if (h->conn->ssl && SSL_pending(h->conn->ssl) > 0)
+        return 1;
+    struct pollfd pfd = { .fd = h->conn->fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/**
+ * @brief Reads more bytes from the connection into the frame buffer.
+ * @return Bytes read, 0 if the peer closed, -1 on error.
+ */
+static ssize_t read_more(h2_conn_t *h) {
+    ssize_t n;
+    do {
+        n = conn_read(h->conn, h->in + h->in_len, sizeof(h->in) - h->in_len);
+    } while (n < 0 && errno == EINTR && !h->conn->ssl);
+
+    if (n > 0)
+        h->in_len += n;
+    return n;
+}
+
+/**
+ * @brief Serves an HTTP/2 connection: frames are read and handled by this
+ *        pool thread, responses are multiplexed by priority within the
+ *        flow-control windows. Returns when the connection must be closed.
+ * @param conn Connection structure (handshake done, preface maybe buffered).
+ * @param client_ip Client address for the access log.
+ */
+void http2_serve(connection_t *conn, const char *client_ip) {
+    h2_conn_t *h = calloc(1, sizeof(h2_conn_t));
+    if (!h) return;
+
+    h->conn = conn;
+    h->client_ip = client_ip;
+    h->send_window = H2_DEFAULT_WINDOW;
+    h->peer_initial_window = H2_DEFAULT_WINDOW;
+    h->peer_max_frame = H2_MAX_FRAME;
+    h->error = -1;
+    hpack_table_init(&h->decoder);
+
+    // Bytes the HTTP/1 path already read (preface)
+    size_t buffered = conn->in_len - conn->in_off;
+    memcpy(h->in, conn->in_buf + conn->in_off, buffered);
+    h->in_len = buffered;
+    conn->in_off = conn->in_len = 0;
+
+    // Frames are already batched per round: do not let Nagle hold back the
+    // last segment while the client waits for it to send WINDOW_UPDATE
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Server preface: our SETTINGS
+    uint8_t *p = h2_frame(h, H2_SETTINGS, 0, 0, 6);
+    p[0] = 0;
+    p[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(p + 2, H2_MAX_STREAMS);
+    if (h2_flush(h) < 0)
+        goto out;
+
+    // Client preface, under the header deadline
+    int timeout_ms = get_timeout_seconds() * 1000;
+    timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_HEADER, timeout_ms);
+    while (h->in_len < H2_PREFACE_LEN && read_more(h) > 0)
+        ;
+    timer_wheel_cancel(&worker_wheel, &conn->timer);
+
+    if (h->in_len < H2_PREFACE_LEN || memcmp(h->in, H2_PREFACE, H2_PREFACE_LEN)) {
+        TRACE_WARN(TRACE_HTTP, "HTTP/2: invalid connection preface");
+        h->error = H2_PROTOCOL_ERROR;
+        goto out;
+    }
+    memmove(h->in, h->in + H2_PREFACE_LEN, h->in_len - H2_PREFACE_LEN);
+    h->in_len -= H2_PREFACE_LEN;
+
+    TRACE_DEBUG(TRACE_HTTP, "HTTP/2 connection from %s (fd %d)", client_ip, conn->fd);
+
+    int idle_ms = get_keepalive_timeout_seconds() * 1000;
+    if (idle_ms <= 0) idle_ms = timeout_ms;
+
+    while (1) {
+        if (process_frames(h) < 0)
+            break;
+
+        // A retiring worker finishes the open streams and refuses new ones
+        if (!h->goaway_sent && worker_draining()) {
+            send_goaway(h, H2_NO_ERROR);
+            h->goaway_sent = 1;
+        }
+
+        if (write_round(h) < 0)
+            goto out;
+
+        if ((h->goaway_received || h->goaway_sent) && h->nstreams == 0)
+            break;
+
+        // Keep sending while there is output and the client has nothing to say
+        int pending = output_pending(h);
+        if (pending && !input_ready(h))
+            continue;
+
+        if (!pending && h->nstreams == 0 && !input_ready(h)) {
+            // Idle: waited here rather than on the wheel, so the TLS session
+            // is still usable to tell the client no more streams are accepted
+            // Polled in slices so a drain is noticed (GOAWAY at the loop top)
+            struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+            int ready = 0;
+            for (int waited = 0; waited < idle_ms && !ready && !worker_draining();
+                 waited += H2_DRAIN_CHECK_MS)
+                ready = poll(&pfd, 1, idle_ms - waited < H2_DRAIN_CHECK_MS ?
+                                      idle_ms - waited : H2_DRAIN_CHECK_MS);
+            if (ready == 0 && worker_draining())
+                continue;
+            if (ready == 0) {
+                if (shm_data)
+                    stats_timeout(&shm_data->stats, sems.sem_stats, TIMEOUT_IDLE);
+                h->error = H2_NO_ERROR;
+                break;
+            }
+        } else if (!pending) {
+            int kind = output_blocked(h) ? TIMEOUT_WRITE : TIMEOUT_HEADER;
+            timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, kind, timeout_ms);
+        }
+
+        ssize_t n = read_more(h);
+        timer_wheel_cancel(&worker_wheel, &conn->timer);
+
+        if (n <= 0)
+            break;
+    }
+
+    if (h->error >= 0) {
+        send_goaway(h, h->error);
+        h2_flush(h);
+    }
+
+out:
+    while (h->nstreams > 0)
+        stream_free(h, h->streams[0]);
+    hpack_table_free(&h->decoder);
+    free(h->hblock);
+    free(h);
+}
@@ -0,0 +1,21 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stddef.h>
+#include "worker.h"  // For connection_t
+
+// ------------------------------------------------------------
+// HTTP/2 (RFC 7540): negotiated with ALPN "h2" on the HTTPS port, or
+// with prior knowledge (h2c, H2C=on) on the plain port
+// ------------------------------------------------------------
+
+// Connection preface sent by every HTTP/2 client
+#define H2_PREFACE     "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+// Serves an HTTP/2 connection until the client closes it, an error occurs
+// or it stays idle for KEEPALIVE_TIMEOUT_SECONDS. Bytes already read into
+// conn->in_buf (the preface) are consumed first. The caller closes conn.
+void http2_serve(connection_t *conn, const char *client_ip);
+
+#endif
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+#include "http_parser.h"
+
+const http_charset_t HTTP_CS_EOL   = { .chars = "\n", .n = 1, .map = { ['\n'] = 1 } };
+const http_charset_t HTTP_CS_SPACE = { .chars = " ",  .n = 1, .map = { [' '] = 1 } };
+const http_charset_t HTTP_CS_COLON = { .chars = ":",  .n = 1, .map = { [':'] = 1 } };
+
+// ------------------------------------------------------------
+// Scanners
+// ------------------------------------------------------------
+static size_t scan_scalar(const char *p, size_t len, const http_charset_t *set) {
+    for (size_t i = 0; i < len; i++)
+        if (set->map[(unsigned char)p[i]])
+            return i;
+    return len;
+}
+
+#ifdef HTTP_SCAN_X86
+/**
+ * @brief SSE4.2: PCMPESTRI compares 16 input bytes against the whole set.
+ */
+__attribute__((target("sse4.2")))
+static size_t scan_sse42(const char *p, size_t len, const http_charset_t *set) {
+    const __m128i needles = _mm_load_si128((const __m128i *)set->chars);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+        int idx = _mm_cmpestri(needles, set->n, chunk, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                               _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+            return i + idx;
+    }
+    return i + scan_scalar(p + i, len - i, set);
+}
+
+/**
+ * @brief AVX2: one compare per delimiter over 32 bytes, then a bit scan.
+ */
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *p, size_t len, const http_charset_t *set) {
+    __m256i needles[16];
+    for (int k = 0; k < set->n; k++)
+        needles[k] = _mm256_set1_epi8(set->chars[k]);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hit = _mm256_cmpeq_epi8(chunk, needles[0]);
+        for (int k = 1; k < set->n; k++)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(chunk, needles[k]));
+
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scan_scalar(p + i, len - i, set);
+}
+#endif
+
+typedef size_t (*scan_fn)(const char *, size_t, const http_charset_t *);
+
+static size_t scan_resolve(const char *p, size_t len, const http_charset_t *set);
+
+// Replaced by the chosen implementation on the first scan (or by
+// http_scan_select at startup); a racing first call just resolves twice
+static scan_fn scan_impl = scan_resolve;
+static const char *scan_name = "scalar";
+
+static size_t scan_resolve(const char *p, size_t len, const http_charset_t *set) {
+    http_scan_select("auto");
+    return scan_impl(p, len, set);
+}
+
+/**
+ * @brief Finds the first byte of a delimiter set.
+ * @param p Bytes to scan.
+ * @param len Number of bytes.
+ * @param set Delimiters.
+ * @return Offset of the first delimiter, or len if there is none.
+ */
+size_t http_scan(const char *p, size_t len, const http_charset_t *set) {
+    return __atomic_load_n(&scan_impl, __ATOMIC_RELAXED)(p, len, set);
+}
+
+/**
+ * @brief Selects the scanner implementation.
+ * @param impl "auto" (best available), "avx2", "sse4.2" or "off" (scalar).
+ * @return 0 on success, -1 if the CPU does not support it.
+ */
+int http_scan_select(const char *impl) {
+    scan_fn fn = scan_scalar;
+    const char *name = "scalar";
+    int is_auto = !impl || !strcasecmp(impl, "auto");
+
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if ((is_auto || !strcasecmp(impl, "avx2")) && __builtin_cpu_supports("avx2")) {
+        fn = scan_avx2;
+        name = "avx2";
+    } else if ((is_auto || !strcasecmp(impl, "sse4.2")) && __builtin_cpu_supports("sse4.2")) {
+        fn = scan_sse42;
+        name = "sse4.2";
+    } else
+#endif
+    if (!is_auto && strcasecmp(impl, "off") && strcasecmp(impl, "scalar")) {
+        return -1;
+    }
+
+    scan_name = name;
+    __atomic_store_n(&scan_impl, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief Gets the name of the scanner in use.
+ * @return "avx2", "sse4.2" or "scalar".
+ */
+const char *http_scan_impl(void) {
+    if (__atomic_load_n(&scan_impl, __ATOMIC_RELAXED) == scan_resolve)
+        http_scan_select("auto");
+    return scan_name;
+}
+
+// ------------------------------------------------------------
+// Known header names, grouped by length
+// ------------------------------------------------------------
+typedef struct {
+    const char *name;
+    http_header_id_t id;
+} known_header_t;
+
+static const known_header_t known_headers[] = {
+    { "te",                HTTP_HDR_TE },                   // 2
+    { "host",              HTTP_HDR_HOST },                 // 4
+    { "vary",              HTTP_HDR_VARY },
+    { "range",             HTTP_HDR_RANGE },                // 5
+    { "accept",            HTTP_HDR_ACCEPT },               // 6
+    { "cookie",            HTTP_HDR_COOKIE },
+    { "expect",            HTTP_HDR_EXPECT },
+    { "referer",           HTTP_HDR_REFERER },              // 7
+    { "upgrade",           HTTP_HDR_UPGRADE },
+    { "user-agent",        HTTP_HDR_USER_AGENT },           // 10
+    { "connection",        HTTP_HDR_CONNECTION },
+    { "keep-alive",        HTTP_HDR_KEEP_ALIVE },
+    { "set-cookie",        HTTP_HDR_SET_COOKIE },
+    { "content-type",      HTTP_HDR_CONTENT_TYPE },         // 12
+    { "if-none-match",     HTTP_HDR_IF_NONE_MATCH },        // 13
+    { "authorization",     HTTP_HDR_AUTHORIZATION },
+    { "cache-control",     HTTP_HDR_CACHE_CONTROL },
+    { "content-length",    HTTP_HDR_CONTENT_LENGTH },       // 14
+    { "accept-encoding",   HTTP_HDR_ACCEPT_ENCODING },      // 15
+    { "accept-language",   HTTP_HDR_ACCEPT_LANGUAGE },
+    { "x-forwarded-for",   HTTP_HDR_X_FORWARDED_FOR },
+    { "proxy-connection",  HTTP_HDR_PROXY_CONNECTION },     // 16
+    { "transfer-encoding", HTTP_HDR_TRANSFER_ENCODING },    // 17
+    { "if-modified-since", HTTP_HDR_IF_MODIFIED_SINCE },
+};
+
+#define KNOWN_MAX_LEN 17
+
+// known_headers[first .. first+count) have the length of the index
+static const struct { unsigned char first, count; } by_len[KNOWN_MAX_LEN + 1] = {
+    [2]  = { 0, 1 },  [4]  = { 1, 2 },  [5]  = { 3, 1 },  [6]  = { 4, 3 },
+    [7]  = { 7, 2 },  [10] = { 9, 4 },  [12] = { 13, 1 }, [13] = { 14, 3 },
+    [14] = { 17, 1 }, [15] = { 18, 3 }, [16] = { 21, 1 }, [17] = { 22, 2 },
+};
+
+/**
+ * @brief Resolves a header name to its id.
+ * @param name Header name (not NUL-terminated).
+ * @param len Length of the name.
+ * @return Id of a known header, HTTP_HDR_OTHER otherwise.
+ */
+http_header_id_t http_header_lookup(const char *name, size_t len) {
+    if (len == 0 || len > KNOWN_MAX_LEN)
+        return HTTP_HDR_OTHER;
+
+    int first = tolower((unsigned char)name[0]);
+    for (int i = by_len[len].first; i < by_len[len].first + by_len[len].count; i++) {
+        const known_header_t *k = &known_headers[i];
+        if (k->name[0] == first && !strncasecmp(name, k->name, len))
+            return k->id;
+    }
+    return HTTP_HDR_OTHER;
+}
+
+// ------------------------------------------------------------
+// Chunked transfer coding
+// ------------------------------------------------------------
+enum {
+    CHUNK_SIZE = 0,     // Hex digits of the size line
+    CHUNK_EXT,          // Extensions (or CR) up to the end of the size line
+    CHUNK_DATA,         // 'size' bytes of data
+    CHUNK_DATA_END,     // CRLF after the data
+    CHUNK_TRAILER,      // Start of a trailer line (empty line: end)
+    CHUNK_TRAILER_LINE, // Rest of a trailer line
+    CHUNK_TRAILER_CR    // CR of the final empty line
+};
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Follows the framing of a chunked body over the next bytes.
+ * @param c Framing state (zero-initialized before the first call).
+ * @param p Bytes of the body.
+ * @param len Number of bytes.
+ * @return Bytes that belong to the body (less than len once it ends; c->done
+ *         is set then), -1 if the framing is malformed.
+ */
+ssize_t http_chunked_scan(http_chunked_t *c, const char *p, size_t len) {
+    size_t i = 0;
+
+    while (i < len && !c->done) {
+        char ch = p[i];
+
+        switch (c->state) {
+            case CHUNK_SIZE: {
+                int v = hex_value(ch);
+                if (v >= 0) {
+                    if (c->size >> 60)
+                        return -1;      // Absurd chunk size
+                    c->size = c->size * 16 + v;
+                    c->digits++;
+                    i++;
+                    break;
+                }
+                if (c->digits == 0)
+                    return -1;
+                c->state = CHUNK_EXT;
+                break;      // The delimiter is handled as an extension
+            }
+
+            case CHUNK_EXT:
+                i++;
+                if (ch == '\n') {
+                    c->state = c->size ? CHUNK_DATA : CHUNK_TRAILER;
+                    c->digits = 0;
+                }
+                break;
+
+            case CHUNK_DATA: {
+                size_t n = len - i;
+                if (n > c->size) n = c->size;
+                i += n;
+                c->size -= n;
+                if (c->size == 0)
+                    c->state = CHUNK_DATA_END;
+                break;
+            }
+
+            case CHUNK_DATA_END:
+                i++;
+                if (ch == '\n')
+                    c->state = CHUNK_SIZE;
+                else if (ch != '\r')
+                    return -1;
+                break;
+
+            case CHUNK_TRAILER:
+                i++;
+                if (ch == '\n')
+                    c->done = 1;
+                else
+                    c->state = (ch == '\r') ? CHUNK_TRAILER_CR : CHUNK_TRAILER_LINE;
+                break;
+
+            case CHUNK_TRAILER_LINE:
+                i++;
+                if (ch == '\n')
+                    c->state = CHUNK_TRAILER;
+                break;
+
+            case CHUNK_TRAILER_CR:
+                i++;
+                if (ch != '\n')
+                    return -1;
+                c->done = 1;
+                break;
+        }
+    }
+    return i;
+}
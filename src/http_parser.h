@@ -0,0 +1,83 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// ------------------------------------------------------------
+// Building blocks of the HTTP/1 request parser
+// ------------------------------------------------------------
+// http_scan finds the first byte of a set (line feeds, spaces, colons) with
+// AVX2 or SSE4.2 when the CPU has them, and with a byte loop otherwise. The
+// implementation is picked once at startup (HTTP_PARSER_SIMD) or on the
+// first scan. Header names are resolved through a table of known names so
+// the request path compares ids instead of strings.
+
+// Set of delimiters (at most 16). 'map' is the scalar lookup table
+typedef struct {
+    char chars[16] __attribute__((aligned(16)));
+    int n;
+    unsigned char map[256];
+} http_charset_t;
+
+extern const http_charset_t HTTP_CS_EOL;     // '\n'
+extern const http_charset_t HTTP_CS_SPACE;   // ' '
+extern const http_charset_t HTTP_CS_COLON;   // ':'
+
+// Offset of the first byte of p[0..len) that belongs to 'set', len if none
+size_t http_scan(const char *p, size_t len, const http_charset_t *set);
+
+// Selects the scanner: "auto", "avx2", "sse4.2" or "off" (scalar).
+// Returns 0, or -1 if the CPU lacks it (the previous choice is kept)
+int http_scan_select(const char *impl);
+
+// Name of the scanner in use ("avx2", "sse4.2" or "scalar")
+const char *http_scan_impl(void);
+
+// Header names known to the server (HTTP_HDR_OTHER for the rest)
+typedef enum {
+    HTTP_HDR_OTHER = 0,
+    HTTP_HDR_HOST,
+    HTTP_HDR_USER_AGENT,
+    HTTP_HDR_ACCEPT,
+    HTTP_HDR_ACCEPT_ENCODING,
+    HTTP_HDR_ACCEPT_LANGUAGE,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_CONTENT_TYPE,
+    HTTP_HDR_TRANSFER_ENCODING,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_IF_MODIFIED_SINCE,
+    HTTP_HDR_RANGE,
+    HTTP_HDR_REFERER,
+    HTTP_HDR_COOKIE,
+    HTTP_HDR_UPGRADE,
+    HTTP_HDR_X_FORWARDED_FOR,
+    HTTP_HDR_TE,
+    HTTP_HDR_EXPECT,
+    HTTP_HDR_KEEP_ALIVE,
+    HTTP_HDR_SET_COOKIE,
+    HTTP_HDR_AUTHORIZATION,
+    HTTP_HDR_CACHE_CONTROL,
+    HTTP_HDR_PROXY_CONNECTION,
+    HTTP_HDR_VARY,
+    HTTP_HDR_COUNT
+} http_header_id_t;
+
+// Case-insensitive lookup of a header name (not NUL-terminated)
+http_header_id_t http_header_lookup(const char *name, size_t len);
+
+// Framing of a chunked body (RFC 7230 4.1), followed byte by byte so that
+// the body can be relayed unchanged and its end found. Zero-initialize
+typedef struct {
+    int state;
+    unsigned long long size;    // Bytes left in the current chunk
+    int digits;                 // Hex digits of the chunk size line
+    int done;                   // Last chunk and trailers consumed
+} http_chunked_t;
+
+// Consumes bytes of a chunked body: returns how many of p[0..len) belong to
+// it (fewer than len once it ends), -1 if the framing is malformed
+ssize_t http_chunked_scan(http_chunked_t *c, const char *p, size_t len);
+
+#endif
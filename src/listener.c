@@ -0,0 +1,453 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "listener.h"
+#include "config.h"
+#include "trace.h"
+
+/**
+ * @brief Reads an integer sysctl from /proc/sys.
+ * @return The value, -1 if it cannot be read.
+ */
+static long read_sysctl(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long v = -1;
+    if (fscanf(f, "%ld", &v) != 1) v = -1;
+    fclose(f);
+    return v;
+}
+
+// Listener addresses opened at startup (compared on reload)
+static char opened[2 * LISTENER_MAX][300];
+static int num_opened = 0;
+
+// Unix socket files created by this process (removed by listener_cleanup)
+static char unix_paths[2 * LISTENER_MAX][sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int num_unix = 0;
+
+typedef struct {
+    char addr[256];     // host:port, [v6]:port, *:port or unix:<path>
+    int https;
+    int v6only;
+    mode_t mode;        // Unix socket file permissions
+} listen_spec_t;
+
+/**
+ * @brief Parses one LISTEN line.
+ * @param line "<address> [https] [ipv6only] [mode=<octal>]".
+ * @param spec Parsed listener.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int parse_spec(const char *line, listen_spec_t *spec) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", line);
+
+    memset(spec, 0, sizeof(*spec));
+    spec->mode = 0660;
+
+    char *save = NULL;
+    char *tok = strtok_r(copy, " \t", &save);
+    if (!tok) return -1;
+    snprintf(spec->addr, sizeof(spec->addr), "%s", tok);
+
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+        if (!strcmp(tok, "https"))
+            spec->https = 1;
+        else if (!strcmp(tok, "ipv6only"))
+            spec->v6only = 1;
+        else if (!strncmp(tok, "mode=", 5))
+            spec->mode = (mode_t)strtol(tok + 5, NULL, 8);
+        else
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Listeners of the configuration: the LISTEN lines, plus *:PORT or
+ *        *:HTTPS_PORT for a protocol that has none.
+ * @return Number of listeners, -1 on a syntax error.
+ */
+static int config_specs(listen_spec_t *specs, int max) {
+    int n = 0, has[2] = {0, 0};
+
+    for (int i = 0; i < get_listen_count() && n < max; i++) {
+        if (parse_spec(get_listen(i), &specs[n]) != 0) {
+            fprintf(stderr, "[MASTER] LISTEN inválido: %s\n", get_listen(i));
+            return -1;
+        }
+        has[specs[n].https] = 1;
+        n++;
+    }
+
+    for (int https = 0; https <= 1 && n < max; https++) {
+        if (has[https]) continue;
+        memset(&specs[n], 0, sizeof(specs[n]));
+        snprintf(specs[n].addr, sizeof(specs[n].addr), "*:%d",
+                 https ? get_https_port() : get_server_port());
+        specs[n].https = https;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Canonical text of a listener (reload comparison).
+ */
+static void spec_name(const listen_spec_t *spec, char *buf, size_t len) {
+    snprintf(buf, len, "%s%s%s mode=%o", spec->addr, spec->https ? " https" : "",
+             spec->v6only ? " ipv6only" : "", (unsigned)spec->mode);
+}
+
+/**
+ * @brief Creates a TCP listening socket (SO_REUSEADDR) bound to a
+ *        host:port, [v6]:port or *:port address.
+ * @return Socket, -1 on error.
+ */
+static int open_tcp(const listen_spec_t *spec) {
+    char host[256];
+    const char *port;
+
+    snprintf(host, sizeof(host), "%s", spec->addr);
+    if (host[0] == '[') {
+        char *end = strchr(host, ']');
+        if (!end || end[1] != ':') return -1;
+        *end = '\0';
+        port = end + 2;
+        memmove(host, host + 1, strlen(host));
+    } else {
+        char *colon = strrchr(host, ':');
+        if (!colon) return -1;
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    memset(&ss, 0, sizeof(ss));
+
+    if (!strcmp(host, "*") || !host[0]) {
+        // Wildcard: IPv6 dual-stack when the host has IPv6
+        int probe = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe >= 0) {
+            close(probe);
+            struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&ss;
+            a6->sin6_family = AF_INET6;
+            a6->sin6_addr = in6addr_any;
+            a6->sin6_port = htons(atoi(port));
+            sslen = sizeof(*a6);
+        } else {
+            struct sockaddr_in *a4 = (struct sockaddr_in *)&ss;
+            a4->sin_family = AF_INET;
+            a4->sin_addr.s_addr = INADDR_ANY;
+            a4->sin_port = htons(atoi(port));
+            sslen = sizeof(*a4);
+        }
+    } else {
+        struct addrinfo hints = {0}, *res = NULL;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+        int rc = getaddrinfo(host, port, &hints, &res);
+        if (rc != 0) {
+            fprintf(stderr, "[MASTER] %s: %s\n", spec->addr, gai_strerror(rc));
+            return -1;
+        }
+        memcpy(&ss, res->ai_addr, res->ai_addrlen);
+        sslen = res->ai_addrlen;
+        freeaddrinfo(res);
+    }
+
+    int fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if (ss.ss_family == AF_INET6) {
+        int v6only = spec->v6only;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+
+    if (bind(fd, (struct sockaddr *)&ss, sslen) < 0) {
+        fprintf(stderr, "[MASTER] bind %s: %s\n", spec->addr, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Creates a Unix stream listening socket. A stale socket file left
+ *        by a previous run is replaced; one that still accepts is not.
+ * @return Socket, -1 on error.
+ */
+static int open_unix(const listen_spec_t *spec) {
+    const char *path = spec->addr + 5;
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+
+    if (!path[0] || strlen(path) >= sizeof(sa.sun_path) || num_unix >= 2 * LISTENER_MAX) {
+        fprintf(stderr, "[MASTER] %s: caminho inválido\n", spec->addr);
+        return -1;
+    }
+    memcpy(sa.sun_path, path, strlen(path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+            fprintf(stderr, "[MASTER] %s: já está em uso\n", spec->addr);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "[MASTER] bind %s: %s\n", spec->addr, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    snprintf(unix_paths[num_unix++], sizeof(unix_paths[0]), "%s", path);
+
+    if (chmod(path, spec->mode) < 0)
+        fprintf(stderr, "[MASTER] chmod %s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+/**
+ * @brief Applies the backlog, TCP_DEFER_ACCEPT and TCP_FASTOPEN to a
+ *        listener (at startup and again on reload).
+ * @param fd Listening socket.
+ * @return 0 on success, -1 if listen() failed.
+ */
+static int listener_configure(int fd) {
+    int backlog = get_listen_backlog();
+    long somaxconn = read_sysctl("/proc/sys/net/core/somaxconn");
+    if (somaxconn > 0 && backlog > somaxconn)
+        TRACE_WARN(TRACE_MASTER, "LISTEN_BACKLOG=%d capped by net.core.somaxconn=%ld",
+                   backlog, somaxconn);
+
+    // On a listening socket, listen() again only changes the backlog
+    if (listen(fd, backlog) < 0) {
+        perror("listen");
+        return -1;
+    }
+
+    struct sockaddr_storage ss;
+    socklen_t sslen = sizeof(ss);
+    if (getsockname(fd, (struct sockaddr *)&ss, &sslen) < 0 || ss.ss_family == AF_UNIX)
+        return 0;
+
+    int defer = get_tcp_defer_accept_seconds();
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer)) < 0)
+        TRACE_WARN(TRACE_MASTER, "TCP_DEFER_ACCEPT: %s", strerror(errno));
+
+    int qlen = get_tcp_fastopen();
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0 && qlen > 0)
+        TRACE_WARN(TRACE_MASTER, "TCP_FASTOPEN: %s", strerror(errno));
+    else if (qlen > 0 && !(read_sysctl("/proc/sys/net/ipv4/tcp_fastopen") & 2))
+        TRACE_WARN(TRACE_MASTER, "TCP_FASTOPEN=%d has no effect: net.ipv4.tcp_fastopen "
+                   "does not enable the server side", qlen);
+    return 0;
+}
+
+/**
+ * @brief Opens the listeners of both protocols from LISTEN (or PORT and
+ *        HTTPS_PORT).
+ * @param http Receives the HTTP listeners.
+ * @param https Receives the HTTPS listeners.
+ */
+void listener_open_all(listener_set_t *http, listener_set_t *https) {
+    listen_spec_t specs[2 * LISTENER_MAX];
+    int n = config_specs(specs, 2 * LISTENER_MAX);
+    if (n < 0)
+        exit(1);
+
+    http->count = https->count = 0;
+    num_opened = 0;
+
+    for (int i = 0; i < n; i++) {
+        listener_set_t *set = specs[i].https ? https : http;
+        if (set->count >= LISTENER_MAX) {
+            fprintf(stderr, "[MASTER] Demasiados listeners, %s ignorado\n", specs[i].addr);
+            continue;
+        }
+
+        int is_unix = !strncmp(specs[i].addr, "unix:", 5);
+        int fd = is_unix ? open_unix(&specs[i]) : open_tcp(&specs[i]);
+        if (fd < 0 || listener_configure(fd) < 0)
+            exit(1);
+
+        // Non-blocking: workers poll() the shared listener and may lose the
+        // race for a connection to another worker (accept() -> EAGAIN)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+        set->fds[set->count++] = fd;
+        spec_name(&specs[i], opened[num_opened++], sizeof(opened[0]));
+        printf("[MASTER] %s aberto em %s\n", specs[i].https ? "HTTPS" : "HTTP ",
+               specs[i].addr);
+    }
+}
+
+/**
+ * @brief Re-applies the listener options on reload. Listeners are inherited
+ *        by the workers, so added or removed addresses need a restart.
+ * @param http HTTP listeners.
+ * @param https HTTPS listeners.
+ */
+void listener_reload(listener_set_t *http, listener_set_t *https) {
+    for (int i = 0; i < http->count; i++)
+        listener_configure(http->fds[i]);
+    for (int i = 0; i < https->count; i++)
+        listener_configure(https->fds[i]);
+
+    listen_spec_t specs[2 * LISTENER_MAX];
+    int n = config_specs(specs, 2 * LISTENER_MAX);
+    int changed = (n != num_opened);
+
+    for (int i = 0; i < n && !changed; i++) {
+        char name[sizeof(opened[0])];
+        spec_name(&specs[i], name, sizeof(name));
+        changed = strcmp(name, opened[i]) != 0;
+    }
+
+    if (changed)
+        fprintf(stderr, "[MASTER] Reload: mudança de listeners ignorada (listeners mantidos)\n");
+}
+
+/**
+ * @brief Closes the listeners of a set.
+ * @param set Listeners (emptied).
+ */
+void listener_close_all(listener_set_t *set) {
+    for (int i = 0; i < set->count; i++)
+        close(set->fds[i]);
+    set->count = 0;
+}
+
+/**
+ * @brief Removes the Unix socket files created by listener_open_all
+ *        (master, at exit).
+ */
+void listener_cleanup(void) {
+    for (int i = 0; i < num_unix; i++)
+        unlink(unix_paths[i]);
+    num_unix = 0;
+}
+
+/**
+ * @brief Accepts one pending connection.
+ * @param listen_fd Listening socket (non-blocking).
+ * @param addr Receives the peer address.
+ * @param len In: size of addr, out: size of the peer address.
+ * @return Client socket (blocking, close-on-exec), -1 with errno set.
+ */
+int listener_accept(int listen_fd, struct sockaddr *addr, socklen_t *len) {
+    int fd = accept4(listen_fd, addr, len, SOCK_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (get_tcp_nodelay() && addr->sa_family != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+/**
+ * @brief Formats the address of a client.
+ * @param addr Peer address from accept().
+ * @param buf Receives the address text.
+ * @param len Size of buf.
+ */
+void listener_peer_name(const struct sockaddr *addr, char *buf, size_t len) {
+    if (addr->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)addr)->sin_addr, buf, len);
+    } else if (addr->sa_family == AF_INET6) {
+        const struct in6_addr *a6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+        // IPv4 client of a dual-stack listener (::ffff:a.b.c.d)
+        if (IN6_IS_ADDR_V4MAPPED(a6))
+            inet_ntop(AF_INET, &a6->s6_addr[12], buf, len);
+        else
+            inet_ntop(AF_INET6, a6, buf, len);
+    } else if (addr->sa_family == AF_UNIX) {
+        snprintf(buf, len, "unix:");
+    } else {
+        snprintf(buf, len, "-");
+    }
+}
+
+/**
+ * @brief Corks or uncorks a client socket; uncorking sends the partial
+ *        segment that was held back.
+ * @param fd Client socket.
+ * @param on 1 to hold partial segments, 0 to release them.
+ */
+void listener_cork(int fd, int on) {
+    if (get_tcp_cork())
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+/**
+ * @brief Reads the accept queue counters of the host.
+ * @param overflows Receives TcpExt ListenOverflows (accept queue full).
+ * @param drops Receives TcpExt ListenDrops (every SYN or ACK dropped by a
+ *              listener, overflows included).
+ * @return 0 on success, -1 if /proc/net/netstat is unavailable.
+ */
+int listener_netstat(long *overflows, long *drops) {
+    FILE *f = fopen("/proc/net/netstat", "r");
+    if (!f) return -1;
+
+    // Pairs of lines: "TcpExt: <names>" then "TcpExt: <values>"
+    char names[4096], values[4096];
+    int found = -1;
+
+    while (fgets(names, sizeof(names), f) && fgets(values, sizeof(values), f)) {
+        if (strncmp(names, "TcpExt:", 7) != 0)
+            continue;
+
+        char *ns = NULL, *vs = NULL;
+        char *n = strtok_r(names + 7, " \n", &ns);
+        char *v = strtok_r(values + 7, " \n", &vs);
+        *overflows = *drops = 0;
+
+        while (n && v) {
+            if (!strcmp(n, "ListenOverflows"))
+                *overflows = atol(v);
+            else if (!strcmp(n, "ListenDrops"))
+                *drops = atol(v);
+            n = strtok_r(NULL, " \n", &ns);
+            v = strtok_r(NULL, " \n", &vs);
+        }
+        found = 0;
+        break;
+    }
+
+    fclose(f);
+    return found;
+}
@@ -0,0 +1,59 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+// ------------------------------------------------------------
+// Listening sockets and TCP options of client sockets
+// ------------------------------------------------------------
+// LISTEN=<address> [https] [ipv6only] [mode=<octal>], one line per
+// listener. <address> is host:port (IPv4 literal or name), [v6addr]:port,
+// *:port (IPv6 dual-stack, or IPv4 if the host has no IPv6) or
+// unix:<path> (stream socket, file mode 0660 unless mode= is given).
+// Without a LISTEN line for a protocol, it listens on *:PORT (HTTP) or
+// *:HTTPS_PORT (HTTPS).
+// The master opens the listeners (LISTEN_BACKLOG, TCP_DEFER_ACCEPT,
+// TCP_FASTOPEN) and re-applies the options on reload; listen() on an open
+// listener only changes its backlog, while new or removed listeners need a
+// restart. Workers poll every listener of their protocol, accept in
+// batches (ACCEPT_BATCH) with accept4 and set TCP_NODELAY on each TCP
+// connection. Responses written in several parts are corked (TCP_CORK), so
+// the header does not leave alone in a short segment ahead of the body.
+
+#define LISTENER_MAX 8      // Per protocol
+
+// Listening sockets of one protocol (HTTP or HTTPS)
+typedef struct {
+    int fds[LISTENER_MAX];
+    int count;
+} listener_set_t;
+
+// Opens the listeners of both protocols (exits on error)
+void listener_open_all(listener_set_t *http, listener_set_t *https);
+
+// Reload: re-applies the options to the open listeners and warns when the
+// configured addresses changed (they are kept until a restart)
+void listener_reload(listener_set_t *http, listener_set_t *https);
+
+// Closes a set (the master also removes its Unix socket files)
+void listener_close_all(listener_set_t *set);
+void listener_cleanup(void);
+
+// Accepts one connection (close-on-exec, TCP_NODELAY as configured).
+// Returns the socket, -1 with errno set (EAGAIN: queue empty)
+int listener_accept(int listen_fd, struct sockaddr *addr, socklen_t *len);
+
+// Client address for logs and X-Forwarded-For: IPv4 (also for IPv4-mapped
+// IPv6 peers), IPv6, or "unix:" for a Unix socket peer
+void listener_peer_name(const struct sockaddr *addr, char *buf, size_t len);
+
+// Holds (on = 1) or releases (on = 0) partial segments of a client socket;
+// no-op with TCP_CORK=off
+void listener_cork(int fd, int on);
+
+// Host-wide accept queue counters from /proc/net/netstat (TcpExt
+// ListenOverflows and ListenDrops). Returns 0, -1 if unavailable
+int listener_netstat(long *overflows, long *drops);
+
+#endif
@@ -7,6 +7,8 @@
 #include "stats.h"
 #include "cache.h"
 #include "master.h"
+#include "trace.h"
+#include "http_parser.h"
 
 
 /**
@@ -22,12 +24,22 @@ int main(void) {
         return 1;
     }
 
+    trace_init(get_trace_level(), get_trace_categories());
+
     printf("Starting HTTP server with:\n");
     printf("- Workers: %d\n", get_num_workers());
-    printf("- Threads per worker: %d\n", get_threads_per_worker());
+    printf("- Threads per worker: %d..%d\n", get_threads_min_per_worker(), get_threads_per_worker());
     printf("- Document root: %s\n", get_document_root());
     printf("- Cache: %d MB\n", get_cache_size_mb());
 
+    // Workers inherit the scanner chosen here
+    if (http_scan_select(get_http_parser_simd()) != 0) {
+        fprintf(stderr, "HTTP_PARSER_SIMD=%s not supported by this CPU, using auto\n",
+                get_http_parser_simd());
+        http_scan_select("auto");
+    }
+    printf("- HTTP parser: %s\n", http_scan_impl());
+
     // 2. Start Logger
     logger_init();
 
@@ -10,6 +10,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <sys/prctl.h>
 
 #include "config.h"
 #include "shared_mem.h"
@@ -17,89 +18,143 @@
 #include "worker.h"
 #include "logger.h"
 #include "cache.h"
+#include "mime.h"
+#include "proxy.h"
+#include "vhost.h"
+#include "listener.h"
+#include "slowlog.h"
+#include "history.h"
 #include "ssl.h"
+#include "trace.h"
 
 // GLOBAL SSL CONTEXT (VISÍVEL NOS WORKERS)
 ssl_server_ctx_t *global_ssl_ctx = NULL;
 
+// Shared memory (defined in worker.c, created here by the master)
+extern shared_data_t* shm_data;
+
+// Signal flags (set by the handlers, handled by the wait loop)
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
 // ================================================================
-// função de criação de socket com bind() + listen()
+//             INICIALIZAÇÃO DO MASTER PROCESS
 // ================================================================
-static int create_listener(int port)
+static void master_init(void)
 {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        perror("socket");
+    logger_init();
+    cache_init(get_cache_size_mb());
+    mime_load(get_mime_types_file());
+    proxy_load();
+    vhost_load();
+    shm_data = shm_create_master();
+    if (!shm_data) {
+        fprintf(stderr, "[MASTER] Erro ao criar memória partilhada\n");
         exit(1);
     }
 
-    int yes = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    // Workers forked by old workers on reload are re-parented to the
+    // master when their parent exits, so wait() keeps seeing every worker
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+}
 
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
 
-    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        exit(1);
-    }
+// ================================================================
+//                 LANÇAR WORKERS (HTTP + HTTPS)
+// ================================================================
+static void spawn_worker(int slot, listener_set_t *http, listener_set_t *https)
+{
+    fflush(stdout);   // não duplicar output pendente no filho
+
+    pid_t pid = fork();
 
-    if (listen(fd, 256) < 0) {
-        perror("listen");
+    if (pid < 0) {
+        perror("fork");
         exit(1);
     }
 
-    return fd;
-}
+    if (pid == 0) {
+        // FILHO = WORKER
+
+        // fecha listeners que não usa
+        // este worker servirá APENAS HTTP ou APENAS HTTPS
+        if (slot % 2 == 0) {
+            listener_close_all(https);
+            worker_main(http, 0, slot);    // worker HTTP
+        } else {
+            listener_close_all(http);
+            worker_main(https, 1, slot);   // worker HTTPS
+        }
 
+        exit(0);
+    }
 
-// ================================================================
-//             INICIALIZAÇÃO DO MASTER PROCESS
-// ================================================================
-static void master_init(void)
-{
-    logger_init();
-    cache_init(get_cache_size_mb());
-    shm_create_master();
+    // Registar já o PID (o worker volta a escrevê-lo ao arrancar)
+    if (shm_data) {
+        shm_data->workers[slot].pid = pid;
+        shm_data->workers[slot].is_https = slot % 2;
+        shm_data->workers[slot].generation = shm_data->generation;
+        shm_data->workers[slot].state = WORKER_STATE_RUNNING;
+    }
 }
 
-
-// ================================================================
-//                 LANÇAR WORKERS (HTTP + HTTPS)
-// ================================================================
-static void launch_workers(int listen_http, int listen_https)
+static void launch_workers(listener_set_t *http, listener_set_t *https)
 {
     int n = get_num_workers();
 
     printf("[MASTER] A lançar %d workers...\n", n);
 
-    for (int i = 0; i < n; i++) {
-
-        pid_t pid = fork();
-
-        if (pid < 0) {
-            perror("fork");
-            exit(1);
-        }
+    for (int i = 0; i < n; i++)
+        spawn_worker(i, http, https);
+}
 
-        if (pid == 0) {
-            // FILHO = WORKER
-
-            // fecha listeners que não usa
-            // este worker servirá APENAS HTTP ou APENAS HTTPS
-            if (i % 2 == 0) {
-                close(listen_https);
-                worker_main(listen_http, 0);   // worker HTTP
-            } else {
-                close(listen_http);
-                worker_main(listen_https, 1);  // worker HTTPS
-            }
 
-            exit(0);
+// ================================================================
+// RELOAD (SIGHUP)
+// ================================================================
+// Existing slots get SIGHUP: the worker forks its own successor (which
+// inherits the listener and its warm cache) and then drains. Slots that
+// no longer exist get SIGTERM (drain only) and new slots are forked here.
+static int reload_workers(int old_n, listener_set_t *http, listener_set_t *https)
+{
+    if (load_config("server.conf") < 0) {
+        fprintf(stderr, "[MASTER] Reload: erro ao ler server.conf, configuração mantida\n");
+        return old_n;
+    }
+    trace_init(get_trace_level(), get_trace_categories());
+    mime_load(get_mime_types_file());    // For the slots forked below
+    proxy_load();
+    vhost_load();
+
+    // Backlog, defer-accept and Fast Open of the listeners kept
+    listener_reload(http, https);
+
+    int new_n = get_num_workers();
+    if (new_n > MAX_WORKERS) new_n = MAX_WORKERS;
+    if (new_n < 1) new_n = 1;
+
+    shm_data->generation++;
+
+    printf("[MASTER] Reload (geração %d): %d -> %d workers\n",
+           shm_data->generation, old_n, new_n);
+
+    int max_n = old_n > new_n ? old_n : new_n;
+    for (int i = 0; i < max_n; i++) {
+        worker_slot_t *ws = &shm_data->workers[i];
+
+        if (i < old_n && i < new_n && ws->pid > 0) {
+            kill(ws->pid, SIGHUP);
+        } else if (i < old_n) {
+            if (ws->pid > 0)
+                kill(ws->pid, SIGTERM);
+            ws->state = WORKER_STATE_DRAINING;
+        } else {
+            spawn_worker(i, http, https);
         }
     }
+
+    return new_n;
 }
 
 
@@ -109,7 +164,19 @@ static void launch_workers(int listen_http, int listen_https)
 static void sigint_handler(int sig)
 {
     (void)sig;
-    printf("\n[MASTER] Encerrando servidor...\n");
+    stop_requested = 1;
+}
+
+static void sighup_handler(int sig)
+{
+    (void)sig;
+    reload_requested = 1;
+}
+
+static void sigusr1_handler(int sig)
+{
+    (void)sig;
+    dump_requested = 1;
 }
 
 
@@ -124,9 +191,6 @@ int master_start(void)
         return 1;
     }
 
-    int http_port  = get_server_port();
-    int https_port = get_https_port();
-
     printf("[MASTER] ========================================\n");
     printf("[MASTER] Servidor Web com SSL/HTTPS\n");
     printf("[MASTER] ========================================\n");
@@ -142,12 +206,9 @@ int master_start(void)
         return 1;
     }
 
-    // 2) Criar sockets
-    int listen_http  = create_listener(http_port);
-    int listen_https = create_listener(https_port);
-
-    printf("[MASTER] HTTP  aberto em 0.0.0.0:%d\n", http_port);
-    printf("[MASTER] HTTPS aberto em 0.0.0.0:%d\n", https_port);
+    // 2) Criar sockets (LISTEN, ou PORT e HTTPS_PORT)
+    listener_set_t listen_http, listen_https;
+    listener_open_all(&listen_http, &listen_https);
 
     // 3) Carregar SSL_CERT e SSL_KEY
     const char *cert = get_ssl_cert();
@@ -166,26 +227,73 @@ int master_start(void)
     }
 
     // 4) Lançar workers
-    launch_workers(listen_http, listen_https);
-
-    signal(SIGINT, sigint_handler);
-    signal(SIGTERM, sigint_handler);
-
-    printf("[MASTER] Servidor a correr. Prima CTRL+C para parar.\n");
+    int num_workers = get_num_workers();
+    if (num_workers > MAX_WORKERS) num_workers = MAX_WORKERS;
+    launch_workers(&listen_http, &listen_https);
+
+    // Sem SA_RESTART: wait() é interrompido para tratar os sinais
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = sigint_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = sighup_handler;
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = sigusr1_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    // Amostragem por segundo para /api/stats/history
+    history_start();
+
+    printf("[MASTER] Servidor a correr. Prima CTRL+C para parar, SIGHUP para recarregar.\n");
+    printf("[MASTER] SIGUSR1 mostra os pedidos lentos.\n");
     printf("[MASTER] ========================================\n");
 
     // 5) MASTER espera pelos workers
+    int stopping = 0;
     while (1) {
+        if (stop_requested && !stopping) {
+            printf("\n[MASTER] Encerrando servidor...\n");
+            stopping = 1;
+            for (int i = 0; i < num_workers; i++) {
+                if (shm_data->workers[i].pid > 0)
+                    kill(shm_data->workers[i].pid, SIGTERM);
+            }
+        }
+
+        if (reload_requested) {
+            reload_requested = 0;
+            if (!stopping)
+                num_workers = reload_workers(num_workers, &listen_http, &listen_https);
+        }
+
+        if (dump_requested) {
+            dump_requested = 0;
+            slowlog_dump(stdout);
+        }
+
         int status;
         pid_t p = wait(&status);
-        if (p < 0) break;
+        if (p < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < MAX_WORKERS; i++) {
+            if (shm_data->workers[i].pid == p) {
+                shm_data->workers[i].pid = 0;
+                shm_data->workers[i].state = WORKER_STATE_EMPTY;
+            }
+        }
         printf("[MASTER] Worker %d terminou\n", p);
     }
 
     printf("[MASTER] A limpar recursos...\n");
 
-    close(listen_http);
-    close(listen_https);
+    listener_close_all(&listen_http);
+    listener_close_all(&listen_https);
+    listener_cleanup();
 
     logger_cleanup();
     cache_cleanup();
@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memgov.h"
+#include "cache.h"
+#include "cache_arena.h"
+#include "config.h"
+#include "mempool.h"
+#include "metrics.h"
+#include "shared_mem.h"
+#include "trace.h"
+
+// Shared memory of this process (worker.c)
+extern shared_data_t* shm_data;
+
+#define MB (1024UL * 1024)
+
+// cgroup v2 directory of this process ("" if there is no unified hierarchy)
+static char cgroup_root[64];
+static char cgroup_dir[PATH_MAX];
+static pthread_once_t cgroup_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int running;
+    int stopping;
+    thread_pool_t *pool;
+} gov = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/**
+ * @brief Finds the cgroup v2 directory of this process: the "0::" line of
+ *        /proc/self/cgroup under the unified mount (/sys/fs/cgroup, or
+ *        /sys/fs/cgroup/unified on hybrid hosts).
+ */
+static void discover_cgroup(void) {
+    static const char *roots[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+    char line[PATH_MAX], path[PATH_MAX + 64];
+
+    for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+        snprintf(path, sizeof(path), "%s/cgroup.controllers", roots[i]);
+        if (access(path, R_OK) == 0) {
+            snprintf(cgroup_root, sizeof(cgroup_root), "%s", roots[i]);
+            break;
+        }
+    }
+    if (!cgroup_root[0])
+        return;
+
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) {
+        cgroup_root[0] = '\0';
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) != 0)
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+        const char *rel = line + 3;
+        snprintf(cgroup_dir, sizeof(cgroup_dir), "%s%s", cgroup_root,
+                 strcmp(rel, "/") ? rel : "");
+        break;
+    }
+    fclose(f);
+
+    if (!cgroup_dir[0])
+        cgroup_root[0] = '\0';
+}
+
+/**
+ * @brief Reads a cgroup file holding a number or "max".
+ * @return 0 with the number in *value, 1 for "max", -1 if unreadable.
+ */
+static int read_limit_file(const char *dir, const char *name, unsigned long *value) {
+    char path[PATH_MAX + 64], text[64];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char *ok = fgets(text, sizeof(text), f);
+    fclose(f);
+
+    if (!ok) return -1;
+    if (!strncmp(text, "max", 3)) return 1;
+    *value = strtoul(text, NULL, 10);
+    return 0;
+}
+
+/**
+ * @brief "some avg10" of a PSI file.
+ * @return Percent of time stalled on memory, -1 if unreadable.
+ */
+static double read_psi(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[256];
+    double avg10 = -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "some avg10=%lf", &avg10) == 1)
+            break;
+    fclose(f);
+    return avg10;
+}
+
+/**
+ * @brief Resident memory of a process, from /proc/<pid>/statm.
+ */
+static unsigned long process_rss(int pid) {
+    char path[64];
+    unsigned long size, resident;
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * (unsigned long)sysconf(_SC_PAGESIZE) : 0;
+}
+
+/**
+ * @brief Adds up the resident memory of the processes serving worker slots.
+ */
+static unsigned long workers_rss(void) {
+    unsigned long total = 0;
+    if (!shm_data) return 0;
+
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        worker_slot_t *ws = &shm_data->workers[i];
+        int pid = __atomic_load_n(&ws->pid, __ATOMIC_RELAXED);
+        if (pid > 0 && __atomic_load_n(&ws->state, __ATOMIC_RELAXED) != WORKER_STATE_EMPTY)
+            total += process_rss(pid);
+    }
+    return total;
+}
+
+/**
+ * @brief Reads the memory in use, the limit and the memory pressure. With
+ *        cgroup v2 the limit is the tightest memory.max (highest usage
+ *        ratio) of the server's cgroup and its ancestors.
+ * @param r Receives the reading.
+ */
+void memgov_read(memgov_reading_t *r) {
+    pthread_once(&cgroup_once, discover_cgroup);
+
+    r->source = "none";
+    r->limit_bytes = 0;
+    r->usage_bytes = 0;
+
+    if (get_memory_limit_mb() > 0) {
+        r->source = "config";
+        r->limit_bytes = (unsigned long)get_memory_limit_mb() * MB;
+        r->usage_bytes = workers_rss();
+    } else if (cgroup_dir[0]) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", cgroup_dir);
+        size_t root_len = strlen(cgroup_root);
+
+        read_limit_file(dir, "memory.current", &r->usage_bytes);
+        while (strlen(dir) >= root_len) {
+            unsigned long max, current;
+            if (read_limit_file(dir, "memory.max", &max) == 0 && max > 0 &&
+                read_limit_file(dir, "memory.current", &current) == 0 &&
+                (!r->limit_bytes ||
+                 (double)current / max > (double)r->usage_bytes / r->limit_bytes)) {
+                r->source = "cgroup";
+                r->limit_bytes = max;
+                r->usage_bytes = current;
+            }
+
+            char *slash = strrchr(dir, '/');
+            if (!slash || (size_t)(slash - dir) < root_len)
+                break;
+            *slash = '\0';
+        }
+    }
+    if (!r->usage_bytes)
+        r->usage_bytes = workers_rss();
+
+    r->psi_some_avg10 = -1;
+    if (cgroup_dir[0]) {
+        char path[PATH_MAX + 64];
+        snprintf(path, sizeof(path), "%s/memory.pressure", cgroup_dir);
+        r->psi_some_avg10 = read_psi(path);
+    }
+    if (r->psi_some_avg10 < 0)
+        r->psi_some_avg10 = read_psi("/proc/pressure/memory");
+}
+
+/**
+ * @brief Shrinks the cache and the pools of this worker.
+ * @param r Reading that triggered the step (for the log).
+ */
+static void shrink(const memgov_reading_t *r) {
+    size_t budget = cache_get_budget();
+    size_t floor = (size_t)get_cache_size_mb() * MB / 8;
+    size_t target = budget - budget / 4;
+    if (target < floor)
+        target = floor;
+    if (target < budget)
+        cache_set_budget(target);
+
+    thread_pool_trim(gov.pool);
+    size_t released = conn_pool_trim() + cache_arena_trim();
+    malloc_trim(0);
+    metrics_memgov(1);
+
+    TRACE_INFO(TRACE_WORKER, "Worker %d: memory pressure (%lu of %lu MB, PSI %.2f): "
+               "cache %zu -> %zu KB, %zu KB released", getpid(),
+               r->usage_bytes / MB, r->limit_bytes / MB, r->psi_some_avg10,
+               budget / 1024, target / 1024, released / 1024);
+}
+
+/**
+ * @brief Grows the cache budget back towards CACHE_SIZE_MB.
+ */
+static void grow(void) {
+    size_t budget = cache_get_budget();
+    size_t full = (size_t)get_cache_size_mb() * MB;
+    if (budget >= full)
+        return;
+
+    size_t target = budget + full / 16;
+    if (target > full)
+        target = full;
+    cache_set_budget(target);
+    metrics_memgov(0);
+
+    TRACE_DEBUG(TRACE_WORKER, "Worker %d: cache budget grew to %zu KB", getpid(), target / 1024);
+}
+
+/**
+ * @brief One governor step: shrink under pressure, grow back after
+ *        MEMGOV_GROW_AFTER calm seconds.
+ * @param calm Consecutive calm steps (updated).
+ */
+static void govern(int *calm) {
+    memgov_reading_t r;
+    memgov_read(&r);
+
+    double psi_limit = get_memory_psi_percent();
+    int high = r.limit_bytes && r.usage_bytes * 100.0 >= r.limit_bytes * (double)get_memory_high_percent();
+    int low = !r.limit_bytes || r.usage_bytes * 100.0 < r.limit_bytes * (double)get_memory_low_percent();
+    int stalled = psi_limit > 0 && r.psi_some_avg10 >= psi_limit;
+    int quiet = psi_limit <= 0 || r.psi_some_avg10 < psi_limit / 2;
+
+    if (high || stalled) {
+        shrink(&r);
+        *calm = 0;
+    } else if (low && quiet) {
+        if (++*calm >= MEMGOV_GROW_AFTER)
+            grow();
+    } else {
+        *calm = 0;
+    }
+}
+
+static void *governor_thread(void *arg) {
+    (void)arg;
+    int calm = 0;
+
+    pthread_mutex_lock(&gov.mutex);
+    while (!gov.stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += MEMGOV_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (long)(MEMGOV_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&gov.cond, &gov.mutex, &deadline) != ETIMEDOUT)
+            continue;
+
+        pthread_mutex_unlock(&gov.mutex);
+        govern(&calm);
+        pthread_mutex_lock(&gov.mutex);
+    }
+    pthread_mutex_unlock(&gov.mutex);
+    return NULL;
+}
+
+/**
+ * @brief Starts the memory governor of this worker (MEMORY_GOVERNOR=on).
+ * @param pool Thread pool trimmed under pressure.
+ * @return 0 on success (or disabled), -1 if the thread could not start.
+ */
+int memgov_start(thread_pool_t *pool) {
+    if (!get_memory_governor())
+        return 0;
+
+    gov.pool = pool;
+    gov.stopping = 0;
+    if (pthread_create(&gov.thread, NULL, governor_thread, NULL) != 0)
+        return -1;
+    gov.running = 1;
+
+    memgov_reading_t r;
+    memgov_read(&r);
+    TRACE_INFO(TRACE_WORKER, "Worker %d: memory governor on (limit %lu MB from %s, PSI %s)",
+               getpid(), r.limit_bytes / MB, r.source, r.psi_some_avg10 >= 0 ? "on" : "off");
+    return 0;
+}
+
+/**
+ * @brief Stops the governor thread.
+ */
+void memgov_stop(void) {
+    if (!gov.running) return;
+
+    pthread_mutex_lock(&gov.mutex);
+    gov.stopping = 1;
+    pthread_cond_signal(&gov.cond);
+    pthread_mutex_unlock(&gov.mutex);
+
+    pthread_join(gov.thread, NULL);
+    gov.running = 0;
+}
+
+/**
+ * @brief Writes the "memory" object of /api/stats: the governor's reading
+ *        and the memory of each subsystem added over the running workers
+ *        (thread stacks are the reserved size, not the touched pages).
+ * @param buf Output buffer.
+ * @param size Size of the buffer.
+ * @return Length of the object, as snprintf.
+ */
+int memgov_render_json(char *buf, size_t size) {
+    memgov_reading_t r;
+    memgov_read(&r);
+
+    unsigned long rss = 0, cache = 0, budget = 0, arena = 0, conns = 0, stacks = 0;
+    unsigned long shrinks = 0, grows = 0;
+
+    size_t stack_size = 0;
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) == 0) {
+        pthread_attr_getstacksize(&attr, &stack_size);
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int i = 0; shm_data && i < MAX_WORKERS; i++) {
+        worker_slot_t *ws = &shm_data->workers[i];
+        const worker_metrics_t *m = &ws->metrics;
+        int pid = __atomic_load_n(&ws->pid, __ATOMIC_RELAXED);
+        if (pid <= 0 || __atomic_load_n(&ws->state, __ATOMIC_RELAXED) == WORKER_STATE_EMPTY)
+            continue;
+
+        rss += process_rss(pid);
+        cache += __atomic_load_n(&m->cache_bytes, __ATOMIC_RELAXED);
+        budget += __atomic_load_n(&m->cache_budget_bytes, __ATOMIC_RELAXED);
+        arena += __atomic_load_n(&m->cache_arena_bytes, __ATOMIC_RELAXED);
+        conns += __atomic_load_n(&m->conn_pool_slabs, __ATOMIC_RELAXED) *
+                 CONN_POOL_SLAB * sizeof(connection_t);
+        stacks += __atomic_load_n(&m->pool_threads, __ATOMIC_RELAXED) * stack_size;
+        shrinks += __atomic_load_n(&m->memgov_shrinks_total, __ATOMIC_RELAXED);
+        grows += __atomic_load_n(&m->memgov_grows_total, __ATOMIC_RELAXED);
+    }
+
+    return snprintf(buf, size,
+        "{\n"
+        "    \"governor\": \"%s\",\n"
+        "    \"limit_source\": \"%s\",\n"
+        "    \"limit_bytes\": %lu,\n"
+        "    \"usage_bytes\": %lu,\n"
+        "    \"psi_some_avg10\": %.2f,\n"
+        "    \"workers_rss_bytes\": %lu,\n"
+        "    \"cache_bytes\": %lu,\n"
+        "    \"cache_budget_bytes\": %lu,\n"
+        "    \"cache_arena_bytes\": %lu,\n"
+        "    \"conn_pool_bytes\": %lu,\n"
+        "    \"thread_stack_bytes\": %lu,\n"
+        "    \"governor_shrinks\": %lu,\n"
+        "    \"governor_grows\": %lu\n"
+        "  }",
+        get_memory_governor() ? "on" : "off", r.source, r.limit_bytes, r.usage_bytes,
+        r.psi_some_avg10, rss, cache, budget, arena, conns, stacks, shrinks, grows);
+}
@@ -0,0 +1,47 @@
+#ifndef MEMGOV_H
+#define MEMGOV_H
+
+#include <stddef.h>
+
+#include "thread_pool.h"
+
+// ------------------------------------------------------------
+// Memory governor
+// ------------------------------------------------------------
+// Each worker runs a thread that once a second compares the memory in use
+// with the limit: the cgroup v2 memory.current / memory.max of the server
+// (the tightest of its cgroup and the ancestors), or MEMORY_LIMIT_MB
+// against the RSS of the workers. It also reads PSI memory pressure (some
+// avg10) from the cgroup's memory.pressure or /proc/pressure/memory.
+//   - Usage above MEMORY_HIGH_PERCENT, or pressure above MEMORY_PSI_PERCENT:
+//     the cache budget drops by a quarter (down to 1/8 of CACHE_SIZE_MB),
+//     idle pool threads exit, idle connection buffers and the free 2 MB
+//     pages of the cache arena are released, and malloc_trim() runs.
+//   - Usage below MEMORY_LOW_PERCENT with little pressure for
+//     MEMGOV_GROW_AFTER seconds: the budget grows back by 1/16 of
+//     CACHE_SIZE_MB per second.
+// /api/stats shows the readings and the memory of each subsystem.
+
+#define MEMGOV_INTERVAL_MS 1000
+#define MEMGOV_GROW_AFTER  10       // Calm seconds before the cache grows
+
+// Memory in use against the limit, and memory pressure
+typedef struct {
+    const char *source;             // "cgroup", "config" or "none" (no limit)
+    unsigned long limit_bytes;
+    unsigned long usage_bytes;
+    double psi_some_avg10;          // Percent, -1 without PSI
+} memgov_reading_t;
+
+// Worker: starts the governor of this process over its cache and pool
+int memgov_start(thread_pool_t *pool);
+void memgov_stop(void);
+
+// Reads the current usage, limit and pressure
+void memgov_read(memgov_reading_t *r);
+
+// Writes the "memory" object of /api/stats (readings and memory of each
+// subsystem over the workers). Returns the length, as snprintf
+int memgov_render_json(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mempool.h"
+#include "metrics.h"
+#include "trace.h"
+
+struct arena_chunk {
+    arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+
+/**
+ * @brief Initializes an arena.
+ * @param a Arena.
+ * @param buf Block to allocate from, or NULL to malloc one.
+ * @param size Size of the block.
+ * @return 0 on success, -1 if the block cannot be allocated.
+ */
+int arena_init(arena_t *a, void *buf, size_t size) {
+    memset(a, 0, sizeof(*a));
+    a->external = (buf != NULL);
+    a->base = buf ? buf : malloc(size);
+    if (!a->base) return -1;
+    a->size = size;
+    return 0;
+}
+
+static void free_overflow(arena_t *a) {
+    while (a->overflow) {
+        arena_chunk_t *next = a->overflow->next;
+        free(a->overflow);
+        a->overflow = next;
+    }
+}
+
+/**
+ * @brief Releases the memory of an arena.
+ * @param a Arena.
+ */
+void arena_destroy(arena_t *a) {
+    free_overflow(a);
+    if (!a->external)
+        free(a->base);
+    a->base = NULL;
+    a->size = a->used = 0;
+}
+
+/**
+ * @brief Forgets every allocation of the arena. O(1) unless the request did
+ *        not fit in the block (the overflow chunks are freed then).
+ * @param a Arena.
+ */
+void arena_reset(arena_t *a) {
+    size_t used = a->used;
+    int overflowed = (a->overflow != NULL);
+
+    for (arena_chunk_t *c = a->overflow; c; c = c->next)
+        used += c->used;
+    if (used > 0)
+        metrics_arena(used, overflowed);
+
+    if (overflowed)
+        free_overflow(a);
+    a->used = 0;
+}
+
+/**
+ * @brief Allocates from the arena (8-byte aligned).
+ * @param a Arena.
+ * @param n Bytes.
+ * @return Pointer valid until the next arena_reset, NULL if out of memory.
+ */
+void *arena_alloc(arena_t *a, size_t n) {
+    n = ALIGN8(n);
+
+    if (a->used + n <= a->size) {
+        void *p = a->base + a->used;
+        a->used += n;
+        return p;
+    }
+
+    arena_chunk_t *c = a->overflow;
+    if (!c || c->used + n > c->size) {
+        size_t size = n > a->size ? n : a->size;
+        c = malloc(sizeof(arena_chunk_t) + size);
+        if (!c) return NULL;
+        c->size = size;
+        c->used = 0;
+        c->next = a->overflow;
+        a->overflow = c;
+    }
+
+    void *p = c->data + c->used;
+    c->used += n;
+    return p;
+}
+
+/**
+ * @brief Copies a string into the arena.
+ * @param a Arena.
+ * @param s Source (need not be NUL-terminated).
+ * @param n Length to copy.
+ * @return The copy, or "" if out of memory.
+ */
+const char *arena_strndup(arena_t *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    if (!p) return "";
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+// ------------------------------------------------------------
+// Per-thread request arenas
+// ------------------------------------------------------------
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+static void arena_free_thread(void *p) {
+    arena_destroy(p);
+    free(p);
+}
+
+static void arena_key_init(void) {
+    pthread_key_create(&arena_key, arena_free_thread);
+}
+
+/**
+ * @brief Returns the request arena of the calling thread.
+ * @return Arena, NULL if it cannot be created.
+ */
+arena_t *request_arena(void) {
+    pthread_once(&arena_once, arena_key_init);
+
+    arena_t *a = pthread_getspecific(arena_key);
+    if (a) return a;
+
+    a = malloc(sizeof(arena_t));
+    if (!a || arena_init(a, NULL, REQUEST_ARENA_SIZE) != 0) {
+        free(a);
+        return NULL;
+    }
+    pthread_setspecific(arena_key, a);
+    return a;
+}
+
+// ------------------------------------------------------------
+// Connection pool
+// ------------------------------------------------------------
+typedef struct conn_slab {
+    struct conn_slab *next;
+    connection_t conns[CONN_POOL_SLAB];
+} conn_slab_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    connection_t *free_list;    // Linked through the ssl field (see below)
+    conn_slab_t *slab_list;     // Every slab (inherited connections on reload)
+    int slabs;
+    int free_count;
+} pool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// A free connection links to the next one through its (unused) ssl field
+static connection_t *conn_next(connection_t *c) {
+    return (connection_t *)(void *)c->ssl;
+}
+
+static void conn_set_next(connection_t *c, connection_t *next) {
+    c->ssl = (SSL *)(void *)next;
+}
+
+static void pool_push(connection_t *conn);
+
+/**
+ * @brief fork() handlers: the pool lock is held across fork so the free
+ *        list is consistent in a successor.
+ */
+static void pool_atfork_prepare(void) { pthread_mutex_lock(&pool.mutex); }
+static void pool_atfork_parent(void)  { pthread_mutex_unlock(&pool.mutex); }
+static void pool_atfork_child(void)   { pthread_mutex_init(&pool.mutex, NULL); }
+
+/**
+ * @brief Closes the connections inherited in use from the predecessor of a
+ *        reloaded worker (queued, in service or idle in keep-alive): only
+ *        this process's copies of their sockets, the predecessor still
+ *        serves them and its close must reach the client.
+ * @return Connections dropped.
+ */
+static int drop_inherited(void) {
+    int dropped = 0;
+
+    for (conn_slab_t *s = pool.slab_list; s; s = s->next) {
+        for (int i = 0; i < CONN_POOL_SLAB; i++) {
+            connection_t *c = &s->conns[i];
+            if (!c->in_use)
+                continue;
+            if (c->fd >= 0)
+                close(c->fd);
+            if (c->ssl)
+                SSL_free(c->ssl);
+            pool_push(c);
+            dropped++;
+        }
+    }
+    return dropped;
+}
+
+/**
+ * @brief Prepares the pool of this worker. A reloaded worker inherits the
+ *        slabs of its predecessor (its own copy of that memory): the
+ *        connections the predecessor was serving are dropped and the
+ *        pool is kept.
+ */
+void conn_pool_init(void) {
+    static int atfork_registered = 0;
+    if (!atfork_registered) {
+        pthread_atfork(pool_atfork_prepare, pool_atfork_parent, pool_atfork_child);
+        atfork_registered = 1;
+    }
+
+    int dropped = drop_inherited();
+    metrics_conn_pool_slabs(pool.slabs);
+    TRACE_DEBUG(TRACE_WORKER, "Connection pool: %d slabs, %d free, %d inherited connections closed",
+                pool.slabs, pool.free_count, dropped);
+}
+
+/**
+ * @brief Carves a new slab into the free list. Called with the mutex held.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int pool_grow(void) {
+    conn_slab_t *slab = malloc(sizeof(conn_slab_t));
+    if (!slab) return -1;
+
+    for (int i = 0; i < CONN_POOL_SLAB; i++) {
+        connection_t *c = &slab->conns[i];
+        c->out_buf = NULL;
+        c->out_cap = 0;
+        c->in_use = 0;
+        conn_set_next(c, pool.free_list);
+        pool.free_list = c;
+    }
+    slab->next = pool.slab_list;
+    pool.slab_list = slab;
+    pool.slabs++;
+    pool.free_count += CONN_POOL_SLAB;
+    metrics_conn_pool_slabs(1);
+    return 0;
+}
+
+/**
+ * @brief Takes a connection from the pool. Everything but the input buffer
+ *        is reset; a recycled output buffer is kept.
+ * @return Connection, NULL if out of memory.
+ */
+connection_t *conn_pool_get(void) {
+    pthread_mutex_lock(&pool.mutex);
+
+    int reused = (pool.free_list != NULL);
+    if (!reused && pool_grow() != 0) {
+        pthread_mutex_unlock(&pool.mutex);
+        return NULL;
+    }
+
+    connection_t *c = pool.free_list;
+    pool.free_list = conn_next(c);
+    pool.free_count--;
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    char *out_buf = c->out_buf;
+    size_t out_cap = c->out_cap;
+
+    // in_buf is last: the header is cleared, the 8 KiB buffer is not
+    memset(c, 0, offsetof(connection_t, in_buf));
+    c->out_buf = out_buf;
+    c->out_cap = out_cap;
+    c->fd = -1;
+    c->in_use = 1;
+
+    metrics_conn_pool_get(reused);
+    return c;
+}
+
+static void pool_push(connection_t *conn) {
+    if (conn->out_cap > CONN_POOL_KEEP_OUT_BUF) {
+        free(conn->out_buf);
+        conn->out_buf = NULL;
+        conn->out_cap = 0;
+    }
+
+    pthread_mutex_lock(&pool.mutex);
+    conn->in_use = 0;
+    conn_set_next(conn, pool.free_list);
+    pool.free_list = conn;
+    pool.free_count++;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * @brief Returns a connection to the pool.
+ * @param conn Connection whose socket and SSL object were released.
+ */
+void conn_pool_put(connection_t *conn) {
+    pool_push(conn);
+    metrics_conn_pool_put();
+}
+
+/**
+ * @brief Releases the output buffers kept by the free connections (memory
+ *        pressure); the connections get a new one when they are reused.
+ * @return Bytes released.
+ */
+size_t conn_pool_trim(void) {
+    size_t released = 0;
+
+    pthread_mutex_lock(&pool.mutex);
+    for (connection_t *c = pool.free_list; c; c = conn_next(c)) {
+        released += c->out_cap;
+        free(c->out_buf);
+        c->out_buf = NULL;
+        c->out_cap = 0;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    return released;
+}
+
+/**
+ * @brief Withdraws the slabs of this process from the metrics before it
+ *        exits (the memory goes away with the process).
+ */
+void conn_pool_shutdown(void) {
+    pthread_mutex_lock(&pool.mutex);
+    int slabs = pool.slabs;
+    pthread_mutex_unlock(&pool.mutex);
+    metrics_conn_pool_slabs(-slabs);
+}
@@ -0,0 +1,65 @@
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <stddef.h>
+#include "worker.h"  // For connection_t
+
+// ------------------------------------------------------------
+// Allocators of the request path
+// ------------------------------------------------------------
+// connection_t objects come from a per-worker pool carved out of slabs and
+// recycled through a free list (they keep their output buffer), instead of
+// one calloc/free per accepted socket.
+//
+// Request strings (path, headers) live in a bump arena: each pool thread
+// owns one and resets it in O(1) before every request. HTTP/2 streams get
+// their own small arena, released with the stream.
+
+// Connections carved per slab
+#define CONN_POOL_SLAB 32
+
+// Output buffers larger than this are released instead of recycled
+#define CONN_POOL_KEEP_OUT_BUF (64 * 1024)
+
+// Size of the arena of each pool thread
+#define REQUEST_ARENA_SIZE 4096
+
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+    char *base;                 // Fixed block (not owned when 'external')
+    size_t size;
+    size_t used;
+    arena_chunk_t *overflow;    // malloc'd chunks once the block is full
+    int external;
+} arena_t;
+
+// Initializes an arena over a caller-provided block (buf != NULL) or a
+// malloc'd one of 'size' bytes. Returns 0 on success
+int arena_init(arena_t *a, void *buf, size_t size);
+
+// Releases the block (if owned) and every overflow chunk
+void arena_destroy(arena_t *a);
+
+// Forgets every allocation: O(1) unless the block overflowed
+void arena_reset(arena_t *a);
+
+// 8-byte aligned allocation, NULL if out of memory
+void *arena_alloc(arena_t *a, size_t n);
+
+// Copies n bytes of s as a NUL-terminated string ("" if out of memory)
+const char *arena_strndup(arena_t *a, const char *s, size_t n);
+
+// Arena of the calling pool thread (created on first use)
+arena_t *request_arena(void);
+
+// Connection pool of this worker. conn_pool_init also adopts the pool
+// inherited by a reloaded worker and closes its copies of the connections
+// the predecessor still serves
+void conn_pool_init(void);
+connection_t *conn_pool_get(void);      // Zeroed header, NULL if out of memory
+void conn_pool_put(connection_t *conn); // Socket/SSL already closed
+void conn_pool_shutdown(void);          // Withdraws the slab gauge on exit
+size_t conn_pool_trim(void);            // Frees the idle output buffers (bytes)
+
+#endif
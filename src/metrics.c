@@ -0,0 +1,979 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "shared_mem.h"
+#include "listener.h"
+#include "cache_arena.h"
+#include "vhost.h"
+
+// Shared memory of this process (worker.c)
+extern shared_data_t* shm_data;
+
+// Metrics of the slot served by this process (NULL until metrics_bind)
+static worker_metrics_t *local = NULL;
+
+static const double duration_bounds[METRICS_DURATION_BUCKETS] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+static const double size_bounds[METRICS_SIZE_BUCKETS] = {
+    256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216, 67108864
+};
+
+static const double handshake_bounds[METRICS_HANDSHAKE_BUCKETS] = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.1, 0.25, 1
+};
+
+#define ADD(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+
+/**
+ * @brief Finds the bucket of a value (index of the +Inf bucket if above all bounds).
+ */
+static int bucket_of(const double *bounds, int n, double value) {
+    int i = 0;
+    while (i < n && value > bounds[i])
+        i++;
+    return i;
+}
+
+/**
+ * @brief Binds this process to the metrics block of its worker slot.
+ * @param slot Worker slot index in shared memory.
+ */
+void metrics_bind(int slot) {
+    if (!shm_data || slot < 0 || slot >= MAX_WORKERS) return;
+    local = &shm_data->workers[slot].metrics;
+    __atomic_store_n(&local->start_time, (long)time(NULL), __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Microseconds since an arbitrary point.
+ */
+unsigned long metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Upper bound of a request duration bucket.
+ * @param i Bucket index (0 .. METRICS_DURATION_BUCKETS - 1).
+ * @return Bound in seconds.
+ */
+double metrics_duration_bound(int i) {
+    return duration_bounds[i];
+}
+
+/**
+ * @brief Counts a served request: status class, body bytes and the duration
+ *        and size histograms.
+ * @param status HTTP status code.
+ * @param bytes Body bytes sent.
+ * @param duration_us Time from the parsed request to the response being sent.
+ * @param http2 1 if the request came on an HTTP/2 stream.
+ */
+void metrics_request(int status, size_t bytes, unsigned long duration_us, int http2) {
+    if (!local) return;
+
+    ADD(local->requests_total, 1);
+    if (http2)
+        ADD(local->http2_requests_total, 1);
+
+    int cls = status / 100;
+    if (cls > 0 && cls < METRICS_STATUS_CLASSES)
+        ADD(local->responses_total[cls], 1);
+
+    ADD(local->response_bytes_total, bytes);
+
+    ADD(local->duration_buckets[bucket_of(duration_bounds, METRICS_DURATION_BUCKETS,
+                                          duration_us / 1e6)], 1);
+    ADD(local->duration_sum_us, duration_us);
+
+    ADD(local->size_buckets[bucket_of(size_bounds, METRICS_SIZE_BUCKETS, bytes)], 1);
+    ADD(local->size_sum, bytes);
+}
+
+/**
+ * @brief Counts a cache lookup.
+ * @param hit 1 for a hit, 0 for a miss.
+ */
+void metrics_cache(int hit) {
+    if (!local) return;
+    if (hit)
+        ADD(local->cache_hits_total, 1);
+    else
+        ADD(local->cache_misses_total, 1);
+}
+
+/**
+ * @brief Counts a file let in by the cache admission filter.
+ */
+void metrics_cache_admitted(void) {
+    if (local) ADD(local->cache_admitted_total, 1);
+}
+
+/**
+ * @brief Counts a file kept out of the cache.
+ * @param too_large 1 if above CACHE_MAX_OBJECT_KB, 0 if less popular than
+ *                  the entries it would displace.
+ */
+void metrics_cache_rejected(int too_large) {
+    if (!local) return;
+    if (too_large)
+        ADD(local->cache_rejected_size_total, 1);
+    else
+        ADD(local->cache_rejected_frequency_total, 1);
+}
+
+/**
+ * @brief Counts an entry evicted in favour of a more popular file.
+ */
+void metrics_cache_evicted(void) {
+    if (local) ADD(local->cache_evictions_total, 1);
+}
+
+/**
+ * @brief Adjusts the bytes and entries held by the cache of this process.
+ * @param vhost Virtual host the entries are charged to.
+ */
+void metrics_cache_usage(int vhost, long bytes, long entries) {
+    if (!local) return;
+    ADD(local->cache_bytes, bytes);
+    ADD(local->cache_entries, entries);
+    ADD(local->vhost_cache_bytes[vhost], bytes);
+}
+
+/**
+ * @brief Publishes the cache arena of this process: /metrics reads its
+ *        huge-page coverage from the smaps of the slot's pid.
+ * @param addr Start of the mapping (0 = none).
+ * @param bytes Size of the mapping.
+ * @param pages CACHE_ARENA_* value.
+ */
+void metrics_cache_arena(unsigned long addr, size_t bytes, int pages) {
+    if (!local) return;
+    __atomic_store_n(&local->cache_arena_addr, addr, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->cache_arena_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->cache_arena_pages, pages, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts a cache entry malloc'd because the arena had no room.
+ */
+void metrics_cache_arena_fallback(void) {
+    if (local) ADD(local->cache_arena_fallbacks_total, 1);
+}
+
+/**
+ * @brief Publishes the byte budget of this process's cache.
+ */
+void metrics_cache_budget(size_t bytes) {
+    if (local) __atomic_store_n(&local->cache_budget_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts a memory governor step.
+ * @param shrink 1 if caches and pools were shrunk, 0 if the cache grew back.
+ */
+void metrics_memgov(int shrink) {
+    if (!local) return;
+    if (shrink)
+        ADD(local->memgov_shrinks_total, 1);
+    else
+        ADD(local->memgov_grows_total, 1);
+}
+
+/**
+ * @brief Counts a request for a site (static file or proxied).
+ * @param vhost Virtual host index (vhost.h).
+ * @param cache_hit 1 if answered from the file cache or the micro-cache.
+ */
+void metrics_vhost(int vhost, int cache_hit) {
+    if (!local || vhost < 0 || vhost > CONFIG_MAX_VHOSTS) return;
+    ADD(local->vhost_requests_total[vhost], 1);
+    if (cache_hit)
+        ADD(local->vhost_cache_hits_total[vhost], 1);
+}
+
+/**
+ * @brief Counts an accepted connection.
+ */
+void metrics_connection_open(void) {
+    if (!local) return;
+    ADD(local->connections_total, 1);
+    ADD(local->connections_active, 1);
+}
+
+/**
+ * @brief Counts a closed connection.
+ */
+void metrics_connection_close(void) {
+    if (!local) return;
+    ADD(local->connections_active, -1);
+}
+
+/**
+ * @brief Counts a TLS handshake.
+ * @param ok 1 if it succeeded.
+ * @param duration_us Time spent in SSL_accept.
+ */
+void metrics_handshake(int ok, unsigned long duration_us) {
+    if (!local) return;
+
+    if (!ok) {
+        ADD(local->tls_handshake_errors_total, 1);
+        return;
+    }
+    ADD(local->tls_handshakes_total, 1);
+    ADD(local->handshake_buckets[bucket_of(handshake_bounds, METRICS_HANDSHAKE_BUCKETS,
+                                           duration_us / 1e6)], 1);
+    ADD(local->handshake_sum_us, duration_us);
+}
+
+/**
+ * @brief Adjusts the number of pool threads of this worker.
+ */
+void metrics_pool_threads(int delta) {
+    if (local) ADD(local->pool_threads, delta);
+}
+
+/**
+ * @brief Adjusts the number of pool threads handling a connection.
+ */
+void metrics_pool_busy(int delta) {
+    if (local) ADD(local->pool_busy_threads, delta);
+}
+
+/**
+ * @brief Adjusts the number of connections waiting in the pool queue.
+ */
+void metrics_pool_queue(int delta) {
+    if (local) ADD(local->pool_queue_depth, delta);
+}
+
+/**
+ * @brief Publishes the thread limits of this worker's pool.
+ */
+void metrics_pool_limits(int min_threads, int max_threads) {
+    if (!local) return;
+    __atomic_store_n(&local->pool_min_threads, min_threads, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->pool_max_threads, max_threads, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts a pool thread started on demand (grew = 1) or retired
+ *        after an idle period (grew = 0).
+ */
+void metrics_pool_resized(int grew) {
+    if (!local) return;
+    if (grew)
+        ADD(local->pool_grown_total, 1);
+    else
+        ADD(local->pool_shrunk_total, 1);
+}
+
+/**
+ * @brief Adds the time a connection waited in the pool queue.
+ */
+void metrics_pool_wait(unsigned long wait_us) {
+    if (local) ADD(local->pool_queue_wait_us_total, wait_us);
+}
+
+/**
+ * @brief Adds up the pool gauges of the running worker slots.
+ * @param threads Receives the pool threads.
+ * @param busy Receives the threads handling a connection.
+ * @param max_threads Receives the most threads the pools may grow to.
+ */
+void metrics_pool_totals(long *threads, long *busy, long *max_threads) {
+    *threads = *busy = *max_threads = 0;
+    if (!shm_data) return;
+
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        worker_slot_t *ws = &shm_data->workers[i];
+        if (__atomic_load_n(&ws->state, __ATOMIC_RELAXED) == WORKER_STATE_EMPTY)
+            continue;
+        *threads += __atomic_load_n(&ws->metrics.pool_threads, __ATOMIC_RELAXED);
+        *busy += __atomic_load_n(&ws->metrics.pool_busy_threads, __ATOMIC_RELAXED);
+        *max_threads += __atomic_load_n(&ws->metrics.pool_max_threads, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Largest response body memory held by one request, over every
+ *        worker slot (slots keep their metrics across reloads).
+ * @return Bytes.
+ */
+unsigned long metrics_response_memory_peak(void) {
+    unsigned long peak = 0;
+    if (!shm_data) return 0;
+
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        unsigned long v = __atomic_load_n(&shm_data->workers[i].metrics.response_memory_peak_bytes,
+                                          __ATOMIC_RELAXED);
+        if (v > peak) peak = v;
+    }
+    return peak;
+}
+
+/**
+ * @brief Adjusts the number of live stats stream viewers.
+ */
+void metrics_stream_viewers(int delta) {
+    if (local) ADD(local->stream_viewers, delta);
+}
+
+/**
+ * @brief Adjusts the number of slabs carved by the connection pool.
+ */
+void metrics_conn_pool_slabs(int delta) {
+    if (local) ADD(local->conn_pool_slabs, delta);
+}
+
+/**
+ * @brief Counts a connection taken from the pool.
+ * @param reused 1 if it came from the free list, 0 if a new slab was carved.
+ */
+void metrics_conn_pool_get(int reused) {
+    if (!local) return;
+    ADD(local->conn_pool_allocs_total, 1);
+    if (reused) ADD(local->conn_pool_reused_total, 1);
+    ADD(local->conn_pool_in_use, 1);
+}
+
+/**
+ * @brief Counts a connection returned to the pool.
+ */
+void metrics_conn_pool_put(void) {
+    if (local) ADD(local->conn_pool_in_use, -1);
+}
+
+/**
+ * @brief Records the arena usage of one request when the arena is reset.
+ * @param used Bytes the request allocated.
+ * @param overflowed 1 if the request did not fit in the fixed block.
+ */
+void metrics_arena(size_t used, int overflowed) {
+    if (!local) return;
+    if (overflowed) ADD(local->arena_overflows_total, 1);
+
+    unsigned long cur = __atomic_load_n(&local->arena_high_water_bytes, __ATOMIC_RELAXED);
+    while (used > cur &&
+           !__atomic_compare_exchange_n(&local->arena_high_water_bytes, &cur, used, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * @brief Counts a proxied request by outcome.
+ * @param result METRICS_PROXY_UPSTREAM, METRICS_PROXY_CACHE_HIT or METRICS_PROXY_ERROR.
+ */
+void metrics_proxy_request(int result) {
+    if (!local) return;
+    if (result == METRICS_PROXY_CACHE_HIT)
+        ADD(local->proxy_cache_hits_total, 1);
+    else if (result == METRICS_PROXY_ERROR)
+        ADD(local->proxy_errors_total, 1);
+    else
+        ADD(local->proxy_upstream_total, 1);
+}
+
+/**
+ * @brief Counts an upstream connection used by the proxy.
+ * @param reused 1 if it came from the idle pool, 0 if it was opened.
+ */
+void metrics_proxy_connection(int reused) {
+    if (!local) return;
+    if (reused)
+        ADD(local->proxy_reused_total, 1);
+    else
+        ADD(local->proxy_connects_total, 1);
+}
+
+/**
+ * @brief Counts an upstream taken out of rotation after repeated failures.
+ */
+void metrics_proxy_upstream_down(void) {
+    if (local) ADD(local->proxy_upstream_down_total, 1);
+}
+
+/**
+ * @brief Counts a request or connection refused by a per-client limit.
+ * @param connection 1 for a connection limit, 0 for a request rate.
+ * @param subnet 1 if the subnet limit was hit, 0 for the client IP.
+ */
+void metrics_rate_limited(int connection, int subnet) {
+    if (!local) return;
+    if (connection && subnet)
+        ADD(local->ratelimit_connections_subnet_total, 1);
+    else if (connection)
+        ADD(local->ratelimit_connections_ip_total, 1);
+    else if (subnet)
+        ADD(local->ratelimit_requests_subnet_total, 1);
+    else
+        ADD(local->ratelimit_requests_ip_total, 1);
+}
+
+/**
+ * @brief Adjusts the number of file loads waiting for a disk I/O thread.
+ */
+void metrics_disk_queue(int delta) {
+    if (local) ADD(local->disk_queue_depth, delta);
+}
+
+/**
+ * @brief Counts a file read by a disk I/O thread.
+ * @param bytes Bytes read.
+ * @param duration_us Time from open to the last read.
+ */
+void metrics_disk_read(size_t bytes, unsigned long duration_us) {
+    if (!local) return;
+    ADD(local->disk_reads_total, 1);
+    ADD(local->disk_read_bytes_total, bytes);
+    ADD(local->disk_read_us_total, duration_us);
+}
+
+/**
+ * @brief Counts a file load that failed (open, read or memory).
+ */
+void metrics_disk_error(void) {
+    if (local) ADD(local->disk_read_errors_total, 1);
+}
+
+/**
+ * @brief Counts a cache miss served by a load of the same file in flight.
+ */
+void metrics_disk_coalesced(void) {
+    if (local) ADD(local->disk_coalesced_total, 1);
+}
+
+/**
+ * @brief Counts a file response streamed from disk instead of memory.
+ * @param bytes Length of the body.
+ */
+void metrics_stream(size_t bytes) {
+    if (!local) return;
+    ADD(local->stream_responses_total, 1);
+    ADD(local->stream_bytes_total, bytes);
+}
+
+/**
+ * @brief Records the body memory a request held (its own buffers, not the
+ *        shared cache) and keeps the largest.
+ * @param bytes Bytes allocated for the response body.
+ */
+void metrics_response_memory(size_t bytes) {
+    if (!local) return;
+
+    unsigned long cur = __atomic_load_n(&local->response_memory_peak_bytes, __ATOMIC_RELAXED);
+    while (bytes > cur &&
+           !__atomic_compare_exchange_n(&local->response_memory_peak_bytes, &cur, bytes, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * @brief Adds the phases and the CPU time of a finished request.
+ * @param phase_us Microseconds per phase (PHASE_COUNT values).
+ * @param cpu_us Thread CPU time of the request.
+ */
+void metrics_phases(const unsigned long *phase_us, unsigned long cpu_us) {
+    if (!local) return;
+    for (int i = 0; i < PHASE_COUNT; i++)
+        if (phase_us[i])
+            ADD(local->phase_sum_us[i], phase_us[i]);
+    ADD(local->cpu_sum_us, cpu_us);
+}
+
+/**
+ * @brief Counts a request recorded in the slow-request ring.
+ */
+void metrics_slow_request(void) {
+    if (!local) return;
+    ADD(local->slow_requests_total, 1);
+}
+
+/**
+ * @brief Copies a metrics block word by word with relaxed atomic loads
+ *        (writers never block, values may be a few requests apart).
+ */
+static void snapshot_worker(worker_metrics_t *dst, const worker_metrics_t *src) {
+    _Static_assert(sizeof(worker_metrics_t) % sizeof(long) == 0,
+                   "worker_metrics_t must only hold machine words");
+
+    const long *s = (const long *)src;
+    long *d = (long *)dst;
+    for (size_t i = 0; i < sizeof(worker_metrics_t) / sizeof(long); i++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
+
+static void family(FILE *f, const char *name, const char *type, const char *help) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Writes one histogram series (cumulative buckets, sum, count).
+ * @param scale Divides the sum (1e6 for microseconds to seconds).
+ */
+static void histogram(FILE *f, const char *name, const char *labels,
+                      const double *bounds, int n, const unsigned long *buckets,
+                      unsigned long sum, double scale) {
+    unsigned long cumulative = 0;
+
+    for (int i = 0; i < n; i++) {
+        cumulative += buckets[i];
+        fprintf(f, "%s_bucket{%s,le=\"%g\"} %lu\n", name, labels, bounds[i], cumulative);
+    }
+    cumulative += buckets[n];
+    fprintf(f, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, cumulative);
+    if (scale == 1)
+        fprintf(f, "%s_sum{%s} %lu\n", name, labels, sum);
+    else
+        fprintf(f, "%s_sum{%s} %.6f\n", name, labels, sum / scale);
+    fprintf(f, "%s_count{%s} %lu\n", name, labels, cumulative);
+}
+
+/**
+ * @brief Renders every metric in the Prometheus text exposition format
+ *        (version 0.0.4) from a snapshot of shared memory.
+ * @param len Receives the length of the text.
+ * @return malloc'd text (caller frees), NULL on error.
+ */
+char *metrics_render(size_t *len) {
+    static const char *class_names[METRICS_STATUS_CLASSES] = {
+        "", "1xx", "2xx", "3xx", "4xx", "5xx"
+    };
+
+    if (!shm_data) return NULL;
+
+    // Snapshot first, format afterwards
+    int nslots = 0;
+    int slot_ids[MAX_WORKERS];
+    struct { int pid, is_https, generation, state; } slots[MAX_WORKERS];
+    worker_metrics_t m[MAX_WORKERS];
+    server_stats_t stats;
+
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        worker_slot_t *ws = &shm_data->workers[i];
+        if (__atomic_load_n(&ws->state, __ATOMIC_RELAXED) == WORKER_STATE_EMPTY)
+            continue;
+        slots[nslots].pid = __atomic_load_n(&ws->pid, __ATOMIC_RELAXED);
+        slots[nslots].is_https = ws->is_https;
+        slots[nslots].generation = __atomic_load_n(&ws->generation, __ATOMIC_RELAXED);
+        slots[nslots].state = __atomic_load_n(&ws->state, __ATOMIC_RELAXED);
+        snapshot_worker(&m[nslots], &ws->metrics);
+        slot_ids[nslots++] = i;
+    }
+    stats_snapshot(&shm_data->stats, &stats);
+    int generation = __atomic_load_n(&shm_data->generation, __ATOMIC_RELAXED);
+
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&buf, &size);
+    if (!f) return NULL;
+
+    char labels[MAX_WORKERS][32];
+    for (int i = 0; i < nslots; i++)
+        snprintf(labels[i], sizeof(labels[i]), "worker=\"%d\"", slot_ids[i]);
+
+    // --- Workers ---
+    family(f, "webserver_worker_info", "gauge",
+           "Worker slot: current process, listener and config generation.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_worker_info{%s,pid=\"%d\",listener=\"%s\",generation=\"%d\"} 1\n",
+                labels[i], slots[i].pid, slots[i].is_https ? "https" : "http",
+                slots[i].generation);
+
+    family(f, "webserver_worker_draining", "gauge",
+           "1 while the worker of the slot drains before exiting.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_worker_draining{%s} %d\n", labels[i],
+                slots[i].state == WORKER_STATE_DRAINING);
+
+    family(f, "webserver_worker_start_time_seconds", "gauge",
+           "Unix time the current process of the slot started.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_worker_start_time_seconds{%s} %ld\n", labels[i], m[i].start_time);
+
+    family(f, "webserver_config_generation", "gauge",
+           "Configuration generation (incremented on every reload).");
+    fprintf(f, "webserver_config_generation %d\n", generation);
+
+    // --- Requests ---
+    family(f, "webserver_http_requests_total", "counter", "Requests served.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_http_requests_total{%s} %lu\n", labels[i], m[i].requests_total);
+
+    family(f, "webserver_http2_requests_total", "counter", "Requests served on HTTP/2 streams.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_http2_requests_total{%s} %lu\n", labels[i], m[i].http2_requests_total);
+
+    family(f, "webserver_http_responses_total", "counter", "Responses by status class.");
+    for (int i = 0; i < nslots; i++)
+        for (int c = 1; c < METRICS_STATUS_CLASSES; c++)
+            fprintf(f, "webserver_http_responses_total{%s,code=\"%s\"} %lu\n",
+                    labels[i], class_names[c], m[i].responses_total[c]);
+
+    family(f, "webserver_http_response_bytes_total", "counter", "Response body bytes sent.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_http_response_bytes_total{%s} %lu\n", labels[i],
+                m[i].response_bytes_total);
+
+    family(f, "webserver_http_request_duration_seconds", "histogram",
+           "Time from a parsed request to its response being sent.");
+    for (int i = 0; i < nslots; i++)
+        histogram(f, "webserver_http_request_duration_seconds", labels[i],
+                  duration_bounds, METRICS_DURATION_BUCKETS, m[i].duration_buckets,
+                  m[i].duration_sum_us, 1e6);
+
+    family(f, "webserver_http_response_size_bytes", "histogram", "Response body sizes.");
+    for (int i = 0; i < nslots; i++)
+        histogram(f, "webserver_http_response_size_bytes", labels[i],
+                  size_bounds, METRICS_SIZE_BUCKETS, m[i].size_buckets, m[i].size_sum, 1);
+
+    // --- Cache ---
+    family(f, "webserver_cache_hits_total", "counter", "File cache hits.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_hits_total{%s} %lu\n", labels[i], m[i].cache_hits_total);
+
+    family(f, "webserver_cache_misses_total", "counter", "File cache misses.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_misses_total{%s} %lu\n", labels[i], m[i].cache_misses_total);
+
+    family(f, "webserver_cache_admissions_total", "counter",
+           "Cache inserts by admission result (TinyLFU).");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_cache_admissions_total{%s,result=\"admitted\"} %lu\n",
+                labels[i], m[i].cache_admitted_total);
+        fprintf(f, "webserver_cache_admissions_total{%s,result=\"rejected_size\"} %lu\n",
+                labels[i], m[i].cache_rejected_size_total);
+        fprintf(f, "webserver_cache_admissions_total{%s,result=\"rejected_frequency\"} %lu\n",
+                labels[i], m[i].cache_rejected_frequency_total);
+    }
+
+    family(f, "webserver_cache_evictions_total", "counter",
+           "Cache entries evicted for a more popular file.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_evictions_total{%s} %lu\n", labels[i],
+                m[i].cache_evictions_total);
+
+    family(f, "webserver_cache_bytes", "gauge", "Bytes held by the file cache.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_bytes{%s} %ld\n", labels[i], m[i].cache_bytes);
+
+    family(f, "webserver_cache_entries", "gauge", "Files held by the file cache.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_entries{%s} %ld\n", labels[i], m[i].cache_entries);
+
+    family(f, "webserver_cache_budget_bytes", "gauge",
+           "Byte budget of the file cache (lowered by the memory governor under pressure).");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_budget_bytes{%s} %lu\n", labels[i], m[i].cache_budget_bytes);
+
+    family(f, "webserver_memory_governor_steps_total", "counter",
+           "Memory governor steps (action=shrink|grow).");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_memory_governor_steps_total{%s,action=\"shrink\"} %lu\n",
+                labels[i], m[i].memgov_shrinks_total);
+        fprintf(f, "webserver_memory_governor_steps_total{%s,action=\"grow\"} %lu\n",
+                labels[i], m[i].memgov_grows_total);
+    }
+
+    family(f, "webserver_cache_arena_bytes", "gauge",
+           "Size of the cache arena by backing pages (hugetlb, thp, normal).");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_arena_bytes{%s,pages=\"%s\"} %lu\n", labels[i],
+                cache_arena_pages_name(m[i].cache_arena_pages), m[i].cache_arena_bytes);
+
+    // Coverage: read from the smaps of each worker process
+    size_t arena_resident[MAX_WORKERS], arena_huge[MAX_WORKERS];
+    int arena_read[MAX_WORKERS];
+    for (int i = 0; i < nslots; i++)
+        arena_read[i] = m[i].cache_arena_addr &&
+                        cache_arena_coverage(slots[i].pid, m[i].cache_arena_addr,
+                                             &arena_resident[i], &arena_huge[i]) == 0;
+
+    family(f, "webserver_cache_arena_resident_bytes", "gauge",
+           "Bytes of the cache arena in memory.");
+    for (int i = 0; i < nslots; i++)
+        if (arena_read[i])
+            fprintf(f, "webserver_cache_arena_resident_bytes{%s} %zu\n", labels[i],
+                    arena_resident[i]);
+
+    family(f, "webserver_cache_arena_huge_bytes", "gauge",
+           "Bytes of the cache arena mapped by huge pages.");
+    for (int i = 0; i < nslots; i++)
+        if (arena_read[i])
+            fprintf(f, "webserver_cache_arena_huge_bytes{%s} %zu\n", labels[i], arena_huge[i]);
+
+    family(f, "webserver_cache_arena_fallbacks_total", "counter",
+           "Cache entries malloc'd because the arena had no room or could not be mapped.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_cache_arena_fallbacks_total{%s} %lu\n", labels[i],
+                m[i].cache_arena_fallbacks_total);
+
+    // --- Connections and TLS ---
+    family(f, "webserver_connections_total", "counter", "Accepted connections.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_connections_total{%s} %lu\n", labels[i], m[i].connections_total);
+
+    family(f, "webserver_connections_active", "gauge", "Open connections.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_connections_active{%s} %ld\n", labels[i], m[i].connections_active);
+
+    family(f, "webserver_tls_handshakes_total", "counter", "TLS handshakes by result.");
+    for (int i = 0; i < nslots; i++) {
+        if (!slots[i].is_https) continue;
+        fprintf(f, "webserver_tls_handshakes_total{%s,result=\"ok\"} %lu\n",
+                labels[i], m[i].tls_handshakes_total);
+        fprintf(f, "webserver_tls_handshakes_total{%s,result=\"error\"} %lu\n",
+                labels[i], m[i].tls_handshake_errors_total);
+    }
+
+    family(f, "webserver_tls_handshake_duration_seconds", "histogram",
+           "Duration of successful TLS handshakes.");
+    for (int i = 0; i < nslots; i++)
+        if (slots[i].is_https)
+            histogram(f, "webserver_tls_handshake_duration_seconds", labels[i],
+                      handshake_bounds, METRICS_HANDSHAKE_BUCKETS, m[i].handshake_buckets,
+                      m[i].handshake_sum_us, 1e6);
+
+    // --- Thread pool ---
+    family(f, "webserver_pool_threads", "gauge", "Threads in the worker pool.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_pool_threads{%s} %ld\n", labels[i], m[i].pool_threads);
+
+    family(f, "webserver_pool_busy_threads", "gauge", "Pool threads handling a connection.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_pool_busy_threads{%s} %ld\n", labels[i], m[i].pool_busy_threads);
+
+    family(f, "webserver_pool_queue_depth", "gauge",
+           "Accepted connections waiting for a pool thread.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_pool_queue_depth{%s} %ld\n", labels[i], m[i].pool_queue_depth);
+
+    family(f, "webserver_pool_min_threads", "gauge", "Threads the pool keeps when idle.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_pool_min_threads{%s} %ld\n", labels[i], m[i].pool_min_threads);
+
+    family(f, "webserver_pool_max_threads", "gauge", "Most threads the pool may grow to.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_pool_max_threads{%s} %ld\n", labels[i], m[i].pool_max_threads);
+
+    family(f, "webserver_pool_resizes_total", "counter",
+           "Pool threads started on demand (grow) or retired when idle (shrink).");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_pool_resizes_total{%s,direction=\"grow\"} %lu\n", labels[i],
+                m[i].pool_grown_total);
+        fprintf(f, "webserver_pool_resizes_total{%s,direction=\"shrink\"} %lu\n", labels[i],
+                m[i].pool_shrunk_total);
+    }
+
+    family(f, "webserver_pool_queue_wait_seconds_total", "counter",
+           "Time accepted connections waited for a pool thread.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_pool_queue_wait_seconds_total{%s} %.6f\n", labels[i],
+                m[i].pool_queue_wait_us_total / 1e6);
+
+    family(f, "webserver_stats_stream_viewers", "gauge",
+           "Dashboards connected to /api/stats/stream.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_stats_stream_viewers{%s} %ld\n", labels[i], m[i].stream_viewers);
+
+    // --- Allocators ---
+    family(f, "webserver_conn_pool_slabs", "gauge",
+           "Slabs of connection objects carved by the pool.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_conn_pool_slabs{%s} %ld\n", labels[i], m[i].conn_pool_slabs);
+
+    family(f, "webserver_conn_pool_in_use", "gauge",
+           "Connection objects currently handed out by the pool.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_conn_pool_in_use{%s} %ld\n", labels[i], m[i].conn_pool_in_use);
+
+    family(f, "webserver_conn_pool_allocs_total", "counter",
+           "Connection objects taken from the pool.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_conn_pool_allocs_total{%s} %lu\n", labels[i],
+                m[i].conn_pool_allocs_total);
+
+    family(f, "webserver_conn_pool_reused_total", "counter",
+           "Connection objects recycled from the free list.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_conn_pool_reused_total{%s} %lu\n", labels[i],
+                m[i].conn_pool_reused_total);
+
+    family(f, "webserver_request_arena_overflows_total", "counter",
+           "Requests whose strings did not fit in the request arena.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_request_arena_overflows_total{%s} %lu\n", labels[i],
+                m[i].arena_overflows_total);
+
+    family(f, "webserver_request_arena_high_water_bytes", "gauge",
+           "Largest request arena usage seen.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_request_arena_high_water_bytes{%s} %lu\n", labels[i],
+                m[i].arena_high_water_bytes);
+
+    // --- Reverse proxy ---
+    family(f, "webserver_proxy_requests_total", "counter",
+           "Proxied requests by outcome.");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_proxy_requests_total{%s,result=\"upstream\"} %lu\n",
+                labels[i], m[i].proxy_upstream_total);
+        fprintf(f, "webserver_proxy_requests_total{%s,result=\"cache_hit\"} %lu\n",
+                labels[i], m[i].proxy_cache_hits_total);
+        fprintf(f, "webserver_proxy_requests_total{%s,result=\"error\"} %lu\n",
+                labels[i], m[i].proxy_errors_total);
+    }
+
+    family(f, "webserver_proxy_connections_total", "counter",
+           "Upstream connections used, opened or reused from the idle pool.");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_proxy_connections_total{%s,kind=\"new\"} %lu\n",
+                labels[i], m[i].proxy_connects_total);
+        fprintf(f, "webserver_proxy_connections_total{%s,kind=\"reused\"} %lu\n",
+                labels[i], m[i].proxy_reused_total);
+    }
+
+    family(f, "webserver_proxy_upstream_down_total", "counter",
+           "Times an upstream was taken out of rotation after repeated failures.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_proxy_upstream_down_total{%s} %lu\n", labels[i],
+                m[i].proxy_upstream_down_total);
+
+    // --- Virtual hosts (labelled with the first name of the VHOST line) ---
+    int nvhosts = vhost_count();
+
+    family(f, "webserver_vhost_requests_total", "counter",
+           "Static and proxied requests by virtual host.");
+    for (int i = 0; i < nslots; i++)
+        for (int v = 0; v < nvhosts; v++)
+            fprintf(f, "webserver_vhost_requests_total{%s,host=\"%s\"} %lu\n", labels[i],
+                    vhost_get(v)->names[0], m[i].vhost_requests_total[v]);
+
+    family(f, "webserver_vhost_cache_hits_total", "counter",
+           "Requests of a virtual host answered from the file cache or micro-cache.");
+    for (int i = 0; i < nslots; i++)
+        for (int v = 0; v < nvhosts; v++)
+            fprintf(f, "webserver_vhost_cache_hits_total{%s,host=\"%s\"} %lu\n", labels[i],
+                    vhost_get(v)->names[0], m[i].vhost_cache_hits_total[v]);
+
+    family(f, "webserver_vhost_cache_bytes", "gauge",
+           "Bytes of the file cache held by a virtual host (capped by its cache= quota).");
+    for (int i = 0; i < nslots; i++)
+        for (int v = 0; v < nvhosts; v++)
+            fprintf(f, "webserver_vhost_cache_bytes{%s,host=\"%s\"} %ld\n", labels[i],
+                    vhost_get(v)->names[0], m[i].vhost_cache_bytes[v]);
+
+    // --- Per-client limits ---
+    family(f, "webserver_ratelimit_throttled_total", "counter",
+           "Requests (429) and connections refused by a per-client limit.");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_ratelimit_throttled_total{%s,kind=\"requests\",limit=\"ip\"} %lu\n",
+                labels[i], m[i].ratelimit_requests_ip_total);
+        fprintf(f, "webserver_ratelimit_throttled_total{%s,kind=\"requests\",limit=\"subnet\"} %lu\n",
+                labels[i], m[i].ratelimit_requests_subnet_total);
+        fprintf(f, "webserver_ratelimit_throttled_total{%s,kind=\"connections\",limit=\"ip\"} %lu\n",
+                labels[i], m[i].ratelimit_connections_ip_total);
+        fprintf(f, "webserver_ratelimit_throttled_total{%s,kind=\"connections\",limit=\"subnet\"} %lu\n",
+                labels[i], m[i].ratelimit_connections_subnet_total);
+    }
+
+    // --- Disk I/O threads ---
+    family(f, "webserver_disk_queue_depth", "gauge",
+           "File loads waiting for a disk I/O thread.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_disk_queue_depth{%s} %ld\n", labels[i], m[i].disk_queue_depth);
+
+    family(f, "webserver_disk_reads_total", "counter",
+           "Files read by the disk I/O threads (result=ok|error).");
+    for (int i = 0; i < nslots; i++) {
+        fprintf(f, "webserver_disk_reads_total{%s,result=\"ok\"} %lu\n", labels[i],
+                m[i].disk_reads_total - m[i].disk_read_errors_total);
+        fprintf(f, "webserver_disk_reads_total{%s,result=\"error\"} %lu\n", labels[i],
+                m[i].disk_read_errors_total);
+    }
+
+    family(f, "webserver_disk_read_bytes_total", "counter", "Bytes read from files on cache misses.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_disk_read_bytes_total{%s} %lu\n", labels[i], m[i].disk_read_bytes_total);
+
+    family(f, "webserver_disk_read_seconds_total", "counter", "Time spent reading files.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_disk_read_seconds_total{%s} %.6f\n", labels[i],
+                m[i].disk_read_us_total / 1e6);
+
+    family(f, "webserver_disk_coalesced_total", "counter",
+           "Cache misses that joined a load of the same file already in flight.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_disk_coalesced_total{%s} %lu\n", labels[i], m[i].disk_coalesced_total);
+
+    // --- Response bodies ---
+    family(f, "webserver_stream_responses_total", "counter",
+           "Files above STREAM_THRESHOLD_KB sent from disk in chunks (never cached).");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_stream_responses_total{%s} %lu\n", labels[i], m[i].stream_responses_total);
+
+    family(f, "webserver_stream_bytes_total", "counter", "Bytes of streamed file responses.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_stream_bytes_total{%s} %lu\n", labels[i], m[i].stream_bytes_total);
+
+    family(f, "webserver_response_memory_peak_bytes", "gauge",
+           "Largest response body memory held by one request.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_response_memory_peak_bytes{%s} %lu\n", labels[i],
+                m[i].response_memory_peak_bytes);
+
+    // --- Request phases ---
+    family(f, "webserver_request_phase_seconds_total", "counter",
+           "Time spent by requests in each phase (queue, handshake, read, cache, disk, upstream, send, other).");
+    for (int i = 0; i < nslots; i++)
+        for (int p = 0; p < PHASE_COUNT; p++)
+            fprintf(f, "webserver_request_phase_seconds_total{%s,phase=\"%s\"} %.6f\n",
+                    labels[i], slowlog_phase_name(p), m[i].phase_sum_us[p] / 1e6);
+
+    family(f, "webserver_request_cpu_seconds_total", "counter",
+           "Thread CPU time consumed by requests.");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_request_cpu_seconds_total{%s} %.6f\n", labels[i],
+                m[i].cpu_sum_us / 1e6);
+
+    family(f, "webserver_slow_requests_total", "counter",
+           "Requests slower than SLOW_REQUEST_MS (recorded at /api/slow).");
+    for (int i = 0; i < nslots; i++)
+        fprintf(f, "webserver_slow_requests_total{%s} %lu\n", labels[i],
+                m[i].slow_requests_total);
+
+    // --- Deadlines (global) ---
+    family(f, "webserver_timeouts_total", "counter", "Connections cut by a deadline.");
+    fprintf(f, "webserver_timeouts_total{kind=\"handshake\"} %ld\n", stats.timeouts_handshake);
+    fprintf(f, "webserver_timeouts_total{kind=\"header\"} %ld\n", stats.timeouts_header);
+    fprintf(f, "webserver_timeouts_total{kind=\"idle\"} %ld\n", stats.timeouts_idle);
+    fprintf(f, "webserver_timeouts_total{kind=\"write\"} %ld\n", stats.timeouts_write);
+
+    // --- Accept queue (kernel counters of the whole host) ---
+    long overflows, drops;
+    if (listener_netstat(&overflows, &drops) == 0) {
+        family(f, "webserver_listen_overflows_total", "counter",
+               "Connections dropped because an accept queue was full (TcpExt ListenOverflows).");
+        fprintf(f, "webserver_listen_overflows_total %ld\n", overflows);
+        family(f, "webserver_listen_drops_total", "counter",
+               "SYNs and ACKs dropped by listening sockets (TcpExt ListenDrops).");
+        fprintf(f, "webserver_listen_drops_total %ld\n", drops);
+    }
+
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+
+    *len = size;
+    return buf;
+}
@@ -0,0 +1,187 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+#include "config.h"
+#include "slowlog.h"
+
+// ------------------------------------------------------------
+// Per-worker metrics exported at /metrics (Prometheus text format)
+// ------------------------------------------------------------
+// Each worker slot in shared memory holds one worker_metrics_t. It is only
+// written by the process(es) serving that slot, with relaxed atomic adds,
+// so no semaphore is taken on the request path nor by the scraper. During
+// a reload the retiring and the new process share the slot: counters keep
+// growing and the gauges (inc/dec) add up.
+
+// Histogram bucket upper bounds ("le"), the +Inf bucket is implicit
+#define METRICS_DURATION_BUCKETS  14     // seconds, 0.0005 .. 10
+#define METRICS_SIZE_BUCKETS      10     // bytes, 256 .. 16 MiB
+#define METRICS_HANDSHAKE_BUCKETS 8      // seconds, 0.001 .. 1
+
+// Outcomes of a proxied request (metrics_proxy_request)
+#define METRICS_PROXY_UPSTREAM  0   // Answered by an upstream
+#define METRICS_PROXY_CACHE_HIT 1   // Answered from the micro-cache
+#define METRICS_PROXY_ERROR     2   // 502/504: no upstream answered
+
+// Status classes 1xx..5xx (index status / 100)
+#define METRICS_STATUS_CLASSES 6
+
+// Every field is a machine word, so a snapshot is a word-by-word copy
+typedef struct {
+    unsigned long requests_total;
+    unsigned long responses_total[METRICS_STATUS_CLASSES];
+    unsigned long response_bytes_total;
+    unsigned long http2_requests_total;
+
+    unsigned long cache_hits_total;
+    unsigned long cache_misses_total;
+    unsigned long cache_admitted_total;
+    unsigned long cache_rejected_size_total;
+    unsigned long cache_rejected_frequency_total;
+    unsigned long cache_evictions_total;
+    long cache_bytes;
+    long cache_entries;
+    unsigned long cache_arena_addr;     // Arena of the slot's process (stored, not added)
+    unsigned long cache_arena_bytes;
+    long cache_arena_pages;             // CACHE_ARENA_* (cache_arena.h)
+    unsigned long cache_arena_fallbacks_total;
+    unsigned long cache_budget_bytes;   // Set by the memory governor (stored, not added)
+
+    // Virtual hosts (vhost.c), index 0 = default host
+    unsigned long vhost_requests_total[CONFIG_MAX_VHOSTS + 1];
+    unsigned long vhost_cache_hits_total[CONFIG_MAX_VHOSTS + 1];
+    long vhost_cache_bytes[CONFIG_MAX_VHOSTS + 1];
+
+    // Memory governor (memgov.c)
+    unsigned long memgov_shrinks_total;
+    unsigned long memgov_grows_total;
+
+    unsigned long connections_total;
+    long connections_active;
+
+    unsigned long tls_handshakes_total;
+    unsigned long tls_handshake_errors_total;
+
+    long pool_threads;
+    long pool_busy_threads;
+    long pool_queue_depth;
+    long pool_min_threads;      // Limits of the elastic pool (stored, not added)
+    long pool_max_threads;
+    unsigned long pool_grown_total;
+    unsigned long pool_shrunk_total;
+    unsigned long pool_queue_wait_us_total;
+    long stream_viewers;
+
+    // Allocators (mempool.c)
+    long conn_pool_slabs;
+    long conn_pool_in_use;
+    unsigned long conn_pool_allocs_total;
+    unsigned long conn_pool_reused_total;
+    unsigned long arena_overflows_total;
+    unsigned long arena_high_water_bytes;
+
+    // Reverse proxy (proxy.c)
+    unsigned long proxy_upstream_total;
+    unsigned long proxy_cache_hits_total;
+    unsigned long proxy_errors_total;
+    unsigned long proxy_connects_total;
+    unsigned long proxy_reused_total;
+    unsigned long proxy_upstream_down_total;
+
+    // Per-client limits (ratelimit.c)
+    unsigned long ratelimit_requests_ip_total;
+    unsigned long ratelimit_requests_subnet_total;
+    unsigned long ratelimit_connections_ip_total;
+    unsigned long ratelimit_connections_subnet_total;
+
+    // Disk I/O threads (diskio.c)
+    long disk_queue_depth;
+    unsigned long disk_reads_total;
+    unsigned long disk_read_errors_total;
+    unsigned long disk_read_bytes_total;
+    unsigned long disk_read_us_total;
+    unsigned long disk_coalesced_total;
+
+    // Response bodies (http.c)
+    unsigned long stream_responses_total;
+    unsigned long stream_bytes_total;
+    unsigned long response_memory_peak_bytes;
+
+    // Request phases (slowlog.c)
+    unsigned long phase_sum_us[PHASE_COUNT];
+    unsigned long cpu_sum_us;
+    unsigned long slow_requests_total;
+
+    // Histograms: non-cumulative counts per bucket (+Inf last), sum
+    unsigned long duration_buckets[METRICS_DURATION_BUCKETS + 1];
+    unsigned long duration_sum_us;
+    unsigned long size_buckets[METRICS_SIZE_BUCKETS + 1];
+    unsigned long size_sum;
+    unsigned long handshake_buckets[METRICS_HANDSHAKE_BUCKETS + 1];
+    unsigned long handshake_sum_us;
+
+    long start_time;        // Unix time the current process took the slot
+} worker_metrics_t;
+
+// Binds this process to the metrics of its worker slot (worker_serve)
+void metrics_bind(int slot);
+
+// Monotonic clock in microseconds (request and handshake durations)
+unsigned long metrics_now_us(void);
+
+// Upper bound in seconds of duration bucket i (0 .. METRICS_DURATION_BUCKETS - 1)
+double metrics_duration_bound(int i);
+
+// Request path (no-ops before metrics_bind, e.g. in the microbenchmarks)
+void metrics_request(int status, size_t bytes, unsigned long duration_us, int http2);
+void metrics_cache(int hit);
+void metrics_cache_admitted(void);
+void metrics_cache_rejected(int too_large);
+void metrics_cache_evicted(void);
+void metrics_cache_usage(int vhost, long bytes, long entries);
+void metrics_cache_arena(unsigned long addr, size_t bytes, int pages);
+void metrics_cache_arena_fallback(void);
+void metrics_cache_budget(size_t bytes);
+void metrics_memgov(int shrink);
+void metrics_vhost(int vhost, int cache_hit);
+void metrics_connection_open(void);
+void metrics_connection_close(void);
+void metrics_handshake(int ok, unsigned long duration_us);
+void metrics_pool_threads(int delta);
+void metrics_pool_busy(int delta);
+void metrics_pool_queue(int delta);
+void metrics_pool_limits(int min_threads, int max_threads);
+void metrics_pool_resized(int grew);
+void metrics_pool_wait(unsigned long wait_us);
+void metrics_stream_viewers(int delta);
+void metrics_conn_pool_slabs(int delta);
+void metrics_conn_pool_get(int reused);
+void metrics_conn_pool_put(void);
+void metrics_arena(size_t used, int overflowed);
+void metrics_proxy_request(int result);
+void metrics_proxy_connection(int reused);
+void metrics_proxy_upstream_down(void);
+void metrics_rate_limited(int connection, int subnet);
+void metrics_disk_queue(int delta);
+void metrics_disk_read(size_t bytes, unsigned long duration_us);
+void metrics_disk_error(void);
+void metrics_disk_coalesced(void);
+void metrics_stream(size_t bytes);
+void metrics_response_memory(size_t bytes);
+void metrics_phases(const unsigned long *phase_us, unsigned long cpu_us);
+void metrics_slow_request(void);
+
+// Pool threads, busy threads and thread limit added over the running
+// workers (for /api/stats)
+void metrics_pool_totals(long *threads, long *busy, long *max_threads);
+
+// Largest response body memory of one request, over every slot (/api/stats)
+unsigned long metrics_response_memory_peak(void);
+
+// Renders the Prometheus exposition from a lock-free snapshot of shared
+// memory. Returns a malloc'd buffer (caller frees) and its length, NULL on error
+char *metrics_render(size_t *len);
+
+#endif
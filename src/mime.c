@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mime.h"
+#include "trace.h"
+
+#define MIME_EXT_MAX    16      // Longest extension + 1
+#define MIME_SEED_TRIES 256     // Seeds tried per table size
+
+// Used when the MIME_TYPES file cannot be read
+static const char builtin_types[] =
+    "text/html              html htm    charset=utf-8\n"
+    "text/css               css\n"
+    "application/javascript js\n"
+    "application/json       json        charset=utf-8\n"
+    "image/png              png\n"
+    "image/jpeg             jpg jpeg\n"
+    "image/gif              gif\n"
+    "image/svg+xml          svg\n"
+    "text/plain             txt         charset=utf-8\n"
+    "application/pdf        pdf\n";
+
+static const mime_type_t default_type = { "application/octet-stream", -1, 0, 0 };
+
+typedef struct {
+    char ext[MIME_EXT_MAX];     // Lowercase, "" for a free slot
+    int type;
+} mime_slot_t;
+
+typedef struct {
+    mime_type_t *types;
+    int ntypes;
+    mime_slot_t *slots;
+    uint32_t mask;              // Table size - 1 (power of two)
+    uint32_t seed;
+    int nexts;
+} mime_table_t;
+
+static mime_table_t table;
+
+/**
+ * @brief FNV-1a of a lowercase extension, mixed with the table seed.
+ */
+static uint32_t ext_hash(const char *ext, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (; *ext; ext++) {
+        h ^= (unsigned char)*ext;
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6dU;
+    h ^= h >> 12;
+    return h;
+}
+
+/**
+ * @brief Places every extension for one size/seed pair.
+ * @return 1 if no two extensions collide, 0 otherwise.
+ */
+static int try_place(mime_table_t *t, const mime_slot_t *exts, int n) {
+    memset(t->slots, 0, sizeof(mime_slot_t) * (t->mask + 1));
+    for (int i = 0; i < n; i++) {
+        mime_slot_t *s = &t->slots[ext_hash(exts[i].ext, t->seed) & t->mask];
+        if (s->ext[0])
+            return 0;
+        *s = exts[i];
+    }
+    return 1;
+}
+
+/**
+ * @brief Finds a collision-free size and seed for the extensions.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int build_perfect_hash(mime_table_t *t, const mime_slot_t *exts, int n) {
+    uint32_t size = 8;
+    while (size < (uint32_t)n * 2)
+        size <<= 1;
+
+    for (;; size <<= 1) {
+        free(t->slots);
+        t->slots = malloc(sizeof(mime_slot_t) * size);
+        if (!t->slots) return -1;
+        t->mask = size - 1;
+
+        for (uint32_t seed = 1; seed <= MIME_SEED_TRIES; seed++) {
+            t->seed = seed * 0x9e3779b9u;
+            if (try_place(t, exts, n))
+                return 0;
+        }
+    }
+}
+
+/**
+ * @brief Parses one "type ext... [options]" line into the table being built.
+ */
+static void parse_line(mime_table_t *t, mime_slot_t **exts, int *nexts, int *cap, char *line) {
+    char *save = NULL;
+    char *type = strtok_r(line, " \t;\r\n", &save);
+    if (!type || type[0] == '#' || !strchr(type, '/'))
+        return;
+
+    mime_type_t mt = { NULL, -1, 0, 0 };
+    char charset[32] = "";
+    int first_ext = *nexts;
+
+    for (char *tok = strtok_r(NULL, " \t;\r\n", &save); tok; tok = strtok_r(NULL, " \t;\r\n", &save)) {
+        if (tok[0] == '#')
+            break;
+        if (!strncasecmp(tok, "charset=", 8)) {
+            snprintf(charset, sizeof(charset), "%s", tok + 8);
+        } else if (!strncasecmp(tok, "max-age=", 8)) {
+            mt.max_age = atoi(tok + 8);
+        } else if (!strcasecmp(tok, "immutable")) {
+            mt.immutable = 1;
+        } else if (!strcasecmp(tok, "no-cache")) {
+            mt.no_cache = 1;
+        } else if (strlen(tok) < MIME_EXT_MAX) {
+            if (*nexts == *cap) {
+                mime_slot_t *p = realloc(*exts, sizeof(mime_slot_t) * (*cap ? *cap * 2 : 64));
+                if (!p) {
+                    *nexts = first_ext;
+                    return;
+                }
+                *exts = p;
+                *cap = *cap ? *cap * 2 : 64;
+            }
+            mime_slot_t *e = &(*exts)[(*nexts)++];
+            for (int i = 0; tok[i]; i++)
+                e->ext[i] = tolower((unsigned char)tok[i]);
+            e->ext[strlen(tok)] = '\0';
+            e->type = t->ntypes;
+        }
+    }
+    if (*nexts == first_ext)
+        return;     // A type without extensions is never looked up
+
+    char full[160];
+    if (charset[0])
+        snprintf(full, sizeof(full), "%s; charset=%s", type, charset);
+    else
+        snprintf(full, sizeof(full), "%s", type);
+
+    mime_type_t *p = realloc(t->types, sizeof(mime_type_t) * (t->ntypes + 1));
+    if (p) {
+        t->types = p;
+        mt.content_type = strdup(full);
+    }
+    if (!p || !mt.content_type) {
+        *nexts = first_ext;     // Out of memory: the line is dropped
+        return;
+    }
+    t->types[t->ntypes++] = mt;
+}
+
+static void table_free(mime_table_t *t) {
+    for (int i = 0; i < t->ntypes; i++)
+        free((char *)t->types[i].content_type);
+    free(t->types);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/**
+ * @brief Builds a table from mime.types text.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int table_build(mime_table_t *t, FILE *f) {
+    mime_slot_t *exts = NULL;
+    int nexts = 0, cap = 0;
+    char line[1024];
+
+    memset(t, 0, sizeof(*t));
+    while (fgets(line, sizeof(line), f))
+        parse_line(t, &exts, &nexts, &cap, line);
+
+    // A repeated extension keeps its last type
+    int n = 0;
+    for (int i = 0; i < nexts; i++) {
+        int j;
+        for (j = 0; j < n; j++)
+            if (!strcmp(exts[j].ext, exts[i].ext))
+                break;
+        exts[j] = exts[i];
+        if (j == n) n++;
+    }
+
+    int rc = build_perfect_hash(t, exts, n);
+    t->nexts = n;
+    free(exts);
+    return rc;
+}
+
+/**
+ * @brief Loads the extension table from a mime.types-style file.
+ * @param path File to read.
+ * @return Number of extensions, -1 if the file could not be read (the
+ *         built-in table is used then).
+ */
+int mime_load(const char *path) {
+    mime_table_t t = {0};
+    int rc = -1;
+
+    FILE *f = path ? fopen(path, "r") : NULL;
+    if (f) {
+        if (table_build(&t, f) == 0)
+            rc = t.nexts;
+        else
+            table_free(&t);
+        fclose(f);
+    }
+
+    if (rc < 0) {
+        TRACE_WARN(TRACE_SERVE, "Cannot load MIME types from '%s', using built-in table",
+                   path ? path : "(none)");
+        f = fmemopen((void *)builtin_types, sizeof(builtin_types) - 1, "r");
+        if (!f || table_build(&t, f) != 0) {
+            if (f) fclose(f);
+            table_free(&t);
+            return -1;
+        }
+        fclose(f);
+    }
+
+    // Called before the pool threads exist (startup, reload successor)
+    table_free(&table);
+    table = t;
+
+    TRACE_INFO(TRACE_SERVE, "MIME types: %d extensions, %d types, %u slots",
+               table.nexts, table.ntypes, table.mask + 1);
+    return rc;
+}
+
+/**
+ * @brief Finds the type of a file by its extension.
+ * @param path File path.
+ * @return Type and cache policy (application/octet-stream if unknown).
+ */
+const mime_type_t *mime_lookup(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/') || !table.slots)
+        return &default_type;
+    ext++;
+
+    char key[MIME_EXT_MAX];
+    size_t i;
+    for (i = 0; ext[i]; i++) {
+        if (i == MIME_EXT_MAX - 1)
+            return &default_type;
+        key[i] = tolower((unsigned char)ext[i]);
+    }
+    key[i] = '\0';
+
+    const mime_slot_t *s = &table.slots[ext_hash(key, table.seed) & table.mask];
+    if (s->ext[0] && !strcmp(s->ext, key))
+        return &table.types[s->type];
+    return &default_type;
+}
+
+/**
+ * @brief Writes the cache headers of a type.
+ * @param type Type returned by mime_lookup.
+ * @param buf Destination for the header lines ("Name: value\r\n").
+ * @param len Size of buf.
+ * @return Length written, 0 if the type has no policy.
+ */
+size_t mime_cache_headers(const mime_type_t *type, char *buf, size_t len) {
+    int n;
+
+    if (type->no_cache) {
+        n = snprintf(buf, len, "Cache-Control: no-cache\r\n");
+    } else if (type->max_age >= 0) {
+        // The Expires date only changes once per second and max-age
+        static __thread time_t last_now = 0;
+        static __thread int last_age = -1;
+        static __thread char expires[40];
+
+        time_t now = time(NULL);
+        if (now != last_now || type->max_age != last_age) {
+            time_t when = now + type->max_age;
+            struct tm tm;
+            gmtime_r(&when, &tm);
+            strftime(expires, sizeof(expires), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            last_now = now;
+            last_age = type->max_age;
+        }
+
+        n = snprintf(buf, len, "Cache-Control: public, max-age=%d%s\r\nExpires: %s\r\n",
+                     type->max_age, type->immutable ? ", immutable" : "", expires);
+    } else {
+        return 0;
+    }
+
+    return (n > 0 && (size_t)n < len) ? (size_t)n : 0;
+}
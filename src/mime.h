@@ -0,0 +1,37 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <stddef.h>
+
+// ------------------------------------------------------------
+// Content types and cache policies by file extension
+// ------------------------------------------------------------
+// Loaded from a mime.types-style file (MIME_TYPES) at startup and on every
+// reload, into a perfect hash: the table size and seed are chosen so that
+// no two extensions share a slot, and a lookup is one hash and one compare.
+// Each line is "type ext ext... [options]" where the options are
+//   charset=X    appended to the type ("; charset=X")
+//   max-age=N    Cache-Control: public, max-age=N and Expires
+//   immutable    adds "immutable" to Cache-Control
+//   no-cache     Cache-Control: no-cache
+// Without the file a built-in table is used (no cache policy).
+
+typedef struct {
+    const char *content_type;   // Including the charset, if any
+    int max_age;                // Seconds, -1 for no policy
+    int immutable;
+    int no_cache;
+} mime_type_t;
+
+// Loads (or reloads) the table. Returns the number of extensions, -1 if the
+// file cannot be read (the built-in table is used then)
+int mime_load(const char *path);
+
+// Type of a file path by its extension (application/octet-stream if unknown)
+const mime_type_t *mime_lookup(const char *path);
+
+// Writes the Cache-Control / Expires lines of a type into buf.
+// Returns their length (0 if the type has no policy)
+size_t mime_cache_headers(const mime_type_t *type, char *buf, size_t len);
+
+#endif
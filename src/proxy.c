@@ -0,0 +1,1324 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "proxy.h"
+#include "config.h"
+#include "cache.h"
+#include "logger.h"
+#include "stats.h"
+#include "shared_mem.h"
+#include "semaphores.h"
+#include "metrics.h"
+#include "mempool.h"
+#include "timer_wheel.h"
+#include "trace.h"
+#include "vhost.h"
+
+#define PROXY_BUF           16384               // Response head / relay buffer
+#define PROXY_IDLE_SECONDS  30                  // Older idle connections are closed
+#define PROXY_H2_MAX_BODY   (16 * 1024 * 1024)  // HTTP/2 responses are buffered
+#define PROXY_SUFFIX_MAX    128                 // X-Cache and Connection lines
+
+extern shared_data_t* shm_data;
+extern ipc_semaphores_t sems;
+extern timer_wheel_t worker_wheel;
+
+typedef struct {
+    int fd;
+    time_t since;
+} idle_conn_t;
+
+typedef struct {
+    char name[128];                 // host:port (logs, Host of HTTP/1.0 requests)
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    idle_conn_t *idle;              // Idle keep-alive connections (stack)
+    int nidle;
+    int fails;                      // Consecutive failures
+    time_t down_until;              // Skipped until then
+} upstream_t;
+
+struct proxy_route {
+    char prefix[128];
+    size_t prefix_len;
+    upstream_t ups[PROXY_MAX_UPSTREAMS];
+    int nups;
+    int next;                       // Round robin
+    int cache_seconds;              // Micro-cache TTL (0 = off)
+};
+
+// Routes are rebuilt before the pool threads exist; 'proxy_lock' guards the
+// idle stacks, the health state and the round robin
+static proxy_route_t routes[CONFIG_MAX_PROXY_ROUTES];
+static int nroutes = 0;
+static int idle_max = 0;
+static pthread_mutex_t proxy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Micro-cache entry: this header, the client head (status line and
+// headers, no blank line), then the body
+typedef struct {
+    time_t expires;
+    size_t head_len;
+} cached_hdr_t;
+
+// One request/response exchange with an upstream
+typedef struct {
+    upstream_t *up;
+    int fd;
+    int reused;                     // Taken from the idle pool
+    int received;                   // Some response bytes arrived
+    int timed_out;                  // The failure was a timeout (504)
+    char buf[PROXY_BUF];            // Response head, then body pieces
+    size_t len;
+    size_t head_len;                // Head including the blank line
+    int status;
+    long long content_length;       // -1 if absent
+    int chunked;
+    int upstream_close;             // Not reusable after this response
+    int cacheable;                  // No Set-Cookie, Vary, private or no-store
+} exchange_t;
+
+// Where the response body goes: the client (HTTP/1) and/or a copy in
+// memory (micro-cache entry, HTTP/2 response)
+typedef struct {
+    connection_t *conn;             // NULL: capture only
+    char *pending;                  // Client head, sent with the first body piece
+    size_t pending_len, pending_cap;
+    char *data;                     // Capture: cached_hdr_t, head, body
+    size_t len, cap, limit;
+    int capturing;
+} sink_t;
+
+// ------------------------------------------------------------
+// Routes
+// ------------------------------------------------------------
+
+/**
+ * @brief Resolves "host:port" (or "[v6]:port") into an upstream.
+ * @return 0 on success, -1 if malformed or unresolvable.
+ */
+static int upstream_resolve(upstream_t *u, const char *spec) {
+    char host[128];
+    const char *port;
+
+    if (spec[0] == '[') {
+        const char *end = strchr(spec, ']');
+        if (!end || end[1] != ':' || (size_t)(end - spec - 1) >= sizeof(host)) return -1;
+        memcpy(host, spec + 1, end - spec - 1);
+        host[end - spec - 1] = '\0';
+        port = end + 2;
+    } else {
+        const char *colon = strrchr(spec, ':');
+        if (!colon || (size_t)(colon - spec) >= sizeof(host)) return -1;
+        memcpy(host, spec, colon - spec);
+        host[colon - spec] = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    if (!*port || getaddrinfo(host, port, &hints, &res) != 0 || !res)
+        return -1;
+
+    memcpy(&u->addr, res->ai_addr, res->ai_addrlen);
+    u->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    snprintf(u->name, sizeof(u->name), "%s", spec);
+    return 0;
+}
+
+/**
+ * @brief Parses one PROXY_PASS value into a route.
+ * @return 0 on success, -1 if the route is unusable.
+ */
+static int parse_route(proxy_route_t *r, const char *value) {
+    char copy[256], *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", value);
+
+    char *prefix = strtok_r(copy, " \t", &save);
+    char *list = strtok_r(NULL, " \t", &save);
+    if (!prefix || prefix[0] != '/' || !list || strlen(prefix) >= sizeof(r->prefix))
+        return -1;
+
+    memset(r, 0, sizeof(*r));
+    snprintf(r->prefix, sizeof(r->prefix), "%s", prefix);
+    r->prefix_len = strlen(prefix);
+
+    for (char *opt = strtok_r(NULL, " \t", &save); opt; opt = strtok_r(NULL, " \t", &save)) {
+        if (!strncasecmp(opt, "cache=", 6))
+            r->cache_seconds = atoi(opt + 6);
+        else
+            printf("PROXY_PASS %s: unknown option '%s'\n", prefix, opt);
+    }
+
+    char *save2 = NULL;
+    for (char *spec = strtok_r(list, ",", &save2); spec; spec = strtok_r(NULL, ",", &save2)) {
+        if (r->nups == PROXY_MAX_UPSTREAMS) {
+            printf("PROXY_PASS %s: more than %d upstreams, '%s' ignored\n",
+                   prefix, PROXY_MAX_UPSTREAMS, spec);
+            continue;
+        }
+        upstream_t *u = &r->ups[r->nups];
+        if (upstream_resolve(u, spec) != 0) {
+            printf("PROXY_PASS %s: cannot resolve upstream '%s'\n", prefix, spec);
+            continue;
+        }
+        u->idle = idle_max > 0 ? calloc(idle_max, sizeof(idle_conn_t)) : NULL;
+        r->nups++;
+    }
+    return r->nups > 0 ? 0 : -1;
+}
+
+static int by_prefix_len(const void *a, const void *b) {
+    const proxy_route_t *ra = a, *rb = b;
+    return (int)rb->prefix_len - (int)ra->prefix_len;
+}
+
+/**
+ * @brief Closes the idle connections and frees the routes of this process.
+ */
+static void routes_free(void) {
+    for (int i = 0; i < nroutes; i++) {
+        for (int j = 0; j < routes[i].nups; j++) {
+            upstream_t *u = &routes[i].ups[j];
+            for (int k = 0; k < u->nidle; k++)
+                close(u->idle[k].fd);
+            free(u->idle);
+        }
+    }
+    nroutes = 0;
+}
+
+static void proxy_atfork_prepare(void) { pthread_mutex_lock(&proxy_lock); }
+static void proxy_atfork_parent(void)  { pthread_mutex_unlock(&proxy_lock); }
+static void proxy_atfork_child(void)   { pthread_mutex_init(&proxy_lock, NULL); }
+
+/**
+ * @brief Loads the PROXY_PASS routes of the current configuration.
+ *        The idle stacks are consistent in a forked successor (the lock is
+ *        held across fork), so its inherited sockets can be closed: they
+ *        stay open in the draining parent.
+ * @return Number of usable routes.
+ */
+int proxy_load(void) {
+    static int atfork_registered = 0;
+    if (!atfork_registered) {
+        pthread_atfork(proxy_atfork_prepare, proxy_atfork_parent, proxy_atfork_child);
+        atfork_registered = 1;
+    }
+
+    routes_free();
+    idle_max = get_proxy_keepalive();
+
+    for (int i = 0; i < get_proxy_route_count(); i++) {
+        if (parse_route(&routes[nroutes], get_proxy_route(i)) == 0)
+            nroutes++;
+        else
+            printf("PROXY_PASS '%s' ignored (no usable upstream)\n", get_proxy_route(i));
+    }
+    qsort(routes, nroutes, sizeof(routes[0]), by_prefix_len);
+
+    for (int i = 0; i < nroutes; i++)
+        TRACE_INFO(TRACE_PROXY, "Proxy route %s -> %d upstream(s), cache %ds",
+                   routes[i].prefix, routes[i].nups, routes[i].cache_seconds);
+    return nroutes;
+}
+
+/**
+ * @brief Finds the route of a request path.
+ * @param path Request path.
+ * @return Route with the longest matching prefix, NULL if none.
+ */
+proxy_route_t *proxy_match(const char *path) {
+    for (int i = 0; i < nroutes; i++)
+        if (!strncmp(path, routes[i].prefix, routes[i].prefix_len))
+            return &routes[i];
+    return NULL;
+}
+
+/**
+ * @brief Closes every idle upstream connection of this process.
+ */
+void proxy_shutdown(void) {
+    pthread_mutex_lock(&proxy_lock);
+    for (int i = 0; i < nroutes; i++) {
+        for (int j = 0; j < routes[i].nups; j++) {
+            upstream_t *u = &routes[i].ups[j];
+            while (u->nidle > 0)
+                close(u->idle[--u->nidle].fd);
+        }
+    }
+    pthread_mutex_unlock(&proxy_lock);
+}
+
+// ------------------------------------------------------------
+// Upstream connections and health
+// ------------------------------------------------------------
+
+/**
+ * @brief Picks the next healthy upstream not tried yet by this request.
+ *        When all of them are out of rotation, the one that comes back
+ *        first is used anyway.
+ * @param tried Bit mask of upstream indexes already tried.
+ * @return Upstream, NULL if every upstream was tried.
+ */
+static upstream_t *pick_upstream(proxy_route_t *r, unsigned tried) {
+    time_t now = time(NULL);
+    upstream_t *best = NULL, *fallback = NULL;
+
+    pthread_mutex_lock(&proxy_lock);
+    for (int k = 0; k < r->nups; k++) {
+        int i = (r->next + k) % r->nups;
+        upstream_t *u = &r->ups[i];
+        if (tried & (1u << i))
+            continue;
+        if (u->down_until <= now) {
+            best = u;
+            r->next = (i + 1) % r->nups;
+            break;
+        }
+        if (!fallback || u->down_until < fallback->down_until)
+            fallback = u;
+    }
+    pthread_mutex_unlock(&proxy_lock);
+
+    return best ? best : fallback;
+}
+
+/**
+ * @brief Records the outcome of an exchange in the upstream's health.
+ * @param ok 1 if a response head arrived, 0 on failure.
+ */
+static void upstream_result(upstream_t *u, int ok) {
+    int max_fails = get_proxy_max_fails();
+    int down = 0;
+
+    pthread_mutex_lock(&proxy_lock);
+    if (ok) {
+        u->fails = 0;
+        u->down_until = 0;
+    } else if (++u->fails >= max_fails) {
+        u->down_until = time(NULL) + get_proxy_fail_timeout_seconds();
+        u->fails = max_fails - 1;   // One failure after the pause takes it out again
+        down = 1;
+    }
+    pthread_mutex_unlock(&proxy_lock);
+
+    if (down) {
+        TRACE_WARN(TRACE_PROXY, "Upstream %s out of rotation for %ds after %d failures",
+                   u->name, get_proxy_fail_timeout_seconds(), max_fails);
+        metrics_proxy_upstream_down();
+    }
+}
+
+/**
+ * @brief Opens a connection to an upstream, bounded by PROXY_TIMEOUT_SECONDS.
+ *        The socket is left blocking with send/receive timeouts.
+ * @return Socket, or -1 on error (*timed_out set if the connect timed out).
+ */
+static int upstream_connect(const upstream_t *u, int *timed_out) {
+    int timeout = get_proxy_timeout_seconds();
+    int fd = socket(u->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, (const struct sockaddr *)&u->addr, u->addrlen) < 0) {
+        if (errno != EINPROGRESS) goto fail;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        int rc;
+        do {
+            rc = poll(&pfd, 1, timeout * 1000);
+        } while (rc < 0 && errno == EINTR);
+
+        if (rc == 0) {
+            *timed_out = 1;
+            goto fail;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (rc < 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+            goto fail;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    struct timeval tv = { .tv_sec = timeout };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/**
+ * @brief Takes the most recent idle connection that is still usable.
+ *        A readable idle socket was closed (or spoken to) by the upstream.
+ * @return Socket, or -1 if the pool has none.
+ */
+static int upstream_take_idle(upstream_t *u) {
+    time_t now = time(NULL);
+    int fd = -1;
+
+    pthread_mutex_lock(&proxy_lock);
+    while (u->nidle > 0 && fd < 0) {
+        idle_conn_t c = u->idle[--u->nidle];
+        struct pollfd pfd = { .fd = c.fd, .events = POLLIN };
+
+        if (now - c.since < PROXY_IDLE_SECONDS && poll(&pfd, 1, 0) == 0)
+            fd = c.fd;
+        else
+            close(c.fd);
+    }
+    pthread_mutex_unlock(&proxy_lock);
+    return fd;
+}
+
+/**
+ * @brief Returns a connection to the idle pool, or closes it.
+ * @param reusable 0 if the exchange left the connection in an unknown state.
+ */
+static void upstream_release(upstream_t *u, int fd, int reusable) {
+    if (reusable && u->idle) {
+        pthread_mutex_lock(&proxy_lock);
+        if (u->nidle < idle_max) {
+            u->idle[u->nidle].fd = fd;
+            u->idle[u->nidle].since = time(NULL);
+            u->nidle++;
+            fd = -1;
+        }
+        pthread_mutex_unlock(&proxy_lock);
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * @brief Sends a whole buffer to an upstream.
+ * @return 0 on success, -1 on error (timed_out set on a send timeout).
+ */
+static int upstream_send(exchange_t *x, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(x->fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) x->timed_out = 1;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Request and response heads
+// ------------------------------------------------------------
+typedef struct {
+    char *p;
+    size_t len, cap;
+    int overflow;
+} strbuf_t;
+
+static void sb_printf(strbuf_t *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= b->cap - b->len)
+        b->overflow = 1;
+    else
+        b->len += n;
+}
+
+/**
+ * @brief Checks whether a comma-separated header value lists a token
+ *        (case-insensitive, whitespace around it ignored). Parameters
+ *        ("private=\"x\"", "chunked;p") do not change the token.
+ */
+static int has_token(const char *v, size_t len, const char *tok) {
+    size_t tl = strlen(tok);
+    const char *end = v + len;
+
+    while (v < end) {
+        const char *comma = memchr(v, ',', end - v);
+        const char *e = comma ? comma : end;
+
+        while (v < e && (*v == ' ' || *v == '\t'))
+            v++;
+        const char *name = v;
+        while (v < e && *v != '=' && *v != ';' && *v != ' ' && *v != '\t')
+            v++;
+        if ((size_t)(v - name) == tl && !strncasecmp(name, tok, tl))
+            return 1;
+
+        v = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds the request head sent upstream: the client's headers minus
+ *        the hop-by-hop and framing ones, X-Forwarded-For/-Proto, the
+ *        framing of the body actually relayed, and keep-alive.
+ * @return Head length, 0 if it does not fit.
+ */
+static size_t build_request_head(const http_request_t *req, const upstream_t *u,
+                                 char *out, size_t cap) {
+    strbuf_t b = { out, 0, cap, 0 };
+    const char *xff = NULL;
+
+    sb_printf(&b, "%s %s HTTP/1.1\r\n", req->method, req->path);
+
+    for (int i = 0; i < req->nheaders; i++) {
+        const http_header_t *h = &req->headers[i];
+        switch (h->id) {
+            case HTTP_HDR_CONNECTION:
+            case HTTP_HDR_KEEP_ALIVE:
+            case HTTP_HDR_PROXY_CONNECTION:
+            case HTTP_HDR_TE:
+            case HTTP_HDR_UPGRADE:
+            case HTTP_HDR_EXPECT:
+            case HTTP_HDR_CONTENT_LENGTH:       // Framing: written below
+            case HTTP_HDR_TRANSFER_ENCODING:
+                break;
+            case HTTP_HDR_X_FORWARDED_FOR:
+                xff = h->value;
+                break;
+            default:
+                sb_printf(&b, "%.*s: %s\r\n", (int)h->name_len, h->name, h->value);
+        }
+    }
+
+    // HTTP/2 requests only carry the named fields
+    if (req->nheaders == 0) {
+        if (req->host[0])       sb_printf(&b, "Host: %s\r\n", req->host);
+        if (req->user_agent[0]) sb_printf(&b, "User-Agent: %s\r\n", req->user_agent);
+        if (req->accept[0])     sb_printf(&b, "Accept: %s\r\n", req->accept);
+    }
+    if (!req->host[0])
+        sb_printf(&b, "Host: %s\r\n", u->name);
+
+    // A Unix socket peer is a local sidecar: it adds no address to the chain
+    if (req->client_family != AF_UNIX)
+        sb_printf(&b, "X-Forwarded-For: %s%s%s\r\n",
+                  xff ? xff : "", xff ? ", " : "", req->client_ip);
+    else if (xff)
+        sb_printf(&b, "X-Forwarded-For: %s\r\n", xff);
+
+    // The body relay_request_body sends: Content-Length bytes or the
+    // validated chunks as they came
+    if (req->content_length > 0)
+        sb_printf(&b, "Content-Length: %ld\r\n", req->content_length);
+    else if (req->content_length < 0)
+        sb_printf(&b, "Transfer-Encoding: chunked\r\n");
+
+    sb_printf(&b, "X-Forwarded-Proto: %s\r\n"
+                  "Connection: keep-alive\r\n\r\n",
+              req->is_https ? "https" : "http");
+
+    return b.overflow ? 0 : b.len;
+}
+
+/**
+ * @brief Parses a Content-Length value of the upstream (not NUL-terminated).
+ * @return 0 on success, -1 if it is empty, not all digits or overflows.
+ */
+static int parse_length(const char *v, size_t len, long long *out) {
+    while (len > 0 && (v[len - 1] == ' ' || v[len - 1] == '\t'))
+        len--;
+    if (len == 0)
+        return -1;
+
+    long long n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (v[i] < '0' || v[i] > '9' || n > (LLONG_MAX - (v[i] - '0')) / 10)
+            return -1;
+        n = n * 10 + (v[i] - '0');
+    }
+    *out = n;
+    return 0;
+}
+
+/**
+ * @brief Parses the status line and the framing headers of a response head.
+ * @return 0 on success, -1 if it is not an HTTP/1.x response or its
+ *         Content-Length is malformed or conflicting (the client gets 502).
+ */
+static int parse_response_head(exchange_t *x) {
+    const char *p = x->buf;
+    const char *end = x->buf + x->head_len - 2;     // CRLF of the blank line
+
+    if (x->head_len < 16 || strncmp(p, "HTTP/1.", 7) || p[8] != ' ')
+        return -1;
+    x->status = atoi(p + 9);
+    if (x->status < 100 || x->status > 999)
+        return -1;
+
+    int http10 = (p[7] == '0');
+    x->content_length = -1;
+    x->chunked = 0;
+    x->upstream_close = http10;
+    x->cacheable = 1;
+
+    const char *line = (const char *)memchr(p, '\n', end - p) + 1;
+    while (line < end) {
+        const char *eol = memchr(line, '\n', end + 2 - line);
+        size_t len = eol - line;
+        if (len > 0 && line[len - 1] == '\r') len--;
+
+        const char *colon = memchr(line, ':', len);
+        if (colon) {
+            const char *v = colon + 1;
+            const char *vend = line + len;
+            while (v < vend && (*v == ' ' || *v == '\t')) v++;
+            size_t vlen = vend - v;
+
+            switch (http_header_lookup(line, colon - line)) {
+                case HTTP_HDR_CONTENT_LENGTH: {
+                    long long n;
+                    if (parse_length(v, vlen, &n) < 0 ||
+                        (x->content_length >= 0 && n != x->content_length)) {
+                        TRACE_WARN(TRACE_PROXY, "Upstream %s: bad Content-Length", x->up->name);
+                        return -1;
+                    }
+                    x->content_length = n;
+                    break;
+                }
+                case HTTP_HDR_TRANSFER_ENCODING:
+                    x->chunked = has_token(v, vlen, "chunked");
+                    break;
+                case HTTP_HDR_CONNECTION:
+                    if (has_token(v, vlen, "close"))
+                        x->upstream_close = 1;
+                    else if (http10 && has_token(v, vlen, "keep-alive"))
+                        x->upstream_close = 0;
+                    break;
+                case HTTP_HDR_SET_COOKIE:
+                case HTTP_HDR_VARY:         // The key does not hold the varied headers
+                    x->cacheable = 0;
+                    break;
+                case HTTP_HDR_CACHE_CONTROL:
+                    if (has_token(v, vlen, "private") || has_token(v, vlen, "no-store") ||
+                        has_token(v, vlen, "no-cache"))
+                        x->cacheable = 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+        line = eol + 1;
+    }
+
+    if (x->chunked)
+        x->content_length = -1;
+    return 0;
+}
+
+/**
+ * @brief Reads the response head into x->buf; 1xx interim responses are
+ *        dropped (the client never sees them).
+ * @return 0 on success, -1 on error, timeout or a malformed/oversized head.
+ */
+static int read_response_head(exchange_t *x) {
+    x->len = 0;
+
+    while (1) {
+        char *blank = memmem(x->buf, x->len, "\r\n\r\n", 4);
+        if (blank) {
+            x->head_len = blank + 4 - x->buf;
+            if (parse_response_head(x) < 0)
+                return -1;
+            if (x->status >= 200)
+                return 0;
+
+            memmove(x->buf, x->buf + x->head_len, x->len - x->head_len);
+            x->len -= x->head_len;
+            continue;
+        }
+        if (x->len == sizeof(x->buf))
+            return -1;
+
+        ssize_t n = recv(x->fd, x->buf + x->len, sizeof(x->buf) - x->len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                x->timed_out = 1;
+            return -1;
+        }
+        x->received = 1;
+        x->len += n;
+    }
+}
+
+/**
+ * @brief Copies the response head for the client: status line as HTTP/1.1,
+ *        hop-by-hop headers dropped, no blank line.
+ * @return Length written (always fits in x->head_len bytes).
+ */
+static size_t client_head(const exchange_t *x, char *out) {
+    const char *end = x->buf + x->head_len - 2;
+    const char *line = (const char *)memchr(x->buf, '\n', end - x->buf) + 1;
+    size_t n = 0;
+
+    memcpy(out, "HTTP/1.1", 8);
+    memcpy(out + 8, x->buf + 8, line - x->buf - 8);
+    n = line - x->buf;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', end + 2 - line);
+        const char *colon = memchr(line, ':', eol - line);
+
+        http_header_id_t id = colon ? http_header_lookup(line, colon - line) : HTTP_HDR_OTHER;
+        if (colon && id != HTTP_HDR_CONNECTION && id != HTTP_HDR_KEEP_ALIVE &&
+            id != HTTP_HDR_PROXY_CONNECTION) {
+            memcpy(out + n, line, eol + 1 - line);
+            n += eol + 1 - line;
+        }
+        line = eol + 1;
+    }
+    return n;
+}
+
+/**
+ * @brief Fills an HTTP/2 response from a client head (modified in place:
+ *        the Content-Type value is NUL-terminated where it ends).
+ */
+static void response_from_head(http_response_t *resp, char *head, size_t len,
+                               const char *x_cache) {
+    char *end = head + len;
+    char *line = (char *)memchr(head, '\n', len) + 1;
+    size_t hl = 0;
+
+    resp->status = atoi(head + 9);
+    resp->reason = "";          // HTTP/2 has no reason phrase
+    resp->content_type = "application/octet-stream";
+    resp->headers[0] = '\0';
+
+    while (line < end) {
+        char *eol = memchr(line, '\n', end - line);
+        char *colon = memchr(line, ':', eol - line);
+        size_t n = eol + 1 - line;
+
+        switch (colon ? http_header_lookup(line, colon - line) : HTTP_HDR_OTHER) {
+            case HTTP_HDR_CONTENT_TYPE: {
+                char *v = colon + 1;
+                while (*v == ' ' || *v == '\t') v++;
+                eol[eol[-1] == '\r' ? -1 : 0] = '\0';
+                resp->content_type = v;
+                break;
+            }
+            case HTTP_HDR_CONTENT_LENGTH:
+            case HTTP_HDR_TRANSFER_ENCODING:
+                break;
+            default:
+                if (colon && hl + n < sizeof(resp->headers)) {
+                    memcpy(resp->headers + hl, line, n);
+                    hl += n;
+                    resp->headers[hl] = '\0';
+                }
+        }
+        line = eol + 1;
+    }
+
+    if (x_cache)
+        snprintf(resp->headers + hl, sizeof(resp->headers) - hl, "X-Cache: %s\r\n", x_cache);
+}
+
+// ------------------------------------------------------------
+// Bodies
+// ------------------------------------------------------------
+
+/**
+ * @brief Passes body bytes to the client (after the pending head) and to
+ *        the capture buffer while it stays under its limit.
+ * @return 0 on success, -1 if the client write failed.
+ */
+static int sink_write(sink_t *s, const char *p, size_t n) {
+    if (s->capturing && n > 0) {
+        if (s->len + n > s->limit) {
+            s->capturing = 0;
+        } else {
+            if (s->len + n > s->cap) {
+                size_t cap = s->cap ? s->cap : 4096;
+                while (cap < s->len + n) cap *= 2;
+                char *d = realloc(s->data, cap);
+                if (!d) {
+                    s->capturing = 0;
+                    goto send;
+                }
+                s->data = d;
+                s->cap = cap;
+            }
+            memcpy(s->data + s->len, p, n);
+            s->len += n;
+        }
+    }
+
+send:
+    if (!s->conn)
+        return 0;
+
+    // The head leaves in the same write as the first body piece
+    if (s->pending_len > 0) {
+        if (n > 0 && s->pending_len + n <= s->pending_cap) {
+            memcpy(s->pending + s->pending_len, p, n);
+            s->pending_len += n;
+            n = 0;
+        }
+        ssize_t w = conn_write(s->conn, s->pending, s->pending_len);
+        if (w != (ssize_t)s->pending_len)
+            return -1;
+        s->pending_len = 0;
+    }
+    if (n > 0 && conn_write(s->conn, p, n) != (ssize_t)n)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Relays the response body that follows the head: Content-Length
+ *        bytes, a chunked body (framing kept) or everything until the
+ *        upstream closes.
+ * @param has_body 0 for HEAD, 1xx, 204 and 304 responses.
+ * @param bytes Incremented with the bytes relayed.
+ * @return 0 when complete, -1 on an upstream error, -2 on a client error.
+ */
+static int relay_response_body(exchange_t *x, sink_t *s, int has_body, size_t *bytes) {
+    http_chunked_t ch = {0};
+    long long left = x->content_length;
+    int until_close = has_body && !x->chunked && left < 0;
+    size_t off = x->head_len;
+
+    if (until_close)
+        x->upstream_close = 1;
+
+    while (has_body) {
+        size_t take = x->len - off;
+        int done = 0;
+
+        if (x->chunked) {
+            ssize_t t = http_chunked_scan(&ch, x->buf + off, take);
+            if (t < 0) return -1;
+            take = t;
+            done = ch.done;
+        } else if (!until_close) {
+            if ((long long)take > left) take = left;
+            left -= take;
+            done = (left == 0);
+        }
+
+        if (take > 0 && sink_write(s, x->buf + off, take) < 0)
+            return -2;
+        *bytes += take;
+        off += take;
+
+        if (done)
+            break;
+
+        ssize_t n;
+        do {
+            n = recv(x->fd, x->buf, sizeof(x->buf), 0);
+        } while (n < 0 && errno == EINTR);
+
+        if (n == 0 && until_close)
+            break;
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                x->timed_out = 1;
+            return -1;
+        }
+        x->len = n;
+        off = 0;
+    }
+
+    // Bytes beyond the response: the connection cannot be trusted
+    if (off < x->len)
+        x->upstream_close = 1;
+
+    // A response without body still has its head pending
+    return sink_write(s, NULL, 0) < 0 ? -2 : 0;
+}
+
+/**
+ * @brief Removes the chunk framing of a captured (already validated) body.
+ * @return Length of the decoded body.
+ */
+static size_t dechunk(char *p, size_t len) {
+    size_t in = 0, out = 0;
+
+    while (in < len) {
+        unsigned long long size = strtoull(p + in, NULL, 16);
+        char *nl = memchr(p + in, '\n', len - in);
+        if (!nl || size == 0) break;
+        in = nl + 1 - p;
+        if (size > len - in) break;
+        memmove(p + out, p + in, size);
+        out += size;
+        in += size;
+        nl = memchr(p + in, '\n', len - in);
+        if (!nl) break;
+        in = nl + 1 - p;
+    }
+    return out;
+}
+
+/**
+ * @brief Streams the request body from the client to the upstream.
+ *        Bytes already buffered after the head go first; then the input
+ *        buffer is reused, so the request strings must have been copied.
+ *        Each client read has TIMEOUT_SECONDS.
+ * @return 0 on success, -1 on an upstream error, -2 on a client error.
+ */
+static int relay_request_body(connection_t *conn, const http_request_t *req, exchange_t *x) {
+    http_chunked_t ch = {0};
+    long left = req->content_length;
+    int chunked = (left < 0);
+
+    while (1) {
+        if (conn->in_off == conn->in_len) {
+            conn->in_off = conn->in_len = 0;
+
+            timer_wheel_arm(&worker_wheel, &conn->timer, conn->fd, TIMEOUT_HEADER,
+                            get_timeout_seconds() * 1000);
+            ssize_t n;
+            do {
+                n = conn_read(conn, conn->in_buf, sizeof(conn->in_buf));
+            } while (n < 0 && errno == EINTR && !conn->ssl);
+            timer_wheel_cancel(&worker_wheel, &conn->timer);
+
+            if (n <= 0) return -2;
+            conn->in_len = n;
+        }
+
+        const char *p = conn->in_buf + conn->in_off;
+        size_t take = conn->in_len - conn->in_off;
+        int done;
+
+        if (chunked) {
+            ssize_t t = http_chunked_scan(&ch, p, take);
+            if (t < 0) return -2;
+            take = t;
+            done = ch.done;
+        } else {
+            if ((long)take > left) take = left;
+            left -= take;
+            done = (left == 0);
+        }
+
+        if (upstream_send(x, p, take) < 0)
+            return -1;
+        conn->in_off += take;
+
+        if (done)
+            return 0;
+    }
+}
+
+// ------------------------------------------------------------
+// Exchanges
+// ------------------------------------------------------------
+
+/**
+ * @brief Sends the request to an upstream of the route and reads the
+ *        response head. A failed upstream is marked and the next one is
+ *        tried, as long as no part of the request body was consumed; a
+ *        pooled connection that the upstream had closed is retried on a
+ *        fresh one without counting as a failure.
+ * @param conn Client to read the body from (HTTP/1), NULL if no body.
+ * @return 0 with x->fd open, -1 if no upstream answered, -2 on a client error.
+ */
+static int exchange_start(exchange_t *x, proxy_route_t *route, const http_request_t *req,
+                          connection_t *conn, const char *head, size_t head_len) {
+    int has_body = conn && req->content_length != 0;
+    unsigned tried = 0;
+    int timed_out = 0;
+
+    for (int attempt = 0; attempt <= route->nups; attempt++) {
+        upstream_t *u = pick_upstream(route, tried);
+        if (!u) break;
+
+        memset(x, 0, offsetof(exchange_t, buf));
+        x->up = u;
+        x->fd = upstream_take_idle(u);
+        x->reused = (x->fd >= 0);
+        if (x->fd < 0)
+            x->fd = upstream_connect(u, &x->timed_out);
+
+        int rc = -1;
+        if (x->fd >= 0) {
+            metrics_proxy_connection(x->reused);
+
+            rc = upstream_send(x, head, head_len);
+            if (rc == 0 && has_body) {
+                const http_header_t *expect = http_request_header(req, HTTP_HDR_EXPECT);
+                if (expect && has_token(expect->value, expect->value_len, "100-continue") &&
+                    conn->in_off == conn->in_len)
+                    conn_write(conn, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+
+                rc = relay_request_body(conn, req, x);
+                if (rc == -2) {
+                    close(x->fd);
+                    return -2;
+                }
+            }
+            if (rc == 0)
+                rc = read_response_head(x);
+        }
+
+        if (rc == 0) {
+            upstream_result(u, 1);
+            return 0;
+        }
+
+        if (x->fd >= 0)
+            close(x->fd);
+
+        if (x->reused && !x->received && !x->timed_out && !has_body) {
+            TRACE_DEBUG(TRACE_PROXY, "Idle connection to %s was closed, retrying", u->name);
+            continue;
+        }
+
+        TRACE_WARN(TRACE_PROXY, "Upstream %s failed (%s) for %s %s", u->name,
+                   x->timed_out ? "timeout" : "error", req->method, req->path);
+        upstream_result(u, 0);
+        tried |= 1u << (u - route->ups);
+        timed_out = x->timed_out;
+
+        if (has_body)
+            break;      // The body cannot be sent again
+    }
+
+    x->timed_out = timed_out;
+    return -1;
+}
+
+/**
+ * @brief Checks whether a request may be answered from the micro-cache and
+ *        builds its key.
+ */
+static int cache_key(const proxy_route_t *route, const http_request_t *req,
+                     char *key, size_t len) {
+    if (route->cache_seconds <= 0 || req->content_length != 0)
+        return 0;
+    if (strcmp(req->method, "GET") && strcmp(req->method, "HEAD"))
+        return 0;
+    if (http_request_header(req, HTTP_HDR_AUTHORIZATION) ||
+        http_request_header(req, HTTP_HDR_COOKIE))
+        return 0;
+
+    // Upstreams see the Host header, not the vhost it maps to: two names of
+    // one "*.example.com" line get their own entries. Case and a trailing
+    // dot do not change the host
+    int n = snprintf(key, len, "proxy:");
+    for (const char *h = req->host; *h && (size_t)n < len; h++) {
+        if (*h == '.' && (h[1] == '\0' || h[1] == ':'))
+            continue;
+        key[n++] = tolower((unsigned char)*h);
+    }
+    if ((size_t)n >= len)
+        return 0;
+    int m = snprintf(key + n, len - n, ":%s", req->path);
+    return m > 0 && (size_t)m < len - n;
+}
+
+/**
+ * @brief Looks up a fresh micro-cache entry.
+ * @return Pinned entry data (release with cache_release), NULL if absent or
+ *         expired.
+ */
+static char *cache_lookup(const char *key, cached_hdr_t *hdr, size_t *size) {
+    char *data = NULL;
+
+    if (!cache_get(key, &data, size))
+        return NULL;
+
+    memcpy(hdr, data, sizeof(*hdr));
+    if (hdr->expires <= time(NULL)) {
+        cache_release(data);
+        return NULL;
+    }
+    return data;
+}
+
+/**
+ * @brief Starts the capture of a cacheable response: entry header and head.
+ */
+static void capture_start(sink_t *s, int seconds, const char *head, size_t head_len,
+                          size_t limit) {
+    cached_hdr_t hdr = { time(NULL) + seconds, head_len };
+
+    s->capturing = 1;
+    s->limit = limit;
+    s->data = malloc(sizeof(hdr) + head_len + 4096);
+    if (!s->data) {
+        s->capturing = 0;
+        return;
+    }
+    s->cap = sizeof(hdr) + head_len + 4096;
+    memcpy(s->data, &hdr, sizeof(hdr));
+    memcpy(s->data + sizeof(hdr), head, head_len);
+    s->len = sizeof(hdr) + head_len;
+}
+
+/**
+ * @brief Logs a proxied request and counts it in the stats.
+ * @param vhost Index of the request's virtual host, resolved before the
+ *        body relay reuses the buffer req->host points into.
+ */
+static void account(const http_request_t *req, int vhost, int status, size_t bytes, int result) {
+    if (shm_data && result != METRICS_PROXY_ERROR)
+        stats_update(&shm_data->stats, sems.sem_stats, status, bytes);
+    logger_log(req->client_ip, req->method, req->path, status, bytes);
+    metrics_proxy_request(result);
+    metrics_vhost(vhost, result == METRICS_PROXY_CACHE_HIT);
+}
+
+/**
+ * @brief Answers an HTTP/1 request from a micro-cache entry.
+ * @return 1 if answered (or the client failed), 0 on a miss.
+ */
+static int serve_cached(connection_t *conn, const char *key,
+                        int is_head, size_t *bytes, int *status) {
+    cached_hdr_t hdr;
+    size_t size;
+    char *data = cache_lookup(key, &hdr, &size);
+    if (!data)
+        return 0;
+
+    char out[PROXY_BUF + PROXY_SUFFIX_MAX];
+    const char *head = data + sizeof(hdr);
+    const char *body = head + hdr.head_len;
+    size_t body_len = size - sizeof(hdr) - hdr.head_len;
+
+    memcpy(out, head, hdr.head_len);
+    size_t n = hdr.head_len + snprintf(out + hdr.head_len, PROXY_SUFFIX_MAX,
+                                       "X-Cache: HIT\r\nConnection: %s\r\n\r\n",
+                                       conn->keep_alive ? "keep-alive" : "close");
+
+    if (conn_write(conn, out, n) != (ssize_t)n ||
+        (!is_head && conn_write(conn, body, body_len) != (ssize_t)body_len))
+        conn->keep_alive = 0;
+
+    *bytes = is_head ? 0 : body_len;
+    *status = atoi(head + 9);
+    cache_release(data);
+
+    TRACE_DEBUG(TRACE_PROXY, "Micro-cache HIT %s", key);
+    return 1;
+}
+
+/**
+ * @brief Forwards an HTTP/1 request and streams the response back.
+ * @param conn Client connection (keep_alive already decided by the caller).
+ * @param req Parsed request.
+ * @param route Matching route.
+ * @param bytes Body bytes sent to the client.
+ * @return Status sent to the client.
+ */
+int proxy_serve(connection_t *conn, http_request_t *req, proxy_route_t *route, size_t *bytes) {
+    int is_head = !strcmp(req->method, "HEAD");
+    int vhost = vhost_match(req->host)->index;
+    char key[1024];
+    int use_cache = cache_key(route, req, key, sizeof(key));
+    int status;
+
+    *bytes = 0;
+    if (use_cache && serve_cached(conn, key, is_head, bytes, &status)) {
+        account(req, vhost, status, *bytes, METRICS_PROXY_CACHE_HIT);
+        return status;
+    }
+
+    char head[PROXY_BUF];
+    size_t head_len = build_request_head(req, &route->ups[0], head, sizeof(head));
+
+    // Relaying a body reuses the input buffer the request strings point
+    // into: only method, client_ip (arrays), path (copied here) and vhost
+    // are read after it
+    if (req->content_length != 0) {
+        arena_t *arena = request_arena();
+        const char *path = arena ? arena_strndup(arena, req->path, strlen(req->path)) : NULL;
+        req->path = path ? path : "-";
+    }
+
+    exchange_t x;
+    x.timed_out = 0;
+    int rc = head_len ? exchange_start(&x, route, req, conn, head, head_len) : -1;
+
+    if (rc == -2) {
+        conn->keep_alive = 0;
+        account(req, vhost, 400, 0, METRICS_PROXY_ERROR);
+        return 400;
+    }
+
+    if (rc < 0) {
+        status = x.timed_out ? 504 : 502;
+        http_response_t resp = { .body_fd = -1 };
+        http_build_error(status, x.timed_out ? "Gateway Timeout" : "Bad Gateway", &resp);
+        resp.head_only = is_head;
+        if (req->content_length != 0)
+            conn->keep_alive = 0;   // The rest of the body is still unread
+        http_send_response(conn, &resp);
+        *bytes = is_head ? 0 : resp.body_len;
+        http_response_free(&resp);
+        account(req, vhost, status, *bytes, METRICS_PROXY_ERROR);
+        return status;
+    }
+
+    int has_body = !is_head && x.status >= 200 && x.status != 204 && x.status != 304;
+    if (has_body && !x.chunked && x.content_length < 0)
+        conn->keep_alive = 0;       // Delimited by the upstream closing
+
+    // Client head, sent together with the first body bytes
+    char out[PROXY_BUF + PROXY_SUFFIX_MAX];
+    size_t out_len = client_head(&x, out);
+    sink_t sink = { .conn = conn, .pending = out, .pending_cap = sizeof(out) };
+
+    size_t max_object = (size_t)get_cache_max_object_kb() * 1024;
+    if (use_cache && !is_head && x.cacheable && x.status == 200 && x.content_length >= 0 &&
+        sizeof(cached_hdr_t) + out_len + x.content_length <= max_object)
+        capture_start(&sink, route->cache_seconds, out, out_len, max_object);
+
+    out_len += snprintf(out + out_len, PROXY_SUFFIX_MAX, "%sConnection: %s\r\n\r\n",
+                        use_cache ? "X-Cache: MISS\r\n" : "",
+                        conn->keep_alive ? "keep-alive" : "close");
+    sink.pending_len = out_len;
+
+    rc = relay_response_body(&x, &sink, has_body, bytes);
+
+    if (rc == 0) {
+        upstream_release(x.up, x.fd, !x.upstream_close);
+        if (sink.capturing && cache_put(key, sink.data, sink.len, vhost))
+            TRACE_DEBUG(TRACE_PROXY, "Micro-cached %s for %ds", key, route->cache_seconds);
+    } else {
+        close(x.fd);
+        conn->keep_alive = 0;       // The client got a truncated response
+        if (rc == -1) {
+            TRACE_WARN(TRACE_PROXY, "Upstream %s failed during the body of %s",
+                       x.up->name, req->path);
+            upstream_result(x.up, 0);
+        }
+    }
+    free(sink.data);
+
+    account(req, vhost, x.status, *bytes, METRICS_PROXY_UPSTREAM);
+    return x.status;
+}
+
+/**
+ * @brief Forwards an HTTP/2 request (no body) and buffers the response.
+ * @param req Parsed request.
+ * @param route Matching route.
+ * @param resp Response to fill (release with http_response_free).
+ */
+void proxy_build_response(http_request_t *req, proxy_route_t *route, http_response_t *resp) {
+    int is_head = !strcmp(req->method, "HEAD");
+    int vhost = vhost_match(req->host)->index;
+    char key[1024];
+    int use_cache = cache_key(route, req, key, sizeof(key));
+
+    if (req->content_length != 0) {
+        http_build_error(501, "Not Implemented", resp);
+        logger_log(req->client_ip, req->method, req->path, 501, 0);
+        return;
+    }
+
+    if (use_cache) {
+        cached_hdr_t hdr;
+        size_t size;
+        char *data = cache_lookup(key, &hdr, &size);
+        char *head = data ? malloc(hdr.head_len) : NULL;
+
+        if (head) {
+            memcpy(head, data + sizeof(hdr), hdr.head_len);
+            response_from_head(resp, head, hdr.head_len, "HIT");
+            resp->owned = head;
+            resp->cached = data;
+            resp->body = data + sizeof(hdr) + hdr.head_len;
+            resp->body_len = size - sizeof(hdr) - hdr.head_len;
+            resp->head_only = is_head;
+            account(req, vhost, resp->status, is_head ? 0 : resp->body_len,
+                    METRICS_PROXY_CACHE_HIT);
+            return;
+        }
+        cache_release(data);
+    }
+
+    char head[PROXY_BUF];
+    size_t head_len = build_request_head(req, &route->ups[0], head, sizeof(head));
+
+    exchange_t x;
+    x.timed_out = 0;
+    if (!head_len || exchange_start(&x, route, req, NULL, head, head_len) < 0) {
+        int status = x.timed_out ? 504 : 502;
+        http_build_error(status, x.timed_out ? "Gateway Timeout" : "Bad Gateway", resp);
+        account(req, vhost, status, resp->body_len, METRICS_PROXY_ERROR);
+        return;
+    }
+
+    int has_body = !is_head && x.status != 204 && x.status != 304;
+    char out[PROXY_BUF];
+    size_t out_len = client_head(&x, out);
+
+    sink_t sink = {0};
+    capture_start(&sink, route->cache_seconds, out, out_len, PROXY_H2_MAX_BODY);
+
+    size_t bytes = 0;
+    int rc = relay_response_body(&x, &sink, has_body, &bytes);
+    if (rc == 0)
+        upstream_release(x.up, x.fd, !x.upstream_close);
+    else
+        close(x.fd);
+
+    if (rc != 0 || !sink.capturing) {
+        if (rc == -1)
+            upstream_result(x.up, 0);
+        free(sink.data);
+        http_build_error(502, "Bad Gateway", resp);
+        account(req, vhost, 502, resp->body_len, METRICS_PROXY_ERROR);
+        return;
+    }
+
+    size_t body_off = sizeof(cached_hdr_t) + out_len;
+    size_t body_len = sink.len - body_off;
+    if (x.chunked) {
+        body_len = dechunk(sink.data + body_off, body_len);
+        sink.len = body_off + body_len;
+    }
+
+    if (use_cache && x.cacheable && x.status == 200 && !is_head &&
+        cache_put(key, sink.data, sink.len, vhost))
+        TRACE_DEBUG(TRACE_PROXY, "Micro-cached %s for %ds", key, route->cache_seconds);
+
+    response_from_head(resp, sink.data + sizeof(cached_hdr_t), out_len,
+                       use_cache ? "MISS" : NULL);
+    resp->owned = sink.data;
+    resp->body = sink.data + body_off;
+    resp->body_len = is_head && x.content_length > 0 ? (size_t)x.content_length : body_len;
+    resp->head_only = is_head;
+
+    account(req, vhost, resp->status, is_head ? 0 : body_len, METRICS_PROXY_UPSTREAM);
+}
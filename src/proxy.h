@@ -0,0 +1,46 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stddef.h>
+#include "http.h"
+
+// ------------------------------------------------------------
+// Reverse proxy
+// ------------------------------------------------------------
+// PROXY_PASS=<prefix> <host:port>[,<host:port>...] [cache=<seconds>]
+// Requests whose path starts with <prefix> (longest prefix wins) are
+// forwarded, path unchanged, to the upstreams of the route in round robin.
+// Each worker keeps up to PROXY_KEEPALIVE idle keep-alive connections per
+// upstream. An upstream that fails PROXY_MAX_FAILS times in a row (connect,
+// send or response head errors and timeouts) is skipped for
+// PROXY_FAIL_TIMEOUT_SECONDS, then given one request again.
+// HTTP/1 request and response bodies are streamed through a fixed buffer.
+// With cache=N, 200 responses to GET with a Content-Length are kept in the
+// file cache for N seconds (micro-caching), so a burst of identical
+// requests costs one upstream round trip per N seconds.
+
+#define PROXY_MAX_UPSTREAMS 8       // Per route
+
+typedef struct proxy_route proxy_route_t;
+
+// Parses the PROXY_PASS routes and resolves their upstreams (startup and
+// reload, before the pool threads exist). Idle connections inherited from
+// the previous generation are closed. Returns the number of routes
+int proxy_load(void);
+
+// Route whose prefix matches the path, NULL if the path is not proxied
+proxy_route_t *proxy_match(const char *path);
+
+// HTTP/1: forwards the request (its body streamed from the connection) and
+// streams the response back. Clears conn->keep_alive when the connection
+// cannot serve another request. Updates stats and the access log.
+// Returns the status sent and the body bytes in *bytes
+int proxy_serve(connection_t *conn, http_request_t *req, proxy_route_t *route, size_t *bytes);
+
+// HTTP/2: forwards a request without body and buffers the response
+void proxy_build_response(http_request_t *req, proxy_route_t *route, http_response_t *resp);
+
+// Closes the idle upstream connections of this process (worker exit)
+void proxy_shutdown(void);
+
+#endif
@@ -0,0 +1,304 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include "ratelimit.h"
+#include "shared_mem.h"
+#include "config.h"
+#include "metrics.h"
+
+// Shared memory of this process (worker.c)
+extern shared_data_t* shm_data;
+
+#define LOAD(p)             __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE(p, v)         __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define CAS(p, expected, v) __atomic_compare_exchange_n((p), (expected), (v), 0, \
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+// Key tags (top byte): the same table holds IPs and subnets of both families
+#define TAG_V4       (1ULL << 56)
+#define TAG_V4_NET   (2ULL << 56)
+#define TAG_V6       (3ULL << 56)
+#define TAG_V6_NET   (4ULL << 56)
+#define KEY_MASK     ((1ULL << 56) - 1)
+
+// Largest bucket: tokens x 1000 must fit in 32 bits
+#define MAX_BURST    4000000
+
+typedef struct {
+    uint64_t ip;
+    uint64_t subnet;
+} client_keys_t;
+
+/**
+ * @brief 64-bit finalizer (splitmix64): spreads a key over the table.
+ */
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief FNV-1a hash of an IPv6 address prefix.
+ */
+static uint64_t hash_bytes(const unsigned char *p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Milliseconds of the monotonic clock (wraps every ~49 days, the
+ *        buckets only look at differences).
+ */
+static uint32_t now_ms(void) {
+    return (uint32_t)(metrics_now_us() / 1000);
+}
+
+static void keys_v4(uint32_t addr, client_keys_t *k) {
+    int prefix = get_rate_limit_subnet_prefix();
+    uint32_t mask = prefix >= 32 ? 0xffffffffu : ~(0xffffffffu >> prefix);
+    k->ip = TAG_V4 | addr;
+    k->subnet = TAG_V4_NET | ((uint64_t)prefix << 32) | (addr & mask);
+}
+
+static void keys_v6(const struct in6_addr *a, client_keys_t *k) {
+    // IPv4-mapped (::ffff:a.b.c.d): the IPv4 client
+    if (IN6_IS_ADDR_V4MAPPED(a)) {
+        uint32_t v4;
+        memcpy(&v4, &a->s6_addr[12], 4);
+        keys_v4(ntohl(v4), k);
+        return;
+    }
+    k->ip = TAG_V6 | (hash_bytes(a->s6_addr, 16) & KEY_MASK);
+    k->subnet = TAG_V6_NET | (hash_bytes(a->s6_addr, 8) & KEY_MASK);
+}
+
+/**
+ * @brief Keys of a client from its socket address.
+ * @return 0 on success, -1 for other address families (never limited).
+ */
+static int keys_from_sockaddr(const struct sockaddr *addr, client_keys_t *k) {
+    if (addr->sa_family == AF_INET) {
+        keys_v4(ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr), k);
+        return 0;
+    }
+    if (addr->sa_family == AF_INET6) {
+        keys_v6(&((const struct sockaddr_in6 *)addr)->sin6_addr, k);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Keys of a client from its textual address (as logged).
+ * @return 0 on success, -1 if the address cannot be parsed.
+ */
+static int keys_from_string(const char *ip, client_keys_t *k) {
+    struct in_addr a4;
+    struct in6_addr a6;
+
+    if (inet_pton(AF_INET, ip, &a4) == 1) {
+        keys_v4(ntohl(a4.s_addr), k);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, ip, &a6) == 1) {
+        keys_v6(&a6, k);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief An entry may be reused by another key: nothing open and no
+ *        request within RATELIMIT_IDLE_MS.
+ */
+static int entry_idle(ratelimit_entry_t *e, uint32_t now) {
+    if (LOAD(&e->connections) > 0)
+        return 0;
+    uint64_t b = LOAD(&e->bucket);
+    return b == 0 || now - (uint32_t)b > RATELIMIT_IDLE_MS;
+}
+
+/**
+ * @brief Finds or claims the entry of a key.
+ * @return Slot index, -1 if every probed slot is in use.
+ */
+static int entry_find(uint64_t key, uint32_t now) {
+    ratelimit_entry_t *t = shm_data->ratelimit.entries;
+    unsigned start = (unsigned)mix(key) & (RATELIMIT_SLOTS - 1);
+    int victim = -1;
+    uint64_t victim_key = 0;
+
+    for (int i = 0; i < RATELIMIT_PROBE; i++) {
+        unsigned slot = (start + i) & (RATELIMIT_SLOTS - 1);
+        ratelimit_entry_t *e = &t[slot];
+        uint64_t k = LOAD(&e->key);
+
+        if (k == key)
+            return slot;
+
+        if (k == 0) {
+            uint64_t expected = 0;
+            if (CAS(&e->key, &expected, key)) {
+                STORE(&e->bucket, 0);
+                return slot;
+            }
+            if (expected == key)        // Claimed by the same client meanwhile
+                return slot;
+            continue;
+        }
+
+        if (victim < 0 && entry_idle(e, now)) {
+            victim = slot;
+            victim_key = k;
+        }
+    }
+
+    // Take over an idle entry (another process may win the race: fail open)
+    if (victim >= 0 && CAS(&t[victim].key, &victim_key, key)) {
+        STORE(&t[victim].bucket, 0);
+        return victim;
+    }
+    return -1;
+}
+
+/**
+ * @brief Takes one token from the bucket of a key.
+ * @param rps Refill rate (tokens per second).
+ * @param burst Bucket size.
+ * @return 1 if a token was taken, 0 if the bucket is empty.
+ */
+static int bucket_take(uint64_t key, int rps, int burst, uint32_t now) {
+    int slot = entry_find(key, now);
+    if (slot < 0)
+        return 1;
+
+    uint64_t *bucket = &shm_data->ratelimit.entries[slot].bucket;
+    uint64_t full = (uint64_t)(burst < MAX_BURST ? burst : MAX_BURST) * 1000;
+    uint64_t old = LOAD(bucket);
+
+    while (1) {
+        // 0: new entry, full bucket
+        uint64_t tokens = old ? old >> 32 : full;
+        uint32_t last = old ? (uint32_t)old : now;
+
+        // rps tokens per second = rps thousandths per millisecond
+        tokens += (uint64_t)(uint32_t)(now - last) * (uint64_t)rps;
+        if (tokens > full)
+            tokens = full;
+
+        int ok = tokens >= 1000;
+        if (ok)
+            tokens -= 1000;
+
+        // Never store 0 (it means "new entry")
+        uint64_t next = (tokens << 32) | (now ? now : 1);
+        if (CAS(bucket, &old, next))
+            return ok;
+    }
+}
+
+/**
+ * @brief Counts a connection on the entry of a key.
+ * @return Slot + 1 when counted, 0 when not tracked, -1 over the limit.
+ */
+static int conn_take(uint64_t key, int limit, uint32_t now) {
+    int slot = entry_find(key, now);
+    if (slot < 0)
+        return 0;
+
+    long *count = &shm_data->ratelimit.entries[slot].connections;
+    if (__atomic_add_fetch(count, 1, __ATOMIC_RELAXED) > limit) {
+        __atomic_sub_fetch(count, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return slot + 1;
+}
+
+static void conn_release(unsigned held) {
+    if (held)
+        __atomic_sub_fetch(&shm_data->ratelimit.entries[held - 1].connections, 1,
+                           __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Applies RATE_LIMIT_CONNECTIONS and RATE_LIMIT_SUBNET_CONNECTIONS
+ *        to a new connection.
+ * @param addr Peer address from accept().
+ * @param hold Receives the entries to release in ratelimit_disconnect.
+ * @return RATELIMIT_OK, RATELIMIT_IP or RATELIMIT_SUBNET.
+ */
+int ratelimit_connect(const struct sockaddr *addr, ratelimit_hold_t *hold) {
+    hold->ip = hold->subnet = 0;
+
+    int per_ip = get_rate_limit_connections();
+    int per_subnet = get_rate_limit_subnet_connections();
+    client_keys_t k;
+
+    if ((!per_ip && !per_subnet) || !shm_data || keys_from_sockaddr(addr, &k) != 0)
+        return RATELIMIT_OK;
+
+    uint32_t now = now_ms();
+
+    if (per_ip) {
+        int held = conn_take(k.ip, per_ip, now);
+        if (held < 0) {
+            metrics_rate_limited(1, 0);
+            return RATELIMIT_IP;
+        }
+        hold->ip = held;
+    }
+
+    if (per_subnet) {
+        int held = conn_take(k.subnet, per_subnet, now);
+        if (held < 0) {
+            ratelimit_disconnect(hold);
+            metrics_rate_limited(1, 1);
+            return RATELIMIT_SUBNET;
+        }
+        hold->subnet = held;
+    }
+    return RATELIMIT_OK;
+}
+
+/**
+ * @brief Releases the connection counts taken by ratelimit_connect.
+ * @param hold Entries held by the connection (cleared).
+ */
+void ratelimit_disconnect(ratelimit_hold_t *hold) {
+    if (!shm_data) return;
+    conn_release(hold->ip);
+    conn_release(hold->subnet);
+    hold->ip = hold->subnet = 0;
+}
+
+/**
+ * @brief Applies RATE_LIMIT_RPS and RATE_LIMIT_SUBNET_RPS to a request.
+ * @param client_ip Client address as text (IPv4 or IPv6).
+ * @return RATELIMIT_OK, RATELIMIT_IP or RATELIMIT_SUBNET.
+ */
+int ratelimit_request(const char *client_ip) {
+    int rps = get_rate_limit_rps();
+    int subnet_rps = get_rate_limit_subnet_rps();
+    client_keys_t k;
+
+    if ((!rps && !subnet_rps) || !shm_data || keys_from_string(client_ip, &k) != 0)
+        return RATELIMIT_OK;
+
+    uint32_t now = now_ms();
+
+    if (rps && !bucket_take(k.ip, rps, get_rate_limit_burst(), now)) {
+        metrics_rate_limited(0, 0);
+        return RATELIMIT_IP;
+    }
+    if (subnet_rps && !bucket_take(k.subnet, subnet_rps, get_rate_limit_subnet_burst(), now)) {
+        metrics_rate_limited(0, 1);
+        return RATELIMIT_SUBNET;
+    }
+    return RATELIMIT_OK;
+}
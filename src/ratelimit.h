@@ -0,0 +1,55 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// ------------------------------------------------------------
+// Per-client rate and connection limits
+// ------------------------------------------------------------
+// One fixed-size table in shared memory, so the limits hold across every
+// worker process. An entry is keyed by a client IP or by its subnet
+// (/RATE_LIMIT_SUBNET_PREFIX for IPv4, /64 for IPv6) and holds a token
+// bucket and the number of connections open. Entries are claimed and
+// updated with atomic compare-and-swap only: no semaphore on the request
+// path. A key is looked up in RATELIMIT_PROBE consecutive slots; when they
+// are all taken, an idle entry (no connection, no request for
+// RATELIMIT_IDLE_MS) is reused. If none is idle the client is not limited
+// (the table fails open rather than throttling innocent clients). Races
+// between processes on the same entry only make the counts approximate.
+
+#define RATELIMIT_SLOTS   8192      // Power of two
+#define RATELIMIT_PROBE   8         // Slots tried per key
+#define RATELIMIT_IDLE_MS 60000     // Idle entries may be reused after this
+
+// Limit hit (0 = allowed)
+#define RATELIMIT_OK     0
+#define RATELIMIT_IP     1
+#define RATELIMIT_SUBNET 2
+
+typedef struct {
+    uint64_t key;           // Client IP or subnet tag (0 = free slot)
+    uint64_t bucket;        // Tokens x 1000 (high half) | last refill ms (low half)
+    long connections;       // Connections open by the key
+} ratelimit_entry_t;
+
+typedef struct {
+    ratelimit_entry_t entries[RATELIMIT_SLOTS];
+} ratelimit_table_t;
+
+// Entries a connection holds a count on (slot + 1, 0 = none)
+typedef struct {
+    unsigned ip;
+    unsigned subnet;
+} ratelimit_hold_t;
+
+// Connection limits (accept loop). On RATELIMIT_OK the connection is
+// counted in 'hold' until ratelimit_disconnect; otherwise the limit hit
+int ratelimit_connect(const struct sockaddr *addr, ratelimit_hold_t *hold);
+void ratelimit_disconnect(ratelimit_hold_t *hold);
+
+// Request rate of a client (textual address): takes one token from its IP
+// and subnet buckets. Returns RATELIMIT_OK or the limit hit
+int ratelimit_request(const char *client_ip);
+
+#endif
@@ -2,6 +2,10 @@
 #define SHARED_MEM_H
 
 #include "stats.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "slowlog.h"
+#include "history.h"
 
 #define SHM_NAME "/webserver_shm_v1"
 
@@ -12,9 +16,29 @@ typedef struct {
     int total_accepted;  // Total accepted connections (statistic)
 } accept_control_t;
 
+// Worker slots: one per configured worker, updated on every reload
+#define MAX_WORKERS 64
+
+#define WORKER_STATE_EMPTY    0
+#define WORKER_STATE_RUNNING  1
+#define WORKER_STATE_DRAINING 2
+
+typedef struct {
+    int pid;             // Process currently serving this slot (0 = none)
+    int is_https;        // 1 if the slot serves the HTTPS listener
+    int generation;      // Config generation the process was started with
+    int state;           // WORKER_STATE_*
+    worker_metrics_t metrics;   // Written lock-free by the slot's process(es)
+} worker_slot_t;
+
 typedef struct {
     accept_control_t accept_ctrl;
     server_stats_t stats;
+    int generation;                    // Incremented by the master on each reload
+    worker_slot_t workers[MAX_WORKERS];
+    ratelimit_table_t ratelimit;       // Per-client limits (ratelimit.c)
+    slowlog_ring_t slowlog;            // Slowest recent requests (slowlog.c)
+    history_t history;                 // Per-second/minute/hour stats (history.c)
 } shared_data_t;
 
 shared_data_t* shm_create_master(void);
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sketch.h"
+
+#define LOAD(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+/**
+ * @brief Initializes a sketch.
+ * @param s Sketch.
+ * @param items Expected number of distinct keys (the width is rounded up to
+ *              a power of two).
+ * @return 0 on success, -1 if out of memory.
+ */
+int cm_sketch_init(cm_sketch_t *s, size_t items) {
+    size_t width = 64;
+    while (width < items)
+        width <<= 1;
+
+    memset(s, 0, sizeof(*s));
+    s->counters = calloc(SKETCH_ROWS, width);
+    if (!s->counters) return -1;
+
+    s->mask = width - 1;
+    s->sample = 10 * width;
+    return 0;
+}
+
+/**
+ * @brief Releases the counters of a sketch.
+ * @param s Sketch.
+ */
+void cm_sketch_free(cm_sketch_t *s) {
+    free(s->counters);
+    s->counters = NULL;
+}
+
+/**
+ * @brief Counter of a key in one row (double hashing over the 64-bit hash).
+ */
+static uint8_t *counter(const cm_sketch_t *s, uint64_t hash, int row) {
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    return &s->counters[row * (s->mask + 1) + ((h1 + row * h2) & s->mask)];
+}
+
+/**
+ * @brief Halves every counter (aging).
+ */
+static void age(cm_sketch_t *s) {
+    size_t n = SKETCH_ROWS * (s->mask + 1);
+    for (size_t i = 0; i < n; i++)
+        STORE(&s->counters[i], LOAD(&s->counters[i]) >> 1);
+    __atomic_fetch_add(&s->resets, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records one access of a key (conservative update).
+ * @param s Sketch.
+ * @param hash 64-bit hash of the key.
+ */
+void cm_sketch_add(cm_sketch_t *s, uint64_t hash) {
+    if (!s->counters) return;
+
+    unsigned min = cm_sketch_estimate(s, hash);
+    if (min < SKETCH_MAX) {
+        for (int r = 0; r < SKETCH_ROWS; r++) {
+            uint8_t *c = counter(s, hash, r);
+            if (LOAD(c) == min)
+                STORE(c, min + 1);
+        }
+    }
+
+    // The thread that completes the sample ages the sketch
+    if (__atomic_add_fetch(&s->additions, 1, __ATOMIC_RELAXED) == s->sample) {
+        age(s);
+        STORE(&s->additions, 0);
+    }
+}
+
+/**
+ * @brief Estimates the recent accesses of a key.
+ * @param s Sketch.
+ * @param hash 64-bit hash of the key.
+ * @return Smallest of its counters.
+ */
+unsigned cm_sketch_estimate(const cm_sketch_t *s, uint64_t hash) {
+    if (!s->counters) return 0;
+
+    unsigned min = SKETCH_MAX;
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        unsigned v = LOAD(counter(s, hash, r));
+        if (v < min) min = v;
+    }
+    return min;
+}
@@ -0,0 +1,38 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------
+// Count-min frequency sketch (TinyLFU)
+// ------------------------------------------------------------
+// Four rows of small saturating counters (max 15) indexed by a 64-bit key
+// hash. An addition only raises the smallest counters (conservative
+// update). After 10 x width additions every counter is halved, so the
+// estimates follow recent popularity instead of all-time totals.
+// Counters are read and written with relaxed atomics: concurrent additions
+// may occasionally be lost, which only makes the estimate approximate.
+
+#define SKETCH_ROWS    4
+#define SKETCH_MAX     15
+
+typedef struct {
+    uint8_t *counters;          // SKETCH_ROWS rows of 'width' counters
+    size_t mask;                // width - 1 (power of two)
+    unsigned long additions;    // Since the last aging
+    unsigned long sample;       // Additions between agings
+    unsigned long resets;       // Number of agings
+} cm_sketch_t;
+
+// Sized for about 'items' distinct keys. Returns 0, -1 if out of memory
+int cm_sketch_init(cm_sketch_t *s, size_t items);
+void cm_sketch_free(cm_sketch_t *s);
+
+// Records one access of a key
+void cm_sketch_add(cm_sketch_t *s, uint64_t hash);
+
+// Estimated recent accesses of a key (0..SKETCH_MAX)
+unsigned cm_sketch_estimate(const cm_sketch_t *s, uint64_t hash);
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "slowlog.h"
+#include "shared_mem.h"
+#include "config.h"
+#include "metrics.h"
+
+// Shared memory of this process (worker.c)
+extern shared_data_t* shm_data;
+
+// Request being timed by this thread (HTTP/1 connection or HTTP/2 stream)
+static __thread req_timer_t *current;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "queue", "handshake", "read", "cache", "disk", "upstream", "send", "other"
+};
+
+/**
+ * @brief Name of a phase.
+ * @param phase PHASE_* value.
+ * @return Lowercase name, "?" if out of range.
+ */
+const char *slowlog_phase_name(int phase) {
+    return phase >= 0 && phase < PHASE_COUNT ? phase_names[phase] : "?";
+}
+
+/**
+ * @brief CPU time consumed by the calling thread, in microseconds.
+ */
+static unsigned long thread_cpu_us(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Starts timing a request and makes it the current one of the thread.
+ * @param t Timer (usually on the stack of the serving thread).
+ * @param start_us Monotonic instant the request started (metrics_now_us).
+ */
+void slowlog_begin(req_timer_t *t, unsigned long start_us) {
+    memset(t, 0, sizeof(*t));
+    t->start_us = t->mark_us = start_us;
+    t->cpu_start_us = thread_cpu_us();
+    current = t;
+}
+
+/**
+ * @brief Charges the time since the last mark of a timer to a phase.
+ * @param t Timer.
+ * @param phase Phase the elapsed time belongs to.
+ * @param now_us Monotonic instant of the new mark.
+ */
+void slowlog_phase_at(req_timer_t *t, req_phase_t phase, unsigned long now_us) {
+    if (now_us > t->mark_us) {
+        t->phase_us[phase] += now_us - t->mark_us;
+        t->mark_us = now_us;
+    }
+}
+
+/**
+ * @brief Charges the time since the last mark of the thread's current
+ *        request to a phase (no-op if the thread is not timing one).
+ * @param phase Phase the elapsed time belongs to.
+ */
+void slowlog_phase(req_phase_t phase) {
+    if (current)
+        slowlog_phase_at(current, phase, metrics_now_us());
+}
+
+/**
+ * @brief Copies a string into a fixed field, truncated and NUL-terminated.
+ */
+static void copy_field(char *dst, size_t size, const char *src) {
+    size_t n = src ? strnlen(src, size - 1) : 0;
+    if (n) memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+/**
+ * @brief Appends a slow request to the ring in shared memory.
+ */
+static void ring_push(const req_timer_t *t, unsigned long total_us, unsigned long cpu_us,
+                      const char *method, const char *path, const char *client,
+                      int status, int http2) {
+    slowlog_ring_t *ring = &shm_data->slowlog;
+    unsigned long pos = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    slowlog_entry_t *e = &ring->entries[pos & (SLOWLOG_ENTRIES - 1)];
+
+    // Readers skip the entry until its sequence number is published again
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    e->time = time(NULL);
+    e->pid = getpid();
+    e->status = status;
+    e->http2 = http2;
+    e->total_us = total_us;
+    e->cpu_us = cpu_us;
+    memcpy(e->phase_us, t->phase_us, sizeof(e->phase_us));
+    copy_field(e->method, sizeof(e->method), method);
+    copy_field(e->client, sizeof(e->client), client);
+    copy_field(e->path, sizeof(e->path), path);
+
+    __atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Ends a request: the time since the last mark goes to PHASE_OTHER,
+ *        the phases and CPU time are added to the worker metrics and, when
+ *        the request took SLOW_REQUEST_MS or more, it is recorded in the ring.
+ * @param t Timer started by slowlog_begin.
+ * @param method Request method.
+ * @param path Request path.
+ * @param client Client address.
+ * @param status Response status.
+ * @param http2 1 for an HTTP/2 stream.
+ */
+void slowlog_end(req_timer_t *t, const char *method, const char *path,
+                 const char *client, int status, int http2) {
+    slowlog_phase_at(t, PHASE_OTHER, metrics_now_us());
+    if (current == t)
+        current = NULL;
+
+    // HTTP/2: CPU of the connection thread while the stream was open
+    unsigned long cpu = thread_cpu_us();
+    unsigned long cpu_us = cpu > t->cpu_start_us ? cpu - t->cpu_start_us : 0;
+    unsigned long total_us = t->mark_us - t->start_us;
+
+    metrics_phases(t->phase_us, cpu_us);
+
+    int threshold = get_slow_request_ms();
+    if (threshold > 0 && shm_data && total_us >= (unsigned long)threshold * 1000) {
+        metrics_slow_request();
+        ring_push(t, total_us, cpu_us, method, path, client, status, http2);
+    }
+}
+
+/**
+ * @brief Stops timing a request without recording it.
+ * @param t Timer started by slowlog_begin.
+ */
+void slowlog_cancel(req_timer_t *t) {
+    if (current == t)
+        current = NULL;
+}
+
+/**
+ * @brief Copies the entry at a ring position if it is still there and was
+ *        not being rewritten meanwhile.
+ * @return 1 if 'out' holds the entry, 0 if it was overwritten or in flux.
+ */
+static int ring_read(unsigned long pos, slowlog_entry_t *out) {
+    slowlog_entry_t *e = &shm_data->slowlog.entries[pos & (SLOWLOG_ENTRIES - 1)];
+
+    unsigned long seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (seq != pos + 1)
+        return 0;
+    memcpy(out, e, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+        return 0;
+
+    // Fields copied mid-write by a wrapped-around writer stay terminated
+    out->method[sizeof(out->method) - 1] = '\0';
+    out->client[sizeof(out->client) - 1] = '\0';
+    out->path[sizeof(out->path) - 1] = '\0';
+    return 1;
+}
+
+/**
+ * @brief Writes a string as a JSON string literal.
+ */
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/**
+ * @brief Renders the slow-request ring for GET /api/slow, newest first.
+ * @param len Receives the length of the document.
+ * @return malloc'd JSON document (caller frees), NULL on error.
+ */
+char *slowlog_render_json(size_t *len) {
+    if (!shm_data) return NULL;
+
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&buf, &size);
+    if (!f) return NULL;
+
+    unsigned long head = __atomic_load_n(&shm_data->slowlog.head, __ATOMIC_ACQUIRE);
+    unsigned long first = head > SLOWLOG_ENTRIES ? head - SLOWLOG_ENTRIES : 0;
+
+    fprintf(f, "{\"threshold_ms\":%d,\"recorded\":%lu,\"requests\":[",
+            get_slow_request_ms(), head);
+
+    int n = 0;
+    slowlog_entry_t e;
+    for (unsigned long pos = head; pos > first; pos--) {
+        if (!ring_read(pos - 1, &e))
+            continue;
+
+        fprintf(f, "%s{\"time\":%ld,\"pid\":%ld,\"method\":", n++ ? "," : "", e.time, e.pid);
+        json_string(f, e.method);
+        fputs(",\"path\":", f);
+        json_string(f, e.path);
+        fputs(",\"client\":", f);
+        json_string(f, e.client);
+        fprintf(f, ",\"status\":%ld,\"http2\":%s,\"total_ms\":%.3f,\"cpu_ms\":%.3f,\"phases_ms\":{",
+                e.status, e.http2 ? "true" : "false", e.total_us / 1000.0, e.cpu_us / 1000.0);
+        for (int p = 0; p < PHASE_COUNT; p++)
+            fprintf(f, "%s\"%s\":%.3f", p ? "," : "", phase_names[p], e.phase_us[p] / 1000.0);
+        fputs("}}", f);
+    }
+    fputs("]}", f);
+
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+    *len = size;
+    return buf;
+}
+
+/**
+ * @brief Writes the slow-request ring as text, one line per request,
+ *        oldest first.
+ * @param f Output stream.
+ */
+void slowlog_dump(FILE *f) {
+    if (!shm_data) return;
+
+    unsigned long head = __atomic_load_n(&shm_data->slowlog.head, __ATOMIC_ACQUIRE);
+    unsigned long first = head > SLOWLOG_ENTRIES ? head - SLOWLOG_ENTRIES : 0;
+
+    fprintf(f, "[MASTER] Pedidos lentos (>= %d ms): %lu registados, últimos %lu\n",
+            get_slow_request_ms(), head, head - first);
+
+    slowlog_entry_t e;
+    for (unsigned long pos = first; pos < head; pos++) {
+        if (!ring_read(pos, &e))
+            continue;
+
+        struct tm tm;
+        char when[32];
+        time_t t = e.time;
+        localtime_r(&t, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+        fprintf(f, "[SLOW] %s pid=%ld %s %s %s %ld %s total=%.1fms cpu=%.1fms",
+                when, e.pid, e.client, e.method, e.path, e.status,
+                e.http2 ? "h2" : "h1", e.total_us / 1000.0, e.cpu_us / 1000.0);
+        for (int p = 0; p < PHASE_COUNT; p++)
+            if (e.phase_us[p])
+                fprintf(f, " %s=%.1fms", phase_names[p], e.phase_us[p] / 1000.0);
+        fputc('\n', f);
+    }
+    fflush(f);
+}
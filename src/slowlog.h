@@ -0,0 +1,90 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// ------------------------------------------------------------
+// Per-request phase timing and the slow-request trace ring
+// ------------------------------------------------------------
+// Each request carries a req_timer_t on the stack of the thread serving it.
+// slowlog_phase() charges the monotonic time since the previous mark to a
+// phase, so a request costs a handful of vDSO clock reads plus two reads of
+// the thread CPU clock. Every request adds its phases to the worker metrics;
+// those slower than SLOW_REQUEST_MS are also copied into a ring in shared
+// memory, read by GET /api/slow and dumped by the master on SIGUSR1.
+// Ring entries are written with a sequence number (seqlock): a reader skips
+// an entry whose number changed while it was being copied.
+
+// Where the time of a request goes
+typedef enum {
+    PHASE_QUEUE,        // Accepted, waiting for a pool thread (first request)
+    PHASE_HANDSHAKE,    // TLS handshake (first request)
+    PHASE_READ,         // Header received and parsed (keep-alive idle excluded)
+    PHASE_CACHE,        // File cache lookup
+    PHASE_DISK,         // File opened and read on a cache miss
+    PHASE_UPSTREAM,     // Reverse proxy exchange, bodies included
+    PHASE_SEND,         // Response written to the client
+    PHASE_OTHER,        // Routing, API endpoints, error pages
+    PHASE_COUNT
+} req_phase_t;
+
+typedef struct {
+    unsigned long start_us;     // Monotonic clock at the start of the request
+    unsigned long mark_us;      // Last phase boundary
+    unsigned long cpu_start_us; // Thread CPU clock at the start
+    unsigned long phase_us[PHASE_COUNT];
+} req_timer_t;
+
+#define SLOWLOG_ENTRIES 256     // Power of two
+
+typedef struct {
+    unsigned long seq;          // Ring position + 1, 0 while being written
+    long time;                  // Unix time the request finished
+    long pid;
+    long status;
+    long http2;
+    unsigned long total_us;
+    unsigned long cpu_us;
+    unsigned long phase_us[PHASE_COUNT];
+    char method[16];
+    char client[48];
+    char path[160];
+} slowlog_entry_t;
+
+typedef struct {
+    unsigned long head;         // Slow requests recorded since start
+    slowlog_entry_t entries[SLOWLOG_ENTRIES];
+} slowlog_ring_t;
+
+// Name of a phase ("queue", "read", ...)
+const char *slowlog_phase_name(int phase);
+
+// Starts timing a request at 'start_us' (monotonic); the timer becomes the
+// current request of this thread
+void slowlog_begin(req_timer_t *t, unsigned long start_us);
+
+// Charges the time since the last mark of the current request to 'phase'
+// (no-op when this thread is not timing a request)
+void slowlog_phase(req_phase_t phase);
+
+// Same, on a given timer and up to a given instant
+void slowlog_phase_at(req_timer_t *t, req_phase_t phase, unsigned long now_us);
+
+// Ends a request: adds its phases to the metrics and records it in the ring
+// when slower than SLOW_REQUEST_MS
+void slowlog_end(req_timer_t *t, const char *method, const char *path,
+                 const char *client, int status, int http2);
+
+// Stops timing without recording (request failed, or the connection was
+// handed to HTTP/2 or the stats hub)
+void slowlog_cancel(req_timer_t *t);
+
+// GET /api/slow: the ring as JSON, newest first. Returns a malloc'd buffer
+// (caller frees) and its length, NULL on error
+char *slowlog_render_json(size_t *len);
+
+// Writes the ring as text, oldest first (master, on SIGUSR1)
+void slowlog_dump(FILE *f);
+
+#endif
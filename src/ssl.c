@@ -6,48 +6,80 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
-ssl_server_ctx_t* ssl_server_init(const char *cert_path, const char *key_path)
+#include "config.h"
+#include "vhost.h"
+
+/**
+ * @brief ALPN: picks "h2" when HTTP/2 is enabled and offered by the client,
+ *        otherwise "http/1.1". Clients without ALPN get HTTP/1.1 anyway.
+ */
+static int alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                       const unsigned char *in, unsigned int inlen, void *arg)
 {
-    printf("[SSL] Initializing OpenSSL...\n");
-    
-    // Initialize OpenSSL library
-    SSL_load_error_strings();
-    OpenSSL_add_ssl_algorithms();
-    ERR_load_crypto_strings();
+    (void)ssl;
+    (void)arg;
 
-    ssl_server_ctx_t *server_ctx = malloc(sizeof(ssl_server_ctx_t));
-    if (!server_ctx) {
-        perror("malloc ssl_server_ctx");
-        return NULL;
-    }
+    static const unsigned char with_h2[] = "\x02h2\x08http/1.1";
+    static const unsigned char http1_only[] = "\x08http/1.1";
 
+    const unsigned char *server = get_http2_enabled() ? with_h2 : http1_only;
+    unsigned int server_len = get_http2_enabled() ? sizeof(with_h2) - 1 : sizeof(http1_only) - 1;
+
+    if (SSL_select_next_proto((unsigned char **)out, outlen, server, server_len,
+                              in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/**
+ * @brief SNI: hands the handshake to the certificate of the virtual host
+ *        the client names. Other names keep SSL_CERT.
+ */
+static int sni_select(SSL *ssl, int *al, void *arg)
+{
+    (void)al;
+    (void)arg;
+
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!name)
+        return SSL_TLSEXT_ERR_NOACK;
+
+    const vhost_t *vh = vhost_match(name);
+    if (vh->ssl_ctx)
+        SSL_set_SSL_CTX(ssl, vh->ssl_ctx);
+    return SSL_TLSEXT_ERR_OK;
+}
+
+SSL_CTX* ssl_context_create(const char *cert_path, const char *key_path)
+{
     // Create SSL context with generic TLS method
     const SSL_METHOD *method = TLS_server_method();
-    server_ctx->ctx = SSL_CTX_new(method);
+    SSL_CTX *ctx = SSL_CTX_new(method);
     
-    if (!server_ctx->ctx) {
+    if (!ctx) {
         fprintf(stderr, "[SSL] Erro ao criar SSL_CTX\n");
         ERR_print_errors_fp(stderr);
-        free(server_ctx);
         return NULL;
     }
 
     // Configure SSL options
-    SSL_CTX_set_options(server_ctx->ctx, 
+    SSL_CTX_set_options(ctx, 
                         SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | 
                         SSL_OP_NO_COMPRESSION);
     
     // Set minimum TLS version
-    SSL_CTX_set_min_proto_version(server_ctx->ctx, TLS1_2_VERSION);
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    // Protocol negotiation (h2 / http/1.1), also after an SNI switch
+    SSL_CTX_set_alpn_select_cb(ctx, alpn_select, NULL);
 
     printf("[SSL] Loading certificate: %s\n", cert_path);
     
     // Load certificate
-    if (SSL_CTX_use_certificate_file(server_ctx->ctx, cert_path, SSL_FILETYPE_PEM) <= 0) {
+    if (SSL_CTX_use_certificate_file(ctx, cert_path, SSL_FILETYPE_PEM) <= 0) {
         fprintf(stderr, "[SSL] ERRO: Falha ao carregar certificado '%s'\n", cert_path);
         ERR_print_errors_fp(stderr);
-        SSL_CTX_free(server_ctx->ctx);
-        free(server_ctx);
+        SSL_CTX_free(ctx);
         return NULL;
     }
     
@@ -55,26 +87,51 @@ ssl_server_ctx_t* ssl_server_init(const char *cert_path, const char *key_path)
     printf("[SSL] Loading private key: %s\n", key_path);
 
     // Load private key
-    if (SSL_CTX_use_PrivateKey_file(server_ctx->ctx, key_path, SSL_FILETYPE_PEM) <= 0) {
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_path, SSL_FILETYPE_PEM) <= 0) {
         fprintf(stderr, "[SSL] ERRO: Falha ao carregar chave privada '%s'\n", key_path);
         ERR_print_errors_fp(stderr);
-        SSL_CTX_free(server_ctx->ctx);
-        free(server_ctx);
+        SSL_CTX_free(ctx);
         return NULL;
     }
     
     printf("[SSL] Private key loaded successfully\n");
 
     // Check if the key and certificate match
-    if (!SSL_CTX_check_private_key(server_ctx->ctx)) {
+    if (!SSL_CTX_check_private_key(ctx)) {
         fprintf(stderr, "[SSL] ERRO CRÍTICO: Certificado e chave privada não correspondem!\n");
         ERR_print_errors_fp(stderr);
-        SSL_CTX_free(server_ctx->ctx);
-        free(server_ctx);
+        SSL_CTX_free(ctx);
         return NULL;
     }
 
     printf("[SSL] ✓ Certificate and key verified and matching\n");
+    return ctx;
+}
+
+ssl_server_ctx_t* ssl_server_init(const char *cert_path, const char *key_path)
+{
+    printf("[SSL] Initializing OpenSSL...\n");
+    
+    // Initialize OpenSSL library
+    SSL_load_error_strings();
+    OpenSSL_add_ssl_algorithms();
+    ERR_load_crypto_strings();
+
+    ssl_server_ctx_t *server_ctx = malloc(sizeof(ssl_server_ctx_t));
+    if (!server_ctx) {
+        perror("malloc ssl_server_ctx");
+        return NULL;
+    }
+
+    server_ctx->ctx = ssl_context_create(cert_path, key_path);
+    if (!server_ctx->ctx) {
+        free(server_ctx);
+        return NULL;
+    }
+
+    // Virtual hosts with their own certificate (VHOST ... cert= key=)
+    SSL_CTX_set_tlsext_servername_callback(server_ctx->ctx, sni_select);
+
     printf("[SSL] ✓ SSL initialized successfully\n");
 
     return server_ctx;
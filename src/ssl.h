@@ -16,6 +16,12 @@ typedef struct {
  */
 ssl_server_ctx_t* ssl_server_init(const char *cert_path, const char *key_path);
 
+/**
+ * Creates a TLS context for a certificate and its key (the server's, or a
+ * virtual host's picked by SNI). NULL if they cannot be loaded.
+ */
+SSL_CTX* ssl_context_create(const char *cert_path, const char *key_path);
+
 /**
  * Frees the SSL context.
  */
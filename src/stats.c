@@ -2,6 +2,7 @@
 #include <semaphore.h>
 #include <string.h>
 #include "stats.h"
+#include "timer_wheel.h"
 
 /**
  * @brief Initializes the statistics structure to zero.
@@ -38,6 +39,25 @@ void stats_update(server_stats_t *stats, sem_t *mutex, int status_code, long byt
     sem_post(mutex);
 }
 
+/**
+ * @brief Safely counts a connection cut by a deadline of the timer wheel.
+ * @param stats Pointer to the statistics structure.
+ * @param mutex Semaphore for critical section protection.
+ * @param kind Deadline kind (TIMEOUT_HANDSHAKE, HEADER, IDLE or WRITE).
+ */
+void stats_timeout(server_stats_t *stats, sem_t *mutex, int kind) {
+    if (!stats || !mutex) return;
+
+    sem_wait(mutex);
+    switch (kind) {
+        case TIMEOUT_HANDSHAKE: stats->timeouts_handshake++; break;
+        case TIMEOUT_HEADER:    stats->timeouts_header++; break;
+        case TIMEOUT_IDLE:      stats->timeouts_idle++; break;
+        case TIMEOUT_WRITE:     stats->timeouts_write++; break;
+    }
+    sem_post(mutex);
+}
+
 /**
  * @brief Safely increments the number of active connections.
  * @param stats Pointer to the statistics structure.
@@ -97,6 +117,29 @@ void stats_print(server_stats_t *stats, sem_t *mutex) {
                          (snapshot.cache_hits + snapshot.cache_misses) * 100.0;
         printf("   Hit Rate:          %9.2f%%      \n", hit_rate);
     }
+
+    printf("========================================\n");
+    printf(" Timeouts:                              \n");
+    printf("   TLS Handshake:     %10ld       \n", snapshot.timeouts_handshake);
+    printf("   Header Read:       %10ld       \n", snapshot.timeouts_header);
+    printf("   Idle Keep-Alive:   %10ld       \n", snapshot.timeouts_idle);
+    printf("   Slow Write:        %10ld       \n", snapshot.timeouts_write);
     
     printf("========================================\n");
-}
\ No newline at end of file
+}
+/**
+ * @brief Copies the statistics without taking the semaphore. Each counter is
+ *        read with a relaxed atomic load, so a reader never blocks writers;
+ *        counters may be a few requests apart from each other.
+ * @param stats Pointer to the shared statistics structure.
+ * @param out Receives the copy.
+ */
+void stats_snapshot(const server_stats_t *stats, server_stats_t *out) {
+    _Static_assert(sizeof(server_stats_t) % sizeof(long) == 0,
+                   "server_stats_t must only hold machine words");
+
+    const long *s = (const long *)stats;
+    long *d = (long *)out;
+    for (size_t i = 0; i < sizeof(server_stats_t) / sizeof(long); i++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
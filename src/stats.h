@@ -16,12 +16,23 @@ typedef struct {
     // CACHE STATS
     long cache_hits;
     long cache_misses;
+
+    // DEADLINES (connections cut by the timer wheel)
+    long timeouts_handshake;
+    long timeouts_header;
+    long timeouts_idle;
+    long timeouts_write;
 } server_stats_t;
 
 void stats_init(server_stats_t *stats);
 void stats_update(server_stats_t *stats, sem_t *mutex, int status_code, long bytes);
+void stats_timeout(server_stats_t *stats, sem_t *mutex, int kind);
 void stats_connection_start(server_stats_t *stats, sem_t *mutex);
 void stats_connection_end(server_stats_t *stats, sem_t *mutex);
 void stats_print(server_stats_t *stats, sem_t *mutex);
 
+// Copies the counters without the semaphore (word-sized relaxed loads):
+// for readers that tolerate counters a few requests apart
+void stats_snapshot(const server_stats_t *stats, server_stats_t *out);
+
 #endif
\ No newline at end of file
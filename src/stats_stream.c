@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+#include "stats_stream.h"
+#include "http.h"
+#include "config.h"
+#include "stats.h"
+#include "shared_mem.h"
+#include "metrics.h"
+#include "mempool.h"
+#include "trace.h"
+
+// Shared memory of this process (worker.c)
+extern shared_data_t* shm_data;
+
+// Events a viewer may lag behind before it is dropped
+#define VIEWER_MAX_PENDING (64 * 1024)
+
+// Ticks without changes before a keep-alive comment is sent
+#define HEARTBEAT_TICKS 15
+
+// Counters sent to the dashboard (same names as /api/stats)
+static const struct {
+    const char *name;
+    size_t offset;
+} stat_fields[] = {
+    { "total_requests",     offsetof(server_stats_t, total_requests) },
+    { "status_200",         offsetof(server_stats_t, status_200) },
+    { "status_400",         offsetof(server_stats_t, status_400) },
+    { "status_403",         offsetof(server_stats_t, status_403) },
+    { "status_404",         offsetof(server_stats_t, status_404) },
+    { "status_500",         offsetof(server_stats_t, status_500) },
+    { "bytes_served",       offsetof(server_stats_t, bytes_transferred) },
+    { "cache_hits",         offsetof(server_stats_t, cache_hits) },
+    { "cache_misses",       offsetof(server_stats_t, cache_misses) },
+    { "timeouts_handshake", offsetof(server_stats_t, timeouts_handshake) },
+    { "timeouts_header",    offsetof(server_stats_t, timeouts_header) },
+    { "timeouts_idle",      offsetof(server_stats_t, timeouts_idle) },
+    { "timeouts_write",     offsetof(server_stats_t, timeouts_write) },
+};
+#define NUM_STAT_FIELDS (sizeof(stat_fields) / sizeof(stat_fields[0]))
+
+static struct {
+    int initialized;                // Set once started (also seen by a successor)
+    volatile int running;
+    pthread_t thread;
+    int wake[2];                    // Pipe: new viewers in the inbox, or stop
+
+    pthread_mutex_t mutex;          // Protects inbox and total
+    connection_t *inbox[STATS_STREAM_MAX_VIEWERS];
+    int ninbox;
+    int total;                      // Viewers in the inbox or the hub
+
+    // Hub thread only
+    connection_t *viewers[STATS_STREAM_MAX_VIEWERS];
+    int nviewers;
+    server_stats_t last;            // Snapshot sent on the previous tick
+    int quiet_ticks;
+} hub;
+
+
+static long field(const server_stats_t *s, int i) {
+    return *(const long *)((const char *)s + stat_fields[i].offset);
+}
+
+static unsigned long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Formats a "snapshot" event with every counter.
+ * @return Length of the event.
+ */
+static int format_snapshot(char *buf, size_t cap, const server_stats_t *s) {
+    int len = snprintf(buf, cap, "retry: 3000\nevent: snapshot\ndata: {");
+    for (size_t i = 0; i < NUM_STAT_FIELDS; i++)
+        len += snprintf(buf + len, cap - len, "\"%s\":%ld,", stat_fields[i].name, field(s, i));
+    len += snprintf(buf + len, cap - len, "\"timestamp\":%ld}\n\n", (long)time(NULL));
+    return len;
+}
+
+/**
+ * @brief Formats a "delta" event with the increments since the previous tick.
+ * @return Length of the event, 0 if nothing changed.
+ */
+static int format_delta(char *buf, size_t cap, const server_stats_t *prev,
+                        const server_stats_t *cur) {
+    int len = snprintf(buf, cap, "event: delta\ndata: {");
+    int changed = 0;
+
+    for (size_t i = 0; i < NUM_STAT_FIELDS; i++) {
+        long d = field(cur, i) - field(prev, i);
+        if (d == 0) continue;
+        len += snprintf(buf + len, cap - len, "\"%s\":%ld,", stat_fields[i].name, d);
+        changed = 1;
+    }
+    if (!changed) return 0;
+
+    len += snprintf(buf + len, cap - len, "\"timestamp\":%ld}\n\n", (long)time(NULL));
+    return len;
+}
+
+/**
+ * @brief Writes as much of the pending output of a viewer as the socket takes.
+ * @return 0 on success (possibly partial), -1 if the viewer is gone.
+ */
+static int viewer_flush(connection_t *c) {
+    while (c->out_len > 0) {
+        ssize_t n;
+
+        if (c->ssl) {
+            int r = SSL_write(c->ssl, c->out_buf, c->out_len);
+            if (r <= 0) {
+                int e = SSL_get_error(c->ssl, r);
+                return (e == SSL_ERROR_WANT_WRITE || e == SSL_ERROR_WANT_READ) ? 0 : -1;
+            }
+            n = r;
+        } else {
+            n = send(c->fd, c->out_buf, c->out_len, MSG_NOSIGNAL);
+            if (n < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+
+        memmove(c->out_buf, c->out_buf + n, c->out_len - n);
+        c->out_len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues an event for a viewer and tries to send it.
+ * @return 0 on success, -1 if the viewer is gone or too far behind.
+ */
+static int viewer_send(connection_t *c, const char *event, size_t len) {
+    if (c->out_len + len > VIEWER_MAX_PENDING)
+        return -1;
+
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap * 2 : 4096;
+        while (cap < c->out_len + len) cap *= 2;
+        char *p = realloc(c->out_buf, cap);
+        if (!p) return -1;
+        c->out_buf = p;
+        c->out_cap = cap;
+    }
+
+    memcpy(c->out_buf + c->out_len, event, len);
+    c->out_len += len;
+    return viewer_flush(c);
+}
+
+/**
+ * @brief Consumes input of a viewer (viewers only send a close).
+ * @return 1 if the viewer closed the connection, 0 otherwise.
+ */
+static int viewer_closed(connection_t *c) {
+    char scratch[512];
+
+    if (c->ssl) {
+        int r = SSL_read(c->ssl, scratch, sizeof(scratch));
+        if (r > 0) return 0;
+        int e = SSL_get_error(c->ssl, r);
+        return !(e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE);
+    }
+
+    ssize_t n = recv(c->fd, scratch, sizeof(scratch), 0);
+    if (n > 0) return 0;
+    return n == 0 || !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/**
+ * @brief Closes viewer i (the last viewer takes its place).
+ */
+static void viewer_drop(int i) {
+    connection_t *c = hub.viewers[i];
+    hub.viewers[i] = hub.viewers[--hub.nviewers];
+
+    conn_close(c);
+    metrics_stream_viewers(-1);
+
+    pthread_mutex_lock(&hub.mutex);
+    hub.total--;
+    pthread_mutex_unlock(&hub.mutex);
+}
+
+/**
+ * @brief Moves new viewers from the inbox to the hub and sends them the
+ *        snapshot the next deltas apply to.
+ */
+static void take_inbox(void) {
+    connection_t *fresh[STATS_STREAM_MAX_VIEWERS];
+    int n;
+
+    pthread_mutex_lock(&hub.mutex);
+    n = hub.ninbox;
+    memcpy(fresh, hub.inbox, n * sizeof(connection_t *));
+    hub.ninbox = 0;
+    pthread_mutex_unlock(&hub.mutex);
+
+    if (n == 0) return;
+
+    char event[2048];
+    int len = format_snapshot(event, sizeof(event), &hub.last);
+
+    for (int i = 0; i < n; i++) {
+        hub.viewers[hub.nviewers++] = fresh[i];
+        metrics_stream_viewers(1);
+        if (viewer_send(fresh[i], event, len) < 0)
+            viewer_drop(hub.nviewers - 1);
+    }
+}
+
+/**
+ * @brief One tick: a single snapshot, a single delta event written to everyone.
+ */
+static void tick(void) {
+    server_stats_t cur;
+    stats_snapshot(&shm_data->stats, &cur);
+
+    char event[2048];
+    int len = format_delta(event, sizeof(event), &hub.last, &cur);
+    hub.last = cur;
+
+    if (len == 0) {
+        if (++hub.quiet_ticks < HEARTBEAT_TICKS) return;
+        len = snprintf(event, sizeof(event), ": keep-alive\n\n");
+    }
+    hub.quiet_ticks = 0;
+
+    for (int i = hub.nviewers - 1; i >= 0; i--)
+        if (viewer_send(hub.viewers[i], event, len) < 0)
+            viewer_drop(i);
+}
+
+/**
+ * @brief Hub thread: watches every viewer with one poll() and pushes an event
+ *        every STATS_STREAM_INTERVAL_MS.
+ */
+static void *hub_thread(void *arg) {
+    (void)arg;
+    static struct pollfd pfds[1 + STATS_STREAM_MAX_VIEWERS];
+    int interval = get_stats_stream_interval_ms();
+    unsigned long next_tick = now_ms() + interval;
+
+    while (hub.running) {
+        int polled = hub.nviewers;
+
+        pfds[0].fd = hub.wake[0];
+        pfds[0].events = POLLIN;
+        for (int i = 0; i < polled; i++) {
+            pfds[i + 1].fd = hub.viewers[i]->fd;
+            pfds[i + 1].events = POLLIN | (hub.viewers[i]->out_len ? POLLOUT : 0);
+        }
+
+        unsigned long now = now_ms();
+        int wait = next_tick > now ? (int)(next_tick - now) : 0;
+
+        if (poll(pfds, polled + 1, wait) < 0 && errno != EINTR) {
+            TRACE_ERROR(TRACE_API, "stats stream: poll failed (errno=%d)", errno);
+            break;
+        }
+
+        // Downwards: dropping i only moves viewers that were already handled
+        for (int i = polled - 1; i >= 0; i--) {
+            short re = pfds[i + 1].revents;
+            connection_t *c = hub.viewers[i];
+
+            if ((re & (POLLERR | POLLNVAL)) ||
+                ((re & (POLLIN | POLLHUP)) && viewer_closed(c)) ||
+                ((re & POLLOUT) && viewer_flush(c) < 0))
+                viewer_drop(i);
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            char drain[64];
+            if (read(hub.wake[0], drain, sizeof(drain)) < 0 && errno != EAGAIN)
+                TRACE_WARN(TRACE_API, "stats stream: wake pipe read failed");
+            take_inbox();
+        }
+
+        now = now_ms();
+        if (now >= next_tick) {
+            tick();
+            next_tick += interval;
+            if (next_tick <= now)
+                next_tick = now + interval;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Closes the wake pipe inherited from the previous generation. The
+ *        viewers' sockets were closed with the other inherited connections
+ *        (conn_pool_init), the old hub still serves them.
+ */
+static void drop_inherited(void) {
+    close(hub.wake[0]);
+    close(hub.wake[1]);
+}
+
+/**
+ * @brief Starts the hub thread of this worker.
+ * @return 0 on success, -1 on error (the stream endpoint then answers 503).
+ */
+int stats_stream_start(void) {
+    if (hub.initialized)
+        drop_inherited();
+
+    memset(&hub, 0, sizeof(hub));
+    pthread_mutex_init(&hub.mutex, NULL);
+
+    if (!shm_data || pipe2(hub.wake, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+
+    stats_snapshot(&shm_data->stats, &hub.last);
+    hub.initialized = 1;
+    hub.running = 1;
+
+    if (pthread_create(&hub.thread, NULL, hub_thread, NULL) != 0) {
+        perror("pthread_create (stats stream)");
+        hub.running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the hub thread and closes every viewer (they reconnect to
+ *        the next generation on their own).
+ */
+void stats_stream_stop(void) {
+    if (!hub.running) return;
+
+    pthread_mutex_lock(&hub.mutex);
+    hub.running = 0;
+    pthread_mutex_unlock(&hub.mutex);
+
+    if (write(hub.wake[1], "x", 1) < 0)
+        TRACE_WARN(TRACE_API, "stats stream: wake pipe write failed");
+    pthread_join(hub.thread, NULL);
+
+    take_inbox();
+    while (hub.nviewers > 0)
+        viewer_drop(hub.nviewers - 1);
+}
+
+/**
+ * @brief Hands a connection to the hub after writing the response header.
+ *        Called by a pool thread, which returns to the pool right away.
+ * @param conn Connection with no pending output.
+ * @return 0 if the hub owns the connection, -1 if it is full or stopped.
+ */
+int stats_stream_subscribe(connection_t *conn) {
+    static const char header[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n";
+
+    pthread_mutex_lock(&hub.mutex);
+    if (!hub.running || hub.total >= STATS_STREAM_MAX_VIEWERS) {
+        pthread_mutex_unlock(&hub.mutex);
+        return -1;
+    }
+    hub.total++;
+    pthread_mutex_unlock(&hub.mutex);
+
+    // A failed write is noticed by the hub on its first event
+    conn_write(conn, header, sizeof(header) - 1);
+
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    if (conn->ssl)
+        SSL_set_mode(conn->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    pthread_mutex_lock(&hub.mutex);
+    hub.inbox[hub.ninbox++] = conn;
+    pthread_mutex_unlock(&hub.mutex);
+
+    if (write(hub.wake[1], "x", 1) < 0 && errno != EAGAIN)
+        TRACE_WARN(TRACE_API, "stats stream: wake pipe write failed");
+
+    TRACE_DEBUG(TRACE_API, "stats stream: viewer fd %d subscribed", conn->fd);
+    return 0;
+}
+
+/**
+ * @brief Builds the one-shot event stream of an HTTP/2 request.
+ * @param len Receives the length of the body.
+ * @return malloc'd body, NULL on error.
+ */
+char *stats_stream_oneshot(size_t *len) {
+    char *buf = malloc(2048);
+    if (!buf) return NULL;
+
+    server_stats_t cur;
+    memset(&cur, 0, sizeof(cur));
+    if (shm_data)
+        stats_snapshot(&shm_data->stats, &cur);
+
+    *len = format_snapshot(buf, 2048, &cur);
+    return buf;
+}
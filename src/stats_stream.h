@@ -0,0 +1,33 @@
+#ifndef STATS_STREAM_H
+#define STATS_STREAM_H
+
+#include <stddef.h>
+#include "worker.h"  // For connection_t
+
+// ------------------------------------------------------------
+// Live statistics for the dashboard (Server-Sent Events)
+// ------------------------------------------------------------
+// GET /api/stats/stream keeps one connection per viewer open. After the
+// response header the pool thread hands the connection to the hub thread
+// of its worker and goes back to the pool. Every STATS_STREAM_INTERVAL_MS
+// the hub takes one snapshot of the shared stats (no semaphore) and writes
+// the same "delta" event (counters that changed, as increments) to every
+// viewer. A new viewer first gets a "snapshot" event with all counters.
+
+// Viewers per worker; further subscriptions get 503
+#define STATS_STREAM_MAX_VIEWERS 256
+
+// Starts / stops the hub thread of this worker (stop closes every viewer).
+// A reloaded worker starts a fresh hub and drops the viewers it inherited
+int stats_stream_start(void);
+void stats_stream_stop(void);
+
+// Sends the event-stream response header and hands the connection to the
+// hub. Returns 0 if the hub owns conn now, -1 if the caller keeps it
+int stats_stream_subscribe(connection_t *conn);
+
+// One-shot body (a snapshot event with a retry hint) for HTTP/2 streams,
+// which cannot leave their connection. Returns a malloc'd buffer
+char *stats_stream_oneshot(size_t *len);
+
+#endif
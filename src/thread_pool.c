@@ -2,26 +2,141 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 #include "thread_pool.h"
 #include "http.h"
+#include "trace.h"
+#include "affinity.h"
+#include "metrics.h"
+#include "config.h"
+
+static void *worker_thread(void *arg);
 
 /**
- * @brief Removes and returns a connection from the work queue (consumer).
+ * @brief Starts one more detached pool thread (queue.mutex held).
+ * @param pool Pointer to the thread pool.
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+static int pool_spawn(thread_pool_t *pool) {
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&tid, &attr, worker_thread, pool);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0) {
+        TRACE_WARN(TRACE_POOL, "Could not start a pool thread (error %d)", rc);
+        return -1;
+    }
+
+    // The new thread blocks on queue.mutex, so 'tid' is still valid here
+    affinity_apply_thread(tid, pool->started++);
+    pool->live_threads++;
+    metrics_pool_threads(1);
+    return 0;
+}
+
+/**
+ * @brief Adds a thread when the pool is short of them (queue.mutex held):
+ *        a connection waited too long, queued connections outnumber the
+ *        idle threads, or grow_busy_percent of the threads are needed.
+ * @param pool Pointer to the thread pool.
+ * @param waited 1 if a connection waited more than grow_wait_us.
+ */
+static void pool_maybe_grow(thread_pool_t *pool, int waited) {
+    if (pool->live_threads >= pool->max_threads || pool->shutting_down)
+        return;
+
+    int demand = pool->active + pool->queue.count;
+    if (!waited && pool->idle_threads >= pool->queue.count &&
+        demand * 100 < pool->live_threads * pool->grow_busy_percent)
+        return;
+
+    if (pool_spawn(pool) == 0) {
+        pool->last_grow_us = metrics_now_us();
+        pool->trim_threads = 0;
+        metrics_pool_resized(1);
+        TRACE_DEBUG(TRACE_POOL, "Pool grew to %d threads (%d busy, %d queued)",
+                    pool->live_threads, pool->active, pool->queue.count);
+    }
+}
+
+/**
+ * @brief Waits for a connection (consumer).
  * @param pool Pointer to the thread pool.
- * @return Pointer to the connection removed from the queue.
+ * @param retired NULL for a plain queue pop; for a pool thread, set to 1
+ *        when the thread must exit because it stayed idle (it is then no
+ *        longer counted, and must not touch the pool again).
+ * @return Connection, or NULL (shutting down and queue empty, or retired).
  */
-static connection_t* queue_pop(thread_pool_t *pool) {
+static connection_t* pool_wait(thread_pool_t *pool, int *retired) {
     thread_pool_queue_t *q = &pool->queue;
 
     pthread_mutex_lock(&q->mutex);
 
-    while (q->count == 0)
-        pthread_cond_wait(&q->cond_non_empty, &q->mutex);
+    while (q->count == 0 && !pool->shutting_down) {
+        int rc;
+
+        pool->idle_threads++;
+        if (retired && pool->idle_ms > 0 && pool->live_threads > pool->min_threads) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += pool->idle_ms / 1000;
+            deadline.tv_nsec += (long)(pool->idle_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            rc = pthread_cond_timedwait(&q->cond_non_empty, &q->mutex, &deadline);
+        } else {
+            rc = pthread_cond_wait(&q->cond_non_empty, &q->mutex);
+        }
+        pool->idle_threads--;
+
+        // Idle for idle_ms, and no growth for as long (or trimmed under
+        // memory pressure): give the thread back
+        int expired = rc == ETIMEDOUT &&
+                      metrics_now_us() - pool->last_grow_us >= (unsigned long)pool->idle_ms * 1000;
+        if (retired && (expired || pool->trim_threads > 0) && q->count == 0 &&
+            !pool->shutting_down && pool->live_threads > pool->min_threads) {
+            if (pool->trim_threads > 0)
+                pool->trim_threads--;
+            pool->live_threads--;
+            metrics_pool_threads(-1);
+            metrics_pool_resized(0);
+            TRACE_DEBUG(TRACE_POOL, "Pool shrank to %d threads", pool->live_threads);
+            *retired = 1;
+            pthread_cond_broadcast(&pool->cond_exited);
+            pthread_mutex_unlock(&q->mutex);
+            return NULL;
+        }
+    }
+
+    if (q->count == 0) {
+        pthread_mutex_unlock(&q->mutex);
+        return NULL;
+    }
 
     connection_t* conn = q->connections[q->front];
     q->front = (q->front + 1) % WORKER_QUEUE_SIZE;
     q->count--;
+    metrics_pool_queue(-1);
+
+    if (retired) {
+        pool->active++;
+
+        // Queue wait since accept (0 for connections not from a listener)
+        if (conn->accepted_us) {
+            unsigned long waited = metrics_now_us() - conn->accepted_us;
+            metrics_pool_wait(waited);
+            if (pool->grow_wait_us && waited >= pool->grow_wait_us)
+                pool_maybe_grow(pool, 1);
+        }
+    }
 
     pthread_cond_signal(&q->cond_non_full);
     pthread_mutex_unlock(&q->mutex);
@@ -29,23 +144,54 @@ static connection_t* queue_pop(thread_pool_t *pool) {
     return conn;
 }
 
+/**
+ * @brief Removes and returns a connection from the work queue (consumer).
+ * @param pool Pointer to the thread pool.
+ * @return Pointer to the connection removed from the queue, or NULL when the
+ *         pool is shutting down and the queue is empty.
+ */
+connection_t* thread_pool_pop(thread_pool_t *pool) {
+    return pool_wait(pool, NULL);
+}
+
 /**
  * @brief Function executed by each thread in the pool.
  * @param arg Pointer to the thread pool (thread_pool_t*).
- * @return NULL (never normally returns).
+ * @return NULL when the pool is shut down or the thread retires.
  */
 static void *worker_thread(void *arg) {
     thread_pool_t *pool = arg;
+    thread_pool_queue_t *q = &pool->queue;
+    int retired = 0;
 
     while (1) {
-        connection_t* conn = queue_pop(pool);
+        connection_t* conn = pool_wait(pool, &retired);
+        if (!conn)
+            break;
+
+        TRACE_DEBUG(TRACE_POOL, "Thread %lu received connection fd=%d (HTTPS=%d)",
+                    (unsigned long)pthread_self(), conn->fd, conn->is_https);
 
-         printf("  [Thread %ld] Received connection fd=%d (HTTPS=%d)\n",
-             pthread_self(), conn->fd, conn->is_https);
+        metrics_pool_busy(1);
 
         http_handle_request(conn);
+
+        metrics_pool_busy(-1);
+        pthread_mutex_lock(&q->mutex);
+        pool->active--;
+        pthread_mutex_unlock(&q->mutex);
     }
 
+    if (retired)
+        return NULL;
+
+    metrics_pool_threads(-1);
+
+    pthread_mutex_lock(&q->mutex);
+    pool->live_threads--;
+    pthread_cond_broadcast(&pool->cond_exited);
+    pthread_mutex_unlock(&q->mutex);
+
     return NULL;
 }
 
@@ -65,34 +211,127 @@ void thread_pool_add(thread_pool_t *pool, connection_t* conn) {
     q->connections[q->rear] = conn;
     q->rear = (q->rear + 1) % WORKER_QUEUE_SIZE;
     q->count++;
+    metrics_pool_queue(1);
+
+    if (pool->max_threads)
+        pool_maybe_grow(pool, 0);
 
     pthread_cond_signal(&q->cond_non_empty);
     pthread_mutex_unlock(&q->mutex);
 }
 
 /**
- * @brief Initializes the thread pool and the internal queue.
- * @param pool Pointer to the thread pool to initialize.
- * @param n Number of threads to create in the pool.
+ * @brief Initializes only the internal queue of the pool (no threads are created).
+ * @param pool Pointer to the thread pool whose queue will be initialized.
  */
-void thread_pool_init(thread_pool_t *pool, int n) {
-
-    // Initialize internal queue
+void thread_pool_queue_init(thread_pool_t *pool) {
     pool->queue.front = 0;
     pool->queue.rear  = 0;
     pool->queue.count = 0;
+    pool->shutting_down = 0;
+    pool->active = 0;
+    pool->min_threads = pool->max_threads = 0;
+    pool->live_threads = pool->idle_threads = pool->started = 0;
+    pool->idle_ms = 0;
+    pool->trim_threads = 0;
 
     pthread_mutex_init(&pool->queue.mutex, NULL);
     pthread_cond_init(&pool->queue.cond_non_empty, NULL);
     pthread_cond_init(&pool->queue.cond_non_full, NULL);
+}
+
+/**
+ * @brief Initializes the thread pool and the internal queue, and starts the
+ *        minimum number of threads (growth and idle limits from server.conf).
+ * @param pool Pointer to the thread pool to initialize.
+ * @param min_threads Threads started now and kept when idle.
+ * @param max_threads Most threads the pool may grow to.
+ */
+void thread_pool_init(thread_pool_t *pool, int min_threads, int max_threads) {
+
+    // Initialize internal queue
+    thread_pool_queue_init(pool);
+
+    pthread_cond_init(&pool->cond_exited, NULL);
+
+    if (max_threads < 1) max_threads = 1;
+    if (min_threads < 1) min_threads = 1;
+    if (min_threads > max_threads) min_threads = max_threads;
+
+    pool->min_threads = min_threads;
+    pool->max_threads = max_threads;
+    pool->grow_busy_percent = get_pool_grow_busy_percent();
+    pool->grow_wait_us = (unsigned long)get_pool_grow_queue_wait_ms() * 1000;
+    pool->idle_ms = get_pool_idle_seconds() * 1000;
+    pool->last_grow_us = metrics_now_us();
+    metrics_pool_limits(min_threads, max_threads);
 
     // Create threads
-    pool->thread_count = n;
-    pool->threads = malloc(sizeof(pthread_t) * n);
+    pthread_mutex_lock(&pool->queue.mutex);
+    for (int i = 0; i < min_threads; i++)
+        pool_spawn(pool);
+    pthread_mutex_unlock(&pool->queue.mutex);
+
+    TRACE_INFO(TRACE_POOL, "Worker process created %d threads (up to %d).",
+               min_threads, max_threads);
+}
+
+/**
+ * @brief Asks the idle threads above min_threads to exit now (memory
+ *        pressure), without waiting for idle_ms. A growth cancels the request.
+ * @param pool Pointer to the thread pool.
+ */
+void thread_pool_trim(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->queue.mutex);
 
-    for (int i = 0; i < n; i++) {
-        pthread_create(&pool->threads[i], NULL, worker_thread, pool);
+    int extra = pool->live_threads - pool->min_threads;
+    if (extra > pool->idle_threads)
+        extra = pool->idle_threads;
+    if (extra > 0) {
+        pool->trim_threads = extra;
+        pthread_cond_broadcast(&pool->queue.cond_non_empty);
     }
 
-    printf("Worker process created %d threads.\n", n);
-}
\ No newline at end of file
+    pthread_mutex_unlock(&pool->queue.mutex);
+}
+
+/**
+ * @brief Returns how many connections are queued or being handled.
+ * @param pool Pointer to the thread pool.
+ * @return Queued + active connections.
+ */
+int thread_pool_pending(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->queue.mutex);
+    int n = pool->queue.count + pool->active;
+    pthread_mutex_unlock(&pool->queue.mutex);
+    return n;
+}
+
+/**
+ * @brief Stops the pool gracefully: threads finish the queued connections
+ *        and exit once the queue is empty.
+ * @param pool Pointer to the thread pool.
+ * @param timeout_sec Maximum time to wait for the threads to exit.
+ * @return 0 if every thread exited, -1 on timeout.
+ */
+int thread_pool_shutdown(thread_pool_t *pool, int timeout_sec) {
+    thread_pool_queue_t *q = &pool->queue;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_sec;
+
+    pthread_mutex_lock(&q->mutex);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&q->cond_non_empty);
+
+    int rc = 0;
+    while (pool->live_threads > 0 && rc != ETIMEDOUT)
+        rc = pthread_cond_timedwait(&pool->cond_exited, &q->mutex, &deadline);
+
+    int drained = pool->live_threads == 0;
+    pthread_mutex_unlock(&q->mutex);
+
+    // Threads are detached: nothing to join
+    return drained ? 0 : -1;
+}
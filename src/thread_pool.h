@@ -16,13 +16,46 @@ typedef struct {
     pthread_cond_t cond_non_full;
 } thread_pool_queue_t;
 
+// Elastic pool: it starts with min_threads (detached) threads and adds one,
+// up to max_threads, when a new connection finds grow_busy_percent of the
+// threads busy or when a connection waited grow_wait_us in the queue. A
+// thread above min_threads exits after idle_ms without work, but not until
+// idle_ms after the last growth (hysteresis: a burst does not make the
+// pool shrink and grow again). Pool fields are protected by queue.mutex.
 typedef struct {
-    pthread_t *threads;
-    int thread_count;
+    int min_threads;
+    int max_threads;                // 0: never grows (queue-only pool)
+    int grow_busy_percent;
+    unsigned long grow_wait_us;
+    int idle_ms;                    // 0: threads never retire
+    int live_threads;               // Threads that have not exited yet
+    int idle_threads;               // Threads waiting for a connection
+    int active;                     // Threads currently handling a connection
+    int started;                    // Threads created so far (affinity index)
+    unsigned long last_grow_us;     // Monotonic time of the last growth
+    int trim_threads;               // Idle threads asked to exit now (thread_pool_trim)
+    int shutting_down;              // Set by thread_pool_shutdown()
+    pthread_cond_t cond_exited;     // Signalled when a thread exits
     thread_pool_queue_t queue;
 } thread_pool_t;
 
-void thread_pool_init(thread_pool_t *pool, int n);
+// Starts min_threads threads; the pool may grow up to max_threads
+void thread_pool_init(thread_pool_t *pool, int min_threads, int max_threads);
 void thread_pool_add(thread_pool_t *pool, connection_t* conn);  // Changed from int to connection_t*
 
+// Stop the pool after the queue is drained; waits up to timeout_sec
+// for the threads to finish (returns 0 if drained, -1 on timeout)
+int thread_pool_shutdown(thread_pool_t *pool, int timeout_sec);
+
+// Connections queued or being handled right now
+int thread_pool_pending(thread_pool_t *pool);
+
+// Memory pressure: idle threads above min_threads exit now instead of
+// after idle_ms (their stacks are released)
+void thread_pool_trim(thread_pool_t *pool);
+
+// Queue-only helpers (also used by the microbenchmarks)
+void thread_pool_queue_init(thread_pool_t *pool);
+connection_t* thread_pool_pop(thread_pool_t *pool);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "timer_wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+static timer_expired_fn expired_callback = NULL;
+
+
+static void list_init(wheel_timer_t *head) {
+    head->next = head->prev = head;
+}
+
+static void list_add(wheel_timer_t *head, wheel_timer_t *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(wheel_timer_t *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+static unsigned long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * @brief Places a timer in the slot matching its distance to the current tick.
+ *        Must be called with the wheel lock held.
+ * @param w Timer wheel.
+ * @param t Timer with 'expires' already set.
+ */
+static void wheel_insert(timer_wheel_t *w, wheel_timer_t *t) {
+    unsigned long max_delta = (1UL << (WHEEL_SLOT_BITS * WHEEL_LEVELS)) - 1;
+
+    if (t->expires <= w->now)
+        t->expires = w->now + 1;
+    if (t->expires - w->now > max_delta)
+        t->expires = w->now + max_delta;
+
+    unsigned long delta = t->expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           delta >= (1UL << (WHEEL_SLOT_BITS * (level + 1))))
+        level++;
+
+    int idx = (t->expires >> (WHEEL_SLOT_BITS * level)) & WHEEL_MASK;
+    list_add(&w->slots[level][idx], t);
+}
+
+/**
+ * @brief Moves every timer of one slot of a higher level back into the wheel
+ *        (they now land on lower levels).
+ * @return The slot index, so the caller knows whether to cascade the next level.
+ */
+static int cascade(timer_wheel_t *w, int level) {
+    int idx = (w->now >> (WHEEL_SLOT_BITS * level)) & WHEEL_MASK;
+    wheel_timer_t *head = &w->slots[level][idx];
+
+    wheel_timer_t pending;
+    list_init(&pending);
+
+    // Detach the whole slot first: wheel_insert may put timers back in it
+    if (head->next != head) {
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        list_init(head);
+    }
+
+    while (pending.next != &pending) {
+        wheel_timer_t *t = pending.next;
+        list_del(t);
+        wheel_insert(w, t);
+    }
+    return idx;
+}
+
+/**
+ * @brief Advances the wheel by one tick and fires the timers that expire on it.
+ *        Must be called with the wheel lock held.
+ * @param counts Per-kind counter of fired deadlines (incremented).
+ */
+static void wheel_tick(timer_wheel_t *w, int *counts) {
+    w->now++;
+
+    // Cascade higher levels when the lower level wraps around
+    if ((w->now & WHEEL_MASK) == 0) {
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if (cascade(w, level) != 0)
+                break;
+        }
+    }
+
+    wheel_timer_t *head = &w->slots[0][w->now & WHEEL_MASK];
+    while (head->next != head) {
+        wheel_timer_t *t = head->next;
+        list_del(t);
+
+        int kind = t->kind;
+        t->kind = TIMEOUT_NONE;
+        t->fired = kind;
+
+        // Header/idle deadlines only stop reading so a 408 can still be sent;
+        // handshake/write deadlines close both directions
+        if (kind == TIMEOUT_HEADER || kind == TIMEOUT_IDLE)
+            shutdown(t->fd, SHUT_RD);
+        else
+            shutdown(t->fd, SHUT_RDWR);
+
+        if (kind > TIMEOUT_NONE && kind <= TIMEOUT_WRITE)
+            counts[kind]++;
+    }
+}
+
+/**
+ * @brief Tick thread: advances the wheel to the current time every WHEEL_TICK_MS.
+ * @param arg Pointer to the timer wheel.
+ * @return NULL when the wheel is stopped.
+ */
+static void *wheel_thread(void *arg) {
+    timer_wheel_t *w = arg;
+    unsigned long start = monotonic_ms();
+    struct timespec tick = { 0, WHEEL_TICK_MS * 1000000L };
+
+    while (w->running) {
+        nanosleep(&tick, NULL);
+
+        unsigned long target = (monotonic_ms() - start) / WHEEL_TICK_MS;
+        int counts[TIMEOUT_WRITE + 1] = {0};
+
+        pthread_mutex_lock(&w->mutex);
+        while (w->now < target)
+            wheel_tick(w, counts);
+        pthread_mutex_unlock(&w->mutex);
+
+        for (int kind = TIMEOUT_HANDSHAKE; kind <= TIMEOUT_WRITE; kind++) {
+            for (int i = 0; i < counts[kind]; i++) {
+                if (expired_callback)
+                    expired_callback(kind);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Initializes the wheel and starts its tick thread.
+ *        Also used by a reloaded worker: the inherited state is discarded.
+ * @param w Timer wheel.
+ * @param on_expired Callback invoked for every expired deadline (may be NULL).
+ * @return 0 on success, -1 if the thread cannot be created.
+ */
+int timer_wheel_start(timer_wheel_t *w, timer_expired_fn on_expired) {
+    memset(w, 0, sizeof(*w));
+    pthread_mutex_init(&w->mutex, NULL);
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int i = 0; i < WHEEL_SLOTS; i++)
+            list_init(&w->slots[level][i]);
+
+    expired_callback = on_expired;
+    w->running = 1;
+
+    if (pthread_create(&w->thread, NULL, wheel_thread, w) != 0) {
+        perror("pthread_create (timer wheel)");
+        w->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the tick thread (armed timers are simply forgotten).
+ * @param w Timer wheel.
+ */
+void timer_wheel_stop(timer_wheel_t *w) {
+    if (!w->running) return;
+    w->running = 0;
+    pthread_join(w->thread, NULL);
+}
+
+/**
+ * @brief Arms or re-arms a deadline in O(1).
+ * @param w Timer wheel.
+ * @param t Timer embedded in the connection.
+ * @param fd Socket to shut down on expiry.
+ * @param kind TIMEOUT_* kind of the deadline.
+ * @param timeout_ms Time from now until the deadline.
+ */
+void timer_wheel_arm(timer_wheel_t *w, wheel_timer_t *t, int fd, int kind, int timeout_ms) {
+    if (!w->running || timeout_ms <= 0) return;
+
+    pthread_mutex_lock(&w->mutex);
+
+    if (t->next)
+        list_del(t);
+
+    t->fd = fd;
+    t->kind = kind;
+    t->fired = TIMEOUT_NONE;
+    t->expires = w->now + (timeout_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    wheel_insert(w, t);
+
+    pthread_mutex_unlock(&w->mutex);
+}
+
+/**
+ * @brief Cancels a deadline in O(1). Once this returns the tick thread will not
+ *        touch the timer (nor its socket) any more, so the fd can be closed.
+ * @param w Timer wheel.
+ * @param t Timer embedded in the connection.
+ */
+void timer_wheel_cancel(timer_wheel_t *w, wheel_timer_t *t) {
+    if (!t->next) return;   // not armed (t->next only changes under the lock)
+
+    pthread_mutex_lock(&w->mutex);
+    if (t->next)
+        list_del(t);
+    t->kind = TIMEOUT_NONE;
+    pthread_mutex_unlock(&w->mutex);
+}
+
+/**
+ * @brief Fires every armed deadline of one kind at once, as if it had
+ *        expired. Walks the whole wheel: only used when a worker drains.
+ * @param w Timer wheel.
+ * @param kind TIMEOUT_* kind to expire.
+ */
+void timer_wheel_expire(timer_wheel_t *w, int kind) {
+    if (!w->running) return;
+
+    pthread_mutex_lock(&w->mutex);
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            wheel_timer_t *head = &w->slots[level][i];
+            for (wheel_timer_t *t = head->next, *next; t != head; t = next) {
+                next = t->next;
+                if (t->kind != kind)
+                    continue;
+                list_del(t);
+                t->kind = TIMEOUT_NONE;
+                t->fired = kind;
+                shutdown(t->fd, kind == TIMEOUT_HEADER || kind == TIMEOUT_IDLE ?
+                                SHUT_RD : SHUT_RDWR);
+            }
+        }
+    pthread_mutex_unlock(&w->mutex);
+}
@@ -0,0 +1,62 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <pthread.h>
+
+// ------------------------------------------------------------
+// Hierarchical timer wheel (one per worker process)
+// ------------------------------------------------------------
+// 4 levels x 64 slots. With the default 100 ms tick level 0 covers
+// 6.4 s, level 1 ~7 min, level 2 ~7 h and level 3 ~19 days.
+// Insert and cancel are O(1) (intrusive doubly-linked lists).
+
+#define WHEEL_LEVELS     4
+#define WHEEL_SLOT_BITS  6
+#define WHEEL_SLOTS      (1 << WHEEL_SLOT_BITS)
+#define WHEEL_TICK_MS    100
+
+// Deadline kinds (also index the timeout counters in the stats)
+#define TIMEOUT_NONE      0
+#define TIMEOUT_HANDSHAKE 1
+#define TIMEOUT_HEADER    2
+#define TIMEOUT_IDLE      3
+#define TIMEOUT_WRITE     4
+
+typedef struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer *prev;
+    unsigned long expires;     // Absolute tick
+    int kind;                  // TIMEOUT_* (TIMEOUT_NONE = not armed)
+    int fd;                    // Socket shut down when the deadline passes
+    volatile int fired;        // Kind of the deadline that expired (0 = none)
+} wheel_timer_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    unsigned long now;                              // Current tick
+    wheel_timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS]; // List heads (sentinels)
+    pthread_t thread;
+    volatile int running;
+} timer_wheel_t;
+
+// Called (outside the wheel lock) once per expired deadline
+typedef void (*timer_expired_fn)(int kind);
+
+// Initializes the wheel and starts its tick thread
+int timer_wheel_start(timer_wheel_t *w, timer_expired_fn on_expired);
+
+// Stops the tick thread
+void timer_wheel_stop(timer_wheel_t *w);
+
+// Arms (or re-arms) a deadline for a socket; on expiry the socket is shut
+// down so a thread blocked on it wakes up, and t->fired is set to kind
+void timer_wheel_arm(timer_wheel_t *w, wheel_timer_t *t, int fd, int kind, int timeout_ms);
+
+// Cancels a deadline; after it returns the timer can no longer fire
+void timer_wheel_cancel(timer_wheel_t *w, wheel_timer_t *t);
+
+// Fires every armed deadline of one kind now (a draining worker ends the
+// keep-alive waits); not counted as timeouts
+void timer_wheel_expire(timer_wheel_t *w, int kind);
+
+#endif
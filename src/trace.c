@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int trace_level = TRACE_LVL_INFO;
+unsigned trace_categories = TRACE_ALL;
+
+static const struct {
+    const char *name;
+    unsigned mask;
+} categories[] = {
+    { "master", TRACE_MASTER },
+    { "worker", TRACE_WORKER },
+    { "pool",   TRACE_POOL },
+    { "http",   TRACE_HTTP },
+    { "parse",  TRACE_PARSE },
+    { "serve",  TRACE_SERVE },
+    { "cache",  TRACE_CACHE },
+    { "ssl",    TRACE_SSL },
+    { "api",    TRACE_API },
+    { "proxy",  TRACE_PROXY },
+};
+
+#define NUM_CATEGORIES (sizeof(categories) / sizeof(categories[0]))
+
+static const char *level_names[] = { "off", "error", "warn", "info", "debug" };
+
+
+/**
+ * @brief Converts a level name ("error", "warn", "info", "debug", "off") to its value.
+ * @param name Level name (case insensitive).
+ * @return Level value, or -1 if the name is unknown.
+ */
+int trace_parse_level(const char *name) {
+    if (!name) return -1;
+    for (int i = 0; i <= TRACE_LVL_DEBUG; i++) {
+        if (!strcasecmp(name, level_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Converts a comma separated list of categories ("all" allowed) to a bitmask.
+ * @param list Category list, e.g. "parse,serve".
+ * @return Bitmask of the categories, 0 if none is valid.
+ */
+unsigned trace_parse_categories(const char *list) {
+    if (!list) return 0;
+
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", list);
+
+    unsigned mask = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (!strcasecmp(tok, "all")) {
+            mask |= TRACE_ALL;
+            continue;
+        }
+
+        size_t i;
+        for (i = 0; i < NUM_CATEGORIES; i++) {
+            if (!strcasecmp(tok, categories[i].name)) {
+                mask |= categories[i].mask;
+                break;
+            }
+        }
+        if (i == NUM_CATEGORIES)
+            fprintf(stderr, "[TRACE] Unknown category '%s'\n", tok);
+    }
+    return mask;
+}
+
+/**
+ * @brief Sets the runtime trace level.
+ * @param level One of TRACE_LVL_*.
+ */
+void trace_set_level(int level) {
+    if (level >= TRACE_LVL_OFF && level <= TRACE_LVL_DEBUG)
+        trace_level = level;
+}
+
+/**
+ * @brief Sets the runtime category mask.
+ * @param mask Bitmask of TRACE_* categories.
+ */
+void trace_set_categories(unsigned mask) {
+    trace_categories = mask;
+}
+
+/**
+ * @brief Applies the runtime level and categories from configuration strings.
+ *        Invalid values keep the current setting.
+ * @param level Level name.
+ * @param cats Comma separated category list.
+ */
+void trace_init(const char *level, const char *cats) {
+    int l = trace_parse_level(level);
+    if (l >= 0)
+        trace_set_level(l);
+    else if (level && *level)
+        fprintf(stderr, "[TRACE] Unknown level '%s', keeping '%s'\n",
+                level, level_names[trace_level]);
+
+    unsigned mask = trace_parse_categories(cats);
+    if (mask)
+        trace_set_categories(mask);
+
+    if (trace_level > TRACE_COMPILE_LEVEL)
+        fprintf(stderr, "[TRACE] Level '%s' requested but build only has up to '%s' "
+                "(rebuild with make TRACE=DEBUG)\n",
+                level_names[trace_level], level_names[TRACE_COMPILE_LEVEL]);
+}
+
+/**
+ * @brief Formats one trace line and writes it with a single write() call,
+ *        so concurrent threads never serialize on the stdio lock.
+ *        Errors and warnings go to stderr, the rest to stdout.
+ * @param level Trace level of the message.
+ * @param cat Category of the message.
+ * @param fmt printf-style format.
+ */
+void trace_write(int level, unsigned cat, const char *fmt, ...) {
+    char buf[1024];
+    int len = 0;
+
+    const char *name = "?";
+    for (size_t i = 0; i < NUM_CATEGORIES; i++) {
+        if (cat & categories[i].mask) {
+            name = categories[i].name;
+            break;
+        }
+    }
+
+    len = snprintf(buf, sizeof(buf), "[%s%s] ",
+                   name, level <= TRACE_LVL_WARN ? (level == TRACE_LVL_ERROR ? " ERROR" : " WARN") : "");
+    for (char *p = buf + 1; *p && *p != ' ' && *p != ']'; p++)
+        if (*p >= 'a' && *p <= 'z') *p -= 'a' - 'A';
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0) return;
+    len += n;
+    if (len >= (int)sizeof(buf) - 1)
+        len = sizeof(buf) - 2;
+
+    if (buf[len - 1] != '\n')
+        buf[len++] = '\n';
+
+    ssize_t w = write(level <= TRACE_LVL_WARN ? STDERR_FILENO : STDOUT_FILENO, buf, len);
+    (void)w;
+}
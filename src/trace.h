@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// ------------------------------------------------------------
+// Trace levels (lower = more important)
+// ------------------------------------------------------------
+#define TRACE_LVL_OFF   0
+#define TRACE_LVL_ERROR 1
+#define TRACE_LVL_WARN  2
+#define TRACE_LVL_INFO  3
+#define TRACE_LVL_DEBUG 4
+
+// Compile-time minimum level: calls above it compile to nothing.
+// Select with "make TRACE=DEBUG" (default INFO).
+#ifndef TRACE_COMPILE_LEVEL
+#define TRACE_COMPILE_LEVEL TRACE_LVL_INFO
+#endif
+
+// ------------------------------------------------------------
+// Trace categories (bitmask)
+// ------------------------------------------------------------
+#define TRACE_MASTER  (1u << 0)
+#define TRACE_WORKER  (1u << 1)
+#define TRACE_POOL    (1u << 2)
+#define TRACE_HTTP    (1u << 3)
+#define TRACE_PARSE   (1u << 4)
+#define TRACE_SERVE   (1u << 5)
+#define TRACE_CACHE   (1u << 6)
+#define TRACE_SSL     (1u << 7)
+#define TRACE_API     (1u << 8)
+#define TRACE_PROXY   (1u << 9)
+#define TRACE_ALL     0xffffffffu
+
+// Runtime filters (set by trace_init / trace_set_*)
+extern int trace_level;
+extern unsigned trace_categories;
+
+// Emits a trace line if the level is compiled in and enabled at runtime.
+// Arguments are not evaluated when the call is filtered out.
+#define TRACE(level, cat, ...)                                          \
+    do {                                                                \
+        if ((level) <= TRACE_COMPILE_LEVEL &&                           \
+            (level) <= trace_level && (trace_categories & (cat)))       \
+            trace_write((level), (cat), __VA_ARGS__);                   \
+    } while (0)
+
+#define TRACE_ERROR(cat, ...) TRACE(TRACE_LVL_ERROR, cat, __VA_ARGS__)
+#define TRACE_WARN(cat, ...)  TRACE(TRACE_LVL_WARN,  cat, __VA_ARGS__)
+#define TRACE_INFO(cat, ...)  TRACE(TRACE_LVL_INFO,  cat, __VA_ARGS__)
+#define TRACE_DEBUG(cat, ...) TRACE(TRACE_LVL_DEBUG, cat, __VA_ARGS__)
+
+// Set runtime level/categories from strings (e.g. "debug", "parse,serve")
+void trace_init(const char *level, const char *categories);
+void trace_set_level(int level);
+void trace_set_categories(unsigned mask);
+
+// Parse helpers (return -1 / 0 on invalid input)
+int trace_parse_level(const char *name);
+unsigned trace_parse_categories(const char *list);
+
+// Formats and writes one line with a single write() (no stdio lock)
+void trace_write(int level, unsigned cat, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "vhost.h"
+#include "cache.h"
+#include "ssl.h"
+#include "trace.h"
+
+#define MB (1024UL * 1024)
+
+// Rebuilt before the pool threads exist, read without locks afterwards
+static vhost_t hosts[CONFIG_MAX_VHOSTS + 1];
+static int nhosts = 1;
+
+/**
+ * @brief Adds one name (or "*.domain" wildcard) to a virtual host.
+ */
+static void add_name(vhost_t *v, const char *name) {
+    if (v->nnames == VHOST_MAX_NAMES || strlen(name) >= sizeof(v->names[0])) {
+        printf("VHOST %s: name '%s' ignored\n", v->names[0], name);
+        return;
+    }
+
+    char *dst = v->names[v->nnames++];
+    for (; *name; name++)
+        *dst++ = tolower((unsigned char)*name);
+    *dst = '\0';
+}
+
+/**
+ * @brief Parses one VHOST value into a virtual host.
+ * @return 0 on success, -1 if the line is unusable.
+ */
+static int parse_vhost(vhost_t *v, const char *value) {
+    char copy[256], *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", value);
+
+    char *list = strtok_r(copy, " \t", &save);
+    char *root = strtok_r(NULL, " \t", &save);
+    if (!list || !root || strlen(root) >= sizeof(v->root))
+        return -1;
+
+    memset(v, 0, sizeof(*v));
+    char *save2 = NULL;
+    for (char *name = strtok_r(list, ",", &save2); name; name = strtok_r(NULL, ",", &save2))
+        add_name(v, name);
+    if (!v->nnames)
+        return -1;
+
+    // "www/" and "www" give the same paths (and cache keys)
+    size_t len = strlen(root);
+    while (len > 1 && root[len - 1] == '/')
+        root[--len] = '\0';
+    snprintf(v->root, sizeof(v->root), "%s", root);
+
+    struct stat st;
+    if (stat(v->root, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        printf("VHOST %s: document root '%s' is not a directory\n", v->names[0], v->root);
+        return -1;
+    }
+
+    const char *cert = NULL, *key = NULL;
+    for (char *opt = strtok_r(NULL, " \t", &save); opt; opt = strtok_r(NULL, " \t", &save)) {
+        if (!strncasecmp(opt, "cert=", 5))
+            cert = opt + 5;
+        else if (!strncasecmp(opt, "key=", 4))
+            key = opt + 4;
+        else if (!strncasecmp(opt, "cache=", 6))
+            v->cache_quota = (size_t)atoi(opt + 6) * MB;
+        else
+            printf("VHOST %s: unknown option '%s'\n", v->names[0], opt);
+    }
+
+    if (cert && key) {
+        v->ssl_ctx = ssl_context_create(cert, key);
+        if (!v->ssl_ctx)
+            printf("VHOST %s: certificate not loaded, HTTPS uses SSL_CERT\n", v->names[0]);
+    } else if (cert || key) {
+        printf("VHOST %s: cert= needs key= (and the reverse), HTTPS uses SSL_CERT\n",
+               v->names[0]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the certificates of the previous configuration. Handshakes
+ *        in progress hold their own reference to the context.
+ */
+static void vhosts_free(void) {
+    for (int i = 1; i < nhosts; i++)
+        SSL_CTX_free(hosts[i].ssl_ctx);
+    nhosts = 1;
+}
+
+/**
+ * @brief Loads the VHOST lines of the current configuration.
+ * @return Number of virtual hosts, the default one excluded.
+ */
+int vhost_load(void) {
+    vhosts_free();
+
+    vhost_t *def = &hosts[VHOST_DEFAULT];
+    memset(def, 0, sizeof(*def));
+    snprintf(def->names[0], sizeof(def->names[0]), "default");
+    snprintf(def->root, sizeof(def->root), "%s", get_document_root());
+
+    for (int i = 0; i < get_vhost_count(); i++) {
+        vhost_t *v = &hosts[nhosts];
+        if (parse_vhost(v, get_vhost(i)) == 0)
+            v->index = nhosts++;
+        else
+            printf("VHOST '%s' ignored\n", get_vhost(i));
+    }
+
+    for (int i = 0; i <= CONFIG_MAX_VHOSTS; i++)
+        cache_set_quota(i, i < nhosts ? hosts[i].cache_quota : 0);
+
+    for (int i = 1; i < nhosts; i++)
+        TRACE_INFO(TRACE_SERVE, "Virtual host %s (%d name(s)) -> %s, cache quota %zu MB%s",
+                   hosts[i].names[0], hosts[i].nnames, hosts[i].root,
+                   hosts[i].cache_quota / MB, hosts[i].ssl_ctx ? ", own certificate" : "");
+    return nhosts - 1;
+}
+
+/**
+ * @brief Finds the virtual host of a Host header or SNI name. Exact names
+ *        win over wildcards; the port and a trailing dot are ignored.
+ * @param host Host as sent by the client.
+ * @return Matching virtual host, the default one if none matches.
+ */
+const vhost_t *vhost_match(const char *host) {
+    if (nhosts == 1 || !host || host[0] == '[')
+        return &hosts[VHOST_DEFAULT];
+
+    size_t len = strcspn(host, ":");
+    while (len > 0 && host[len - 1] == '.')
+        len--;
+    if (len == 0)
+        return &hosts[VHOST_DEFAULT];
+
+    for (int i = 1; i < nhosts; i++)
+        for (int j = 0; j < hosts[i].nnames; j++) {
+            const char *name = hosts[i].names[j];
+            if (!strncasecmp(name, host, len) && name[len] == '\0')
+                return &hosts[i];
+        }
+
+    // "*.example.com" matches "a.example.com" and "a.b.example.com"
+    for (int i = 1; i < nhosts; i++)
+        for (int j = 0; j < hosts[i].nnames; j++) {
+            const char *name = hosts[i].names[j];
+            if (name[0] != '*' || name[1] != '.')
+                continue;
+            size_t suffix = strlen(name + 1);
+            if (len > suffix && !strncasecmp(host + len - suffix, name + 1, suffix))
+                return &hosts[i];
+        }
+
+    return &hosts[VHOST_DEFAULT];
+}
+
+/**
+ * @brief Gets a virtual host by index.
+ * @param i Index (0 = default host).
+ * @return Virtual host, NULL if out of range.
+ */
+const vhost_t *vhost_get(int i) {
+    if (i < 0 || i >= nhosts)
+        return NULL;
+    return &hosts[i];
+}
+
+/**
+ * @brief Gets the number of virtual hosts.
+ * @return Count including the default host (at least 1).
+ */
+int vhost_count(void) {
+    return nhosts;
+}
@@ -0,0 +1,46 @@
+#ifndef VHOST_H
+#define VHOST_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+// ------------------------------------------------------------
+// Virtual hosts
+// ------------------------------------------------------------
+// VHOST=<name>[,<alias>...] <root> [cert=<file> key=<file>] [cache=<MB>]
+// Requests are routed on the Host header (HTTP/2 :authority): the port is
+// ignored, names compare without case and "*.example.com" matches any
+// subdomain. A Host no line names goes to the default host, index 0:
+// DOCUMENT_ROOT with SSL_CERT/SSL_KEY. All sites share the workers, the
+// pools and the file cache; cache=N caps the bytes one site may hold, so a
+// large site cannot push the others' hot files out. cert/key are picked
+// during the TLS handshake from the SNI name.
+
+#define VHOST_DEFAULT   0
+#define VHOST_MAX_NAMES 8           // Names and aliases per VHOST line
+
+typedef struct {
+    int index;                      // 0 = default, 1.. = VHOST lines in order
+    char names[VHOST_MAX_NAMES][128];   // Lower case, names[0] labels metrics
+    int nnames;
+    char root[256];
+    size_t cache_quota;             // Bytes (0 = only the CACHE_SIZE_MB budget)
+    struct ssl_ctx_st *ssl_ctx;     // SSL_CTX of cert/key (NULL = SSL_CERT)
+} vhost_t;
+
+// Parses the VHOST lines, loads their certificates and sets the cache
+// quotas (startup and reload, before the pool threads exist). Returns the
+// number of virtual hosts, the default one excluded
+int vhost_load(void);
+
+// Virtual host of a Host header or SNI name (never NULL: default host)
+const vhost_t *vhost_match(const char *host);
+
+// Virtual host by index (0 .. vhost_count() - 1), NULL if out of range
+const vhost_t *vhost_get(int i);
+
+// Number of virtual hosts, the default one included
+int vhost_count(void);
+
+#endif
@@ -1,125 +1,297 @@
 // ===================== worker.c (SSL FIXED) =====================
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <time.h>
 #include <string.h>
-#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
 #include "config.h"
+#include "cache.h"
 #include "worker.h"
 #include "thread_pool.h"
 #include "shared_mem.h"
 #include "semaphores.h"
 #include "ssl.h"
+#include "trace.h"
+#include "affinity.h"
+#include "timer_wheel.h"
+#include "stats.h"
+#include "metrics.h"
+#include "stats_stream.h"
+#include "mempool.h"
+#include "diskio.h"
+#include "memgov.h"
+#include "mime.h"
+#include "proxy.h"
+#include "vhost.h"
+#include "ratelimit.h"
+#include "listener.h"
 
 // Global reference to the SSL_CTX created in master
 extern ssl_server_ctx_t *global_ssl_ctx;
 
+// Maximum time (seconds) a retiring worker waits for in-flight requests
+#define WORKER_DRAIN_TIMEOUT 30
+
 // Worker's shared memory
 shared_data_t* shm_data = NULL;
 ipc_semaphores_t sems;
 
+// Per-worker timer wheel (deadlines of every connection of this process)
+timer_wheel_t worker_wheel;
+
 /**
- * @brief Sets a socket as blocking
+ * @brief Timer wheel callback: counts each expired deadline in the shared stats.
+ * @param kind Deadline kind (TIMEOUT_*).
  */
-static int set_blocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) return -1;
-    return fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+static void on_deadline_expired(int kind) {
+    TRACE_DEBUG(TRACE_WORKER, "Worker %d: deadline %d expired", getpid(), kind);
+    if (shm_data)
+        stats_timeout(&shm_data->stats, sems.sem_stats, kind);
 }
 
+// Set by the signal handlers, checked by the accept loop
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+// Set by the accept thread once it stops accepting, read by the pool threads
+static int draining = 0;
+
 /**
- * @brief Tries to perform SSL handshake with timeout
+ * @brief Tells the connection loops that this worker is retiring: responses
+ *        go out with "Connection: close" and HTTP/2 sends GOAWAY.
+ * @return 1 while draining, 0 otherwise.
  */
-static int ssl_accept_with_timeout(SSL *ssl, int fd, int timeout_sec) {
-    // Temporarily block the socket for SSL_accept
-    set_blocking(fd);
-    
-    struct timeval tv;
-    tv.tv_sec = timeout_sec;
-    tv.tv_usec = 0;
-    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-    
-    int ret = SSL_accept(ssl);
+int worker_draining(void) {
+    return __atomic_load_n(&draining, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief SIGHUP asks for a reload (successor + drain), SIGTERM for a drain only.
+ */
+static void worker_signal_handler(int sig) {
+    if (sig == SIGHUP)
+        reload_requested = 1;
+    else
+        stop_requested = 1;
+}
+
+/**
+ * @brief Publishes this process as the current owner of a worker slot in SHM.
+ */
+static void worker_claim_slot(int slot, int is_https_listener) {
+    if (!shm_data || slot < 0 || slot >= MAX_WORKERS) return;
+
+    worker_slot_t *ws = &shm_data->workers[slot];
+    ws->pid = getpid();
+    ws->is_https = is_https_listener;
+    ws->generation = shm_data->generation;
+    ws->state = WORKER_STATE_RUNNING;
+}
+
+/**
+ * @brief Refuses a connection over a per-client limit without using a pool
+ *        thread: a fixed 429 on HTTP (non-blocking send), a plain close on
+ *        HTTPS (the TLS handshake would cost more than the connection).
+ * @param fd Accepted socket (closed).
+ * @param is_https 1 for the HTTPS listener.
+ */
+static void reject_connection(int fd, int is_https) {
+    static const char too_many[] =
+        "HTTP/1.1 429 Too Many Requests\r\n"
+        "Content-Length: 0\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n\r\n";
+
+    if (!is_https) {
+        if (send(fd, too_many, sizeof(too_many) - 1, MSG_DONTWAIT | MSG_NOSIGNAL) > 0)
+            shutdown(fd, SHUT_WR);
+    }
+    close(fd);
+}
+
+/**
+ * @brief Hands an accepted connection to the thread pool, unless its client
+ *        is over a connection limit.
+ * @param pool Thread pool of this worker.
+ * @param fd Accepted socket.
+ * @param addr Peer address.
+ * @param is_https_listener 1 if the connection came from the HTTPS listener.
+ */
+static void dispatch_connection(thread_pool_t *pool, int fd, const struct sockaddr_storage *addr,
+                                int is_https_listener) {
+    char peer[INET6_ADDRSTRLEN];
+    listener_peer_name((const struct sockaddr *)addr, peer, sizeof(peer));
+    TRACE_DEBUG(TRACE_WORKER, "Worker %d: accepted connection fd=%d from %s (Type: %s)",
+                getpid(), fd, peer, is_https_listener ? "HTTPS" : "HTTP");
+
+    // Per-client connection limits, before the connection takes a pool thread
+    ratelimit_hold_t limits;
+    if (ratelimit_connect((const struct sockaddr *)addr, &limits) != RATELIMIT_OK) {
+        TRACE_DEBUG(TRACE_WORKER, "Worker %d: connection from %s over its limit",
+                    getpid(), peer);
+        reject_connection(fd, is_https_listener);
+        return;
+    }
+
+    // Take a connection_t from the pool (zeroed: timer not armed)
+    connection_t *conn = conn_pool_get();
+    if (!conn) {
+        TRACE_ERROR(TRACE_WORKER, "Worker %d: error allocating connection_t", getpid());
+        ratelimit_disconnect(&limits);
+        close(fd);
+        return;
+    }
     
-    if (ret <= 0) {
-        int ssl_err = SSL_get_error(ssl, ret);
+    conn->fd = fd;
+    conn->is_https = is_https_listener;
+    conn->ssl = NULL;
+    conn->limits = limits;
+    conn->peer = *addr;
+    conn->accepted_us = metrics_now_us();
+
+    // If HTTPS → create SSL object; the handshake itself runs in the pool
+    // thread under a deadline, so a silent client cannot stall the accept loop
+    if (is_https_listener) {
+        conn->ssl = SSL_new(global_ssl_ctx->ctx);
+        if (!conn->ssl) {
+            TRACE_ERROR(TRACE_SSL, "Worker %d: error creating SSL object", getpid());
+            ERR_print_errors_fp(stderr);
+            ratelimit_disconnect(&conn->limits);
+            close(fd);
+            conn_pool_put(conn);
+            return;
+        }
         
-        switch (ssl_err) {
-            case SSL_ERROR_WANT_READ:
-            case SSL_ERROR_WANT_WRITE:
-                fprintf(stderr, "[Worker %d] SSL_accept: needs more data\n", getpid());
-                return -1;
-                
-            case SSL_ERROR_SYSCALL:
-                if (errno == ETIMEDOUT) {
-                    fprintf(stderr, "[Worker %d] SSL_accept: timeout\n", getpid());
-                } else {
-                    fprintf(stderr, "[Worker %d] SSL_accept: syscall error (errno=%d)\n", 
-                            getpid(), errno);
-                    ERR_print_errors_fp(stderr);
-                }
-                return -1;
-                
-            case SSL_ERROR_SSL:
-                fprintf(stderr, "[Worker %d] SSL_accept: SSL protocol error\n", getpid());
-                ERR_print_errors_fp(stderr);
-                return -1;
-                
-            case SSL_ERROR_ZERO_RETURN:
-                fprintf(stderr, "[Worker %d] SSL_accept: connection closed\n", getpid());
-                return -1;
-                
-            default:
-                fprintf(stderr, "[Worker %d] SSL_accept: unknown error %d\n", 
-                        getpid(), ssl_err);
-                ERR_print_errors_fp(stderr);
-                return -1;
+        if (SSL_set_fd(conn->ssl, fd) != 1) {
+            TRACE_ERROR(TRACE_SSL, "Worker %d: error associating SSL to socket", getpid());
+            ERR_print_errors_fp(stderr);
+            SSL_free(conn->ssl);
+            ratelimit_disconnect(&conn->limits);
+            close(fd);
+            conn_pool_put(conn);
+            return;
         }
     }
-    
-    printf("[Worker %d] SSL handshake completed successfully\n", getpid());
-    return 0;
+
+    // Send to the thread pool
+    metrics_connection_open();
+    thread_pool_add(pool, conn);
 }
 
-void worker_main(int listen_fd, int is_https_listener) {
-    // SHM
-    shm_data = shm_attach_worker();
-    if (!shm_data) {
-        fprintf(stderr, "[Worker %d] Failed to attach SHM\n", getpid());
-        exit(1);
+/**
+ * @brief Forks the next generation of this worker. The child inherits the
+ *        listening socket, the SHM mapping and the (warm) cache and re-reads
+ *        server.conf; it returns to worker_main, which serves again with a
+ *        fresh thread pool. The parent then drains.
+ * @return 1 in the successor, 0 in the parent, -1 if fork failed.
+ */
+static int spawn_successor(void) {
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork (successor)");
+        return -1;
     }
 
-    // IPC SEMAPHORES
-    sems.sem_accept = sem_open("/sem_ws_accept", 0);
-    sems.sem_stats  = sem_open("/sem_ws_stats", 0);
-    sems.sem_log    = sem_open("/sem_ws_log", 0);
+    if (pid == 0) {
+        reload_requested = 0;
+        stop_requested = 0;
 
-    if (sems.sem_accept == SEM_FAILED ||
-        sems.sem_stats == SEM_FAILED ||
-        sems.sem_log   == SEM_FAILED) {
-        perror("Worker sem_open");
-        exit(1);
+        load_config("server.conf");
+        trace_init(get_trace_level(), get_trace_categories());
+        cache_resize(get_cache_size_mb());
+        mime_load(get_mime_types_file());
+        proxy_load();
+        vhost_load();
+        return 1;
     }
 
+    TRACE_INFO(TRACE_WORKER, "Worker %d: successor %d started, draining", getpid(), pid);
+    return 0;
+}
+
+/**
+ * @brief Accept loop of a worker: hands connections to the thread pool until
+ *        SIGHUP/SIGTERM, then drains the pool and exits.
+ * @param listeners Listening sockets of the protocol (non-blocking, shared
+ *                  by all workers of the protocol).
+ * @param is_https_listener 1 if this worker serves HTTPS.
+ * @param slot Worker slot index in shared memory.
+ * @return Only in a successor forked on SIGHUP (1), which must serve again:
+ *         the pool of this frame belongs to the predecessor.
+ */
+static int worker_serve(listener_set_t *listeners, int is_https_listener, int slot) {
+    // Only the accept thread handles SIGHUP/SIGTERM: block them before the
+    // pool threads are created and unblock them atomically inside ppoll().
+    sigset_t block, wait_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGHUP);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, NULL);
+    pthread_sigmask(SIG_SETMASK, NULL, &wait_mask);
+    sigdelset(&wait_mask, SIGHUP);
+    sigdelset(&wait_mask, SIGTERM);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = worker_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // A peer that vanishes (or a socket cut by a write deadline) must not
+    // kill the worker when OpenSSL writes to it
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR1 is for the master (slow-request dump)
+    signal(SIGUSR1, SIG_IGN);
+
+    worker_claim_slot(slot, is_https_listener);
+    metrics_bind(slot);
+    conn_pool_init();
+    cache_publish_usage(1);
+
+    // Pin before creating the pool so the threads inherit the placement
+    affinity_apply_worker(slot, get_num_workers());
+
+    // Deadlines are started before the pool (a successor gets a fresh wheel)
+    if (timer_wheel_start(&worker_wheel, on_deadline_expired) != 0)
+        exit(1);
+
+    // Live stats viewers are served by one hub thread, not by the pool
+    if (stats_stream_start() != 0)
+        TRACE_WARN(TRACE_WORKER, "Worker %d: stats stream unavailable", getpid());
+
     // Start thread pool
     thread_pool_t pool;
-    int nthreads = get_threads_per_worker();
-    thread_pool_init(&pool, nthreads);
+    int nthreads = get_threads_min_per_worker();
+    thread_pool_init(&pool, nthreads, get_threads_per_worker());
+
+    // Cache misses are read by a few dedicated threads
+    diskio_start(get_disk_io_threads());
+
+    // Shrinks the cache and the pool under memory pressure
+    if (memgov_start(&pool) != 0)
+        TRACE_WARN(TRACE_WORKER, "Worker %d: memory governor unavailable", getpid());
 
     const char* type = is_https_listener ? "HTTPS" : "HTTP";
-        printf("[Worker %d] Started with %d threads - Type: %s\n",
-            getpid(), nthreads, type);
+        printf("[Worker %d] Started with %d threads (up to %d) - Type: %s\n",
+            getpid(), nthreads, get_threads_per_worker(), type);
 
     // Check if we have SSL context available for HTTPS worker
     if (is_https_listener && !global_ssl_ctx) {
@@ -127,75 +299,110 @@ void worker_main(int listen_fd, int is_https_listener) {
         exit(1);
     }
 
-    struct sockaddr_in client_addr;
-    socklen_t len = sizeof(client_addr);
+    struct sockaddr_storage client_addr;
+    socklen_t len;
+    struct pollfd pfds[LISTENER_MAX];
+    int nfds = listeners->count;
+    for (int i = 0; i < nfds; i++) {
+        pfds[i].fd = listeners->fds[i];
+        pfds[i].events = POLLIN;
+    }
 
     // Worker's accept loop
-    while (1) {
-        int client_socket = accept(listen_fd,(struct sockaddr *)&client_addr,&len);
-
-        if (client_socket < 0) {
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
-            perror("accept");
-            continue;
+    while (!stop_requested) {
+        if (reload_requested) {
+            int rc = spawn_successor();
+            if (rc > 0)
+                return 1;
+            if (rc == 0)
+                break;
+            reload_requested = 0;
         }
 
-        printf("[Worker %d] Accepted connection fd=%d from %s:%d (Type: %s)\n",
-               getpid(),
-               client_socket,
-               inet_ntoa(client_addr.sin_addr),
-               ntohs(client_addr.sin_port),
-               type);
-
-        // Create connection_t for the thread pool
-        connection_t *conn = malloc(sizeof(connection_t));
-        if (!conn) {
-            fprintf(stderr, "[Worker %d] Error allocating connection_t\n", getpid());
-            close(client_socket);
+        if (ppoll(pfds, nfds, NULL, &wait_mask) < 0) {
+            if (errno != EINTR)
+                perror("ppoll");
             continue;
         }
-        
-        conn->fd = client_socket;
-        conn->is_https = is_https_listener;
-        conn->ssl = NULL;
-
-        // If HTTPS → create SSL object and perform handshake
-        if (is_https_listener) {
-            printf("[Worker %d] Starting SSL handshake...\n", getpid());
-            
-            conn->ssl = SSL_new(global_ssl_ctx->ctx);
-            if (!conn->ssl) {
-                fprintf(stderr, "[Worker %d] Error creating SSL object\n", getpid());
-                ERR_print_errors_fp(stderr);
-                close(client_socket);
-                free(conn);
-                continue;
-            }
-            
-            if (SSL_set_fd(conn->ssl, client_socket) != 1) {
-                fprintf(stderr, "[Worker %d] Error associating SSL to socket\n", getpid());
-                ERR_print_errors_fp(stderr);
-                SSL_free(conn->ssl);
-                close(client_socket);
-                free(conn);
-                continue;
-            }
-            
-            // Perform SSL handshake with 10 second timeout
-            if (ssl_accept_with_timeout(conn->ssl, client_socket, 10) != 0) {
-                fprintf(stderr, "[Worker %d] SSL handshake failed\n", getpid());
-                SSL_free(conn->ssl);
-                close(client_socket);
-                free(conn);
+
+        // Drain up to ACCEPT_BATCH connections per ready listener and wakeup
+        int batch = get_accept_batch();
+        for (int i = 0; i < nfds; i++) {
+            if (!(pfds[i].revents & POLLIN))
                 continue;
+
+            for (int n = 0; n < batch && !stop_requested; n++) {
+                len = sizeof(client_addr);
+                int client_socket = listener_accept(pfds[i].fd, (struct sockaddr *)&client_addr,
+                                                    &len);
+
+                if (client_socket < 0) {
+                    // EAGAIN: queue drained, or another worker took the connection first
+                    if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+                        perror("accept");
+                    break;
+                }
+
+                dispatch_connection(&pool, client_socket, &client_addr, is_https_listener);
             }
-            
-            printf("[Worker %d] HTTPS connection established (cipher: %s)\n", 
-                   getpid(), SSL_get_cipher(conn->ssl));
         }
+    }
 
-        // Send to the thread pool
-        thread_pool_add(&pool, conn);
+    // Stop accepting: the successor (if any) keeps the listeners open
+    listener_close_all(listeners);
+
+    if (!reload_requested && shm_data && slot >= 0 && slot < MAX_WORKERS &&
+        shm_data->workers[slot].pid == getpid())
+        shm_data->workers[slot].state = WORKER_STATE_DRAINING;
+
+    TRACE_INFO(TRACE_WORKER, "Worker %d: draining %d queued/active connections",
+               getpid(), thread_pool_pending(&pool));
+
+    // Keep-alive clients are not held until WORKER_DRAIN_TIMEOUT: the next
+    // response closes, and connections idle between requests end now
+    __atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+    timer_wheel_expire(&worker_wheel, TIMEOUT_IDLE);
+
+    if (thread_pool_shutdown(&pool, WORKER_DRAIN_TIMEOUT) != 0)
+        TRACE_WARN(TRACE_WORKER, "Worker %d: drain timed out, exiting anyway", getpid());
+    else
+        diskio_stop();
+
+    memgov_stop();
+    stats_stream_stop();
+    timer_wheel_stop(&worker_wheel);
+    conn_pool_shutdown();
+    proxy_shutdown();
+    cache_publish_usage(-1);
+
+    exit(0);
+}
+
+void worker_main(const listener_set_t *listeners, int is_https_listener, int slot) {
+    // Own copy: successors forked on reload inherit it
+    static listener_set_t set;
+    set = *listeners;
+
+    // SHM
+    shm_data = shm_attach_worker();
+    if (!shm_data) {
+        fprintf(stderr, "[Worker %d] Failed to attach SHM\n", getpid());
+        exit(1);
     }
-}
\ No newline at end of file
+
+    // IPC SEMAPHORES
+    sems.sem_accept = sem_open("/sem_ws_accept", 0);
+    sems.sem_stats  = sem_open("/sem_ws_stats", 0);
+    sems.sem_log    = sem_open("/sem_ws_log", 0);
+
+    if (sems.sem_accept == SEM_FAILED ||
+        sems.sem_stats == SEM_FAILED ||
+        sems.sem_log   == SEM_FAILED) {
+        perror("Worker sem_open");
+        exit(1);
+    }
+
+    // Each successor forked on reload serves from here again (no recursion)
+    while (worker_serve(&set, is_https_listener, slot))
+        ;
+}
@@ -2,15 +2,47 @@
 #define WORKER_H
 
 #include <openssl/ssl.h>
+#include "timer_wheel.h"
+#include "ratelimit.h"
+#include "listener.h"
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+// Input buffer of a connection: bounds the size of a request header and
+// the amount of pipelined requests read ahead
+#define CONN_IN_BUF_SIZE 8192
 
 // Structure for connection (can be HTTP or HTTPS)
 typedef struct {
     int fd;          // Socket file descriptor
     SSL *ssl;        // SSL context (NULL se for HTTP normal)
     int is_https;    // 1 se for HTTPS, 0 se for HTTP
+    wheel_timer_t timer;  // Current deadline (handshake, header, idle or write)
+
+    // Keep-alive / pipelining
+    size_t in_off;
+    size_t in_len;
+    char *out_buf;                  // Responses waiting to be flushed together
+    size_t out_len;
+    size_t out_cap;
+    int keep_alive;                 // Connection stays open after the current response
+    ratelimit_hold_t limits;        // Per-client connection counts, released on close
+    struct sockaddr_storage peer;   // Client address (AF_INET, AF_INET6 or AF_UNIX)
+    unsigned long accepted_us;      // Monotonic clock at accept (queue wait)
+    int in_use;                     // Taken from the pool (a successor closes its copy)
+
+    // Last field: conn_pool_get clears everything above, not this buffer
+    char in_buf[CONN_IN_BUF_SIZE];  // Received bytes (in_off..in_len not parsed yet)
 } connection_t;
 
-// Each worker receives the listen_fd (listening socket) and is_https_listener flag
-void worker_main(int listen_fd, int is_https_listener);
+// Each worker receives the listeners of its protocol, the is_https_listener flag
+// and its slot index in shared memory. SIGHUP forks a successor that keeps the
+// listeners and the warm cache, then drains; SIGTERM only drains.
+void worker_main(const listener_set_t *listeners, int is_https_listener, int slot);
+
+// 1 once the worker stopped accepting (reload or SIGTERM): connections
+// are closed after their current response
+int worker_draining(void);
 
 #endif
\ No newline at end of file
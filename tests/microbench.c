@@ -0,0 +1,517 @@
+// ===================== microbench.c =====================
+// Microbenchmarks for the hot-path components of the server:
+//   cache_get / cache_put, cache hits over a large hot set (cache_hot, TLB
+//   reach of the cache arena), thread_pool_add / thread_pool_pop,
+//   stats_update, parse_request_conn (from a socket and from a filled
+//   buffer), conn_pool_get / conn_pool_put and mime_lookup.
+//
+// Each benchmark runs at several thread counts and reports ns/op,
+// aggregate throughput and the scaling relative to the first thread
+// count given (1 by default).
+// When perf_event_open() is allowed, cycles and instructions per op
+// are also reported.
+//
+// Build and run: make microbench [BENCH_ARGS="-t 1,2,4 -n 200000"]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cache.h"
+#include "cache_arena.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "http.h"
+#include "mempool.h"
+#include "mime.h"
+
+#define MAX_THREADS 64
+#define CACHE_KEYS 256
+#define CACHE_HOT_MB 160            // Cache of the cache_hot benchmark
+#define CACHE_HOT_KEYS 8192         // 16 KB entries: 128 MB of hot set
+#define CACHE_HOT_SIZE (16 * 1024)
+
+typedef struct {
+    const char *name;
+    void (*setup)(int nthreads);
+    void (*teardown)(int nthreads);
+    void (*op)(int tid, long i);
+} bench_t;
+
+typedef struct {
+    int tid;
+    long iters;
+    pthread_barrier_t *start;
+    long long cycles;
+    long long instructions;
+    int perf_ok;
+} bench_thread_t;
+
+static FILE *out = NULL;
+static int perf_available = 1;
+
+// ================================================================
+// perf counters (cycles + instructions, per thread)
+// ================================================================
+static int perf_open(struct perf_event_attr *attr, int group_fd) {
+    return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static int perf_start(int fds[2]) {
+    fds[0] = fds[1] = -1;
+    if (!perf_available) return -1;
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fds[0] = perf_open(&attr, -1);
+    if (fds[0] < 0) {
+        perf_available = 0;
+        return -1;
+    }
+
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 0;
+    fds[1] = perf_open(&attr, fds[0]);
+    if (fds[1] < 0) {
+        close(fds[0]);
+        fds[0] = -1;
+        perf_available = 0;
+        return -1;
+    }
+
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return 0;
+}
+
+static void perf_stop(int fds[2], long long *cycles, long long *instructions) {
+    *cycles = *instructions = 0;
+    if (fds[0] < 0) return;
+
+    ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(fds[0], cycles, sizeof(*cycles)) != sizeof(*cycles)) *cycles = 0;
+    if (read(fds[1], instructions, sizeof(*instructions)) != sizeof(*instructions)) *instructions = 0;
+    close(fds[1]);
+    close(fds[0]);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// ================================================================
+// cache_get / cache_put
+// ================================================================
+static char cache_keys[CACHE_KEYS][64];
+static char cache_payload[1024];
+
+static void cache_setup(int nthreads) {
+    (void)nthreads;
+    cache_init(16);
+    memset(cache_payload, 'x', sizeof(cache_payload));
+    for (int k = 0; k < CACHE_KEYS; k++) {
+        snprintf(cache_keys[k], sizeof(cache_keys[k]), "www/bench/file_%d.html", k);
+        cache_put(cache_keys[k], cache_payload, sizeof(cache_payload), 0);
+    }
+}
+
+static void cache_teardown(int nthreads) {
+    (void)nthreads;
+    cache_cleanup();
+}
+
+static void cache_get_op(int tid, long i) {
+    char *data;
+    size_t size;
+    if (cache_get(cache_keys[(i + tid * 7) % CACHE_KEYS], &data, &size))
+        cache_release(data);
+}
+
+static void cache_put_op(int tid, long i) {
+    cache_put(cache_keys[(i + tid * 7) % CACHE_KEYS], cache_payload, sizeof(cache_payload), 0);
+}
+
+// Hits spread over 128 MB: each op reads one line per 4 KB page of an
+// entry, so its cost is dominated by TLB reach (-H thp|hugetlb|off)
+static const char *cache_huge_pages = NULL;
+static char (*cache_hot_keys)[64];
+
+static void cache_hot_setup(int nthreads) {
+    (void)nthreads;
+    cache_init(CACHE_HOT_MB);
+    if (cache_huge_pages)
+        cache_arena_configure((size_t)CACHE_HOT_MB * 1024 * 1024 * 9 / 8, cache_huge_pages);
+
+    char *payload = malloc(CACHE_HOT_SIZE);
+    cache_hot_keys = calloc(CACHE_HOT_KEYS, sizeof(*cache_hot_keys));
+    memset(payload, 'x', CACHE_HOT_SIZE);
+    for (int k = 0; k < CACHE_HOT_KEYS; k++) {
+        snprintf(cache_hot_keys[k], sizeof(cache_hot_keys[k]), "www/bench/hot_%d.bin", k);
+        cache_put(cache_hot_keys[k], payload, CACHE_HOT_SIZE, 0);
+    }
+    free(payload);
+}
+
+static void cache_hot_teardown(int nthreads) {
+    (void)nthreads;
+    cache_cleanup();
+    free(cache_hot_keys);
+}
+
+static void cache_hot_op(int tid, long i) {
+    char *data;
+    size_t size;
+    unsigned long k = ((unsigned long)i * 2654435761UL + tid * 7919UL) % CACHE_HOT_KEYS;
+
+    if (cache_get(cache_hot_keys[k], &data, &size)) {
+        volatile char sum = 0;
+        for (size_t off = (i & 63) * 64; off < size; off += 4096)
+            sum += data[off];
+        cache_release(data);
+    }
+}
+
+// ================================================================
+// thread_pool_add / thread_pool_pop (queue only, no pool threads)
+// ================================================================
+static thread_pool_t bench_pool;
+static connection_t bench_conns[MAX_THREADS];
+
+static void queue_setup(int nthreads) {
+    (void)nthreads;
+    memset(&bench_pool, 0, sizeof(bench_pool));
+    thread_pool_queue_init(&bench_pool);
+}
+
+static void queue_teardown(int nthreads) {
+    (void)nthreads;
+    pthread_mutex_destroy(&bench_pool.queue.mutex);
+    pthread_cond_destroy(&bench_pool.queue.cond_non_empty);
+    pthread_cond_destroy(&bench_pool.queue.cond_non_full);
+}
+
+static void queue_op(int tid, long i) {
+    (void)i;
+    // Each op is one push followed by one pop, so the queue never
+    // holds more than nthreads entries and nobody blocks forever.
+    thread_pool_add(&bench_pool, &bench_conns[tid]);
+    thread_pool_pop(&bench_pool);
+}
+
+// ================================================================
+// stats_update
+// ================================================================
+static server_stats_t bench_stats;
+static sem_t bench_sem;
+
+static void stats_setup(int nthreads) {
+    (void)nthreads;
+    stats_init(&bench_stats);
+    sem_init(&bench_sem, 1, 1);
+}
+
+static void stats_teardown(int nthreads) {
+    (void)nthreads;
+    sem_destroy(&bench_sem);
+}
+
+static void stats_op(int tid, long i) {
+    (void)tid;
+    stats_update(&bench_stats, &bench_sem, (i & 7) ? 200 : 404, 1024);
+}
+
+// ================================================================
+// parse_request_conn (request written into a socketpair per thread)
+// ================================================================
+static const char bench_request[] =
+    "GET /test_files/test.html HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: microbench/1.0\r\n"
+    "Accept: text/html,application/xhtml+xml\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static int parse_pairs[MAX_THREADS][2];
+static connection_t parse_conns[MAX_THREADS];
+
+static void parse_setup(int nthreads) {
+    for (int t = 0; t < nthreads; t++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, parse_pairs[t]) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        memset(&parse_conns[t], 0, sizeof(connection_t));
+        parse_conns[t].fd = parse_pairs[t][1];
+    }
+}
+
+static void parse_teardown(int nthreads) {
+    for (int t = 0; t < nthreads; t++) {
+        close(parse_pairs[t][0]);
+        close(parse_pairs[t][1]);
+    }
+}
+
+static void parse_op(int tid, long i) {
+    (void)i;
+    http_request_t req;
+    memset(&req, 0, sizeof(req));
+
+    // Same per-request lifetime as in the server: one reset per request
+    arena_t *arena = request_arena();
+    arena_reset(arena);
+
+    if (write(parse_pairs[tid][0], bench_request, sizeof(bench_request) - 1) < 0) {
+        perror("write");
+        exit(1);
+    }
+    parse_request_conn(&parse_conns[tid], &req, arena);
+}
+
+// Same request already in the input buffer: the parser alone, no read()
+static void parse_buffered_op(int tid, long i) {
+    (void)i;
+    http_request_t req;
+    memset(&req, 0, sizeof(req));
+
+    arena_t *arena = request_arena();
+    arena_reset(arena);
+
+    connection_t *c = &parse_conns[tid];
+    memcpy(c->in_buf, bench_request, sizeof(bench_request) - 1);
+    c->in_off = 0;
+    c->in_len = sizeof(bench_request) - 1;
+    parse_request_conn(c, &req, arena);
+}
+
+// ================================================================
+// conn_pool_get / conn_pool_put (one connection per accept)
+// ================================================================
+static void conn_pool_setup(int nthreads) {
+    (void)nthreads;
+    conn_pool_init();
+}
+
+static void conn_pool_teardown(int nthreads) {
+    (void)nthreads;
+}
+
+static void conn_pool_op(int tid, long i) {
+    (void)tid;
+    (void)i;
+    connection_t *c = conn_pool_get();
+    c->fd = -1;
+    conn_pool_put(c);
+}
+
+// ================================================================
+// mime_lookup (perfect hash over mime.types)
+// ================================================================
+static const char *mime_paths[] = {
+    "www/index.html", "www/style.css", "www/script.js", "www/Tux.png",
+    "www/fonts/a.woff2", "www/data.JSON", "www/noext", "www/file.unknown",
+};
+
+static void mime_setup(int nthreads) {
+    (void)nthreads;
+    mime_load("mime.types");
+}
+
+static void mime_op(int tid, long i) {
+    (void)tid;
+    const mime_type_t *t = mime_lookup(mime_paths[i & 7]);
+    __asm__ volatile("" : : "r"(t));
+}
+
+// ================================================================
+// Harness
+// ================================================================
+static const bench_t *current_bench = NULL;
+
+static void *bench_thread(void *arg) {
+    bench_thread_t *bt = arg;
+    int fds[2];
+
+    pthread_barrier_wait(bt->start);
+
+    bt->perf_ok = perf_start(fds) == 0;
+    for (long i = 0; i < bt->iters; i++)
+        current_bench->op(bt->tid, i);
+    perf_stop(fds, &bt->cycles, &bt->instructions);
+
+    return NULL;
+}
+
+/**
+ * @brief Runs one benchmark with nthreads threads and prints one result row.
+ * @param b Benchmark to run.
+ * @param nthreads Number of concurrent threads.
+ * @param iters Iterations per thread.
+ * @param base_mops Throughput of the first (reference) run, 0 for the reference run itself.
+ * @return Aggregate throughput in Mops/s.
+ */
+static double run_bench(const bench_t *b, int nthreads, long iters, double base_mops) {
+    pthread_t threads[MAX_THREADS];
+    bench_thread_t bt[MAX_THREADS];
+    pthread_barrier_t start;
+
+    current_bench = b;
+    if (b->setup) b->setup(nthreads);
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (int t = 0; t < nthreads; t++) {
+        bt[t] = (bench_thread_t){ .tid = t, .iters = iters, .start = &start };
+        pthread_create(&threads[t], NULL, bench_thread, &bt[t]);
+    }
+
+    double t0 = now_ns();
+    pthread_barrier_wait(&start);
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+    double elapsed = now_ns() - t0;
+
+    pthread_barrier_destroy(&start);
+    if (b->teardown) b->teardown(nthreads);
+
+    long long cycles = 0, instructions = 0;
+    int perf_ok = 1;
+    for (int t = 0; t < nthreads; t++) {
+        cycles += bt[t].cycles;
+        instructions += bt[t].instructions;
+        perf_ok &= bt[t].perf_ok;
+    }
+
+    double total_ops = (double)iters * nthreads;
+    double ns_per_op = elapsed / iters;         // latency seen by one thread
+    double mops = total_ops / elapsed * 1e3;    // aggregate throughput
+    double scaling = base_mops > 0 ? mops / base_mops : 1.0;
+
+    fprintf(out, "  %-14s %3d thr %10.1f ns/op %9.3f Mops/s  x%5.2f",
+            b->name, nthreads, ns_per_op, mops, scaling);
+    if (perf_ok && cycles > 0)
+        fprintf(out, "  %8.1f cyc/op %8.1f ins/op  IPC %.2f",
+                cycles / total_ops, instructions / total_ops,
+                (double)instructions / cycles);
+    fprintf(out, "\n");
+    fflush(out);
+
+    return mops;
+}
+
+static int parse_thread_list(const char *s, int *list, int max) {
+    int n = 0;
+    char *copy = strdup(s);
+    for (char *tok = strtok(copy, ","); tok && n < max; tok = strtok(NULL, ",")) {
+        int v = atoi(tok);
+        if (v >= 1 && v <= MAX_THREADS)
+            list[n++] = v;
+    }
+    free(copy);
+    return n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-t 1,2,4,8] [-n iterations] [-b name] [-s scanner] [-H pages]\n"
+        "  -t  comma separated thread counts (max %d)\n"
+        "  -n  iterations per thread (default 200000)\n"
+        "  -b  run only benchmarks whose name contains this string\n"
+        "  -s  HTTP parser scanner: auto, avx2, sse4.2 or off (default auto)\n"
+        "  -H  cache arena pages: thp, hugetlb or off (default CACHE_HUGE_PAGES)\n",
+        prog, MAX_THREADS);
+}
+
+int main(int argc, char **argv) {
+    int thread_counts[16] = {1, 2, 4, 8};
+    int nthread_counts = 4;
+    long iters = 200000;
+    const char *filter = NULL;
+    const char *scanner = "auto";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:b:s:H:h")) != -1) {
+        switch (opt) {
+            case 't': nthread_counts = parse_thread_list(optarg, thread_counts, 16); break;
+            case 'n': iters = atol(optarg); break;
+            case 'b': filter = optarg; break;
+            case 's': scanner = optarg; break;
+            case 'H': cache_huge_pages = optarg; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (nthread_counts == 0 || iters <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (http_scan_select(scanner) != 0) {
+        fprintf(stderr, "Scanner '%s' not supported by this CPU\n", scanner);
+        return 1;
+    }
+
+    // Components print debug lines on stdout; keep our report on a
+    // private copy of stdout and discard everything else while measuring.
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    if (!out || devnull < 0) {
+        perror("microbench");
+        return 1;
+    }
+    fflush(stdout);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    const bench_t benches[] = {
+        { "cache_get",   cache_setup, cache_teardown, cache_get_op },
+        { "cache_put",   cache_setup, cache_teardown, cache_put_op },
+        { "cache_hot",   cache_hot_setup, cache_hot_teardown, cache_hot_op },
+        { "queue_push_pop", queue_setup, queue_teardown, queue_op },
+        { "stats_update", stats_setup, stats_teardown, stats_op },
+        { "parse_request", parse_setup, parse_teardown, parse_op },
+        { "parse_buffered", parse_setup, parse_teardown, parse_buffered_op },
+        { "conn_pool",   conn_pool_setup, conn_pool_teardown, conn_pool_op },
+        { "mime_lookup", mime_setup, NULL, mime_op },
+    };
+
+    fprintf(out, "=== Microbenchmarks (%ld iterations per thread, parser scanner: %s) ===\n",
+            iters, http_scan_impl());
+
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        if (filter && !strstr(benches[b].name, filter))
+            continue;
+
+        double base = 0;
+        for (int i = 0; i < nthread_counts; i++) {
+            double mops = run_bench(&benches[b], thread_counts[i], iters, base);
+            if (i == 0)
+                base = mops;
+        }
+    }
+
+    if (!perf_available)
+        fprintf(out, "(perf counters unavailable: perf_event_open not permitted here)\n");
+
+    fclose(out);
+    return 0;
+}
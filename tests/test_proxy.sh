@@ -0,0 +1,293 @@
+#!/bin/bash
+# Reverse proxy tests: starts two local test backends (python3) and the
+# server with PROXY_PASS routes from a temporary directory, then checks
+# forwarding, request/response bodies, upstream keep-alive, micro-caching
+# and failover.
+# Usage: tests/test_proxy.sh (from the repository root, after make).
+# No other instance of the server may be running (shared memory is global).
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+PORT=18080
+HTTPS_PORT=18443
+BASE_URL="http://localhost:${PORT}"
+UP1=19001
+UP2=19002
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+total=0
+passed=0
+failed=0
+
+check() {
+    local name=$1
+    local expected=$2
+    local got=$3
+
+    echo -n "  [$((total+1))] $name... "
+    if [ "$got" = "$expected" ]; then
+        echo -e "${GREEN}✓ PASSED${NC}"
+        ((passed++))
+    else
+        echo -e "${RED}✗ FAILED${NC} (expected: '$expected', got: '$got')"
+        ((failed++))
+    fi
+    ((total++))
+}
+
+for dep in curl python3; do
+    if ! command -v $dep &> /dev/null; then
+        echo -e "${RED}ERROR: $dep not installed${NC}"
+        exit 1
+    fi
+done
+
+if [ ! -x "$ROOT/server" ]; then
+    echo -e "${RED}ERROR: build the server first (make)${NC}"
+    exit 1
+fi
+
+if pgrep -x server > /dev/null; then
+    echo -e "${RED}ERROR: another server is running (stop it first)${NC}"
+    exit 1
+fi
+
+TMP=$(mktemp -d)
+BACKEND_PIDS=""
+
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill $SERVER_PID 2>/dev/null
+    [ -n "$BACKEND_PIDS" ] && kill $BACKEND_PIDS 2>/dev/null
+    sleep 1
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+# --- Test backend --------------------------------------------------------
+# Dispatches on the last path segment, so every route can reach it
+cat > "$TMP/backend.py" << 'EOF'
+import hashlib, sys, threading
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+
+port = int(sys.argv[1])
+counter = 0
+lock = threading.Lock()
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def read_body(self):
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            data = b""
+            while True:
+                size = int(self.rfile.readline().split(b";")[0], 16)
+                if size == 0:
+                    while self.rfile.readline() not in (b"\r\n", b"\n", b""):
+                        pass
+                    return data
+                data += self.rfile.read(size)
+                self.rfile.readline()
+        return self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+    def reply(self, code, data, extra=()):
+        self.send_response(code)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(data)))
+        for name, value in extra:
+            self.send_header(name, value)
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(data)
+
+    def do_GET(self):
+        global counter
+        name = self.path.split("?")[0].rsplit("/", 1)[-1]
+
+        if name == "hello":
+            self.reply(200, b"hello from %d\n" % port)
+        elif name == "peer":
+            self.reply(200, b"%d\n" % self.client_address[1])
+        elif name == "headers":
+            h = self.headers
+            self.reply(200, ("%s|%s|%s\n" % (h.get("Host"), h.get("X-Forwarded-For"),
+                                             h.get("X-Forwarded-Proto"))).encode())
+        elif name in ("counter", "private", "vary"):
+            with lock:
+                counter += 1
+                n = counter
+            extra = {"private": [("Cache-Control", "private")],
+                     "vary": [("Vary", "Accept-Language")]}.get(name, [])
+            self.reply(200, b"%d\n" % n, extra)
+        elif name == "chunked":
+            self.send_response(200)
+            self.send_header("Content-Type", "text/plain")
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for i in range(100):
+                line = b"line %d\n" % i
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(line), line))
+            self.wfile.write(b"0\r\n\r\n")
+        elif name == "badlength":
+            self.send_response(200)
+            self.send_header("Content-Length", "12abc")
+            self.end_headers()
+            self.wfile.write(b"x" * 12)
+        elif name == "big":
+            size = 8 * 1024 * 1024
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(size))
+            self.end_headers()
+            if self.command != "HEAD":
+                block = b"x" * 65536
+                for _ in range(size // len(block)):
+                    self.wfile.write(block)
+        else:
+            self.reply(404, b"not found\n")
+
+    do_HEAD = do_GET
+
+    def do_POST(self):
+        data = self.read_body()
+        self.reply(200, b"%d %s\n" % (len(data), hashlib.md5(data).hexdigest().encode()))
+
+    do_PUT = do_POST
+
+ThreadingHTTPServer(("127.0.0.1", port), Handler).serve_forever()
+EOF
+
+for p in $UP1 $UP2; do
+    python3 "$TMP/backend.py" $p &
+    BACKEND_PIDS="$BACKEND_PIDS $!"
+done
+
+for p in $UP1 $UP2; do
+    for i in $(seq 1 50); do
+        curl -s -o /dev/null "http://127.0.0.1:$p/hello" && break
+        sleep 0.1
+    done
+done
+
+# --- Server --------------------------------------------------------------
+cat > "$TMP/server.conf" << EOF
+PORT=$PORT
+HTTPS_PORT=$HTTPS_PORT
+DOCUMENT_ROOT=$ROOT/www
+NUM_WORKERS=2
+THREADS_PER_WORKER=8
+LOG_FILE=$TMP/access.log
+MIME_TYPES=$ROOT/mime.types
+SSL_CERT=$ROOT/certs/cert.pem
+SSL_KEY=$ROOT/certs/key.pem
+TRACE_LEVEL=error
+PROXY_PASS=/app/ 127.0.0.1:$UP1,127.0.0.1:$UP2
+PROXY_PASS=/one/ 127.0.0.1:$UP1
+PROXY_PASS=/cached/ 127.0.0.1:$UP1 cache=2
+PROXY_PASS=/dead/ 127.0.0.1:19009
+PROXY_MAX_FAILS=1
+PROXY_FAIL_TIMEOUT_SECONDS=30
+EOF
+
+(cd "$TMP" && exec "$ROOT/server" > "$TMP/server.log" 2>&1) &
+SERVER_PID=$!
+
+for i in $(seq 1 50); do
+    curl -sf -o /dev/null "$BASE_URL/one/hello" && break
+    sleep 0.1
+done
+
+echo "=========================================="
+echo "  Reverse Proxy Tests"
+echo "=========================================="
+
+echo -e "${BLUE}=== Forwarding ===${NC}"
+check "GET through the proxy" "hello from $UP1" "$(curl -s $BASE_URL/one/hello)"
+
+seen=$(for i in 1 2 3 4; do curl -s $BASE_URL/app/hello; done | sort -u | wc -l)
+check "Round robin over two upstreams" "2" "$seen"
+
+check "Host and X-Forwarded-* headers" "localhost:$PORT|127.0.0.1|http" \
+      "$(curl -s $BASE_URL/one/headers)"
+
+check "Upstream 404 passed through" "404" \
+      "$(curl -s -o /dev/null -w '%{http_code}' $BASE_URL/one/missing)"
+
+check "HEAD keeps the upstream length" "8388608" \
+      "$(curl -sI $BASE_URL/one/big | tr -d '\r' | awk -F': ' 'tolower($1)=="content-length"{print $2}')"
+
+echo -e "${BLUE}=== Bodies ===${NC}"
+head -c 1048576 /dev/urandom > "$TMP/body.bin"
+sum=$(md5sum "$TMP/body.bin" | cut -d' ' -f1)
+
+check "POST with Content-Length (1 MiB)" "1048576 $sum" \
+      "$(curl -s --data-binary @"$TMP/body.bin" $BASE_URL/one/upload)"
+
+check "POST with a chunked body (1 MiB)" "1048576 $sum" \
+      "$(curl -s -H 'Transfer-Encoding: chunked' --data-binary @"$TMP/body.bin" $BASE_URL/one/upload)"
+
+check "Chunked response relayed" "100" "$(curl -s $BASE_URL/one/chunked | wc -l)"
+
+check "Streamed 8 MiB response" "8388608" "$(curl -s $BASE_URL/one/big | wc -c)"
+
+echo -e "${BLUE}=== Keep-alive ===${NC}"
+p1=$(curl -s $BASE_URL/one/peer)
+p2=$(curl -s $BASE_URL/one/peer)
+check "Upstream connection reused" "$p1" "$p2"
+
+connects=$(curl -s -o /dev/null -o /dev/null -w '%{num_connects}' \
+           $BASE_URL/one/hello $BASE_URL/one/hello | tail -c 1)
+check "Client connection kept alive" "0" "$connects"
+
+echo -e "${BLUE}=== Micro-cache ===${NC}"
+c1=$(curl -s $BASE_URL/cached/counter)
+c2=$(curl -s $BASE_URL/cached/counter)
+check "Second request served from the cache" "$c1" "$c2"
+check "X-Cache: HIT" "HIT" \
+      "$(curl -sI $BASE_URL/cached/counter | tr -d '\r' | awk -F': ' 'tolower($1)=="x-cache"{print $2}')"
+sleep 2.2
+c3=$(curl -s $BASE_URL/cached/counter)
+check "Entry expires after cache=2" "1" "$([ "$c3" != "$c1" ] && echo 1 || echo 0)"
+
+v1=$(curl -s $BASE_URL/cached/private)
+v2=$(curl -s $BASE_URL/cached/private)
+check "Cache-Control: private not cached" "1" "$([ "$v1" != "$v2" ] && echo 1 || echo 0)"
+
+v1=$(curl -s -H 'Accept-Language: pt' $BASE_URL/cached/vary)
+v2=$(curl -s -H 'Accept-Language: en' $BASE_URL/cached/vary)
+check "Vary response not cached" "1" "$([ "$v1" != "$v2" ] && echo 1 || echo 0)"
+
+h1=$(curl -s -H 'Host: a.test' $BASE_URL/cached/counter)
+h2=$(curl -s -H 'Host: b.test' $BASE_URL/cached/counter)
+h3=$(curl -s -H 'Host: A.Test.' $BASE_URL/cached/counter)
+check "Cache keyed on the Host header" "1" "$([ "$h1" != "$h2" ] && [ "$h1" = "$h3" ] && echo 1 || echo 0)"
+
+echo -e "${BLUE}=== Health ===${NC}"
+check "No upstream: 502" "502" "$(curl -s -o /dev/null -w '%{http_code}' $BASE_URL/dead/hello)"
+check "Malformed upstream Content-Length: 502" "502" \
+      "$(curl -s -o /dev/null -w '%{http_code}' $BASE_URL/one/badlength)"
+
+kill ${BACKEND_PIDS##* } 2>/dev/null
+sleep 0.5
+codes=$(for i in 1 2 3 4 5 6; do curl -s -o /dev/null -w '%{http_code}\n' $BASE_URL/app/hello; done | sort -u)
+check "Failover when an upstream dies" "200" "$codes"
+
+down=$(curl -s $BASE_URL/metrics | awk '/^webserver_proxy_upstream_down_total/ {s += $2} END {print (s > 0)}')
+check "Upstream taken out of rotation" "1" "$down"
+
+if curl -V | grep -q HTTP2; then
+    echo -e "${BLUE}=== HTTP/2 ===${NC}"
+    check "GET over HTTP/2" "hello from $UP1" \
+          "$(curl -sk --http2 https://localhost:$HTTPS_PORT/one/hello)"
+    check "Chunked response over HTTP/2" "100" \
+          "$(curl -sk --http2 https://localhost:$HTTPS_PORT/one/chunked | wc -l)"
+fi
+
+echo ""
+echo "Total: $total  Passed: $passed  Failed: $failed"
+[ $failed -eq 0 ]
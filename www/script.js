@@ -1,7 +1,7 @@
 let autoRefresh = true;
 let refreshInterval;
 let timeSeriesData = [];
-const maxDataPoints = 20;
+const maxDataPoints = 60;
 let serverStartTime = Date.now();
 
 // Initialize charts
@@ -35,9 +35,79 @@ async function fetchStats() {
     return mock;
 }
 
-// Update dashboard with new data
+// Latest counters received from /api/stats/stream
+let liveStats = null;
+
+// Live stats: one long-lived connection, the server pushes a snapshot and
+// then deltas (increments of the counters that changed)
+function startStream() {
+    if (!window.EventSource) return false;
+
+    const source = new EventSource('/api/stats/stream');
+
+    source.addEventListener('snapshot', (e) => {
+        liveStats = JSON.parse(e.data);
+        renderStats(liveStats);
+    });
+
+    source.addEventListener('delta', (e) => {
+        if (!liveStats) return;
+        const delta = JSON.parse(e.data);
+        for (const key in delta) {
+            if (key === 'timestamp') liveStats.timestamp = delta.timestamp;
+            else liveStats[key] = (liveStats[key] || 0) + delta[key];
+        }
+        renderStats(liveStats);
+    });
+
+    // EventSource reconnects by itself (and gets a new snapshot)
+    source.onerror = () => console.log('Stats stream interrupted, reconnecting');
+    return true;
+}
+
+// Per-second series kept by the server (/api/stats/history): one small
+// request refreshes the last minute, and nothing is lost on page reload
+async function loadHistory() {
+    try {
+        const response = await fetch(`/api/stats/history?res=1s&points=${maxDataPoints}`);
+        if (!response.ok) return;
+        const series = (await response.json())['1s'];
+
+        timeSeriesData = series.requests.map((requests, i) => ({
+            time: new Date((series.start + i * series.step) * 1000).toLocaleTimeString(),
+            requests: requests,
+            p50: series.p50_ms[i],
+            p99: series.p99_ms[i]
+        }));
+        renderHistory();
+    } catch (e) {
+        console.log('Stats history unavailable');
+    }
+}
+
+// Throughput and latency from the per-second series
+function renderHistory() {
+    const recent = timeSeriesData.slice(-10);
+    if (recent.length === 0) return;
+
+    const total = recent.reduce((sum, point) => sum + point.requests, 0);
+    document.getElementById('reqPerSec').textContent =
+        `${(total / recent.length).toFixed(2)} req/s`;
+
+    // Latest second that served requests
+    const busy = recent.filter((point) => point.requests > 0).pop();
+    document.getElementById('avgResponseTime').textContent = busy
+        ? `${busy.p50.toFixed(1)}ms (p99 ${busy.p99.toFixed(1)}ms)`
+        : '-';
+}
+
+// Update dashboard with new data (polling fallback)
 async function updateDashboard() {
-    const stats = await fetchStats();
+    renderStats(await fetchStats());
+}
+
+// Render a set of counters
+function renderStats(stats) {
     
     // Update cards
     document.getElementById('totalRequests').textContent = stats.total_requests.toLocaleString();
@@ -65,13 +135,6 @@ async function updateDashboard() {
     document.getElementById('cacheHits').textContent = stats.cache_hits.toLocaleString();
     document.getElementById('cacheMisses').textContent = stats.cache_misses.toLocaleString();
     
-    // Update time series
-    const now = new Date().toLocaleTimeString();
-    timeSeriesData.push({ time: now, requests: stats.total_requests });
-    if (timeSeriesData.length > maxDataPoints) {
-        timeSeriesData.shift();
-    }
-    
     // Update timestamp
     document.getElementById('lastUpdate').textContent = new Date().toLocaleString();
     
@@ -80,12 +143,6 @@ async function updateDashboard() {
     const hours = Math.floor(uptimeMs / 3600000);
     const minutes = Math.floor((uptimeMs % 3600000) / 60000);
     document.getElementById('uptime').textContent = `${hours}h ${minutes}m`;
-    
-    // Mock additional stats
-    document.getElementById('avgResponseTime').textContent = 
-        `${(Math.random() * 100 + 10).toFixed(0)}ms`;
-    document.getElementById('reqPerSec').textContent = 
-        `${(stats.total_requests / (uptimeMs / 1000)).toFixed(2)} req/s`;
 }
 
 function startAutoRefresh() {
@@ -95,6 +152,10 @@ function startAutoRefresh() {
 // Initialize on page load
 window.addEventListener('load', () => {
     initCharts();
-    updateDashboard();
-    startAutoRefresh();
+    loadHistory();
+    setInterval(loadHistory, 5000);
+    if (!startStream()) {
+        updateDashboard();
+        startAutoRefresh();
+    }
 });
\ No newline at end of file